@@ -214,6 +214,10 @@ struct TrailBlazerPushConstants
     float3 sdf_origin;
 };
 
+// Collider the Trail Blazer particles bounce off. CPU particle systems collide with a baked copy of it
+static const float3 TRAIL_BLAZER_SPHERE_CENTER = float3(0.0, 1.0, -4.0);
+static const float TRAIL_BLAZER_SPHERE_RADIUS = 0.5;
+
 struct ParticleTemplatePushConstants
 {
     uint particles_to_spawn;
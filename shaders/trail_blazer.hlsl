@@ -25,9 +25,6 @@
 [[vk::push_constant]]
 TrailBlazerPushConstants push_constants;
 
-static const float3 sphere_center = float3(0, 1, -4);
-static const float sphere_radius = 0.5;
-
 float sdf_sphere(float3 p, float3 center, float radius)
 {
     return length(p - center) - radius;
@@ -43,7 +40,7 @@ float sdf(float3 p)
     float3 coord = p_sdf / sdf_extent;
 
     //return sdf_texture.SampleLevel(sdf_sampler, coord, 0).x * scale;
-    return sdf_sphere(p, sphere_center, sphere_radius);
+    return sdf_sphere(p, TRAIL_BLAZER_SPHERE_CENTER, TRAIL_BLAZER_SPHERE_RADIUS);
 }
 
 float sdf_func(float3 p)
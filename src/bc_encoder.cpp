@@ -0,0 +1,378 @@
+#include "bc_encoder.h"
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__AVX__)
+#include <immintrin.h>
+#define BC7_SIMD_WIDTH 8
+typedef __m256 simd_float;
+#define simd_load _mm256_load_ps
+#define simd_store _mm256_store_ps
+#define simd_set1 _mm256_set1_ps
+#define simd_add _mm256_add_ps
+#define simd_sub _mm256_sub_ps
+#define simd_mul _mm256_mul_ps
+#define simd_div _mm256_div_ps
+#define simd_min _mm256_min_ps
+#define simd_max _mm256_max_ps
+#define simd_and _mm256_and_ps
+#define simd_less(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define simd_greater_equal(a, b) _mm256_cmp_ps(a, b, _CMP_GE_OQ)
+#define simd_select(mask, a, b) _mm256_blendv_ps(b, a, mask)
+#define simd_truncate(x) _mm256_cvtepi32_ps(_mm256_cvttps_epi32(x))
+#else
+#include <emmintrin.h>
+#define BC7_SIMD_WIDTH 4
+typedef __m128 simd_float;
+#define simd_load _mm_load_ps
+#define simd_store _mm_store_ps
+#define simd_set1 _mm_set1_ps
+#define simd_add _mm_add_ps
+#define simd_sub _mm_sub_ps
+#define simd_mul _mm_mul_ps
+#define simd_div _mm_div_ps
+#define simd_min _mm_min_ps
+#define simd_max _mm_max_ps
+#define simd_and _mm_and_ps
+#define simd_less _mm_cmplt_ps
+#define simd_greater_equal _mm_cmpge_ps
+#define simd_select(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+#define simd_truncate(x) _mm_cvtepi32_ps(_mm_cvttps_epi32(x))
+#endif
+
+// Interpolation weights of 4 bit BC7 indices, out of 64
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BC7Mode6
+{
+	uint8_t endpoints[2][4]; // 7 bit values shifted up with the p-bit in bit 0
+	uint8_t indices[16];
+	uint32_t error = UINT32_MAX;
+};
+
+// Block texels split into one row per channel, so a SIMD register holds one channel of several texels
+struct BC7Texels
+{
+	alignas(32) float channels[4][16];
+};
+
+static void write_bits(uint8_t* block, uint32_t& position, uint32_t value, uint32_t bit_count)
+{
+	for (uint32_t i = 0; i < bit_count; ++i, ++position)
+	{
+		if ((value >> i) & 1) block[position >> 3] |= (uint8_t)(1 << (position & 7));
+	}
+}
+
+static inline int clamp_int(int value, int min_value, int max_value)
+{
+	return std::min(std::max(value, min_value), max_value);
+}
+
+// Picks the closest palette entry for every texel. The index is estimated by projecting onto the
+// endpoint line and only its neighbours are tested, which is exact for all but degenerate lines.
+// Texels and palette entries are small integers, so the float math gives the same results as integers
+static uint32_t find_indices(const BC7Texels& texels, const uint8_t e0[4], const uint8_t e1[4], uint8_t out_indices[16])
+{
+	// Palette entry i is ((64 - w) * e0 + w * e1 + 32) >> 6 = (64 * e0 + 32 + w * (e1 - e0)) >> 6
+	simd_float start[4], direction[4], offset[4];
+	int length_squared = 0;
+	for (int c = 0; c < 4; ++c)
+	{
+		const int d = e1[c] - e0[c];
+		length_squared += d * d;
+		start[c] = simd_set1((float)e0[c]);
+		direction[c] = simd_set1((float)d);
+		offset[c] = simd_set1((float)(64 * e0[c] + 32));
+	}
+
+	const simd_float zero = simd_set1(0.0f);
+	const simd_float half = simd_set1(0.5f);
+	const simd_float one = simd_set1(1.0f);
+	const simd_float max_index = simd_set1(15.0f);
+	const simd_float inv_64 = simd_set1(1.0f / 64.0f);
+	const simd_float weight_scale = simd_set1(64.0f / 15.0f); // bc7_weights[i] = round(i * 64 / 15)
+
+	simd_float total_error = zero;
+	for (int p = 0; p < 16; p += BC7_SIMD_WIDTH)
+	{
+		simd_float texel[4];
+		for (int c = 0; c < 4; ++c) texel[c] = simd_load(texels.channels[c] + p);
+
+		simd_float guess = zero;
+		if (length_squared > 0)
+		{
+			simd_float dot = zero;
+			for (int c = 0; c < 4; ++c) dot = simd_add(dot, simd_mul(simd_sub(texel[c], start[c]), direction[c]));
+			const simd_float t = simd_div(simd_mul(dot, max_index), simd_set1((float)length_squared));
+
+			// Rounds halves away from zero like lroundf, negative values end up clamped to 0 either way
+			guess = simd_truncate(t);
+			guess = simd_add(guess, simd_and(simd_greater_equal(simd_sub(t, guess), half), one));
+			guess = simd_min(simd_max(guess, zero), max_index);
+		}
+
+		// Neighbours past either end are clamped onto the guess itself, which can't win the strict comparison
+		simd_float best_error = simd_set1(FLT_MAX);
+		simd_float best_index = zero;
+		for (int step = -1; step <= 1; ++step)
+		{
+			const simd_float index = simd_min(simd_max(simd_add(guess, simd_set1((float)step)), zero), max_index);
+			const simd_float weight = simd_truncate(simd_add(simd_mul(index, weight_scale), half));
+
+			simd_float error = zero;
+			for (int c = 0; c < 4; ++c)
+			{
+				const simd_float entry = simd_truncate(simd_mul(simd_add(offset[c], simd_mul(weight, direction[c])), inv_64));
+				const simd_float d = simd_sub(entry, texel[c]);
+				error = simd_add(error, simd_mul(d, d));
+			}
+
+			const simd_float better = simd_less(error, best_error);
+			best_error = simd_select(better, error, best_error);
+			best_index = simd_select(better, index, best_index);
+		}
+		total_error = simd_add(total_error, best_error);
+
+		alignas(32) float indices[BC7_SIMD_WIDTH];
+		simd_store(indices, best_index);
+		for (int lane = 0; lane < BC7_SIMD_WIDTH; ++lane) out_indices[p + lane] = (uint8_t)indices[lane];
+	}
+
+	alignas(32) float errors[BC7_SIMD_WIDTH];
+	simd_store(errors, total_error);
+	uint32_t error_sum = 0;
+	for (int lane = 0; lane < BC7_SIMD_WIDTH; ++lane) error_sum += (uint32_t)errors[lane];
+	return error_sum;
+}
+
+// Quantizes a floating point endpoint pair with all four p-bit combinations and keeps the best one in result
+static void try_endpoints(const BC7Texels& texels, const float e0[4], const float e1[4], BC7Mode6& result)
+{
+	for (int p0 = 0; p0 < 2; ++p0)
+	{
+		for (int p1 = 0; p1 < 2; ++p1)
+		{
+			BC7Mode6 candidate;
+			for (int c = 0; c < 4; ++c)
+			{
+				candidate.endpoints[0][c] = (uint8_t)((clamp_int((int)lroundf((e0[c] - p0) * 0.5f), 0, 127) << 1) | p0);
+				candidate.endpoints[1][c] = (uint8_t)((clamp_int((int)lroundf((e1[c] - p1) * 0.5f), 0, 127) << 1) | p1);
+			}
+
+			candidate.error = find_indices(texels, candidate.endpoints[0], candidate.endpoints[1], candidate.indices);
+			if (candidate.error < result.error) result = candidate;
+		}
+	}
+}
+
+// Least squares endpoints for a fixed set of indices, returns false if the indices do not span a line
+static bool fit_endpoints(const uint8_t rgba[16 * 4], const uint8_t indices[16], float out_e0[4], float out_e1[4])
+{
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float d[4] = {}, e[4] = {};
+	for (int p = 0; p < 16; ++p)
+	{
+		const float w = bc7_weights[indices[p]] / 64.0f;
+		a += (1.0f - w) * (1.0f - w);
+		b += (1.0f - w) * w;
+		c += w * w;
+		for (int ch = 0; ch < 4; ++ch)
+		{
+			d[ch] += (1.0f - w) * rgba[p * 4 + ch];
+			e[ch] += w * rgba[p * 4 + ch];
+		}
+	}
+
+	const float determinant = a * c - b * b;
+	if (fabsf(determinant) < 1e-6f) return false;
+
+	for (int ch = 0; ch < 4; ++ch)
+	{
+		out_e0[ch] = std::min(std::max((c * d[ch] - b * e[ch]) / determinant, 0.0f), 255.0f);
+		out_e1[ch] = std::min(std::max((a * e[ch] - b * d[ch]) / determinant, 0.0f), 255.0f);
+	}
+	return true;
+}
+
+namespace BCEncoder
+{
+
+void encode_bc7_block(const uint8_t rgba[16 * 4], uint8_t out_block[16])
+{
+	// Principal axis of the block through power iteration on the covariance matrix
+	float mean[4] = {};
+	for (int p = 0; p < 16; ++p)
+	{
+		for (int c = 0; c < 4; ++c) mean[c] += rgba[p * 4 + c];
+	}
+	for (int c = 0; c < 4; ++c) mean[c] /= 16.0f;
+
+	float covariance[4][4] = {};
+	for (int p = 0; p < 16; ++p)
+	{
+		float d[4];
+		for (int c = 0; c < 4; ++c) d[c] = rgba[p * 4 + c] - mean[c];
+		for (int i = 0; i < 4; ++i)
+		{
+			for (int j = 0; j < 4; ++j) covariance[i][j] += d[i] * d[j];
+		}
+	}
+
+	float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; ++iteration)
+	{
+		float next[4] = {};
+		float largest = 0.0f;
+		for (int i = 0; i < 4; ++i)
+		{
+			for (int j = 0; j < 4; ++j) next[i] += covariance[i][j] * axis[j];
+			largest = std::max(largest, fabsf(next[i]));
+		}
+		if (largest < FLT_EPSILON) break; // Flat block, any axis will do
+		for (int i = 0; i < 4; ++i) axis[i] = next[i] / largest;
+	}
+
+	float length_squared = 0.0f;
+	for (int c = 0; c < 4; ++c) length_squared += axis[c] * axis[c];
+
+	float min_t = FLT_MAX, max_t = -FLT_MAX;
+	for (int p = 0; p < 16; ++p)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < 4; ++c) t += (rgba[p * 4 + c] - mean[c]) * axis[c];
+		t /= length_squared;
+		min_t = std::min(min_t, t);
+		max_t = std::max(max_t, t);
+	}
+
+	float e0[4], e1[4];
+	for (int c = 0; c < 4; ++c)
+	{
+		e0[c] = std::min(std::max(mean[c] + min_t * axis[c], 0.0f), 255.0f);
+		e1[c] = std::min(std::max(mean[c] + max_t * axis[c], 0.0f), 255.0f);
+	}
+
+	BC7Texels texels;
+	for (int p = 0; p < 16; ++p)
+	{
+		for (int c = 0; c < 4; ++c) texels.channels[c][p] = rgba[p * 4 + c];
+	}
+
+	BC7Mode6 best;
+	try_endpoints(texels, e0, e1, best);
+
+	for (int iteration = 0; iteration < 2 && best.error > 0; ++iteration)
+	{
+		const uint32_t previous_error = best.error;
+		if (!fit_endpoints(rgba, best.indices, e0, e1)) break;
+		try_endpoints(texels, e0, e1, best);
+		if (best.error >= previous_error) break;
+	}
+
+	// The anchor index is stored without its top bit, so it has to be below 8
+	if (best.indices[0] & 8)
+	{
+		for (int c = 0; c < 4; ++c) std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+		for (int p = 0; p < 16; ++p) best.indices[p] = 15 - best.indices[p];
+	}
+
+	memset(out_block, 0, 16);
+	uint32_t position = 0;
+	write_bits(out_block, position, 1 << 6, 7);
+	for (int c = 0; c < 4; ++c)
+	{
+		write_bits(out_block, position, best.endpoints[0][c] >> 1, 7);
+		write_bits(out_block, position, best.endpoints[1][c] >> 1, 7);
+	}
+	write_bits(out_block, position, best.endpoints[0][0] & 1, 1);
+	write_bits(out_block, position, best.endpoints[1][0] & 1, 1);
+	write_bits(out_block, position, best.indices[0], 3);
+	for (int p = 1; p < 16; ++p) write_bits(out_block, position, best.indices[p], 4);
+}
+
+void encode_bc4_block(const uint8_t values[16], uint8_t out_block[8])
+{
+	uint8_t min_value = 255, max_value = 0;
+	for (int p = 0; p < 16; ++p)
+	{
+		min_value = std::min(min_value, values[p]);
+		max_value = std::max(max_value, values[p]);
+	}
+
+	memset(out_block, 0, 8);
+	out_block[0] = max_value;
+	out_block[1] = min_value;
+	if (max_value == min_value) return; // Every index 0 decodes to max_value
+
+	// red0 > red1 selects the 8 value palette: red0, red1 and six interpolated steps between them
+	int palette[8];
+	palette[0] = max_value;
+	palette[1] = min_value;
+	for (int i = 1; i < 7; ++i) palette[i + 1] = ((7 - i) * max_value + i * min_value + 3) / 7;
+
+	uint64_t bits = 0;
+	for (int p = 0; p < 16; ++p)
+	{
+		int best_index = 0;
+		int best_error = INT32_MAX;
+		for (int i = 0; i < 8; ++i)
+		{
+			const int error = abs(palette[i] - values[p]);
+			if (error < best_error)
+			{
+				best_error = error;
+				best_index = i;
+			}
+		}
+		bits |= (uint64_t)best_index << (3 * p);
+	}
+
+	for (int i = 0; i < 6; ++i) out_block[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+void encode_bc5_block(const uint8_t red[16], const uint8_t green[16], uint8_t out_block[16])
+{
+	encode_bc4_block(red, out_block);
+	encode_bc4_block(green, out_block + 8);
+}
+
+void fetch_block(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint8_t out_rgba[16 * 4])
+{
+	for (uint32_t by = 0; by < BC_BLOCK_DIM; ++by)
+	{
+		const uint32_t sy = std::min(y + by, height - 1);
+		for (uint32_t bx = 0; bx < BC_BLOCK_DIM; ++bx)
+		{
+			const uint32_t sx = std::min(x + bx, width - 1);
+			memcpy(out_rgba + (by * BC_BLOCK_DIM + bx) * 4, rgba + ((size_t)sy * width + sx) * 4, 4);
+		}
+	}
+}
+
+void downsample(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out_rgba)
+{
+	const uint32_t out_width = std::max(width / 2, 1u);
+	const uint32_t out_height = std::max(height / 2, 1u);
+
+	for (uint32_t y = 0; y < out_height; ++y)
+	{
+		const uint8_t* row0 = rgba + (size_t)std::min(y * 2, height - 1) * width * 4;
+		const uint8_t* row1 = rgba + (size_t)std::min(y * 2 + 1, height - 1) * width * 4;
+		uint8_t* out = out_rgba + (size_t)y * out_width * 4;
+
+		for (uint32_t x = 0; x < out_width; ++x)
+		{
+			const uint32_t x0 = std::min(x * 2, width - 1) * 4;
+			const uint32_t x1 = std::min(x * 2 + 1, width - 1) * 4;
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				out[x * 4 + c] = (uint8_t)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) >> 2);
+			}
+		}
+	}
+}
+
+} // namespace BCEncoder
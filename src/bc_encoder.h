@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#define BC_BLOCK_DIM 4
+
+// CPU block compression for textures that are encoded once and cached, see texture_cache.h.
+// Blocks are 4x4 texels in row major order, RGBA8 unless noted otherwise.
+namespace BCEncoder
+{
+	// BC7 mode 6 only: one RGBA line with 4 bit indices. Covers color with or without alpha at a
+	// fraction of the search time of the partitioned modes
+	void encode_bc7_block(const uint8_t rgba[16 * 4], uint8_t out_block[16]);
+
+	// Single channel, 8 bytes per block
+	void encode_bc4_block(const uint8_t values[16], uint8_t out_block[8]);
+
+	// Two channels stored as two BC4 blocks, 16 bytes per block
+	void encode_bc5_block(const uint8_t red[16], const uint8_t green[16], uint8_t out_block[16]);
+
+	// Gathers a block at texel (x, y), edge texels are repeated for blocks that extend past the image
+	void fetch_block(const uint8_t* rgba, uint32_t width, uint32_t height, uint32_t x, uint32_t y, uint8_t out_rgba[16 * 4]);
+
+	// 2x2 box filter into the next mip level, max(width / 2, 1) x max(height / 2, 1)
+	void downsample(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out_rgba);
+}
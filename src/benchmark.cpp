@@ -0,0 +1,498 @@
+#include "benchmark.h"
+#include "graphics_context.h"
+#include "buffer.h"
+#include "camera.h"
+#include "misc.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+
+#define BENCHMARK_CAMERA_RADIUS 6.0f
+#define BENCHMARK_CAMERA_HEIGHT 2.0f
+
+// Queries 0 and 1 bracket the whole frame, pass i uses 2 + 2 * i and 3 + 2 * i
+#define BENCHMARK_QUERY_COUNT (2 + 2 * BENCHMARK_MAX_PASSES)
+
+typedef std::chrono::high_resolution_clock Clock;
+
+struct SampleSeries
+{
+	std::string name;
+	std::vector<double> samples;
+};
+
+// What one frame in flight recorded, resolved once its fence has been waited on
+struct FrameSlot
+{
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+	Buffer readback_buffer; // One uint32 per particle counter
+
+	bool pending = false;
+	bool recorded = false; // False during warmup
+	uint32_t pass_count = 0;
+	uint32_t pass_series[BENCHMARK_MAX_PASSES];
+	double pass_cpu_ms[BENCHMARK_MAX_PASSES];
+	uint32_t counter_count = 0;
+	uint32_t counter_series[BENCHMARK_MAX_COUNTERS];
+	double cpu_frame_ms = 0.0;
+};
+
+static Context* ctx = nullptr;
+static BenchmarkSettings settings;
+static FrameSlot slots[Context::frames_in_flight];
+static FrameSlot* current = nullptr;
+static uint32_t frame_number = 0;
+static bool gpu_timestamps = false;
+
+static Clock::time_point frame_begin_time;
+static Clock::time_point pass_begin_time;
+static bool pass_open = false;
+
+static SampleSeries cpu_frame_ms{ "frame" };
+static SampleSeries gpu_frame_ms{ "frame" };
+static std::vector<SampleSeries> pass_cpu_ms;
+static std::vector<SampleSeries> pass_gpu_ms;
+static std::vector<SampleSeries> particle_counts;
+
+static std::vector<VkDeviceSize> peak_heap_usage;
+
+static uint32_t find_or_add_series(std::vector<SampleSeries>& series, const char* name)
+{
+	for (uint32_t i = 0; i < (uint32_t)series.size(); ++i)
+	{
+		if (series[i].name == name) return i;
+	}
+	series.push_back({ name });
+	return (uint32_t)series.size() - 1;
+}
+
+static double milliseconds_since(Clock::time_point begin)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+static void resolve_slot(FrameSlot& slot)
+{
+	if (!slot.pending) return;
+	slot.pending = false;
+	if (!slot.recorded) return;
+
+	cpu_frame_ms.samples.push_back(slot.cpu_frame_ms);
+	for (uint32_t i = 0; i < slot.pass_count; ++i)
+	{
+		pass_cpu_ms[slot.pass_series[i]].samples.push_back(slot.pass_cpu_ms[i]);
+	}
+
+	if (gpu_timestamps)
+	{
+		uint64_t timestamps[BENCHMARK_QUERY_COUNT];
+		const uint32_t query_count = 2 + 2 * slot.pass_count;
+		VK_CHECK(vkGetQueryPoolResults(ctx->device, slot.query_pool, 0, query_count, sizeof(timestamps), timestamps,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+
+		const double period_ms = (double)ctx->physical_device.properties.limits.timestampPeriod * 1e-6;
+		gpu_frame_ms.samples.push_back((double)(timestamps[1] - timestamps[0]) * period_ms);
+		for (uint32_t i = 0; i < slot.pass_count; ++i)
+		{
+			const uint64_t begin = timestamps[2 + 2 * i];
+			const uint64_t end = timestamps[3 + 2 * i];
+			pass_gpu_ms[slot.pass_series[i]].samples.push_back((double)(end - begin) * period_ms);
+		}
+	}
+
+	if (slot.counter_count > 0)
+	{
+		void* mapped = nullptr;
+		VK_CHECK(vmaMapMemory(ctx->allocator, slot.readback_buffer.allocation, &mapped));
+		VK_CHECK(vmaInvalidateAllocation(ctx->allocator, slot.readback_buffer.allocation, 0, VK_WHOLE_SIZE));
+		const uint32_t* counts = (const uint32_t*)mapped;
+		for (uint32_t i = 0; i < slot.counter_count; ++i)
+		{
+			particle_counts[slot.counter_series[i]].samples.push_back((double)counts[i]);
+		}
+		vmaUnmapMemory(ctx->allocator, slot.readback_buffer.allocation);
+	}
+}
+
+static void update_peak_memory()
+{
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(ctx->allocator, budgets);
+	for (size_t i = 0; i < peak_heap_usage.size(); ++i)
+	{
+		peak_heap_usage[i] = std::max(peak_heap_usage[i], budgets[i].usage);
+	}
+}
+
+struct SeriesSummary
+{
+	double mean = 0.0;
+	double min = 0.0;
+	double max = 0.0;
+	double p50 = 0.0;
+	double p95 = 0.0;
+	double p99 = 0.0;
+};
+
+static SeriesSummary summarize(const std::vector<double>& samples)
+{
+	SeriesSummary summary;
+	if (samples.empty()) return summary;
+
+	std::vector<double> sorted = samples;
+	std::sort(sorted.begin(), sorted.end());
+
+	double sum = 0.0;
+	for (double s : sorted) sum += s;
+
+	auto percentile = [&](double p) { return sorted[std::min((size_t)(p * (sorted.size() - 1) + 0.5), sorted.size() - 1)]; };
+
+	summary.mean = sum / (double)sorted.size();
+	summary.min = sorted.front();
+	summary.max = sorted.back();
+	summary.p50 = percentile(0.50);
+	summary.p95 = percentile(0.95);
+	summary.p99 = percentile(0.99);
+	return summary;
+}
+
+static void write_summary(FILE* f, const std::vector<double>& samples)
+{
+	const SeriesSummary s = summarize(samples);
+	fprintf(f, "{ \"mean\": %.4f, \"min\": %.4f, \"max\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f }",
+		s.mean, s.min, s.max, s.p50, s.p95, s.p99);
+}
+
+static void write_samples(FILE* f, const std::vector<double>& samples)
+{
+	fputc('[', f);
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		fprintf(f, i == 0 ? "%.4f" : ", %.4f", samples[i]);
+	}
+	fputc(']', f);
+}
+
+// Passes in the order they were first seen, with CPU and GPU time side by side
+static void write_passes(FILE* f)
+{
+	fprintf(f, "  \"passes\": [\n");
+	for (size_t i = 0; i < pass_cpu_ms.size(); ++i)
+	{
+		fprintf(f, "    { \"name\": ");
+		write_json_string(f, pass_cpu_ms[i].name.c_str());
+		fprintf(f, ", \"cpu_ms\": ");
+		write_summary(f, pass_cpu_ms[i].samples);
+		fprintf(f, ", \"gpu_ms\": ");
+		if (gpu_timestamps) write_summary(f, pass_gpu_ms[i].samples);
+		else fprintf(f, "null");
+		fprintf(f, " }%s\n", i + 1 < pass_cpu_ms.size() ? "," : "");
+	}
+	fprintf(f, "  ],\n");
+}
+
+static void write_memory(FILE* f)
+{
+	VmaTotalStatistics stats;
+	vmaCalculateStatistics(ctx->allocator, &stats);
+
+	VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+	vmaGetHeapBudgets(ctx->allocator, budgets);
+
+	const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+	vmaGetMemoryProperties(ctx->allocator, &memory_properties);
+
+	fprintf(f, "  \"memory\": {\n");
+	fprintf(f, "    \"allocation_count\": %u, \"allocation_bytes\": %llu, \"block_count\": %u, \"block_bytes\": %llu,\n",
+		stats.total.statistics.allocationCount, (unsigned long long)stats.total.statistics.allocationBytes,
+		stats.total.statistics.blockCount, (unsigned long long)stats.total.statistics.blockBytes);
+	fprintf(f, "    \"heaps\": [\n");
+	for (uint32_t i = 0; i < memory_properties->memoryHeapCount; ++i)
+	{
+		const bool device_local = (memory_properties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		fprintf(f, "      { \"index\": %u, \"device_local\": %s, \"size_bytes\": %llu, \"usage_bytes\": %llu, \"peak_usage_bytes\": %llu, \"budget_bytes\": %llu }%s\n",
+			i, device_local ? "true" : "false", (unsigned long long)memory_properties->memoryHeaps[i].size,
+			(unsigned long long)budgets[i].usage, (unsigned long long)peak_heap_usage[i], (unsigned long long)budgets[i].budget,
+			i + 1 < memory_properties->memoryHeapCount ? "," : "");
+	}
+	fprintf(f, "    ]\n  }\n");
+}
+
+namespace Benchmark
+{
+
+bool parse_arguments(int argc, char** argv, BenchmarkSettings& out_settings)
+{
+	out_settings = BenchmarkSettings{};
+	if (argc < 2) return false;
+	out_settings.scene_path = argv[1];
+
+	for (int i = 2; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (strcmp(arg, "--benchmark") == 0)
+		{
+			out_settings.enabled = true;
+		}
+		else if (strcmp(arg, "--frames") == 0 && has_value)
+		{
+			out_settings.frame_count = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(arg, "--warmup") == 0 && has_value)
+		{
+			out_settings.warmup_frames = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (strcmp(arg, "--resolution") == 0 && has_value)
+		{
+			if (sscanf(argv[++i], "%ux%u", &out_settings.width, &out_settings.height) != 2 || out_settings.width == 0 || out_settings.height == 0)
+			{
+				LOG_ERROR("Invalid resolution '%s', expected WIDTHxHEIGHT", argv[i]);
+				return false;
+			}
+		}
+		else if (strcmp(arg, "--output") == 0 && has_value)
+		{
+			out_settings.output_path = argv[++i];
+		}
+		else if (strcmp(arg, "--textures") == 0 && has_value)
+		{
+			out_settings.texture_directory = argv[++i];
+			if (!std::filesystem::is_directory(out_settings.texture_directory))
+			{
+				LOG_ERROR("Texture directory '%s' does not exist", out_settings.texture_directory);
+				return false;
+			}
+		}
+		else
+		{
+			LOG_ERROR("Unknown or incomplete option '%s'", arg);
+			return false;
+		}
+	}
+
+	if (out_settings.enabled && out_settings.frame_count == 0)
+	{
+		LOG_ERROR("--frames has to be at least 1");
+		return false;
+	}
+	return true;
+}
+
+void init(Context* context, const BenchmarkSettings& benchmark_settings)
+{
+	ctx = context;
+	settings = benchmark_settings;
+	frame_number = 0;
+
+	gpu_timestamps = ctx->physical_device.properties.limits.timestampComputeAndGraphics == VK_TRUE;
+	if (!gpu_timestamps)
+	{
+		LOG_WARNING("Device does not support timestamps on all queues, GPU timings will be missing from the benchmark");
+	}
+
+	for (FrameSlot& slot : slots)
+	{
+		slot = FrameSlot{};
+
+		VkQueryPoolCreateInfo query_pool_info{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_info.queryCount = BENCHMARK_QUERY_COUNT;
+		VK_CHECK(vkCreateQueryPool(ctx->device, &query_pool_info, nullptr, &slot.query_pool));
+
+		BufferDesc desc{};
+		desc.size = sizeof(uint32_t) * BENCHMARK_MAX_COUNTERS;
+		desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+		slot.readback_buffer = ctx->create_buffer(desc);
+	}
+
+	const VkPhysicalDeviceMemoryProperties* memory_properties = nullptr;
+	vmaGetMemoryProperties(ctx->allocator, &memory_properties);
+	peak_heap_usage.assign(memory_properties->memoryHeapCount, 0);
+
+	LOG_INFO("Benchmark: %u warmup frames, %u recorded frames at %ux%u, results go to '%s'",
+		settings.warmup_frames, settings.frame_count, settings.width, settings.height, settings.output_path);
+}
+
+void shutdown()
+{
+	for (FrameSlot& slot : slots)
+	{
+		vkDestroyQueryPool(ctx->device, slot.query_pool, nullptr);
+		ctx->destroy_buffer(slot.readback_buffer);
+		slot = FrameSlot{};
+	}
+	cpu_frame_ms.samples.clear();
+	gpu_frame_ms.samples.clear();
+	pass_cpu_ms.clear();
+	pass_gpu_ms.clear();
+	particle_counts.clear();
+	peak_heap_usage.clear();
+	ctx = nullptr;
+}
+
+bool is_finished()
+{
+	return frame_number >= settings.warmup_frames + settings.frame_count;
+}
+
+double get_time()
+{
+	return frame_number * BENCHMARK_TIMESTEP;
+}
+
+void update_camera(glm::vec3 target, CameraState& camera)
+{
+	const uint32_t total_frames = settings.warmup_frames + settings.frame_count;
+	const float angle = 2.0f * (float)M_PI * (float)frame_number / (float)total_frames;
+	camera.position = target + glm::vec3(cosf(angle) * BENCHMARK_CAMERA_RADIUS, BENCHMARK_CAMERA_HEIGHT, sinf(angle) * BENCHMARK_CAMERA_RADIUS);
+	camera.forward = glm::normalize(target - camera.position);
+}
+
+void begin_frame(VkCommandBuffer cmd)
+{
+	// Context::begin_frame waited on this slot's fence, so its queries and copies are complete
+	current = &slots[ctx->frame_index];
+	resolve_slot(*current);
+
+	current->recorded = frame_number >= settings.warmup_frames;
+	current->pass_count = 0;
+	current->counter_count = 0;
+	frame_begin_time = Clock::now();
+
+	vkCmdResetQueryPool(cmd, current->query_pool, 0, BENCHMARK_QUERY_COUNT);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->query_pool, 0);
+}
+
+void end_frame(VkCommandBuffer cmd)
+{
+	assert(current && !pass_open);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->query_pool, 1);
+
+	current->cpu_frame_ms = milliseconds_since(frame_begin_time);
+	current->pending = true;
+	current = nullptr;
+
+	update_peak_memory();
+	frame_number++;
+}
+
+void begin_pass(VkCommandBuffer cmd, const char* name)
+{
+	if (!current) return;
+	assert(!pass_open);
+	if (current->pass_count == BENCHMARK_MAX_PASSES)
+	{
+		LOG_WARNING("Benchmark pass '%s' ignored, raise BENCHMARK_MAX_PASSES", name);
+		return;
+	}
+
+	const uint32_t series = find_or_add_series(pass_cpu_ms, name);
+	find_or_add_series(pass_gpu_ms, name);
+	current->pass_series[current->pass_count] = series;
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->query_pool, 2 + 2 * current->pass_count);
+	pass_begin_time = Clock::now();
+	pass_open = true;
+}
+
+void end_pass(VkCommandBuffer cmd)
+{
+	if (!current || !pass_open) return; // Not benchmarking, or begin_pass ran out of passes
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->query_pool, 3 + 2 * current->pass_count);
+	current->pass_cpu_ms[current->pass_count] = milliseconds_since(pass_begin_time);
+	current->pass_count++;
+	pass_open = false;
+}
+
+void record_particle_count(VkCommandBuffer cmd, const char* name, VkBuffer buffer, VkDeviceSize offset)
+{
+	if (!current) return;
+	if (current->counter_count == BENCHMARK_MAX_COUNTERS)
+	{
+		LOG_WARNING("Benchmark counter '%s' ignored, raise BENCHMARK_MAX_COUNTERS", name);
+		return;
+	}
+
+	VkBufferCopy region{};
+	region.srcOffset = offset;
+	region.dstOffset = sizeof(uint32_t) * current->counter_count;
+	region.size = sizeof(uint32_t);
+	vkCmdCopyBuffer(cmd, buffer, current->readback_buffer.buffer, 1, &region);
+
+	current->counter_series[current->counter_count++] = find_or_add_series(particle_counts, name);
+}
+
+bool write_results()
+{
+	VK_CHECK(vkDeviceWaitIdle(ctx->device));
+	for (FrameSlot& slot : slots)
+	{
+		resolve_slot(slot);
+	}
+
+	FILE* f = fopen(settings.output_path, "w");
+	if (!f)
+	{
+		LOG_ERROR("Failed to open benchmark output '%s'", settings.output_path);
+		return false;
+	}
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"scene\": ");
+	write_json_string(f, settings.scene_path ? settings.scene_path : "");
+	fprintf(f, ",\n  \"device\": ");
+	write_json_string(f, ctx->physical_device.name.c_str());
+	fprintf(f, ",\n  \"resolution\": [%d, %d],\n", ctx->window_width, ctx->window_height);
+	fprintf(f, "  \"timestep_ms\": %.4f,\n", BENCHMARK_TIMESTEP * 1000.0);
+	fprintf(f, "  \"warmup_frames\": %u,\n", settings.warmup_frames);
+	fprintf(f, "  \"recorded_frames\": %zu,\n", cpu_frame_ms.samples.size());
+
+	fprintf(f, "  \"frame\": {\n    \"cpu_ms\": ");
+	write_summary(f, cpu_frame_ms.samples);
+	fprintf(f, ",\n    \"gpu_ms\": ");
+	if (gpu_timestamps) write_summary(f, gpu_frame_ms.samples);
+	else fprintf(f, "null");
+	fprintf(f, ",\n    \"cpu_ms_per_frame\": ");
+	write_samples(f, cpu_frame_ms.samples);
+	fprintf(f, ",\n    \"gpu_ms_per_frame\": ");
+	write_samples(f, gpu_frame_ms.samples);
+	fprintf(f, "\n  },\n");
+
+	write_passes(f);
+
+	fprintf(f, "  \"particles\": [\n");
+	for (size_t i = 0; i < particle_counts.size(); ++i)
+	{
+		const std::vector<double>& samples = particle_counts[i].samples;
+		const SeriesSummary s = summarize(samples);
+		fprintf(f, "    { \"name\": ");
+		write_json_string(f, particle_counts[i].name.c_str());
+		fprintf(f, ", \"mean\": %.1f, \"min\": %.0f, \"max\": %.0f, \"final\": %.0f }%s\n",
+			s.mean, s.min, s.max, samples.empty() ? 0.0 : samples.back(), i + 1 < particle_counts.size() ? "," : "");
+	}
+	fprintf(f, "  ],\n");
+
+	write_memory(f);
+	fprintf(f, "}\n");
+
+	const bool success = ferror(f) == 0;
+	fclose(f);
+	if (!success)
+	{
+		LOG_ERROR("Failed to write benchmark output '%s'", settings.output_path);
+		return false;
+	}
+
+	const SeriesSummary cpu = summarize(cpu_frame_ms.samples);
+	const SeriesSummary gpu = summarize(gpu_frame_ms.samples);
+	LOG_INFO("Benchmark finished: %zu frames, CPU %.3f ms (p95 %.3f), GPU %.3f ms (p95 %.3f), written to '%s'",
+		cpu_frame_ms.samples.size(), cpu.mean, cpu.p95, gpu.mean, gpu.p95, settings.output_path);
+	return true;
+}
+
+} // namespace Benchmark
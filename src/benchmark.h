@@ -0,0 +1,58 @@
+#pragma once
+#include "defines.h"
+
+#define BENCHMARK_DEFAULT_FRAMES 1000
+#define BENCHMARK_DEFAULT_WARMUP_FRAMES 100
+#define BENCHMARK_DEFAULT_OUTPUT "benchmark.json"
+#define BENCHMARK_TIMESTEP (1.0 / 60.0)
+#define BENCHMARK_MAX_PASSES 32
+#define BENCHMARK_MAX_COUNTERS 64
+
+struct Context;
+struct CameraState;
+
+struct BenchmarkSettings
+{
+	bool enabled = false;
+	uint32_t frame_count = BENCHMARK_DEFAULT_FRAMES; // Recorded frames, after the warmup
+	uint32_t warmup_frames = BENCHMARK_DEFAULT_WARMUP_FRAMES;
+	uint32_t width = 1280;
+	uint32_t height = 720;
+	const char* output_path = BENCHMARK_DEFAULT_OUTPUT;
+	const char* scene_path = nullptr;
+	const char* texture_directory = nullptr; // Streamed through a TextureCatalog when set, also outside of benchmark runs
+};
+
+// Headless run of the frame loop for regression tracking. Every frame advances by BENCHMARK_TIMESTEP and the
+// camera follows a scripted orbit, so two runs render the same frames regardless of how fast the machine is.
+// Per pass CPU recording time and GPU time, particle counts and memory use are written to a JSON file.
+namespace Benchmark
+{
+	// Options after the scene path: [--textures dir] --benchmark [--frames N] [--warmup N] [--resolution WxH] [--output file.json]
+	bool parse_arguments(int argc, char** argv, BenchmarkSettings& out_settings);
+
+	void init(Context* ctx, const BenchmarkSettings& settings);
+	void shutdown();
+
+	bool is_finished();
+	double get_time(); // Simulation time of the current frame
+	// Orbits target once over the whole run, looking at it from slightly above
+	void update_camera(glm::vec3 target, CameraState& camera);
+
+	// begin_frame goes right after Context::begin_frame and end_frame right before Context::end_frame.
+	// Results of a frame are read back when its slot comes around again, so nothing waits on the GPU
+	void begin_frame(VkCommandBuffer cmd);
+	void end_frame(VkCommandBuffer cmd);
+
+	// Passes do not nest and must be opened and closed outside of dynamic rendering.
+	// These and record_particle_count do nothing outside of a benchmark frame
+	void begin_pass(VkCommandBuffer cmd, const char* name);
+	void end_pass(VkCommandBuffer cmd);
+
+	// Copies a uint32 particle count out of a GPU buffer, the buffer needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT.
+	// Synchronizing with the writes is left to the caller, main.cpp declares a transfer read in its render graph pass
+	void record_particle_count(VkCommandBuffer cmd, const char* name, VkBuffer buffer, VkDeviceSize offset);
+
+	// Waits for the frames still in flight and writes the results
+	bool write_results();
+}
@@ -0,0 +1,318 @@
+#include "cpu_profiler.h"
+#include "misc.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+static_assert((CPU_PROFILER_BUFFER_EVENTS & (CPU_PROFILER_BUFFER_EVENTS - 1)) == 0, "CPU_PROFILER_BUFFER_EVENTS must be a power of two");
+
+struct ZoneEvent
+{
+	const char* name;
+	int64_t begin_ticks;
+	int64_t end_ticks;
+};
+
+// Written by its own thread only, read by end_frame. The indices only grow, slots are index & (size - 1)
+struct ThreadBuffer
+{
+	alignas(64) std::atomic<uint64_t> write_index = 0;
+	uint64_t cached_read_index = 0; // Producer side copy, refreshed only when the ring looks full
+	std::atomic<uint64_t> dropped = 0;
+	alignas(64) std::atomic<uint64_t> read_index = 0;
+	bool in_use = false; // Guarded by threads_mutex. Rings of exited threads go to the next new thread
+	char name[CPU_PROFILER_THREAD_NAME_LENGTH] = {};
+	ZoneEvent events[CPU_PROFILER_BUFFER_EVENTS];
+};
+
+struct CollectedZone
+{
+	const char* name;
+	int64_t begin_ns;
+	int64_t end_ns;
+	uint32_t thread;
+};
+
+struct CollectedFrame
+{
+	uint64_t frame_number = 0;
+	int64_t begin_ns = 0;
+	int64_t end_ns = 0;
+	std::vector<CollectedZone> zones;
+};
+
+// Hands the ring back when its thread exits, so short lived threads like the asset rebuild thread do not use up slots
+struct ThreadRegistration
+{
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+	~ThreadRegistration();
+};
+
+static std::mutex threads_mutex; // Guards registration and thread names
+static ThreadBuffer* threads[CPU_PROFILER_MAX_THREADS];
+static std::atomic<uint32_t> thread_count = 0;
+static uint32_t registry_generation = 0; // Bumped by shutdown, registrations from before then are stale
+static bool warned_thread_limit = false;
+// Kept apart from the registration, which has a destructor and therefore a guard on every access
+static thread_local ThreadBuffer* thread_buffer = nullptr;
+static thread_local bool thread_registered = false;
+static thread_local ThreadRegistration thread_registration;
+
+static CollectedFrame history[CPU_PROFILER_HISTORY];
+static uint64_t frame_count = 0; // The latest frame is history[(frame_count - 1) % CPU_PROFILER_HISTORY]
+static int64_t frame_begin_ns = 0;
+static uint64_t dropped_reported = 0;
+
+// Tick to nanosecond conversion, measured against steady_clock from the first registration on.
+// The ratio is refined every frame, the longer the baseline the more precise it gets
+#define CPU_PROFILER_MIN_CALIBRATION_NS 1000000
+static int64_t calibration_ticks = 0;
+static int64_t calibration_ns = 0;
+static double ns_per_tick = 1.0;
+
+static void update_calibration()
+{
+	const int64_t ns = CPUProfiler::now_ns();
+	const int64_t ticks = CPUProfiler::now_ticks();
+	if (ns - calibration_ns >= CPU_PROFILER_MIN_CALIBRATION_NS && ticks != calibration_ticks)
+	{
+		ns_per_tick = (double)(ns - calibration_ns) / (double)(ticks - calibration_ticks);
+	}
+}
+
+// Spins for the minimum baseline once, so zones collected by the first end_frame already convert correctly
+static void start_calibration()
+{
+	calibration_ns = CPUProfiler::now_ns();
+	calibration_ticks = CPUProfiler::now_ticks();
+	while (CPUProfiler::now_ns() - calibration_ns < CPU_PROFILER_MIN_CALIBRATION_NS) {}
+	update_calibration();
+}
+
+static int64_t ticks_to_ns(int64_t ticks)
+{
+	return calibration_ns + (int64_t)((double)(ticks - calibration_ticks) * ns_per_tick);
+}
+
+ThreadRegistration::~ThreadRegistration()
+{
+	if (index == UINT32_MAX) return;
+
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	if (generation == registry_generation) threads[index]->in_use = false;
+}
+
+// Registers the calling thread on its first zone. Past CPU_PROFILER_MAX_THREADS live threads the thread records nothing
+static ThreadBuffer* get_thread_buffer()
+{
+	if (thread_registered) return thread_buffer;
+	thread_registered = true;
+
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	const uint32_t count = thread_count.load(std::memory_order_relaxed);
+	uint32_t index = 0;
+	while (index < count && threads[index]->in_use) ++index;
+	if (index == CPU_PROFILER_MAX_THREADS)
+	{
+		if (!warned_thread_limit)
+		{
+			LOG_WARNING("CPU profiler: more than %u threads, raise CPU_PROFILER_MAX_THREADS", CPU_PROFILER_MAX_THREADS);
+			warned_thread_limit = true;
+		}
+		return nullptr;
+	}
+
+	if (count == 0) start_calibration();
+	if (index == count)
+	{
+		threads[index] = new ThreadBuffer();
+		thread_count.store(count + 1, std::memory_order_release);
+	}
+	ThreadBuffer* buffer = threads[index];
+	buffer->in_use = true;
+	snprintf(buffer->name, sizeof(buffer->name), "Thread %u", index);
+	// The previous owner's writes happened before it released the ring under the same mutex
+	buffer->cached_read_index = buffer->read_index.load(std::memory_order_acquire);
+
+	thread_registration.index = index;
+	thread_registration.generation = registry_generation;
+	thread_buffer = buffer;
+	return buffer;
+}
+
+void CPUProfiler::record_zone(const char* name, int64_t begin_ticks, int64_t end_ticks)
+{
+	ThreadBuffer* buffer = thread_registered ? thread_buffer : get_thread_buffer();
+	if (!buffer) return;
+
+	const uint64_t index = buffer->write_index.load(std::memory_order_relaxed);
+	if (index - buffer->cached_read_index >= CPU_PROFILER_BUFFER_EVENTS)
+	{
+		buffer->cached_read_index = buffer->read_index.load(std::memory_order_acquire);
+		if (index - buffer->cached_read_index >= CPU_PROFILER_BUFFER_EVENTS)
+		{
+			buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+
+	ZoneEvent& event = buffer->events[index & (CPU_PROFILER_BUFFER_EVENTS - 1)];
+	event.name = name;
+	event.begin_ticks = begin_ticks;
+	event.end_ticks = end_ticks;
+	buffer->write_index.store(index + 1, std::memory_order_release);
+}
+
+void CPUProfiler::set_thread_name(const char* name)
+{
+	ThreadBuffer* buffer = get_thread_buffer();
+	if (!buffer) return;
+
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+}
+
+void CPUProfiler::end_frame()
+{
+	const int64_t end_ns = now_ns();
+	CollectedFrame& frame = history[frame_count % CPU_PROFILER_HISTORY];
+	frame.frame_number = frame_count;
+	frame.begin_ns = frame_count == 0 ? end_ns : frame_begin_ns;
+	frame.end_ns = end_ns;
+	frame.zones.clear();
+
+	uint64_t dropped = 0;
+	const uint32_t count = thread_count.load(std::memory_order_acquire);
+	if (count > 0) update_calibration();
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		ThreadBuffer& buffer = *threads[t];
+		const uint64_t read = buffer.read_index.load(std::memory_order_relaxed);
+		const uint64_t write = buffer.write_index.load(std::memory_order_acquire);
+		for (uint64_t i = read; i < write; ++i)
+		{
+			const ZoneEvent& event = buffer.events[i & (CPU_PROFILER_BUFFER_EVENTS - 1)];
+			frame.zones.push_back({ event.name, ticks_to_ns(event.begin_ticks), ticks_to_ns(event.end_ticks), t });
+		}
+		buffer.read_index.store(write, std::memory_order_release);
+		dropped += buffer.dropped.load(std::memory_order_relaxed);
+	}
+
+	if (dropped > dropped_reported)
+	{
+		LOG_WARNING("CPU profiler: %llu zones dropped on full rings, raise CPU_PROFILER_BUFFER_EVENTS", (unsigned long long)(dropped - dropped_reported));
+		dropped_reported = dropped;
+	}
+
+	frame_begin_ns = end_ns;
+	frame_count++;
+}
+
+void CPUProfiler::shutdown()
+{
+	std::lock_guard<std::mutex> lock(threads_mutex);
+	const uint32_t count = thread_count.load(std::memory_order_acquire);
+	for (uint32_t t = 0; t < count; ++t)
+	{
+		delete threads[t];
+		threads[t] = nullptr;
+	}
+	thread_count.store(0, std::memory_order_release);
+	registry_generation++;
+	ns_per_tick = 1.0;
+	for (CollectedFrame& frame : history) frame.zones.clear();
+	frame_count = 0;
+	dropped_reported = 0;
+	// Threads that are still alive keep a dangling thread_local pointer, hence the requirement in the header
+	thread_buffer = nullptr;
+	thread_registered = false;
+	thread_registration.index = UINT32_MAX;
+}
+
+bool CPUProfiler::export_chrome_trace(const char* path)
+{
+	if (frame_count == 0)
+	{
+		LOG_WARNING("CPU profiler: no frames collected yet, nothing to export");
+		return false;
+	}
+
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		LOG_ERROR("CPU profiler: failed to open %s for writing", path);
+		return false;
+	}
+
+	const uint64_t exported_frames = std::min<uint64_t>(frame_count, CPU_PROFILER_HISTORY);
+	const uint64_t first_frame = frame_count - exported_frames;
+	int64_t origin_ns = history[first_frame % CPU_PROFILER_HISTORY].begin_ns;
+	for (uint64_t i = first_frame; i < frame_count; ++i)
+	{
+		for (const CollectedZone& zone : history[i % CPU_PROFILER_HISTORY].zones) origin_ns = std::min(origin_ns, zone.begin_ns);
+	}
+
+	// Thread t is tid t + 1, tid 0 carries the frame markers
+	fprintf(f, "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [");
+	fprintf(f, "\n    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": { \"name\": \"Frames\" } }");
+	{
+		std::lock_guard<std::mutex> lock(threads_mutex);
+		const uint32_t count = thread_count.load(std::memory_order_acquire);
+		for (uint32_t t = 0; t < count; ++t)
+		{
+			fprintf(f, ",\n    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": { \"name\": ", t + 1);
+			write_json_string(f, threads[t]->name);
+			fprintf(f, " } }");
+		}
+	}
+
+	for (uint64_t i = first_frame; i < frame_count; ++i)
+	{
+		const CollectedFrame& frame = history[i % CPU_PROFILER_HISTORY];
+		fprintf(f, ",\n    { \"name\": \"Frame %llu\", \"cat\": \"frame\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f }",
+			(unsigned long long)frame.frame_number, (double)(frame.begin_ns - origin_ns) * 1e-3, (double)(frame.end_ns - frame.begin_ns) * 1e-3);
+		for (const CollectedZone& zone : frame.zones)
+		{
+			fprintf(f, ",\n    { \"name\": ");
+			write_json_string(f, zone.name);
+			fprintf(f, ", \"cat\": \"cpu\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f }",
+				zone.thread + 1, (double)(zone.begin_ns - origin_ns) * 1e-3, (double)(zone.end_ns - zone.begin_ns) * 1e-3);
+		}
+	}
+	fprintf(f, "\n  ]\n}\n");
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	if (ok) LOG_INFO("CPU profiler: wrote %llu frames to %s", (unsigned long long)exported_frames, path);
+	else LOG_ERROR("CPU profiler: failed to write %s", path);
+	return ok;
+}
+
+double CPUProfiler::measure_zone_overhead(uint32_t zone_count)
+{
+	ThreadBuffer* buffer = get_thread_buffer();
+	if (!buffer || zone_count == 0) return 0.0;
+
+	// Batches of half a ring, emptied in between so every zone takes the full write path instead of being dropped
+	const uint32_t batch_size = CPU_PROFILER_BUFFER_EVENTS / 2;
+	int64_t total_ns = 0;
+	uint32_t measured = 0;
+	while (measured < zone_count)
+	{
+		const uint32_t batch = std::min(batch_size, zone_count - measured);
+		buffer->read_index.store(buffer->write_index.load(std::memory_order_relaxed), std::memory_order_release);
+
+		const int64_t begin_ns = now_ns();
+		for (uint32_t i = 0; i < batch; ++i)
+		{
+			CPUProfiler::Zone zone("Zone overhead");
+		}
+		total_ns += now_ns() - begin_ns;
+		measured += batch;
+	}
+	buffer->read_index.store(buffer->write_index.load(std::memory_order_relaxed), std::memory_order_release);
+
+	return (double)total_ns / (double)zone_count;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Zones cost two cycle counter reads and one ring buffer write, cheap enough to stay on in release builds.
+// Set to 0 to compile every CPU_ZONE out
+#define CPU_PROFILER_ENABLED 1
+#define CPU_PROFILER_BUFFER_EVENTS 8192 // Per thread, power of two. Zones are dropped while a thread's ring is full
+#define CPU_PROFILER_MAX_THREADS 64
+#define CPU_PROFILER_HISTORY 256 // Frames kept for export
+#define CPU_PROFILER_THREAD_NAME_LENGTH 32
+#define CPU_PROFILER_DEFAULT_TRACE_PATH "cpu_trace.json"
+
+#define CPU_PROFILER_CONCAT_INNER(a, b) a##b
+#define CPU_PROFILER_CONCAT(a, b) CPU_PROFILER_CONCAT_INNER(a, b)
+
+// Times the enclosing block. The name is stored as a pointer, so it has to be a string literal or otherwise outlive the profiler
+#if CPU_PROFILER_ENABLED
+#define CPU_ZONE(name) CPUProfiler::Zone CPU_PROFILER_CONCAT(cpu_zone_, __LINE__)(name)
+#else
+#define CPU_ZONE(name)
+#endif
+
+// Instrumentation for the main thread, job workers and the other long lived threads. Every thread writes
+// finished zones into its own single producer ring buffer without locks; end_frame, called once per frame
+// on the main thread, drains all rings into a per frame history that can be exported as Chrome trace JSON.
+// Uses the same clock as the GPU profiler, CPU and GPU traces line up.
+namespace CPUProfiler
+{
+	inline int64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// The CPU's cycle counter where there is one, reading steady_clock costs several times more.
+	// Ticks are converted to nanoseconds on the steady_clock timeline when end_frame collects them
+	inline int64_t now_ticks()
+	{
+#if (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))) || defined(__x86_64__) || defined(__i386__)
+		return (int64_t)__rdtsc();
+#elif defined(__aarch64__)
+		int64_t ticks;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+		return ticks;
+#else
+		return now_ns();
+#endif
+	}
+
+	void record_zone(const char* name, int64_t begin_ticks, int64_t end_ticks);
+
+	struct Zone
+	{
+		const char* name;
+		int64_t begin_ticks;
+
+		Zone(const char* zone_name) : name(zone_name), begin_ticks(now_ticks()) {}
+		~Zone() { record_zone(name, begin_ticks, now_ticks()); }
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+	};
+
+	// Shown as the thread's track in the trace, the name is copied
+	void set_thread_name(const char* name);
+
+	// Collects the zones every thread finished since the last call. Threads may keep recording while it runs
+	void end_frame();
+	// Frees the rings, threads that recorded zones must have exited or stopped recording
+	void shutdown();
+
+	// Last CPU_PROFILER_HISTORY collected frames as Chrome trace JSON (chrome://tracing, Perfetto)
+	bool export_chrome_trace(const char* path);
+
+	// Average cost of an empty zone in nanoseconds. Call from the main thread, the zones are discarded
+	double measure_zone_overhead(uint32_t zone_count);
+}
@@ -0,0 +1,99 @@
+#include "file_mapping.h"
+#include "log.h"
+
+#if _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool map_file(const char* filepath, MappedFile& out_file)
+{
+	out_file = MappedFile{};
+
+#if _WIN32
+	HANDLE file = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		LOG_ERROR("Failed to open file '%s'", filepath);
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		LOG_ERROR("Failed to map empty file '%s'", filepath);
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping)
+	{
+		LOG_ERROR("Failed to create file mapping for '%s'", filepath);
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!data)
+	{
+		LOG_ERROR("Failed to map view of '%s'", filepath);
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	out_file.data = (const uint8_t*)data;
+	out_file.size = (size_t)size.QuadPart;
+	out_file.file_handle = file;
+	out_file.mapping_handle = mapping;
+#else
+	int fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+	{
+		LOG_ERROR("Failed to open file '%s'", filepath);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		LOG_ERROR("Failed to map empty file '%s'", filepath);
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		LOG_ERROR("Failed to map file '%s'", filepath);
+		return false;
+	}
+
+	out_file.data = (const uint8_t*)data;
+	out_file.size = (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void unmap_file(MappedFile& file)
+{
+	if (!file) return;
+
+#if _WIN32
+	UnmapViewOfFile(file.data);
+	CloseHandle((HANDLE)file.mapping_handle);
+	CloseHandle((HANDLE)file.file_handle);
+#else
+	munmap((void*)file.data, file.size);
+#endif
+
+	file = MappedFile{};
+}
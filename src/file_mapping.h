@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Read only memory mapping of a whole file
+struct MappedFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+#if _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+	operator bool() const { return data != nullptr; }
+};
+
+bool map_file(const char* filepath, MappedFile& out_file);
+void unmap_file(MappedFile& file);
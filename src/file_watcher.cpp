@@ -0,0 +1,387 @@
+#include "file_watcher.h"
+#include "log.h"
+#include "timer.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+static std::thread watcher_thread;
+static std::atomic<bool> should_quit = false;
+static bool initialized = false;
+static FileChangeCallback change_callback = nullptr;
+static void* change_user_data = nullptr;
+
+// Shared between the watcher thread and callers of watch_files
+static std::mutex files_mutex;
+static std::unordered_set<std::string> watched_files;
+static bool files_changed = false;
+static FileWatcherStats stats;
+
+// Only touched by the watcher thread
+static std::set<std::string> pending_changes;
+static Clock::time_point last_event_time;
+
+static void add_pending_change(const std::string& path)
+{
+	pending_changes.insert(path);
+	last_event_time = Clock::now();
+}
+
+static void flush_pending_changes()
+{
+	if (pending_changes.empty()) return;
+	if (Clock::now() - last_event_time < std::chrono::milliseconds(FILE_WATCHER_DEBOUNCE_MS)) return;
+
+	std::vector<std::string> changed(pending_changes.begin(), pending_changes.end());
+	pending_changes.clear();
+	{
+		std::lock_guard<std::mutex> lock(files_mutex);
+		stats.change_batches++;
+	}
+
+	// Called without holding the lock, the callback is free to call watch_files
+	change_callback(changed, change_user_data);
+}
+
+// Returns true and a copy of the watched set if it was replaced since the last call
+static bool fetch_watched_files(std::unordered_set<std::string>& out_files)
+{
+	std::lock_guard<std::mutex> lock(files_mutex);
+	if (!files_changed) return false;
+
+	out_files = watched_files;
+	files_changed = false;
+	return true;
+}
+
+static void run_polling()
+{
+	std::unordered_set<std::string> files;
+	std::unordered_map<std::string, std::filesystem::file_time_type> timestamps;
+	Clock::time_point next_poll = Clock::now();
+
+	while (!should_quit)
+	{
+		if (fetch_watched_files(files))
+		{
+			// Keep known timestamps so a change racing with the update is not lost
+			for (auto it = timestamps.begin(); it != timestamps.end();)
+			{
+				it = files.count(it->first) ? std::next(it) : timestamps.erase(it);
+			}
+		}
+
+		if (Clock::now() >= next_poll)
+		{
+			Timer timer;
+			timer.tick();
+
+			uint64_t events = 0;
+			for (const auto& f : files)
+			{
+				std::error_code ec;
+				const std::filesystem::file_time_type time = std::filesystem::last_write_time(f, ec);
+				// Missing files are usually in the middle of being saved, check again next time
+				if (ec) continue;
+
+				auto it = timestamps.find(f);
+				if (it == timestamps.end())
+				{
+					timestamps.emplace(f, time);
+				}
+				else if (it->second != time)
+				{
+					it->second = time;
+					add_pending_change(f);
+					events++;
+				}
+			}
+
+			timer.tock();
+			{
+				std::lock_guard<std::mutex> lock(files_mutex);
+				stats.events += events;
+				stats.last_poll_ms = timer.get_elapsed_milliseconds();
+			}
+			next_poll = Clock::now() + std::chrono::milliseconds(FILE_WATCHER_POLL_INTERVAL_MS);
+		}
+
+		flush_pending_changes();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+#ifdef __linux__
+static void run_inotify(int fd)
+{
+	// Directories are watched instead of the files themselves, since editors often save by writing a
+	// new file and renaming it over the old one, which would silently end a watch on the file
+	const uint32_t watch_mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+	std::unordered_set<std::string> files;
+	std::unordered_map<std::string, int> watches_by_directory;
+	std::unordered_map<int, std::filesystem::path> directories_by_watch;
+	alignas(struct inotify_event) char buffer[16 * 1024];
+
+	while (!should_quit)
+	{
+		if (fetch_watched_files(files))
+		{
+			std::unordered_set<std::string> directories;
+			for (const auto& f : files)
+			{
+				directories.insert(std::filesystem::path(f).parent_path().string());
+			}
+
+			for (auto it = watches_by_directory.begin(); it != watches_by_directory.end();)
+			{
+				if (directories.count(it->first))
+				{
+					++it;
+					continue;
+				}
+				inotify_rm_watch(fd, it->second);
+				directories_by_watch.erase(it->second);
+				it = watches_by_directory.erase(it);
+			}
+
+			for (const auto& d : directories)
+			{
+				if (watches_by_directory.count(d)) continue;
+
+				const int wd = inotify_add_watch(fd, d.c_str(), watch_mask);
+				if (wd < 0)
+				{
+					LOG_WARNING("Failed to watch directory '%s': %s", d.c_str(), strerror(errno));
+					continue;
+				}
+				watches_by_directory[d] = wd;
+				directories_by_watch[wd] = std::filesystem::path(d);
+			}
+
+			std::lock_guard<std::mutex> lock(files_mutex);
+			stats.watched_directories = (uint32_t)watches_by_directory.size();
+		}
+
+		// Wake up often enough to notice quit requests and to flush debounced changes on time
+		pollfd pfd{ fd, POLLIN, 0 };
+		const int timeout_ms = pending_changes.empty() ? 100 : FILE_WATCHER_DEBOUNCE_MS / 4;
+		if (poll(&pfd, 1, timeout_ms) > 0 && (pfd.revents & POLLIN))
+		{
+			const ssize_t length = read(fd, buffer, sizeof(buffer));
+			uint64_t events = 0;
+			for (ssize_t offset = 0; length > 0 && offset < length;)
+			{
+				const inotify_event* event = (const inotify_event*)(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+				events++;
+
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					// Events were dropped, assume everything changed
+					for (const auto& f : files) add_pending_change(f);
+					continue;
+				}
+				if (event->len == 0) continue;
+
+				auto dir = directories_by_watch.find(event->wd);
+				if (dir == directories_by_watch.end()) continue;
+
+				const std::string path = (dir->second / event->name).string();
+				if (files.count(path)) add_pending_change(path);
+			}
+
+			std::lock_guard<std::mutex> lock(files_mutex);
+			stats.events += events;
+		}
+
+		flush_pending_changes();
+	}
+
+	for (const auto& w : watches_by_directory) inotify_rm_watch(fd, w.second);
+}
+#endif
+
+namespace FileWatcher
+{
+
+void init(FileChangeCallback callback, void* user_data, bool force_polling)
+{
+	assert(!initialized);
+	assert(callback);
+
+	change_callback = callback;
+	change_user_data = user_data;
+	should_quit = false;
+	pending_changes.clear();
+
+#ifdef __linux__
+	if (!force_polling)
+	{
+		const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (fd >= 0)
+		{
+			stats.backend = "inotify";
+			watcher_thread = std::thread([fd]()
+				{
+					run_inotify(fd);
+					close(fd);
+				});
+			initialized = true;
+			return;
+		}
+		LOG_WARNING("inotify is unavailable (%s), polling for file changes instead", strerror(errno));
+	}
+#endif
+
+	stats.backend = "polling";
+	watcher_thread = std::thread(run_polling);
+	initialized = true;
+}
+
+void shutdown()
+{
+	if (!initialized) return;
+
+	should_quit = true;
+	watcher_thread.join();
+
+	std::lock_guard<std::mutex> lock(files_mutex);
+	watched_files.clear();
+	files_changed = false;
+	stats = FileWatcherStats{};
+	initialized = false;
+}
+
+void watch_files(const std::vector<std::filesystem::path>& files)
+{
+	std::lock_guard<std::mutex> lock(files_mutex);
+	watched_files.clear();
+	for (const auto& f : files)
+	{
+		watched_files.insert(f.string());
+	}
+	files_changed = true;
+	stats.watched_files = (uint32_t)watched_files.size();
+}
+
+FileWatcherStats get_stats()
+{
+	std::lock_guard<std::mutex> lock(files_mutex);
+	return stats;
+}
+
+static std::atomic<uint64_t> benchmark_batches = 0;
+static std::atomic<size_t> benchmark_changed_files = 0;
+static Clock::time_point benchmark_callback_time;
+
+static void benchmark_callback(const std::vector<std::string>& changed_files, void* user_data)
+{
+	benchmark_changed_files += changed_files.size();
+	benchmark_callback_time = Clock::now();
+	benchmark_batches.fetch_add(1, std::memory_order_release);
+}
+
+static bool write_benchmark_file(const std::filesystem::path& path, const char* contents)
+{
+	FILE* f = fopen(path.string().c_str(), "w");
+	if (!f) return false;
+	fputs(contents, f);
+	fclose(f);
+	return true;
+}
+
+void run_benchmark(uint32_t file_count)
+{
+	assert(!initialized);
+	if (file_count < 2) return;
+
+	std::error_code ec;
+	const std::filesystem::path root = std::filesystem::temp_directory_path(ec) / "gigavfx_file_watcher_benchmark";
+	std::filesystem::remove_all(root, ec);
+
+	std::vector<std::filesystem::path> files;
+	for (uint32_t i = 0; i < file_count; ++i)
+	{
+		const std::filesystem::path directory = root / ("dir" + std::to_string(i % FILE_WATCHER_BENCHMARK_DIRECTORIES));
+		std::filesystem::create_directories(directory, ec);
+		files.push_back(directory / ("file" + std::to_string(i) + ".hlsl"));
+		if (!write_benchmark_file(files.back(), "0"))
+		{
+			LOG_ERROR("Failed to create benchmark file '%s'", files.back().string().c_str());
+			std::filesystem::remove_all(root, ec);
+			return;
+		}
+	}
+
+	printf("File watcher, %u files in %u directories\n", file_count, FILE_WATCHER_BENCHMARK_DIRECTORIES);
+	printf("%10s %12s %10s %12s %14s\n", "backend", "latency ms", "batches", "files", "poll ms");
+
+	const bool force_polling[] = { false, true };
+	for (bool polling : force_polling)
+	{
+		benchmark_batches = 0;
+		benchmark_changed_files = 0;
+		init(benchmark_callback, nullptr, polling);
+		if (!polling && strcmp(get_stats().backend, "polling") == 0)
+		{
+			// No native backend on this platform, the polling run below covers it
+			shutdown();
+			continue;
+		}
+		watch_files(files);
+
+		// Let the watcher pick up the set and, when polling, take its baseline timestamps
+		std::this_thread::sleep_for(std::chrono::milliseconds(FILE_WATCHER_POLL_INTERVAL_MS * 2));
+
+		// Three quick writes to one file plus a save through a temporary file renamed over another
+		const Clock::time_point begin = Clock::now();
+		for (int i = 0; i < 3; ++i)
+		{
+			write_benchmark_file(files[0], i == 0 ? "1" : i == 1 ? "12" : "123");
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		std::filesystem::path temporary = files[file_count / 2];
+		temporary += ".tmp";
+		write_benchmark_file(temporary, "saved");
+		std::filesystem::rename(temporary, files[file_count / 2], ec);
+
+		const Clock::time_point timeout = begin + std::chrono::milliseconds(FILE_WATCHER_BENCHMARK_TIMEOUT_MS);
+		while (benchmark_changed_files < 2 && Clock::now() < timeout)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		// Give stray batches a debounce period to show up before counting them
+		std::this_thread::sleep_for(std::chrono::milliseconds(FILE_WATCHER_DEBOUNCE_MS * 2));
+		const FileWatcherStats result = get_stats();
+		const uint64_t batches = benchmark_batches.load(std::memory_order_acquire);
+		shutdown();
+
+		if (batches == 0)
+		{
+			LOG_WARNING("%s backend reported no changes within %u ms", result.backend, FILE_WATCHER_BENCHMARK_TIMEOUT_MS);
+			continue;
+		}
+		const double latency_ms = std::chrono::duration<double, std::milli>(benchmark_callback_time - begin).count();
+		printf("%10s %12.1f %10llu %12zu %14.3f\n", result.backend, latency_ms, (unsigned long long)batches,
+			benchmark_changed_files.load(), result.last_poll_ms);
+	}
+
+	std::filesystem::remove_all(root, ec);
+}
+
+} // namespace FileWatcher
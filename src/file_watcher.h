@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <filesystem>
+
+// Changes are reported as the paths that were passed to watch_files
+typedef void (*FileChangeCallback)(const std::vector<std::string>& changed_files, void* user_data);
+
+#define FILE_WATCHER_DEBOUNCE_MS 100
+#define FILE_WATCHER_POLL_INTERVAL_MS 500
+#define FILE_WATCHER_BENCHMARK_DIRECTORIES 20
+#define FILE_WATCHER_BENCHMARK_TIMEOUT_MS 5000
+
+struct FileWatcherStats
+{
+	const char* backend = "none";
+	uint32_t watched_files = 0;
+	uint32_t watched_directories = 0;
+	uint64_t events = 0;        // Raw notifications, or files found modified by a poll
+	uint64_t change_batches = 0; // Callbacks issued after debouncing
+	double last_poll_ms = 0.0;   // Polling backend only
+};
+
+// Watches a set of files on a background thread. Uses inotify on Linux and falls back to polling
+// timestamps elsewhere or if inotify is unavailable. Editors tend to save in bursts (truncate, write,
+// rename), so changes are collected until no new event arrived for FILE_WATCHER_DEBOUNCE_MS and then
+// reported in one callback, which runs on the watcher thread.
+namespace FileWatcher
+{
+	void init(FileChangeCallback callback, void* user_data, bool force_polling = false);
+	void shutdown();
+
+	// Replaces the watched set. Paths should be absolute and normalized
+	void watch_files(const std::vector<std::filesystem::path>& files);
+
+	FileWatcherStats get_stats();
+
+	// Watches file_count files spread over FILE_WATCHER_BENCHMARK_DIRECTORIES temporary directories, then saves two
+	// of them the way editors do (a burst of writes and a rename over the original). Prints for every backend how
+	// long the change took to be reported and what a poll of the whole set costs. The watcher must not be running
+	void run_benchmark(uint32_t file_count);
+}
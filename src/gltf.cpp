@@ -2,182 +2,527 @@
 #include "cgltf.h"
 #include "mesh.h"
 #include "graphics_context.h"
+#include "buffer.h"
+#include "vk_helpers.h"
+#include "misc.h"
 #include "stb_image.h"
+#include "texture_cache.h"
+#include "job_system.h"
+#include "timer.h"
+#include "cpu_profiler.h"
 #include "../shaders/shared.h"
 #include <vector>
 
-size_t load_meshes(Context& ctx, const cgltf_data* gltf_data, Mesh* out_meshes, size_t count)
+#define MESH_STAGING_RING_SIZE (64ull * 1024 * 1024) // Split in two halves, one is filled while the other is copied
+#define MESH_ARENA_ALIGNMENT 16
+
+enum MeshAttribute
 {
-    if (out_meshes == nullptr) return gltf_data->meshes_count;
+    MESH_ATTRIBUTE_POSITION,
+    MESH_ATTRIBUTE_NORMAL,
+    MESH_ATTRIBUTE_TANGENT,
+    MESH_ATTRIBUTE_TEXCOORD0,
+    MESH_ATTRIBUTE_TEXCOORD1,
+    MESH_ATTRIBUTE_COUNT
+};
 
-    for (size_t i = 0; i < count; ++i)
+static const uint32_t mesh_attribute_strides[MESH_ATTRIBUTE_COUNT] = {
+    sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec4), sizeof(glm::vec2), sizeof(glm::vec2)
+};
+
+// Counts taken from the accessors, so destinations can be sized before anything is unpacked
+struct MeshLayout
+{
+    uint32_t vertex_count = 0;
+    uint32_t index_count = 0;
+    bool has_attribute[MESH_ATTRIBUTE_COUNT] = {};
+};
+
+// nullptr for attributes the destination does not store
+struct MeshDestination
+{
+    uint32_t* indices;
+    uint8_t* attributes[MESH_ATTRIBUTE_COUNT];
+};
+
+static int get_attribute_slot(const cgltf_attribute& a)
+{
+    switch (a.type)
     {
-        const cgltf_mesh& m = gltf_data->meshes[i];
-        std::vector<glm::vec3> position;
-        std::vector<glm::vec3> normal;
-        std::vector<glm::vec4> tangent;
-        std::vector<glm::vec2> texcoord0;
-        std::vector<glm::vec2> texcoord1;
-        std::vector<uint32_t> indices;
+    case cgltf_attribute_type_position:
+        return MESH_ATTRIBUTE_POSITION;
+    case cgltf_attribute_type_normal:
+        return MESH_ATTRIBUTE_NORMAL;
+    case cgltf_attribute_type_tangent:
+        return MESH_ATTRIBUTE_TANGENT;
+    case cgltf_attribute_type_texcoord:
+        if (a.index == 0) return MESH_ATTRIBUTE_TEXCOORD0;
+        if (a.index == 1) return MESH_ATTRIBUTE_TEXCOORD1;
+        return -1;
+    default:
+        return -1;
+    }
+}
 
-        Mesh& mesh = out_meshes[i];
-        mesh.primitives.resize(m.primitives_count);
+static MeshLayout get_mesh_layout(const cgltf_mesh& m)
+{
+    MeshLayout layout;
+    for (size_t j = 0; j < m.primitives_count; ++j)
+    {
+        const cgltf_primitive& p = m.primitives[j];
+        assert(p.indices);
+        layout.index_count += p.indices->count;
 
-        for (size_t j = 0; j < m.primitives_count; ++j)
+        for (size_t k = 0; k < p.attributes_count; ++k)
         {
-            const cgltf_primitive& p = m.primitives[j];
-            assert(p.indices);
+            const cgltf_attribute& a = p.attributes[k];
+            const int slot = get_attribute_slot(a);
+            if (slot < 0) continue;
+            layout.has_attribute[slot] = true;
+            if (slot == MESH_ATTRIBUTE_POSITION) layout.vertex_count += a.data->count;
+        }
+    }
+    return layout;
+}
 
-            Mesh::Primitive& primitive = mesh.primitives[j];
+static void unpack_mesh(const cgltf_data* gltf_data, const cgltf_mesh& m, const MeshDestination& dst, Mesh::Primitive* out_primitives)
+{
+    uint32_t first_vertex = 0;
+    uint32_t first_index = 0;
 
-            uint32_t first_vertex = position.size();
-            uint32_t first_index = indices.size();
-            uint32_t index_count = p.indices->count;
+    for (size_t j = 0; j < m.primitives_count; ++j)
+    {
+        const cgltf_primitive& p = m.primitives[j];
+        assert(p.indices);
 
-            primitive.first_vertex = first_vertex;
-            primitive.first_index = first_index;
-            primitive.index_count = index_count;
-            primitive.material = p.material ? cgltf_material_index(gltf_data, p.material) : -1;
+        uint32_t vertex_count = 0;
+        for (size_t k = 0; k < p.attributes_count; ++k)
+        {
+            if (p.attributes[k].type == cgltf_attribute_type_position) vertex_count = p.attributes[k].data->count;
+        }
+        uint32_t index_count = p.indices->count;
 
-            indices.resize(first_index + index_count);
-            cgltf_accessor_unpack_indices(p.indices, indices.data() + first_index, sizeof(uint32_t), index_count);
+        Mesh::Primitive& primitive = out_primitives[j];
+        primitive.first_vertex = first_vertex;
+        primitive.first_index = first_index;
+        primitive.index_count = index_count;
+        primitive.material = p.material ? cgltf_material_index(gltf_data, p.material) : -1;
 
-            bool primitive_has_tangents = false;
-            for (size_t k = 0; k < p.attributes_count; ++k)
-            {
-                const cgltf_attribute& a = p.attributes[k];
-                switch (a.type)
-                {
-                case cgltf_attribute_type_position:
-                {
-                    assert(a.data->component_type == cgltf_component_type_r_32f);
-                    assert(a.data->type == cgltf_type_vec3); // TODO: Handle other component types and types
-                    position.resize(first_vertex + a.data->count);
-                    cgltf_accessor_unpack_floats(a.data, (cgltf_float*)(position.data() + first_vertex), CGLTF_FLOAT_COUNT(a.data));
-                    break;
-                }
-                case cgltf_attribute_type_normal:
-                {
-                    assert(a.data->component_type == cgltf_component_type_r_32f);
-                    assert(a.data->type == cgltf_type_vec3); // TODO: Handle other component types and types
-                    normal.resize(first_vertex + a.data->count);
-                    cgltf_accessor_unpack_floats(a.data, (cgltf_float*)(normal.data() + first_vertex), CGLTF_FLOAT_COUNT(a.data));
-                    break;
-                }
-                case cgltf_attribute_type_tangent:
-                {
-                    primitive_has_tangents = true;
-                    assert(a.data->component_type == cgltf_component_type_r_32f);
-                    assert(a.data->type == cgltf_type_vec4); // TODO: Handle other component types and types
-                    tangent.resize(first_vertex + a.data->count);
-                    cgltf_accessor_unpack_floats(a.data, (cgltf_float*)(tangent.data() + first_vertex), CGLTF_FLOAT_COUNT(a.data));
-                    break;
-                }
-                case cgltf_attribute_type_texcoord:
-                {
-                    cgltf_float* out = nullptr;
-                    switch (a.index)
-                    {
-                    case 0:
-                        texcoord0.resize(first_vertex + a.data->count);
-                        out = (cgltf_float*)(texcoord0.data() + first_vertex);
-                        break;
-                    case 1:
-                        texcoord1.resize(first_vertex + a.data->count);
-                        out = (cgltf_float*)(texcoord1.data() + first_vertex);
-                        break;
-                    default:
-                        LOG_WARNING("Unused texcoord index: %d", a.index);
-                        break;
-                    }
-                    cgltf_accessor_unpack_floats(a.data, out, CGLTF_FLOAT_COUNT(a.data));
-
-                    break;
-                }
-                default:
-                    LOG_WARNING("Unused gltf attribute: %s", a.name);
-                    break;
-                }
-            }
+        cgltf_accessor_unpack_indices(p.indices, dst.indices + first_index, sizeof(uint32_t), index_count);
 
-            if (p.material && p.material->normal_texture.texture && !primitive_has_tangents)
+        bool written[MESH_ATTRIBUTE_COUNT] = {};
+        for (size_t k = 0; k < p.attributes_count; ++k)
+        {
+            const cgltf_attribute& a = p.attributes[k];
+            const int slot = get_attribute_slot(a);
+            switch (slot)
             {
-                LOG_WARNING("Primitive on mesh %s has a normal map but is missing tangents!", m.name ? m.name : "");
+            case MESH_ATTRIBUTE_POSITION:
+            case MESH_ATTRIBUTE_NORMAL:
+                assert(a.data->component_type == cgltf_component_type_r_32f);
+                assert(a.data->type == cgltf_type_vec3); // TODO: Handle other component types and types
+                break;
+            case MESH_ATTRIBUTE_TANGENT:
+                assert(a.data->component_type == cgltf_component_type_r_32f);
+                assert(a.data->type == cgltf_type_vec4); // TODO: Handle other component types and types
+                break;
+            case MESH_ATTRIBUTE_TEXCOORD0:
+            case MESH_ATTRIBUTE_TEXCOORD1:
+                break;
+            default:
+                if (a.type == cgltf_attribute_type_texcoord) LOG_WARNING("Unused texcoord index: %d", a.index);
+                else LOG_WARNING("Unused gltf attribute: %s", a.name);
+                continue;
             }
+
+            uint8_t* out = dst.attributes[slot] + (size_t)first_vertex * mesh_attribute_strides[slot];
+            cgltf_accessor_unpack_floats(a.data, (cgltf_float*)out, CGLTF_FLOAT_COUNT(a.data));
+            written[slot] = true;
         }
 
-        // Create GPU buffers
-        { // Indices
-            assert(!indices.empty());
-            BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(indices);
-            desc.usage_flags = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-            desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = indices.data();
-            mesh.indices = ctx.create_buffer(desc);
+        // Another primitive of the mesh has the attribute, keep this one's range zeroed
+        for (uint32_t slot = 0; slot < MESH_ATTRIBUTE_COUNT; ++slot)
+        {
+            if (!dst.attributes[slot] || written[slot]) continue;
+            const uint32_t stride = mesh_attribute_strides[slot];
+            memset(dst.attributes[slot] + (size_t)first_vertex * stride, 0, (size_t)vertex_count * stride);
         }
-        { // Position
-            assert(!position.empty());
-            BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(position);
-            desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-            desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = position.data();
-            mesh.position = ctx.create_buffer(desc);
+
+        if (p.material && p.material->normal_texture.texture && !written[MESH_ATTRIBUTE_TANGENT])
+        {
+            LOG_WARNING("Primitive on mesh %s has a normal map but is missing tangents!", m.name ? m.name : "");
         }
-        if (!normal.empty())
-        { // Normal
-            BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(normal);
-            desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-            desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = normal.data();
-            mesh.normal = ctx.create_buffer(desc);
+
+        first_vertex += vertex_count;
+        first_index += index_count;
+    }
+}
+
+size_t load_mesh_geometry(const cgltf_data* gltf_data, MeshGeometry* out_geometry, size_t count)
+{
+    if (out_geometry == nullptr) return gltf_data->meshes_count;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const cgltf_mesh& m = gltf_data->meshes[i];
+        MeshGeometry& geometry = out_geometry[i];
+        const MeshLayout layout = get_mesh_layout(m);
+
+        geometry.primitives.resize(m.primitives_count);
+        geometry.indices.resize(layout.index_count);
+        if (layout.has_attribute[MESH_ATTRIBUTE_POSITION]) geometry.position.resize(layout.vertex_count);
+        if (layout.has_attribute[MESH_ATTRIBUTE_NORMAL]) geometry.normal.resize(layout.vertex_count);
+        if (layout.has_attribute[MESH_ATTRIBUTE_TANGENT]) geometry.tangent.resize(layout.vertex_count);
+        if (layout.has_attribute[MESH_ATTRIBUTE_TEXCOORD0]) geometry.texcoord0.resize(layout.vertex_count);
+        if (layout.has_attribute[MESH_ATTRIBUTE_TEXCOORD1]) geometry.texcoord1.resize(layout.vertex_count);
+
+        MeshDestination dst{};
+        dst.indices = geometry.indices.data();
+        dst.attributes[MESH_ATTRIBUTE_POSITION] = (uint8_t*)geometry.position.data();
+        dst.attributes[MESH_ATTRIBUTE_NORMAL] = (uint8_t*)geometry.normal.data();
+        dst.attributes[MESH_ATTRIBUTE_TANGENT] = (uint8_t*)geometry.tangent.data();
+        dst.attributes[MESH_ATTRIBUTE_TEXCOORD0] = (uint8_t*)geometry.texcoord0.data();
+        dst.attributes[MESH_ATTRIBUTE_TEXCOORD1] = (uint8_t*)geometry.texcoord1.data();
+        unpack_mesh(gltf_data, m, dst, geometry.primitives.data());
+    }
+
+    return count;
+}
+
+// Where a mesh lives in the arena and, while its batch is in flight, in the staging ring
+struct MeshPlacement
+{
+    MeshLayout layout;
+    uint64_t index_offset = 0;
+    uint64_t attribute_offsets[MESH_ATTRIBUTE_COUNT] = {};
+    uint64_t staging_offset = 0;
+    uint64_t staging_size = 0;
+};
+
+// Staging copy of a mesh: indices followed by the attributes it has, each aligned
+template <typename F>
+static void for_each_mesh_range(const MeshPlacement& placement, F&& f)
+{
+    uint64_t offset = placement.staging_offset;
+    auto add = [&](int slot, uint64_t size, uint64_t arena_offset)
+    {
+        offset = align_power_of_2(offset, MESH_ARENA_ALIGNMENT);
+        f(slot, offset, size, arena_offset);
+        offset += size;
+    };
+
+    add(-1, (uint64_t)placement.layout.index_count * sizeof(uint32_t), placement.index_offset);
+    for (int slot = 0; slot < MESH_ATTRIBUTE_COUNT; ++slot)
+    {
+        if (placement.layout.has_attribute[slot])
+        {
+            add(slot, (uint64_t)placement.layout.vertex_count * mesh_attribute_strides[slot], placement.attribute_offsets[slot]);
         }
-        else
+    }
+}
+
+struct UnpackMeshJobData
+{
+    const cgltf_data* gltf_data;
+    Mesh* meshes;
+    const MeshPlacement* placements;
+    uint8_t* staging; // Mapped, placements hold the offsets
+    uint32_t first_mesh;
+};
+
+static void unpack_mesh_job(void* data, uint32_t index)
+{
+    CPU_ZONE("Unpack mesh");
+    UnpackMeshJobData& job = *(UnpackMeshJobData*)data;
+    const uint32_t mesh_index = job.first_mesh + index;
+    const MeshPlacement& placement = job.placements[mesh_index];
+
+    MeshDestination dst{};
+    for_each_mesh_range(placement, [&](int slot, uint64_t staging_offset, uint64_t size, uint64_t arena_offset)
+        {
+            if (slot < 0) dst.indices = (uint32_t*)(job.staging + staging_offset);
+            else dst.attributes[slot] = job.staging + staging_offset;
+        });
+
+    unpack_mesh(job.gltf_data, job.gltf_data->meshes[mesh_index], dst, job.meshes[mesh_index].primitives.data());
+}
+
+size_t load_meshes(Context& ctx, const cgltf_data* gltf_data, Mesh* out_meshes, size_t count, MeshArena& out_arena)
+{
+    if (out_meshes == nullptr) return gltf_data->meshes_count;
+
+    Timer timer;
+    timer.tick();
+
+    // Lay out the arena: all indices first, then one range per attribute
+    std::vector<MeshPlacement> placements(count);
+    uint64_t range_sizes[MESH_ATTRIBUTE_COUNT + 1] = {};
+    uint32_t separate_buffer_count = 0; // What one buffer per mesh attribute used to cost
+    for (size_t i = 0; i < count; ++i)
+    {
+        MeshPlacement& placement = placements[i];
+        placement.layout = get_mesh_layout(gltf_data->meshes[i]);
+        assert(placement.layout.index_count > 0 && placement.layout.has_attribute[MESH_ATTRIBUTE_POSITION]);
+
+        placement.index_offset = range_sizes[0];
+        range_sizes[0] += (uint64_t)placement.layout.index_count * sizeof(uint32_t);
+        separate_buffer_count++;
+        for (int slot = 0; slot < MESH_ATTRIBUTE_COUNT; ++slot)
         {
-            LOG_WARNING("Mesh has no normals!");
+            if (!placement.layout.has_attribute[slot]) continue;
+            placement.attribute_offsets[slot] = range_sizes[slot + 1];
+            range_sizes[slot + 1] += (uint64_t)placement.layout.vertex_count * mesh_attribute_strides[slot];
+            separate_buffer_count++;
         }
-        if (!tangent.empty())
-        { // Tangent
-            BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(tangent);
-            desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-            desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = tangent.data();
-            mesh.tangent = ctx.create_buffer(desc);
+
+        for_each_mesh_range(placement, [&](int, uint64_t staging_offset, uint64_t size, uint64_t)
+            {
+                placement.staging_size = staging_offset + size;
+            });
+
+        if (!placement.layout.has_attribute[MESH_ATTRIBUTE_NORMAL]) LOG_WARNING("Mesh has no normals!");
+        if (!placement.layout.has_attribute[MESH_ATTRIBUTE_TANGENT]) LOG_WARNING("Mesh has no tangents!");
+    }
+
+    uint64_t range_offsets[MESH_ATTRIBUTE_COUNT + 1] = {};
+    uint64_t arena_size = 0;
+    for (int r = 0; r < MESH_ATTRIBUTE_COUNT + 1; ++r)
+    {
+        range_offsets[r] = align_power_of_2(arena_size, MESH_ARENA_ALIGNMENT);
+        arena_size = range_offsets[r] + range_sizes[r];
+    }
+
+    {
+        BufferDesc desc{};
+        desc.size = std::max(arena_size, (uint64_t)MESH_ARENA_ALIGNMENT);
+        desc.usage_flags = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        out_arena.buffer = ctx.create_buffer(desc);
+        out_arena.address = ctx.buffer_device_address(out_arena.buffer);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        MeshPlacement& placement = placements[i];
+        placement.index_offset += range_offsets[0];
+        for (int slot = 0; slot < MESH_ATTRIBUTE_COUNT; ++slot) placement.attribute_offsets[slot] += range_offsets[slot + 1];
+
+        Mesh& mesh = out_meshes[i];
+        mesh.primitives.resize(gltf_data->meshes[i].primitives_count);
+        VkDeviceAddress* addresses[MESH_ATTRIBUTE_COUNT] = { &mesh.position, &mesh.normal, &mesh.tangent, &mesh.texcoord0, &mesh.texcoord1 };
+        for (int slot = 0; slot < MESH_ATTRIBUTE_COUNT; ++slot)
+        {
+            *addresses[slot] = placement.layout.has_attribute[slot] ? out_arena.address + placement.attribute_offsets[slot] : 0;
         }
-        else
+    }
+
+    // Each batch fills one half of the ring in parallel and is copied while the next one fills the other half.
+    // A mesh larger than half the ring gets a staging buffer of its own
+    const uint64_t half_size = MESH_STAGING_RING_SIZE / 2;
+    struct StagingHalf
+    {
+        Buffer buffer;
+        uint8_t* mapped = nullptr;
+        VkCommandBuffer cmd = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+        bool dedicated = false;
+    };
+    StagingHalf halves[2];
+
+    Buffer ring;
+    {
+        BufferDesc desc{};
+        desc.size = MESH_STAGING_RING_SIZE;
+        desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        ring = ctx.create_buffer(desc);
+    }
+    uint8_t* ring_mapped = nullptr;
+    VK_CHECK(vmaMapMemory(ctx.allocator, ring.allocation, (void**)&ring_mapped));
+
+    for (auto& h : halves)
+    {
+        VkFenceCreateInfo fence_info{ VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+        VK_CHECK(vkCreateFence(ctx.device, &fence_info, nullptr, &h.fence));
+    }
+
+    auto wait_for_half = [&ctx](StagingHalf& h)
+    {
+        if (h.cmd == VK_NULL_HANDLE) return;
+        VK_CHECK(vkWaitForFences(ctx.device, 1, &h.fence, VK_TRUE, UINT64_MAX));
+        VK_CHECK(vkResetFences(ctx.device, 1, &h.fence));
+        vkFreeCommandBuffers(ctx.device, ctx.transfer_command_pool, 1, &h.cmd);
+        h.cmd = VK_NULL_HANDLE;
+        if (h.dedicated)
         {
-            LOG_WARNING("Mesh has no tangents!");
+            vmaUnmapMemory(ctx.allocator, h.buffer.allocation);
+            ctx.destroy_buffer(h.buffer);
+            h.dedicated = false;
         }
-        if (!texcoord0.empty())
-        { // Texcoord0
-            BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(texcoord0);
-            desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
-            desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = texcoord0.data();
-            mesh.texcoord0 = ctx.create_buffer(desc);
+    };
+
+    uint32_t batch_count = 0;
+    uint64_t largest_batch = 0;
+    for (size_t first = 0; first < count; ++batch_count)
+    {
+        StagingHalf& half = halves[batch_count % 2];
+        wait_for_half(half);
+
+        size_t end = first;
+        uint64_t batch_size = 0;
+        while (end < count)
+        {
+            const uint64_t offset = align_power_of_2(batch_size, MESH_ARENA_ALIGNMENT);
+            if (offset + placements[end].staging_size > half_size && end > first) break;
+            placements[end].staging_offset = offset;
+            batch_size = offset + placements[end].staging_size;
+            ++end;
         }
-        if (!texcoord1.empty())
-        { // Texcoord1
+        largest_batch = std::max(largest_batch, batch_size);
+
+        if (batch_size > half_size)
+        {
             BufferDesc desc{};
-            desc.size = VECTOR_SIZE_BYTES(texcoord1);
-            desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+            desc.size = batch_size;
+            desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
             desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-            desc.data = texcoord1.data();
-            mesh.texcoord1 = ctx.create_buffer(desc);
+            half.buffer = ctx.create_buffer(desc);
+            VK_CHECK(vmaMapMemory(ctx.allocator, half.buffer.allocation, (void**)&half.mapped));
+            half.dedicated = true;
         }
+        else
+        {
+            half.buffer = ring;
+            half.mapped = ring_mapped + (batch_count % 2) * half_size;
+            for (size_t i = first; i < end; ++i) placements[i].staging_offset += (batch_count % 2) * half_size;
+        }
+
+        UnpackMeshJobData job_data{ gltf_data, out_meshes, placements.data(), half.dedicated ? half.mapped : ring_mapped, (uint32_t)first };
+        JobCounter counter;
+        JobSystem::dispatch(unpack_mesh_job, &job_data, (uint32_t)(end - first), &counter);
+        JobSystem::wait(&counter);
+
+        const uint64_t flush_offset = half.dedicated ? 0 : (batch_count % 2) * half_size;
+        vmaFlushAllocation(ctx.allocator, half.buffer.allocation, flush_offset, batch_size);
+
+        std::vector<VkBufferCopy> regions;
+        for (size_t i = first; i < end; ++i)
+        {
+            for_each_mesh_range(placements[i], [&](int, uint64_t staging_offset, uint64_t size, uint64_t arena_offset)
+                {
+                    if (size > 0) regions.push_back({ staging_offset, arena_offset, size });
+                });
+        }
+
+        VkCommandBufferAllocateInfo alloc_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+        alloc_info.commandPool = ctx.transfer_command_pool;
+        alloc_info.commandBufferCount = 1;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        VK_CHECK(vkAllocateCommandBuffers(ctx.device, &alloc_info, &half.cmd));
+        VkHelpers::begin_command_buffer(half.cmd, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        vkCmdCopyBuffer(half.cmd, half.buffer.buffer, out_arena.buffer.buffer, (uint32_t)regions.size(), regions.data());
+        VK_CHECK(vkEndCommandBuffer(half.cmd));
+
+        VkSubmitInfo info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+        info.commandBufferCount = 1;
+        info.pCommandBuffers = &half.cmd;
+        VK_CHECK(vkQueueSubmit(ctx.graphics_queue, 1, &info, half.fence));
+
+        first = end;
     }
 
+    for (auto& h : halves)
+    {
+        wait_for_half(h);
+        vkDestroyFence(ctx.device, h.fence, nullptr);
+    }
+    vmaUnmapMemory(ctx.allocator, ring.allocation);
+    ctx.destroy_buffer(ring);
+
+    // Primitives were unpacked relative to their mesh
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint32_t first_index = (uint32_t)(placements[i].index_offset / sizeof(uint32_t));
+        for (auto& primitive : out_meshes[i].primitives) primitive.first_index += first_index;
+    }
+
+    timer.tock();
+    LOG_INFO("Loaded %zu meshes in %.2f ms: %.1f MB in 1 arena buffer instead of %u buffers, %u staging batches on %u threads",
+        count, timer.get_elapsed_milliseconds(), arena_size / (1024.0 * 1024.0), separate_buffer_count, batch_count, JobSystem::get_worker_count() + 1);
+
     return count;
 }
 
+static std::string get_image_path(const char* gltf_path, const char* uri)
+{
+    std::string path = gltf_path;
+    size_t last_slash = path.find_last_of('/');
+    return path.substr(0, last_slash + 1) + uri;
+}
+
+#if USE_COMPRESSED_TEXTURES
+struct CompressTextureJobData
+{
+    const cgltf_data* gltf_data;
+    const char* gltf_path;
+    CompressedTexture* compressed;
+    std::atomic<bool> failed = false;
+};
+
+// Cache misses encode BC7 on the CPU, which is slow enough to be worth spreading across workers
+static void compress_texture_job(void* data, uint32_t index)
+{
+    CPU_ZONE("Compress texture");
+    CompressTextureJobData& job = *(CompressTextureJobData*)data;
+    const cgltf_image* image = job.gltf_data->textures[index].image;
+
+    bool loaded;
+    if (image->buffer_view)
+    {
+        loaded = TextureCache::load_memory(cgltf_buffer_view_data(image->buffer_view), image->buffer_view->size, job.compressed[index]);
+    }
+    else
+    {
+        loaded = TextureCache::load_file(get_image_path(job.gltf_path, image->uri).c_str(), job.compressed[index]);
+    }
+    if (!loaded) job.failed = true;
+}
+#endif
+
 size_t load_textures(Context& ctx, const cgltf_data* gltf_data, const char* gltf_path, Texture* out_textures, size_t count)
 {
     if (out_textures == nullptr) return gltf_data->textures_count;
 
+    Timer timer;
+    timer.tick();
+
+#if USE_COMPRESSED_TEXTURES
+    const TextureCacheStats stats_before = TextureCache::get_stats();
+
+    std::vector<CompressedTexture> compressed(count);
+    CompressTextureJobData job_data;
+    job_data.gltf_data = gltf_data;
+    job_data.gltf_path = gltf_path;
+    job_data.compressed = compressed.data();
+
+    JobCounter counter;
+    JobSystem::dispatch(compress_texture_job, &job_data, (uint32_t)count, &counter);
+    JobSystem::wait(&counter);
+
+    assert(!job_data.failed);
+    const bool created = !job_data.failed && ctx.create_compressed_textures(out_textures, compressed.data(), (uint32_t)count);
+    for (auto& c : compressed) TextureCache::release(c);
+    if (!created)
+    {
+        return 0;
+    }
+
+    timer.tock();
+    const TextureCacheStats stats = TextureCache::get_stats();
+    LOG_INFO("Loaded %zu textures in %.2f ms (%u from cache), %.1f MB block compressed instead of %.1f MB RGBA8", count,
+        timer.get_elapsed_milliseconds(), stats.hits - stats_before.hits,
+        (stats.compressed_bytes - stats_before.compressed_bytes) / (1024.0 * 1024.0),
+        (stats.uncompressed_bytes - stats_before.uncompressed_bytes) / (1024.0 * 1024.0));
+#else
     for (size_t i = 0; i < count; ++i)
     {
         const cgltf_texture& tex = gltf_data->textures[i];
@@ -192,10 +537,7 @@ size_t load_textures(Context& ctx, const cgltf_data* gltf_data, const char* gltf
         }
         else
         {
-            std::string path = gltf_path;
-            std::string uri = tex.image->uri;
-            size_t last_slash = path.find_last_of('/');
-            path = path.substr(0, last_slash + 1) + uri;
+            std::string path = get_image_path(gltf_path, tex.image->uri);
             int comp;
             t.source = stbi_load(path.c_str(), &t.width, &t.height, &comp, 4);
             assert(t.source);
@@ -207,6 +549,10 @@ size_t load_textures(Context& ctx, const cgltf_data* gltf_data, const char* gltf
         return 0;
     }
 
+    timer.tock();
+    LOG_INFO("Loaded %zu textures in %.2f ms", count, timer.get_elapsed_milliseconds());
+#endif
+
     std::vector<VkDescriptorImageInfo> image_info(count);
 
     for (size_t i = 0; i < count; ++i)
@@ -8,6 +8,7 @@
 #include "vk_helpers.h"
 #include "sdf.h"
 #include "colors.h"
+#include "gpu_profiler.h"
 
 constexpr VkFormat PARTICLE_RENDER_TARGET_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
 constexpr VkFormat LIGHT_RENDER_TARGET_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
@@ -19,20 +20,18 @@ static_assert(sizeof(GPUParticlePushConstants) <= 128);
 
 static ComputePipelineAsset* create_pipeline(Context* ctx, const char* shader_src, const char* entry_point)
 {
-	ComputePipelineBuilder builder(ctx->device, true);
+	ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 	builder.set_shader_filepath(shader_src, entry_point);
-	ComputePipelineAsset* pipeline = new ComputePipelineAsset(builder);
-	AssetCatalog::register_asset(pipeline);
+	ComputePipelineAsset* pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 
 	return pipeline;
 }
 
 static ComputePipelineAsset* create_pipeline(Context* ctx, const ShaderSource& shader_source)
 {
-	ComputePipelineBuilder builder(ctx->device, true);
+	ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 	builder.set_shader_source(shader_source);
-	ComputePipelineAsset* pipeline = new ComputePipelineAsset(builder);
-	AssetCatalog::register_asset(pipeline);
+	ComputePipelineAsset* pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 
 	return pipeline;
 }
@@ -111,7 +110,7 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 	}
 
 	{ // Render pipeline
-		GraphicsPipelineBuilder builder(ctx->device, true);
+		GraphicsPipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder
 			.set_vertex_shader_filepath("gpu_particles.hlsl")
 			.set_fragment_shader_filepath("gpu_particles.hlsl", "particle_fs_shadowed")
@@ -136,8 +135,7 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 			})
 			.set_topology(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
 
-		render_pipeline_back_to_front = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(render_pipeline_back_to_front);
+		render_pipeline_back_to_front = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 
 		// "Under" operator
 		builder.set_blend_state({
@@ -151,12 +149,11 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 			VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
 		});
 
-		render_pipeline_front_to_back = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(render_pipeline_front_to_back);
+		render_pipeline_front_to_back = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 	}
 	 
 	{ // Light render pipeline
-		GraphicsPipelineBuilder builder(ctx->device, true);
+		GraphicsPipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder
 			.set_vertex_shader_filepath("gpu_particles.hlsl", "vs_light")
 			.set_fragment_shader_filepath("gpu_particles.hlsl", "particle_fs_light")
@@ -178,8 +175,7 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 				})
 			.set_topology(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
 
-		render_pipeline_light = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(render_pipeline_light);
+		render_pipeline_light = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 	}
 
 	ctx->create_texture(particle_render_target, ctx->window_width, ctx->window_height, 1, PARTICLE_RENDER_TARGET_FORMAT, VK_IMAGE_TYPE_2D, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
@@ -187,52 +183,45 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
 
 	{ // Emit pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath(emit_shader.shader_source_file.c_str(), emit_shader.entry_point.c_str());
-		particle_emit_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_emit_pipeline);
+		particle_emit_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Indirect dispatch size write pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath("gpu_particles.hlsl", "cs_write_dispatch");
-		particle_dispatch_size_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_dispatch_size_pipeline);
+		particle_dispatch_size_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	} 
 
 	{ // Indirect dispatch size write pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath("gpu_particles.hlsl", "cs_write_draw");
-		particle_draw_count_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_draw_count_pipeline);
+		particle_draw_count_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Simulate pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath(update_shader.shader_source_file.c_str(), update_shader.entry_point.c_str());
-		particle_simulate_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_simulate_pipeline);
+		particle_simulate_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Compact pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath("gpu_particles.hlsl", "cs_compact_particles");
-		particle_compact_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_compact_pipeline);
+		particle_compact_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Debug sort pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath("gpu_particles.hlsl", "cs_debug_print_sorted_particles");
-		particle_debug_sort_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_debug_sort_pipeline);
+		particle_debug_sort_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Composite pipeline
-		ComputePipelineBuilder builder(ctx->device, true);
+		ComputePipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder.set_shader_filepath("gpu_particle_composite.hlsl", "cs_composite_image");
-		particle_composite_pipeline = new ComputePipelineAsset(builder);
-		AssetCatalog::register_asset(particle_composite_pipeline);
+		particle_composite_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 	}
 
 	{ // Particle system globals buffer
@@ -258,7 +247,7 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 		{
 			BufferDesc desc{};
 			desc.size = sizeof(GPUParticleSystemState);
-			desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+			desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
 			particle_system_state[i] = ctx->create_buffer(desc);
 		}
 	}
@@ -277,13 +266,6 @@ void GPUParticleSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 		indirect_draw_buffer = ctx->create_buffer(desc);
 	}
 
-	{ // Query pool used for perf measurement
-		VkQueryPoolCreateInfo info{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
-		info.queryCount = 256;
-		info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-		VK_CHECK(vkCreateQueryPool(ctx->device, &info, nullptr, &query_pool));
-	}
-
 	{ // Radix sort context
 		radix_sort_vk_memory_requirements memory_requirements{};
 		radix_sort_vk_get_memory_requirements(ctx->radix_sort_instance, particle_capacity, &memory_requirements);
@@ -463,10 +445,6 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 		memcpy(mapped, &globals, sizeof(globals));
 		ctx->unmap_buffer(system_globals);
 		ctx->upload_buffer(system_globals, cmd);
-
-		VkHelpers::memory_barrier(cmd,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
 	}
 
 	if (!particles_initialized)
@@ -477,16 +455,6 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 			vkCmdFillBuffer(cmd, particle_system_state[i].buffer, 0, VK_WHOLE_SIZE, 0);
 		}
 
-		VkMemoryBarrier memory_barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-		memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
-		vkCmdPipelineBarrier(cmd,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			0,
-			1, &memory_barrier,
-			0, nullptr,
-			0, nullptr);
-
 		particles_initialized = true;
 	}
 
@@ -531,6 +499,7 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 		//vkCmdFillBuffer(cmd, particle_aabbs.buffer, 0, VK_WHOLE_SIZE, 0);
 		//vkCmdFillBuffer(cmd, instances_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
 
+		// Also covers the globals upload and the first frame's zero init
 		VkMemoryBarrier memory_barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
 		memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 		memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
@@ -622,16 +591,6 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 		pc.num_slices = num_slices;
 		vkCmdPushConstants(cmd, particle_draw_count_pipeline->pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
 		vkCmdDispatch(cmd, (num_slices + 63) / 64, 1, 1);
-
-		VkMemoryBarrier memory_barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-		memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		memory_barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-		vkCmdPipelineBarrier(cmd,
-			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-			0,
-			1, &memory_barrier,
-			0, nullptr,
-			0, nullptr);
 	}
 
 	{ // Sort particles
@@ -651,16 +610,6 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 			if (keyvals_sorted.buffer != sort_keyval_buffer[0].buffer)
 				std::swap(sort_keyval_buffer[0], sort_keyval_buffer[1]);
 		}
-
-		VkMemoryBarrier memory_barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-		memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(cmd,
-			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-			0,
-			1, &memory_barrier,
-			0, nullptr,
-			0, nullptr);
 	}
 
 #if 0
@@ -686,38 +635,8 @@ void GPUParticleSystem::simulate(VkCommandBuffer cmd, float dt, CameraState& cam
 
 void GPUParticleSystem::render(VkCommandBuffer cmd, const Texture& depth_target)
 {
-	{ // Transition render targets
-		VkImageMemoryBarrier2 barriers[2] = {
-			VkHelpers::image_memory_barrier2
-			(
-				VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-				0,
-				VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
-				VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_GENERAL,
-				particle_render_target.image,
-				VK_IMAGE_ASPECT_COLOR_BIT
-			),
-			VkHelpers::image_memory_barrier2
-			(
-				VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-				0,
-				VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT,
-				VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
-				VK_IMAGE_LAYOUT_UNDEFINED,
-				VK_IMAGE_LAYOUT_GENERAL,
-				light_render_target.image,
-				VK_IMAGE_ASPECT_COLOR_BIT
-			),
-		};
-
-		VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-		dep_info.imageMemoryBarrierCount = 2;
-		dep_info.pImageMemoryBarriers = barriers;
-		vkCmdPipelineBarrier2(cmd, &dep_info);
-	}
-
+	// The render graph leaves particle_render_target in ATTACHMENT_OPTIMAL, light_render_target in GENERAL since it is
+	// cleared, rendered to and sampled here, and the depth targets in READ_ONLY_OPTIMAL
 	auto render_slice_light = [&](uint32_t slice)
 		{
 			char marker_name[64];
@@ -733,7 +652,7 @@ void GPUParticleSystem::render(VkCommandBuffer cmd, const Texture& depth_target)
 
 			VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
 			depth_info.imageView = light_depth_view;
-			depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+			depth_info.imageLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
 			depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 			depth_info.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
 
@@ -793,14 +712,14 @@ void GPUParticleSystem::render(VkCommandBuffer cmd, const Texture& depth_target)
 
 			VkRenderingAttachmentInfo color_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
 			color_info.imageView = particle_render_target.view;
-			color_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+			color_info.imageLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
 			color_info.loadOp = slice == 0 ? VK_ATTACHMENT_LOAD_OP_CLEAR : VK_ATTACHMENT_LOAD_OP_LOAD;
 			color_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 			color_info.clearValue.color = { 0.0f, 0.0f, 0.0f, 0.0f };
 
 			VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
 			depth_info.imageView = depth_target.view;
-			depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+			depth_info.imageLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
 			depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
 			depth_info.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
 
@@ -866,14 +785,25 @@ void GPUParticleSystem::render(VkCommandBuffer cmd, const Texture& depth_target)
 		range.baseArrayLayer = 0;
 		range.layerCount = 1;
 		vkCmdClearColorImage(cmd, light_render_target.image, VK_IMAGE_LAYOUT_GENERAL, &clear, 1, &range);
+
+		VkHelpers::memory_barrier(cmd,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
 	}
 
 	for (uint32_t i = 0; i < slices_to_display; ++i)
 	{
+		// The view slice samples the light buffer in its vertex shader
 		render_slice_light(i);
-		VkHelpers::fragment_barrier_simple(cmd);
+		VkHelpers::memory_barrier(cmd,
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+
+		// The next light slice overwrites what this one sampled, the next view slice blends onto this one
 		render_slice_view(i, draw_order_flipped);
-		VkHelpers::fragment_barrier_simple(cmd);
+		VkHelpers::memory_barrier(cmd,
+			VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT);
 	}
 }
 
@@ -891,16 +821,6 @@ void GPUParticleSystem::composite(VkCommandBuffer cmd, const Texture& render_tar
 			particle_composite_pipeline->pipeline.layout, 0, descriptor_info);
 
 		vkCmdDispatch(cmd, (ctx->window_width + 7) / 8, (ctx->window_height + 7) / 8, 1);
-
-		VkMemoryBarrier memory_barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
-		memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-		memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(cmd,
-			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			0,
-			1, &memory_barrier,
-			0, nullptr,
-			0, nullptr);
 	}
 
 	VkHelpers::end_label(cmd);
@@ -916,18 +836,17 @@ void GPUParticleSystem::destroy()
 	particle_render_target.destroy(ctx->device, ctx->allocator);
 	light_render_target.destroy(ctx->device, ctx->allocator);
 	vkDestroySampler(ctx->device, light_sampler, nullptr);
-	render_pipeline_back_to_front->builder.destroy_resources(render_pipeline_back_to_front->pipeline);
-	render_pipeline_front_to_back->builder.destroy_resources(render_pipeline_front_to_back->pipeline);
-	render_pipeline_light->builder.destroy_resources(render_pipeline_light->pipeline);
-	particle_emit_pipeline->builder.destroy_resources(particle_emit_pipeline->pipeline);
-	particle_dispatch_size_pipeline->builder.destroy_resources(particle_dispatch_size_pipeline->pipeline);
-	particle_draw_count_pipeline->builder.destroy_resources(particle_draw_count_pipeline->pipeline);
-	particle_simulate_pipeline->builder.destroy_resources(particle_simulate_pipeline->pipeline);
-	particle_compact_pipeline->builder.destroy_resources(particle_compact_pipeline->pipeline);
-	particle_debug_sort_pipeline->builder.destroy_resources(particle_debug_sort_pipeline->pipeline);
-	particle_composite_pipeline->builder.destroy_resources(particle_composite_pipeline->pipeline);
+	AssetCatalog::release_asset(render_pipeline_back_to_front);
+	AssetCatalog::release_asset(render_pipeline_front_to_back);
+	AssetCatalog::release_asset(render_pipeline_light);
+	AssetCatalog::release_asset(particle_emit_pipeline);
+	AssetCatalog::release_asset(particle_dispatch_size_pipeline);
+	AssetCatalog::release_asset(particle_draw_count_pipeline);
+	AssetCatalog::release_asset(particle_simulate_pipeline);
+	AssetCatalog::release_asset(particle_compact_pipeline);
+	AssetCatalog::release_asset(particle_debug_sort_pipeline);
+	AssetCatalog::release_asset(particle_composite_pipeline);
 	ctx->destroy_buffer(system_globals);
-	vkDestroyQueryPool(ctx->device, query_pool, nullptr);
 	ctx->destroy_buffer(indirect_dispatch_buffer);
 	ctx->destroy_buffer(indirect_draw_buffer);
 	ctx->destroy_buffer(sort_indirect_buffer);
@@ -947,7 +866,7 @@ void GPUParticleSystem::destroy()
 void GPUParticleSystem::draw_stats_overlay()
 {
 	ImGui::Begin("GPU Particle System");
-	ImGui::Text("Simulation time: %f us", performance_timings.simulate_total * 1e-3f);
+	ImGui::Text("Simulation time: %f us", GPUProfiler::get_scope_ms("Particle system simulate") * 1e3);
 	ImGui::End();
 }
 
@@ -988,7 +907,7 @@ void TrailBlazerSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 
 	{ // Render pipeline
 		ShaderSource fragment_source("trail_blazer.hlsl", "particle_fs");
-		GraphicsPipelineBuilder builder(ctx->device, true);
+		GraphicsPipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder
 			.set_vertex_shader_filepath("trail_blazer.hlsl")
 			.set_fragment_shader_source(fragment_source)
@@ -1001,8 +920,7 @@ void TrailBlazerSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 			.set_depth_compare_op(VK_COMPARE_OP_LESS)
 			.set_topology(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
 
-		render_pipeline = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(render_pipeline);
+		render_pipeline = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 	}
 
 	// Pipelines
@@ -1035,7 +953,7 @@ void TrailBlazerSystem::init(Context* ctx, VkBuffer globals_buffer, VkFormat ren
 		{
 			BufferDesc desc{};
 			desc.size = sizeof(GPUParticleSystemState);
-			desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | 
+			desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
 				VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
 			particle_system_state[i] = ctx->create_buffer(desc);
 			child_particle_system_state[i] = ctx->create_buffer(desc);
@@ -1099,10 +1017,6 @@ void TrailBlazerSystem::simulate(VkCommandBuffer cmd, float dt)
 			vkCmdFillBuffer(cmd, child_particle_system_state[i].buffer, 0, VK_WHOLE_SIZE, 0);
 		}
 
-		VkHelpers::memory_barrier(cmd,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
-
 		particles_initialized = true;
 	}
 
@@ -1176,6 +1090,7 @@ void TrailBlazerSystem::simulate(VkCommandBuffer cmd, float dt)
 				vkCmdCopyBuffer(cmd, indirect_dispatch_buffer.buffer, child_emit_indirect_dispatch_buffer, 1, &copy);
 			}
 
+			// Also covers the first frame's zero init
 			VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
 				VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
 				VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
@@ -1190,8 +1105,9 @@ void TrailBlazerSystem::simulate(VkCommandBuffer cmd, float dt)
 
 			VkHelpers::begin_label(cmd, "Emit child", Colors::CYAN);
 			dispatch_indirect(cmd, child_emit_pipeline, &child_push_constants, sizeof(child_push_constants), child_descriptor_info, child_emit_indirect_dispatch_buffer, 0);
-			VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-				VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+			// Simulation reads the emitted particles, not only the dispatch size
+			VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 			VkHelpers::end_label(cmd);
 		}
 
@@ -1202,7 +1118,6 @@ void TrailBlazerSystem::simulate(VkCommandBuffer cmd, float dt)
 
 			VkHelpers::begin_label(cmd, "Simulate child", Colors::LIME);
 			dispatch_indirect(cmd, child_simulate_pipeline, &child_push_constants, sizeof(child_push_constants), child_descriptor_info, child_indirect_dispatch_buffer.buffer, 0);
-			compute_barrier_simple(cmd);
 			VkHelpers::end_label(cmd);
 		}
 	}	
@@ -1268,14 +1183,14 @@ void TrailBlazerSystem::render(VkCommandBuffer cmd)
 
 void TrailBlazerSystem::destroy()
 {
-	render_pipeline->builder.destroy_resources(render_pipeline->pipeline);
-	particle_emit_pipeline->builder.destroy_resources(particle_emit_pipeline->pipeline);
-	particle_simulate_pipeline->builder.destroy_resources(particle_simulate_pipeline->pipeline);
+	AssetCatalog::release_asset(render_pipeline);
+	AssetCatalog::release_asset(particle_emit_pipeline);
+	AssetCatalog::release_asset(particle_simulate_pipeline);
 
-	child_emit_pipeline->builder.destroy_resources(child_emit_pipeline->pipeline);
-	child_dispatch_size_pipeline->builder.destroy_resources(child_dispatch_size_pipeline->pipeline);
-	child_draw_count_pipeline->builder.destroy_resources(child_draw_count_pipeline->pipeline);
-	child_simulate_pipeline->builder.destroy_resources(child_simulate_pipeline->pipeline);
+	AssetCatalog::release_asset(child_emit_pipeline);
+	AssetCatalog::release_asset(child_dispatch_size_pipeline);
+	AssetCatalog::release_asset(child_draw_count_pipeline);
+	AssetCatalog::release_asset(child_simulate_pipeline);
 
 	//vkDestroySampler(ctx->device, sdf_sampler, nullptr);
 	ctx->destroy_buffer(indirect_dispatch_buffer);
@@ -1327,7 +1242,7 @@ void ParticleSystemSimple::init(Context* ctx, VkBuffer globals_buffer, VkFormat
 		ShaderSource vertex_source("particle_render.hlsl", "vs_main");
 		ShaderSource fragment_source("particle_render.hlsl", "fs_main");
 		fragment_source.add_include(cfg.emit_and_simulate_file, true);
-		GraphicsPipelineBuilder builder(ctx->device, true);
+		GraphicsPipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 		builder
 			.set_vertex_shader_source(vertex_source)
 			.set_fragment_shader_source(fragment_source)
@@ -1352,8 +1267,7 @@ void ParticleSystemSimple::init(Context* ctx, VkBuffer globals_buffer, VkFormat
 			.set_depth_compare_op(VK_COMPARE_OP_LESS)
 			.set_topology(VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
 
-		render_pipeline = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(render_pipeline);
+		render_pipeline = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 	}
 
 	// Pipelines
@@ -1399,10 +1313,6 @@ void ParticleSystemSimple::pre_update(VkCommandBuffer cmd, float dt, const GPUBu
 
 		vkCmdFillBuffer(cmd, emit_indirect_dispatch_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
 
-		VkHelpers::memory_barrier(cmd,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-			VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
-
 		particles_initialized = true;
 	}
 
@@ -1497,9 +1407,9 @@ void ParticleSystemSimple::render(VkCommandBuffer cmd, VkBuffer indirect_draw_bu
 
 void ParticleSystemSimple::destroy()
 {
-	render_pipeline->builder.destroy_resources(render_pipeline->pipeline);
-	particle_emit_pipeline->builder.destroy_resources(particle_emit_pipeline->pipeline);
-	particle_simulate_pipeline->builder.destroy_resources(particle_simulate_pipeline->pipeline);
+	AssetCatalog::release_asset(render_pipeline);
+	AssetCatalog::release_asset(particle_emit_pipeline);
+	AssetCatalog::release_asset(particle_simulate_pipeline);
 
 	ctx->destroy_buffer(emit_indirect_dispatch_buffer);
 	for (int i = 0; i < 2; ++i)
@@ -1533,7 +1443,7 @@ void ParticleManagerSimple::init(Context* ctx, VkBuffer globals_buffer, VkFormat
 	{
 		BufferDesc desc{};
 		desc.size = sizeof(GPUParticleSystemState) * MAX_SYSTEMS;
-		desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+		desc.usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
 		for (int i = 0; i < 2; ++i)
 			system_states_buffer[i] = ctx->create_gpu_buffer(desc);
 
@@ -1569,13 +1479,10 @@ void ParticleManagerSimple::update_systems(VkCommandBuffer cmd, float dt)
 	vkCmdFillBuffer(cmd, indirect_dispatch_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
 	vkCmdFillBuffer(cmd, indirect_draw_buffer.buffer, 0, VK_WHOLE_SIZE, 0);
 
-	VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
-		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
-
 	VkHelpers::begin_label(cmd, "Particle Manager pre update", Colors::APRICOT);
 	for (size_t i = 0; i < systems.size(); ++i) systems[i]->pre_update(cmd, dt, system_states_buffer[0], system_states_buffer[1], (uint32_t)i);
 
+	// pre_update only records transfers, one barrier covers them and the clears above
 	VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
 		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
 		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
@@ -1628,9 +1535,6 @@ void ParticleManagerSimple::update_systems(VkCommandBuffer cmd, float dt)
 			write_indirect_draw->pipeline.layout, 0, descriptor_info);
 		vkCmdPushConstants(cmd, write_indirect_draw->pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &system_count);
 		vkCmdDispatch(cmd, get_dispatch_size(system_count), 1, 1);
-
-		VkHelpers::memory_barrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
-			VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
 		VkHelpers::end_label(cmd);
 	}
 
@@ -1653,6 +1557,6 @@ void ParticleManagerSimple::destroy()
 	for (int i = 0; i < 2; ++i)
 		ctx->destroy_buffer(system_states_buffer[i]);
 	ctx->destroy_buffer(indirect_draw_buffer);
-	write_indirect_dispatch->builder.destroy_resources(write_indirect_dispatch->pipeline);
-	write_indirect_draw->builder.destroy_resources(write_indirect_draw->pipeline);
+	AssetCatalog::release_asset(write_indirect_dispatch);
+	AssetCatalog::release_asset(write_indirect_draw);
 }
@@ -32,6 +32,8 @@ struct GPUParticleSystem : IConfigUI
     void init(struct Context* ctx, VkBuffer globals_buffer, VkFormat render_target_format, uint32_t particle_capacity,
         const Texture& shadowmap_texture, uint32_t cascade_index, const ShaderInfo& emit_shader, const ShaderInfo& update_shader,
         bool emit_once = false);
+    // Each of these only synchronizes its own dispatches and draws, dependencies on the
+    // other passes of the frame come from the render graph in main.cpp
     void simulate(VkCommandBuffer cmd, float dt, struct CameraState& camera_state, glm::mat4 shadow_view, glm::mat4 shadow_projection);
     void render(VkCommandBuffer cmd, const Texture& depth_target);
     void composite(VkCommandBuffer cmd, const Texture& render_target);
@@ -61,8 +63,6 @@ struct GPUParticleSystem : IConfigUI
     Buffer sort_internal_buffer = {};
     Buffer sort_indirect_buffer = {};
 
-    VkQueryPool query_pool = VK_NULL_HANDLE;
-
     struct GraphicsPipelineAsset* render_pipeline_back_to_front = nullptr;
     struct GraphicsPipelineAsset* render_pipeline_front_to_back = nullptr;
     struct GraphicsPipelineAsset* render_pipeline_light = nullptr;
@@ -110,12 +110,6 @@ struct GPUParticleSystem : IConfigUI
     Buffer instances_buffer = {};
 
     VkImageView light_depth_view = VK_NULL_HANDLE;
-
-    struct
-    {
-        double simulate_total = 0.0;
-        double render_total = 0.0;
-    } performance_timings;
 };
 
 struct TrailBlazerSystem : IConfigUI
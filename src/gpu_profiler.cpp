@@ -0,0 +1,518 @@
+#include "gpu_profiler.h"
+#include "graphics_context.h"
+#include "misc.h"
+#include "imgui/imgui.h"
+#include <chrono>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+// Queries 0 and 1 bracket the whole frame, scope i uses 2 + 2 * i and 3 + 2 * i
+#define GPU_PROFILER_QUERY_COUNT (2 + 2 * GPU_PROFILER_MAX_SCOPES)
+#define GPU_PROFILER_NO_PARENT UINT32_MAX
+
+// Matches the host time domain of VK_EXT_calibrated_timestamps: QueryPerformanceCounter on MSVC, CLOCK_MONOTONIC on libstdc++
+typedef std::chrono::steady_clock Clock;
+
+struct ScopeRecord
+{
+	char name[GPU_PROFILER_NAME_LENGTH];
+	uint32_t parent;
+	uint32_t depth;
+	int64_t cpu_begin_ns;
+	int64_t cpu_end_ns;
+};
+
+// What one frame in flight recorded, resolved once its fence has been waited on
+struct FrameSlot
+{
+	VkQueryPool query_pool = VK_NULL_HANDLE;
+	bool pending = false;
+	uint64_t frame_number = 0;
+	int64_t cpu_begin_ns = 0;
+	int64_t cpu_end_ns = 0;
+	uint32_t scope_count = 0;
+	ScopeRecord scopes[GPU_PROFILER_MAX_SCOPES];
+};
+
+// All times in nanoseconds on the CPU clock
+struct ResolvedScope
+{
+	ScopeRecord record;
+	uint64_t key; // Hash of the names on the path from the top level scope
+	int64_t gpu_begin_ns;
+	int64_t gpu_end_ns;
+};
+
+struct ResolvedFrame
+{
+	uint64_t frame_number = 0;
+	int64_t cpu_begin_ns = 0;
+	int64_t cpu_end_ns = 0;
+	int64_t gpu_begin_ns = 0;
+	int64_t gpu_end_ns = 0;
+	std::vector<ResolvedScope> scopes;
+};
+
+struct ScopeStats
+{
+	char name[GPU_PROFILER_NAME_LENGTH];
+	double average_ms = 0.0;
+	double frame_ms = 0.0; // Summed over the frame being resolved, a path can be opened more than once per frame
+	uint64_t last_frame = UINT64_MAX;
+	float history_ms[GPU_PROFILER_HISTORY] = {};
+};
+
+static Context* ctx = nullptr;
+static bool enabled = false;
+static double timestamp_period = 1.0; // Nanoseconds per tick
+static uint64_t timestamp_mask = UINT64_MAX;
+static bool calibrated = false;
+static VkTimeDomainEXT host_time_domain = VK_TIME_DOMAIN_DEVICE_EXT;
+
+static FrameSlot slots[Context::frames_in_flight];
+static FrameSlot* current = nullptr;
+static VkCommandBuffer current_cmd = VK_NULL_HANDLE;
+static uint64_t frame_number = 0;
+
+static uint32_t scope_stack[GPU_PROFILER_MAX_DEPTH];
+static uint32_t stack_depth = 0;
+static uint32_t dropped_depth = 0; // Open scopes that did not fit, their ends are swallowed
+static bool warned_dropped = false;
+static bool warned_unbalanced = false;
+
+static uint64_t timestamps[GPU_PROFILER_QUERY_COUNT];
+
+static ResolvedFrame history[GPU_PROFILER_HISTORY];
+static uint64_t resolved_count = 0; // The latest frame is history[(resolved_count - 1) % GPU_PROFILER_HISTORY]
+static float frame_history_ms[GPU_PROFILER_HISTORY] = {};
+static double frame_average_ms = 0.0;
+static std::unordered_map<uint64_t, ScopeStats> scope_stats;
+static uint64_t selected_key = 0; // Shown in the graph, 0 for the whole frame
+
+static int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Signed distance in ticks, the counter may have fewer than 64 valid bits and wrap
+static int64_t ticks_between(uint64_t from, uint64_t to)
+{
+	const uint64_t forward = (to - from) & timestamp_mask;
+	if (forward <= (timestamp_mask >> 1)) return (int64_t)forward;
+	return -(int64_t)((from - to) & timestamp_mask);
+}
+
+static double smooth(double average, double sample)
+{
+	return average == 0.0 ? sample : glm::mix(sample, average, 0.95);
+}
+
+static bool sample_calibrated_timestamps(uint64_t& out_device_ticks, int64_t& out_host_ns)
+{
+	VkCalibratedTimestampInfoEXT infos[2] = {
+		{ VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT },
+		{ VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT },
+	};
+	infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+	infos[1].timeDomain = host_time_domain;
+	uint64_t values[2];
+	uint64_t max_deviation;
+	if (vkGetCalibratedTimestampsEXT(ctx->device, 2, infos, values, &max_deviation) != VK_SUCCESS) return false;
+
+	out_device_ticks = values[0];
+#ifdef _WIN32
+	out_host_ns = (int64_t)((double)values[1] * (1e9 / (double)SDL_GetPerformanceFrequency()));
+#else
+	out_host_ns = (int64_t)values[1];
+#endif
+	return true;
+}
+
+static void init_calibration()
+{
+	calibrated = false;
+	if (!ctx->calibrated_timestamps) return;
+
+#ifdef _WIN32
+	host_time_domain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+#else
+	host_time_domain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+#endif
+	uint32_t count = 0;
+	VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(ctx->physical_device, &count, nullptr));
+	std::vector<VkTimeDomainEXT> domains(count);
+	VK_CHECK(vkGetPhysicalDeviceCalibrateableTimeDomainsEXT(ctx->physical_device, &count, domains.data()));
+
+	const bool has_device = std::find(domains.begin(), domains.end(), VK_TIME_DOMAIN_DEVICE_EXT) != domains.end();
+	const bool has_host = std::find(domains.begin(), domains.end(), host_time_domain) != domains.end();
+	calibrated = has_device && has_host;
+	if (!calibrated)
+	{
+		LOG_WARNING("GPU profiler: no calibrateable host time domain, GPU scopes are aligned to the submit time instead");
+	}
+}
+
+static void resolve_slot(FrameSlot& slot)
+{
+	if (!slot.pending) return;
+	slot.pending = false;
+
+	const uint32_t query_count = 2 + 2 * slot.scope_count;
+	VK_CHECK(vkGetQueryPoolResults(ctx->device, slot.query_pool, 0, query_count, query_count * sizeof(uint64_t), timestamps,
+		sizeof(uint64_t), VK_QUERY_RESULT_64_BIT));
+
+	// Without calibration the GPU is assumed to start on the frame as soon as it was submitted
+	uint64_t reference_ticks = timestamps[0];
+	int64_t reference_ns = slot.cpu_end_ns;
+	if (calibrated && !sample_calibrated_timestamps(reference_ticks, reference_ns))
+	{
+		reference_ticks = timestamps[0];
+		reference_ns = slot.cpu_end_ns;
+	}
+	auto to_cpu_ns = [&](uint64_t ticks) {
+		return reference_ns + (int64_t)((double)ticks_between(reference_ticks, ticks) * timestamp_period);
+	};
+
+	const uint32_t history_index = (uint32_t)(resolved_count % GPU_PROFILER_HISTORY);
+	ResolvedFrame& frame = history[history_index];
+	frame.frame_number = slot.frame_number;
+	frame.cpu_begin_ns = slot.cpu_begin_ns;
+	frame.cpu_end_ns = slot.cpu_end_ns;
+	frame.gpu_begin_ns = to_cpu_ns(timestamps[0]);
+	frame.gpu_end_ns = to_cpu_ns(timestamps[1]);
+	frame.scopes.resize(slot.scope_count);
+
+	for (uint32_t i = 0; i < slot.scope_count; ++i)
+	{
+		const ScopeRecord& record = slot.scopes[i];
+		ResolvedScope& scope = frame.scopes[i];
+		scope.record = record;
+		const uint64_t parent_key = record.parent == GPU_PROFILER_NO_PARENT ? FNV1A_64_OFFSET_BASIS : frame.scopes[record.parent].key;
+		scope.key = hash_fnv1a_64(record.name, strlen(record.name), parent_key);
+		scope.gpu_begin_ns = to_cpu_ns(timestamps[2 + 2 * i]);
+		scope.gpu_end_ns = to_cpu_ns(timestamps[3 + 2 * i]);
+
+		ScopeStats& stats = scope_stats[scope.key];
+		if (stats.last_frame != resolved_count)
+		{
+			memcpy(stats.name, record.name, sizeof(stats.name));
+			stats.frame_ms = 0.0;
+			stats.last_frame = resolved_count;
+		}
+		stats.frame_ms += (double)(scope.gpu_end_ns - scope.gpu_begin_ns) * 1e-6;
+	}
+
+	const double frame_ms = (double)(frame.gpu_end_ns - frame.gpu_begin_ns) * 1e-6;
+	frame_average_ms = smooth(frame_average_ms, frame_ms);
+	frame_history_ms[history_index] = (float)frame_ms;
+	for (auto& it : scope_stats)
+	{
+		ScopeStats& stats = it.second;
+		const double ms = stats.last_frame == resolved_count ? stats.frame_ms : 0.0;
+		stats.average_ms = smooth(stats.average_ms, ms);
+		stats.history_ms[history_index] = (float)ms;
+	}
+
+	++resolved_count;
+}
+
+namespace GPUProfiler
+{
+void init(Context* context)
+{
+	ctx = context;
+	frame_number = 0;
+	resolved_count = 0;
+
+	// Frame timestamps are only written on the graphics queue
+	VkQueueFamilyProperties family_properties[16];
+	uint32_t family_count = (uint32_t)std::size(family_properties);
+	vkGetPhysicalDeviceQueueFamilyProperties(ctx->physical_device, &family_count, family_properties);
+	const uint32_t valid_bits = ctx->graphics_queue_family_index < family_count ?
+		family_properties[ctx->graphics_queue_family_index].timestampValidBits : 0;
+	enabled = valid_bits > 0;
+	if (!enabled)
+	{
+		LOG_WARNING("GPU profiler: the graphics queue does not support timestamps, GPU timings are disabled");
+		return;
+	}
+	timestamp_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+	timestamp_period = (double)ctx->physical_device.properties.limits.timestampPeriod;
+
+	init_calibration();
+
+	for (FrameSlot& slot : slots)
+	{
+		slot.pending = false;
+		slot.scope_count = 0;
+
+		VkQueryPoolCreateInfo query_pool_info{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+		query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		query_pool_info.queryCount = GPU_PROFILER_QUERY_COUNT;
+		VK_CHECK(vkCreateQueryPool(ctx->device, &query_pool_info, nullptr, &slot.query_pool));
+	}
+}
+
+void shutdown()
+{
+	for (FrameSlot& slot : slots)
+	{
+		if (slot.query_pool) vkDestroyQueryPool(ctx->device, slot.query_pool, nullptr);
+		slot.query_pool = VK_NULL_HANDLE;
+		slot.pending = false;
+	}
+	scope_stats.clear();
+	for (ResolvedFrame& frame : history) frame.scopes.clear();
+	enabled = false;
+	ctx = nullptr;
+}
+
+void begin_frame(VkCommandBuffer cmd)
+{
+	if (!enabled) return;
+
+	// Context::begin_frame waited on this slot's fence, so its queries are complete
+	current = &slots[ctx->frame_index];
+	resolve_slot(*current);
+
+	current_cmd = cmd;
+	current->frame_number = frame_number++;
+	current->scope_count = 0;
+	current->cpu_begin_ns = now_ns();
+	stack_depth = 0;
+	dropped_depth = 0;
+
+	vkCmdResetQueryPool(cmd, current->query_pool, 0, GPU_PROFILER_QUERY_COUNT);
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->query_pool, 0);
+}
+
+void end_frame(VkCommandBuffer cmd)
+{
+	if (!current || cmd != current_cmd) return;
+
+	if ((stack_depth > 0 || dropped_depth > 0) && !warned_unbalanced)
+	{
+		LOG_WARNING("GPU profiler: %u scope(s) still open at the end of the frame, closing them", stack_depth + dropped_depth);
+		warned_unbalanced = true;
+	}
+	dropped_depth = 0;
+	while (stack_depth > 0) end_scope(cmd);
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->query_pool, 1);
+	current->cpu_end_ns = now_ns();
+	current->pending = true;
+	current = nullptr;
+	current_cmd = VK_NULL_HANDLE;
+}
+
+void begin_scope(VkCommandBuffer cmd, const char* name)
+{
+	if (!current || cmd != current_cmd) return;
+
+	if (dropped_depth > 0 || stack_depth == GPU_PROFILER_MAX_DEPTH || current->scope_count == GPU_PROFILER_MAX_SCOPES)
+	{
+		if (!warned_dropped)
+		{
+			LOG_WARNING("GPU profiler: dropping scope '%s', raise GPU_PROFILER_MAX_SCOPES or GPU_PROFILER_MAX_DEPTH", name);
+			warned_dropped = true;
+		}
+		++dropped_depth;
+		return;
+	}
+
+	const uint32_t index = current->scope_count++;
+	ScopeRecord& record = current->scopes[index];
+	snprintf(record.name, sizeof(record.name), "%s", name);
+	record.parent = stack_depth > 0 ? scope_stack[stack_depth - 1] : GPU_PROFILER_NO_PARENT;
+	record.depth = stack_depth;
+	record.cpu_begin_ns = now_ns();
+	record.cpu_end_ns = record.cpu_begin_ns;
+	scope_stack[stack_depth++] = index;
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, current->query_pool, 2 + 2 * index);
+}
+
+void end_scope(VkCommandBuffer cmd)
+{
+	if (!current || cmd != current_cmd) return;
+
+	if (dropped_depth > 0)
+	{
+		--dropped_depth;
+		return;
+	}
+	if (stack_depth == 0)
+	{
+		if (!warned_unbalanced)
+		{
+			LOG_WARNING("GPU profiler: end_scope without a matching begin_scope");
+			warned_unbalanced = true;
+		}
+		return;
+	}
+
+	const uint32_t index = scope_stack[--stack_depth];
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, current->query_pool, 3 + 2 * index);
+	current->scopes[index].cpu_end_ns = now_ns();
+}
+
+double get_frame_ms()
+{
+	return frame_average_ms;
+}
+
+double get_scope_ms(const char* name)
+{
+	double total = 0.0;
+	for (const auto& it : scope_stats)
+	{
+		if (strcmp(it.second.name, name) == 0) total += it.second.average_ms;
+	}
+	return total;
+}
+
+// Children of a scope follow it directly, scopes are stored in the order they were opened
+static uint32_t draw_scope_row(const ResolvedFrame& frame, uint32_t index)
+{
+	const ResolvedScope& scope = frame.scopes[index];
+	uint32_t end = index + 1;
+	while (end < frame.scopes.size() && frame.scopes[end].record.depth > scope.record.depth) ++end;
+	const bool leaf = end == index + 1;
+
+	ImGui::TableNextRow();
+	ImGui::TableNextColumn();
+	ImGui::PushID((int)index);
+	ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_SpanFullWidth | ImGuiTreeNodeFlags_DefaultOpen;
+	if (leaf) flags |= ImGuiTreeNodeFlags_Leaf | ImGuiTreeNodeFlags_NoTreePushOnOpen;
+	if (scope.key == selected_key) flags |= ImGuiTreeNodeFlags_Selected;
+	const bool open = ImGui::TreeNodeEx(scope.record.name, flags);
+	if (ImGui::IsItemClicked()) selected_key = scope.key == selected_key ? 0 : scope.key;
+	ImGui::PopID();
+
+	auto stats = scope_stats.find(scope.key);
+	ImGui::TableNextColumn();
+	ImGui::Text("%.3f", stats != scope_stats.end() ? stats->second.average_ms : 0.0);
+	ImGui::TableNextColumn();
+	ImGui::Text("%.3f", (double)(scope.gpu_end_ns - scope.gpu_begin_ns) * 1e-6);
+	ImGui::TableNextColumn();
+	ImGui::Text("%.3f", (double)(scope.record.cpu_end_ns - scope.record.cpu_begin_ns) * 1e-6);
+
+	if (open && !leaf)
+	{
+		for (uint32_t child = index + 1; child < end;)
+		{
+			child = draw_scope_row(frame, child);
+		}
+		ImGui::TreePop();
+	}
+	return end;
+}
+
+void draw_ui(bool* open)
+{
+	ImGui::Begin("GPU profiler", open);
+
+	if (!enabled)
+	{
+		ImGui::Text("Timestamps are not supported on the graphics queue");
+		ImGui::End();
+		return;
+	}
+
+	ImGui::Text("GPU frame: %.3f ms", frame_average_ms);
+	ImGui::SameLine();
+	ImGui::TextDisabled(calibrated ? "(calibrated clocks)" : "(aligned to submit)");
+
+	const int sample_count = (int)std::min<uint64_t>(resolved_count, GPU_PROFILER_HISTORY);
+	const int offset = resolved_count < GPU_PROFILER_HISTORY ? 0 : (int)(resolved_count % GPU_PROFILER_HISTORY);
+	auto selected = scope_stats.find(selected_key);
+	if (selected == scope_stats.end()) selected_key = 0;
+	const float* values = selected_key ? selected->second.history_ms : frame_history_ms;
+	char overlay[GPU_PROFILER_NAME_LENGTH + 32];
+	snprintf(overlay, sizeof(overlay), "%s", selected_key ? selected->second.name : "Frame");
+	ImGui::PlotLines("##history", values, sample_count, offset, overlay, 0.0f, FLT_MAX, ImVec2(-1.0f, 80.0f));
+
+	if (ImGui::Button("Export trace"))
+	{
+		export_chrome_trace(GPU_PROFILER_DEFAULT_TRACE_PATH);
+	}
+	ImGui::SameLine();
+	ImGui::TextDisabled("Click a scope to graph it");
+
+	if (resolved_count > 0 && ImGui::BeginTable("scopes", 4, ImGuiTableFlags_RowBg | ImGuiTableFlags_Resizable | ImGuiTableFlags_BordersV | ImGuiTableFlags_ScrollY))
+	{
+		ImGui::TableSetupScrollFreeze(0, 1);
+		ImGui::TableSetupColumn("Scope", ImGuiTableColumnFlags_WidthStretch);
+		ImGui::TableSetupColumn("GPU avg ms", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableSetupColumn("GPU ms", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableSetupColumn("CPU record ms", ImGuiTableColumnFlags_WidthFixed);
+		ImGui::TableHeadersRow();
+
+		const ResolvedFrame& frame = history[(resolved_count - 1) % GPU_PROFILER_HISTORY];
+		for (uint32_t i = 0; i < frame.scopes.size();)
+		{
+			i = draw_scope_row(frame, i);
+		}
+		ImGui::EndTable();
+	}
+
+	ImGui::End();
+}
+
+// Complete event, the metadata events are written first so every event here follows a comma
+static void write_trace_event(FILE* f, const char* name, const char* category, int tid, int64_t begin_ns, int64_t end_ns, int64_t origin_ns)
+{
+	fprintf(f, ",\n    { \"name\": ");
+	write_json_string(f, name);
+	fprintf(f, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f }",
+		category, tid, (double)(begin_ns - origin_ns) * 1e-3, (double)std::max<int64_t>(end_ns - begin_ns, 0) * 1e-3);
+}
+
+bool export_chrome_trace(const char* path)
+{
+	if (resolved_count == 0)
+	{
+		LOG_WARNING("GPU profiler: no frames resolved yet, nothing to export");
+		return false;
+	}
+
+	FILE* f = fopen(path, "w");
+	if (!f)
+	{
+		LOG_ERROR("GPU profiler: failed to open %s for writing", path);
+		return false;
+	}
+
+	const uint64_t frame_count = std::min<uint64_t>(resolved_count, GPU_PROFILER_HISTORY);
+	const uint64_t first_frame = resolved_count - frame_count;
+	const ResolvedFrame& oldest = history[first_frame % GPU_PROFILER_HISTORY];
+	const int64_t origin_ns = std::min(oldest.cpu_begin_ns, oldest.gpu_begin_ns);
+	const int cpu_tid = 1;
+	const int gpu_tid = 2;
+
+	fprintf(f, "{\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [");
+	fprintf(f, "\n    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": { \"name\": \"CPU command recording\" } },", cpu_tid);
+	fprintf(f, "\n    { \"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": { \"name\": \"GPU graphics queue\" } }", gpu_tid);
+	for (uint64_t i = first_frame; i < resolved_count; ++i)
+	{
+		const ResolvedFrame& frame = history[i % GPU_PROFILER_HISTORY];
+		char frame_name[32];
+		snprintf(frame_name, sizeof(frame_name), "Frame %llu", (unsigned long long)frame.frame_number);
+		write_trace_event(f, frame_name, "cpu", cpu_tid, frame.cpu_begin_ns, frame.cpu_end_ns, origin_ns);
+		write_trace_event(f, frame_name, "gpu", gpu_tid, frame.gpu_begin_ns, frame.gpu_end_ns, origin_ns);
+		for (const ResolvedScope& scope : frame.scopes)
+		{
+			write_trace_event(f, scope.record.name, "cpu", cpu_tid, scope.record.cpu_begin_ns, scope.record.cpu_end_ns, origin_ns);
+			write_trace_event(f, scope.record.name, "gpu", gpu_tid, scope.gpu_begin_ns, scope.gpu_end_ns, origin_ns);
+		}
+	}
+	fprintf(f, "\n  ]\n}\n");
+
+	const bool ok = ferror(f) == 0;
+	fclose(f);
+	if (ok) LOG_INFO("GPU profiler: wrote %llu frames to %s", (unsigned long long)frame_count, path);
+	else LOG_ERROR("GPU profiler: failed to write %s", path);
+	return ok;
+}
+}
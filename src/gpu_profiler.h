@@ -0,0 +1,41 @@
+#pragma once
+#include "defines.h"
+
+#define GPU_PROFILER_MAX_SCOPES 512 // Per frame, scopes past this are dropped
+#define GPU_PROFILER_MAX_DEPTH 16
+#define GPU_PROFILER_NAME_LENGTH 48
+#define GPU_PROFILER_HISTORY 256 // Frames kept for the rolling graph
+#define GPU_PROFILER_DEFAULT_TRACE_PATH "gpu_trace.json"
+
+struct Context;
+
+// Times every VkHelpers::begin_label/end_label pair recorded into the frame command buffer, so the existing labels
+// double as the profiler's scopes and nest the same way they do in RenderDoc. Each frame in flight has its own
+// timestamp pool; a frame's results are read back when Context::begin_frame has waited on its fence again,
+// two frames later, so nothing stalls on the GPU.
+namespace GPUProfiler
+{
+	// Called by Context::init and Context::shutdown
+	void init(Context* ctx);
+	void shutdown();
+
+	// Called by Context::begin_frame after the fence wait and by Context::end_frame before the command buffer ends
+	void begin_frame(VkCommandBuffer cmd);
+	void end_frame(VkCommandBuffer cmd);
+
+	// Does nothing unless cmd is the command buffer of the current frame. The name is copied.
+	// Scopes must not be opened inside a multiview rendering instance, where a timestamp takes one query per view
+	void begin_scope(VkCommandBuffer cmd, const char* name);
+	void end_scope(VkCommandBuffer cmd);
+
+	// Smoothed GPU time of the whole frame
+	double get_frame_ms();
+	// Smoothed GPU time summed over every scope with this name, wherever it sits in the hierarchy
+	double get_scope_ms(const char* name);
+
+	void draw_ui(bool* open);
+
+	// Last GPU_PROFILER_HISTORY resolved frames as Chrome trace JSON (chrome://tracing, Perfetto). GPU scopes and
+	// the CPU time spent recording them are on the same timeline
+	bool export_chrome_trace(const char* path);
+}
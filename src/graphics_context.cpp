@@ -3,39 +3,143 @@
 #include "vk_helpers.h"
 #include "buffer.h"
 #include "misc.h"
+#include "texture_cache.h"
+#include "gpu_profiler.h"
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl2.h"
 #include "imgui/imgui_impl_vulkan.h"
 #include "radix_sort/radix_sort_vk.h"
+#include <filesystem>
 
 constexpr uint32_t MAX_BINDLESS_RESOURCES = 1024;
-constexpr uint32_t QUERY_COUNT = 256;
 
 #define VSYNC 0
+#define USE_PIPELINE_CACHE 1
+#define PIPELINE_CACHE_PATH "data/pipeline_cache.bin"
 
-void Context::init(int window_width, int window_height)
+// Drivers are supposed to reject foreign cache data themselves, but not all of them do so gracefully
+static bool is_pipeline_cache_compatible(const std::vector<uint8_t>& data, const VkPhysicalDeviceProperties& properties)
 {
-    if (!SDL_SetHint(SDL_HINT_WINDOWS_DPI_SCALING, "1"))
+    VkPipelineCacheHeaderVersionOne header;
+    if (data.size() < sizeof(header)) return false;
+    memcpy(&header, data.data(), sizeof(header));
+
+    return header.headerSize >= sizeof(header) && header.headerSize <= data.size() &&
+        header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+        header.vendorID == properties.vendorID &&
+        header.deviceID == properties.deviceID &&
+        memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+static std::vector<uint8_t> load_pipeline_cache_data(const VkPhysicalDeviceProperties& properties)
+{
+    std::vector<uint8_t> data;
+    FILE* f = fopen(PIPELINE_CACHE_PATH, "rb");
+    if (!f) return data;
+
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size > 0)
+    {
+        data.resize((size_t)size);
+        if (fread(data.data(), 1, data.size(), f) != data.size()) data.clear();
+    }
+    fclose(f);
+
+    if (!data.empty() && !is_pipeline_cache_compatible(data, properties))
+    {
+        LOG_WARNING("Discarding pipeline cache '%s', it was written by a different driver or device", PIPELINE_CACHE_PATH);
+        data.clear();
+    }
+    return data;
+}
+
+static void save_pipeline_cache(VkDevice device, VkPipelineCache pipeline_cache)
+{
+    size_t size = 0;
+    VK_CHECK(vkGetPipelineCacheData(device, pipeline_cache, &size, nullptr));
+    std::vector<uint8_t> data(size);
+    VK_CHECK(vkGetPipelineCacheData(device, pipeline_cache, &size, data.data()));
+    data.resize(size);
+
+    // Write to a temporary file first so a crash never leaves a truncated cache behind
+    std::error_code ec;
+    const std::filesystem::path path(PIPELINE_CACHE_PATH);
+    std::filesystem::create_directories(path.parent_path(), ec);
+    std::filesystem::path temp_path = path;
+    temp_path += ".tmp";
+
+    FILE* f = fopen(temp_path.string().c_str(), "wb");
+    if (!f)
+    {
+        LOG_ERROR("Failed to write pipeline cache '%s'", PIPELINE_CACHE_PATH);
+        return;
+    }
+    const bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+    fclose(f);
+
+    if (success)
     {
-        LOG_DEBUG("Failed to set Windows DPI scaling");
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec)
+        {
+            std::filesystem::remove(path, ec);
+            std::filesystem::rename(temp_path, path, ec);
+        }
+    }
+    if (!success || ec)
+    {
+        LOG_ERROR("Failed to write pipeline cache '%s'", PIPELINE_CACHE_PATH);
+        std::filesystem::remove(temp_path, ec);
+        return;
+    }
+    LOG_INFO("Saved pipeline cache (%zu bytes)", data.size());
+}
+
+void Context::init(int window_width, int window_height, bool headless)
+{
+    this->headless = headless;
+    window = nullptr;
+    surface = VK_NULL_HANDLE;
+
+    if (headless)
+    {
+        this->window_width = window_width;
+        this->window_height = window_height;
+        LOG_INFO("Running headless, rendering offscreen at (%d, %d)", window_width, window_height);
     }
+    else
+    {
+        if (!SDL_SetHint(SDL_HINT_WINDOWS_DPI_SCALING, "1"))
+        {
+            LOG_DEBUG("Failed to set Windows DPI scaling");
+        }
 
-    SDL_Init(SDL_INIT_VIDEO);
+        SDL_Init(SDL_INIT_VIDEO);
 
-    uint32_t window_flags = SDL_WINDOW_VULKAN | SDL_WINDOW_ALLOW_HIGHDPI;
-    window = SDL_CreateWindow("GigaVFX", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, window_flags);
-    SDL_GetWindowSizeInPixels(window, &this->window_width, &this->window_height);
-    LOG_INFO("Requested window of size: (%d, %d), got size in pixels: (%d, %d)", window_width, window_height, this->window_width, this->window_height);
+        uint32_t window_flags = SDL_WINDOW_VULKAN | SDL_WINDOW_ALLOW_HIGHDPI;
+        window = SDL_CreateWindow("GigaVFX", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, window_flags);
+        SDL_GetWindowSizeInPixels(window, &this->window_width, &this->window_height);
+        LOG_INFO("Requested window of size: (%d, %d), got size in pixels: (%d, %d)", window_width, window_height, this->window_width, this->window_height);
+    }
 
     VK_CHECK(volkInitialize());
 
     vkb::InstanceBuilder instance_builder;
     instance_builder.require_api_version(1, 3, 0);
     instance_builder.set_app_name("GigaVFX");
-    instance_builder.enable_extensions({
-    VK_KHR_SURFACE_EXTENSION_NAME,
-    VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
-        });
+    if (headless)
+    {
+        instance_builder.set_headless();
+    }
+    else
+    {
+        instance_builder.enable_extensions({
+        VK_KHR_SURFACE_EXTENSION_NAME,
+        VK_KHR_WIN32_SURFACE_EXTENSION_NAME,
+            });
+    }
 #if _DEBUG
     instance_builder.request_validation_layers();
     instance_builder.enable_validation_layers();
@@ -97,7 +201,7 @@ void Context::init(int window_width, int window_height)
     }
     auto system_info = system_info_ret.value();
 
-    if (!SDL_Vulkan_CreateSurface(window, instance, &surface))
+    if (!headless && !SDL_Vulkan_CreateSurface(window, instance, &surface))
     {
         LOG_ERROR("Failed to create Vulkan surface");
         exit(-1);
@@ -116,6 +220,7 @@ void Context::init(int window_width, int window_height)
     vulkan_12_features.descriptorBindingStorageImageUpdateAfterBind = VK_TRUE;
     vulkan_12_features.runtimeDescriptorArray = VK_TRUE;
     vulkan_12_features.scalarBlockLayout = VK_TRUE;
+    vulkan_12_features.timelineSemaphore = VK_TRUE;
 
     VkPhysicalDeviceVulkan11Features vulkan_11_features{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
     vulkan_11_features.multiview = VK_TRUE;
@@ -123,6 +228,7 @@ void Context::init(int window_width, int window_height)
     VkPhysicalDeviceFeatures features{};
     features.shaderInt64 = VK_TRUE;
     features.samplerAnisotropy = VK_TRUE;
+    features.textureCompressionBC = VK_TRUE;
     features.vertexPipelineStoresAndAtomics = VK_TRUE;
 	features.fragmentStoresAndAtomics = VK_TRUE;
 
@@ -208,6 +314,9 @@ void Context::init(int window_width, int window_height)
         exit(-1);
     }
 
+    // Puts GPU profiler scopes on the CPU timeline, without it they are aligned to the submit time
+    calibrated_timestamps = physical_device.enable_extension_if_present(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+
     vkb::DeviceBuilder device_builder{ physical_device };
     auto dev_ret = device_builder.build();
     if (!dev_ret) {
@@ -230,34 +339,37 @@ void Context::init(int window_width, int window_height)
     transfer_queue_family_index = device.get_queue_index(vkb::QueueType::graphics).value();
     transfer_queue = device.get_queue(vkb::QueueType::graphics).value();
 
-    vkb::SwapchainBuilder swapchain_builder{ device };
-    swapchain_builder.set_desired_format({ VK_FORMAT_B8G8R8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR });
-    swapchain_builder.set_image_usage_flags(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+    if (!headless)
+    { // Swapchain
+        vkb::SwapchainBuilder swapchain_builder{ device };
+        swapchain_builder.set_desired_format({ VK_FORMAT_B8G8R8A8_UNORM, VK_COLORSPACE_SRGB_NONLINEAR_KHR });
+        swapchain_builder.set_image_usage_flags(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
 #if VSYNC
-    swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR);
+        swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR);
 #endif
-    auto swap_ret = swapchain_builder.build();
-    if (!swap_ret) {
-        LOG_ERROR("Failed to create swapchain!");
-        exit(-1);
-    }
-    swapchain = swap_ret.value();
-    auto swapchain_images = swapchain.get_images().value();
-    auto swapchain_image_views = swapchain.get_image_views().value();
-    assert(swapchain_images.size() == swapchain_image_views.size());
+        auto swap_ret = swapchain_builder.build();
+        if (!swap_ret) {
+            LOG_ERROR("Failed to create swapchain!");
+            exit(-1);
+        }
+        swapchain = swap_ret.value();
+        auto swapchain_images = swapchain.get_images().value();
+        auto swapchain_image_views = swapchain.get_image_views().value();
+        assert(swapchain_images.size() == swapchain_image_views.size());
 
-    swapchain_textures.resize(swapchain_images.size());
-    for (size_t i = 0; i < swapchain_images.size(); ++i)
-    {
-        Texture& tex = swapchain_textures[i];
-        tex.image = swapchain_images[i];
-        tex.view = swapchain_image_views[i];
-        tex.layout = VK_IMAGE_LAYOUT_UNDEFINED;
-        assert(tex.image);
-        assert(tex.view);
-    }
+        swapchain_textures.resize(swapchain_images.size());
+        for (size_t i = 0; i < swapchain_images.size(); ++i)
+        {
+            Texture& tex = swapchain_textures[i];
+            tex.image = swapchain_images[i];
+            tex.view = swapchain_image_views[i];
+            tex.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            assert(tex.image);
+            assert(tex.view);
+        }
 
-    LOG_DEBUG("Swapchain format: %s", string_VkFormat(swapchain.image_format));
+        LOG_DEBUG("Swapchain format: %s", string_VkFormat(swapchain.image_format));
+    }
 
     for (uint32_t i = 0; i < frames_in_flight; ++i)
     {
@@ -278,11 +390,6 @@ void Context::init(int window_width, int window_height)
         VkSemaphoreCreateInfo semaphore_info{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
         VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &image_acquired_semaphore[i]));
         VK_CHECK(vkCreateSemaphore(device, &semaphore_info, nullptr, &rendering_finished_semaphore[i]));
-
-        VkQueryPoolCreateInfo query_pool_info{ VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
-        query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
-        query_pool_info.queryCount = QUERY_COUNT;
-        VK_CHECK(vkCreateQueryPool(device.device, &query_pool_info, nullptr, &query_pool[i]));
     }
 
     {
@@ -308,6 +415,28 @@ void Context::init(int window_width, int window_height)
         VK_CHECK(vmaCreateAllocator(&allocator_info, &allocator));
     }
 
+    if (headless)
+    { // Offscreen images in place of the swapchain
+        swapchain_textures.resize(frames_in_flight);
+        for (uint32_t i = 0; i < frames_in_flight; ++i)
+        {
+            // Same format and usage as the swapchain images, plus transfer for reading results back
+            create_texture(swapchain_textures[i], this->window_width, this->window_height, 1, VK_FORMAT_B8G8R8A8_UNORM, VK_IMAGE_TYPE_2D,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+        }
+    }
+
+    { // Pipeline cache
+        VkPipelineCacheCreateInfo info{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+#if USE_PIPELINE_CACHE
+        std::vector<uint8_t> initial_data = load_pipeline_cache_data(physical_device.properties);
+        info.initialDataSize = initial_data.size();
+        info.pInitialData = initial_data.data();
+        LOG_INFO("Loaded pipeline cache (%zu bytes)", initial_data.size());
+#endif
+        VK_CHECK(vkCreatePipelineCache(device, &info, nullptr, &pipeline_cache));
+    }
+
     { // Bindless descriptor pool
         VkDescriptorPoolSize pool_sizes_bindless[] = {
             {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, MAX_BINDLESS_RESOURCES},
@@ -411,18 +540,38 @@ void Context::init(int window_width, int window_height)
         info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
         VK_CHECK(vkCreateSampler(device, &info, nullptr, &samplers.point));
     }
+
+    GPUProfiler::init(this);
 }
 
 void Context::shutdown()
 {
     VK_CHECK(vkDeviceWaitIdle(device));
 
-    ImGui_ImplVulkan_Shutdown();
-    ImGui_ImplSDL2_Shutdown();
-    ImGui::DestroyContext();
+    GPUProfiler::shutdown();
+
+    if (headless)
+    {
+        for (auto& t : swapchain_textures)
+        {
+            t.destroy(device, allocator);
+        }
+        swapchain_textures.clear();
+    }
+    else
+    {
+        ImGui_ImplVulkan_Shutdown();
+        ImGui_ImplSDL2_Shutdown();
+        ImGui::DestroyContext();
+    }
 
     vmaDestroyAllocator(allocator);
 
+#if USE_PIPELINE_CACHE
+    save_pipeline_cache(device, pipeline_cache);
+#endif
+    vkDestroyPipelineCache(device, pipeline_cache, nullptr);
+
     if (radix_sort_instance) radix_sort_vk_destroy(radix_sort_instance, device.device, nullptr);
 
     for (auto& t : swapchain_textures)
@@ -438,20 +587,22 @@ void Context::shutdown()
         vkDestroyFence(device, frame_fences[i], nullptr);
         vkDestroySemaphore(device, image_acquired_semaphore[i], nullptr);
         vkDestroySemaphore(device, rendering_finished_semaphore[i], nullptr);
-        vkDestroyQueryPool(device, query_pool[i], nullptr);
     }
     vkDestroyCommandPool(device, transfer_command_pool, nullptr);
 
     vkDestroySampler(device, samplers.bilinear, nullptr);
     vkDestroySampler(device, samplers.point, nullptr);
     vkDestroySampler(device, samplers.bilinear_clamp, nullptr);
-    vkb::destroy_swapchain(swapchain);
+    if (!headless) vkb::destroy_swapchain(swapchain);
     vkb::destroy_device(device);
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (surface) vkDestroySurfaceKHR(instance, surface, nullptr);
     vkb::destroy_instance(instance);
 
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    if (window)
+    {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+    }
 }
 
 VkCommandBuffer Context::begin_frame()
@@ -459,85 +610,43 @@ VkCommandBuffer Context::begin_frame()
     VK_CHECK(vkWaitForFences(device, 1, &frame_fences[frame_index], VK_TRUE, UINT64_MAX));
     VK_CHECK(vkResetFences(device, 1, &frame_fences[frame_index]));
 
-    vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_acquired_semaphore[frame_index], VK_NULL_HANDLE, &swapchain_image_index);
+    if (headless)
+        swapchain_image_index = frame_index;
+    else
+        vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, image_acquired_semaphore[frame_index], VK_NULL_HANDLE, &swapchain_image_index);
 
     VK_CHECK(vkResetCommandPool(device, command_pools[frame_index], 0));
 
-    if (frames_rendered > frames_in_flight)
-    { // Timing
-        uint64_t timestamp_results[2];
-        vkGetQueryPoolResults(device, query_pool[frame_index], 0, 2, sizeof(timestamp_results), timestamp_results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
-        uint64_t delta = timestamp_results[1] - timestamp_results[0];
-        double delta_ns = (double)delta * (double)device.physical_device.properties.limits.timestampPeriod;
-        smoothed_frame_time_ns = glm::mix(delta_ns, smoothed_frame_time_ns, 0.95);
-    }
-
     VkCommandBuffer cmd = command_buffers[frame_index];
 
     VkCommandBufferBeginInfo cmd_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     cmd_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_info));
 
-    vkCmdResetQueryPool(cmd, query_pool[frame_index], 0, 2);
-    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool[frame_index], 0);
-
-    VkImageMemoryBarrier2 image_barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-    image_barrier.srcStageMask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-    image_barrier.srcAccessMask = 0;
-    image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
-    image_barrier.dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
-    image_barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    image_barrier.image = swapchain_textures[swapchain_image_index].image;
-    image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_barrier.subresourceRange.baseArrayLayer = 0;
-    image_barrier.subresourceRange.baseMipLevel = 0;
-    image_barrier.subresourceRange.layerCount = 1;
-    image_barrier.subresourceRange.levelCount = 1;
-
-    VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-    dep_info.imageMemoryBarrierCount = 1;
-    dep_info.pImageMemoryBarriers = &image_barrier;
-    vkCmdPipelineBarrier2(cmd, &dep_info);
+    // Resolves the timings this slot recorded two frames ago
+    GPUProfiler::begin_frame(cmd);
+    smoothed_frame_time_ns = GPUProfiler::get_frame_ms() * 1e6;
 
     return cmd;
 }
 
 void Context::end_frame (VkCommandBuffer command_buffer)
 {
-    VkHelpers::begin_label(command_buffer, "End frame", glm::vec4(0.0f, 1.0f, 0.0f, 0.0f));
-    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkPipelineStageFlags wait_stage = (VkPipelineStageFlags)swapchain_wait_stage;
 
     VkSubmitInfo info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
     info.commandBufferCount = 1;
     info.pCommandBuffers = &command_buffer;
-    info.waitSemaphoreCount = 1;
-    info.pWaitSemaphores = &image_acquired_semaphore[frame_index];
-    info.pWaitDstStageMask = &wait_stage;
-    info.signalSemaphoreCount = 1;
-    info.pSignalSemaphores = &rendering_finished_semaphore[frame_index];
-
-    VkImageMemoryBarrier2 image_barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-    image_barrier.srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
-    image_barrier.srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
-    image_barrier.dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT;
-    image_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-    image_barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    image_barrier.image = swapchain_textures[swapchain_image_index].image;
-    image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_barrier.subresourceRange.baseArrayLayer = 0;
-    image_barrier.subresourceRange.baseMipLevel = 0;
-    image_barrier.subresourceRange.layerCount = 1;
-    image_barrier.subresourceRange.levelCount = 1;
-
-    VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-    dep_info.imageMemoryBarrierCount = 1;
-    dep_info.pImageMemoryBarriers = &image_barrier;
-    vkCmdPipelineBarrier2(command_buffer, &dep_info);
-
-    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool[frame_index], 1);
-
-    VkHelpers::end_label(command_buffer);
+    if (!headless)
+    {
+        info.waitSemaphoreCount = 1;
+        info.pWaitSemaphores = &image_acquired_semaphore[frame_index];
+        info.pWaitDstStageMask = &wait_stage;
+        info.signalSemaphoreCount = 1;
+        info.pSignalSemaphores = &rendering_finished_semaphore[frame_index];
+    }
+
+    GPUProfiler::end_frame(command_buffer);
 
     vkEndCommandBuffer(command_buffer);
 
@@ -546,20 +655,23 @@ void Context::end_frame (VkCommandBuffer command_buffer)
     // For debugging sync issues
     //vkQueueWaitIdle(graphics_queue);
 
-    VkPresentInfoKHR present_info{ VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
-    present_info.waitSemaphoreCount = 1;
-    present_info.pWaitSemaphores = &rendering_finished_semaphore[frame_index];
-    present_info.swapchainCount = 1;
-    present_info.pSwapchains = &swapchain.swapchain;
-    present_info.pImageIndices = &swapchain_image_index;
-    VK_CHECK(vkQueuePresentKHR(graphics_queue, &present_info));
+    if (!headless)
+    {
+        VkPresentInfoKHR present_info{ VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
+        present_info.waitSemaphoreCount = 1;
+        present_info.pWaitSemaphores = &rendering_finished_semaphore[frame_index];
+        present_info.swapchainCount = 1;
+        present_info.pSwapchains = &swapchain.swapchain;
+        present_info.pImageIndices = &swapchain_image_index;
+        VK_CHECK(vkQueuePresentKHR(graphics_queue, &present_info));
+    }
 
     frame_index = (frame_index + 1) % frames_in_flight;
     frames_rendered++;
 }
 
 
-bool Context::create_texture(Texture& texture, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageType image_type, VkImageUsageFlags usage, uint32_t mip_levels, uint32_t array_layers)
+bool Context::create_texture(Texture& texture, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageType image_type, VkImageUsageFlags usage, uint32_t mip_levels, uint32_t array_layers, VkComponentMapping swizzle)
 {
     VkImageCreateInfo image_create_info{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
 
@@ -595,6 +707,7 @@ bool Context::create_texture(Texture& texture, uint32_t width, uint32_t height,
     image_view_info.image = image;
     image_view_info.viewType = guess_view_type(width, height, depth, array_layers);
     image_view_info.format = format;
+    image_view_info.components = swizzle;
     image_view_info.subresourceRange.aspectMask = determine_image_aspect(format);
     image_view_info.subresourceRange.baseArrayLayer = 0;
     image_view_info.subresourceRange.baseMipLevel = 0;
@@ -614,33 +727,77 @@ bool Context::create_texture(Texture& texture, uint32_t width, uint32_t height,
     return true;
 }
 
-bool Context::create_textures(Texture* textures, uint32_t count)
+bool Context::record_texture_upload(VkCommandBuffer cmd, Texture& t, VkBuffer staging_buffer, VkDeviceSize staging_offset)
 {
-    VkHelpers::begin_command_buffer(transfer_command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+    uint32_t mip_count = get_mip_count(t.width, t.height);
+    VkImageUsageFlags image_usage_flags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    if (!create_texture(t, t.width, t.height, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, image_usage_flags, mip_count, 1))
+    {
+        return false;
+    }
 
-    std::vector<Buffer> staging_buffers(count);
-    for (uint32_t i = 0; i < count; ++i)
     {
-        Texture& t = textures[i];
-        uint32_t mip_count = get_mip_count(t.width, t.height);
-        VkImageUsageFlags image_usage_flags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-        if (!create_texture(t, t.width, t.height, 1, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TYPE_2D, image_usage_flags, mip_count, 1))
-        {
-            return false;
-        }
+        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            t.image
+        );
+
+        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dep_info.imageMemoryBarrierCount = 1;
+        dep_info.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
 
-        const uint32_t n_channels = 4;
-        uint32_t required_size = t.width * t.height * n_channels;
+    VkBufferImageCopy2 region{ VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2 };
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { (uint32_t)t.width, (uint32_t)t.height, 1 };
+    region.imageOffset = { 0, 0, 0 };
+    region.bufferOffset = staging_offset;
 
-        BufferDesc desc{};
-        desc.size = required_size;
-        desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-        desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-        desc.data = t.source;
-        Buffer& staging_buffer = staging_buffers[i];
-        staging_buffer = create_buffer(desc);
+    VkCopyBufferToImageInfo2 copy_image{ VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2 };
+    copy_image.srcBuffer = staging_buffer;
+    copy_image.dstImage = t.image;
+    copy_image.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    copy_image.regionCount = 1;
+    copy_image.pRegions = &region;
 
-        {
+    vkCmdCopyBufferToImage2(cmd, &copy_image);
+
+    {
+        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            t.image
+        );
+
+        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dep_info.imageMemoryBarrierCount = 1;
+        dep_info.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
+
+    t.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    int32_t width = t.width;
+    int32_t height = t.height;
+    for (uint32_t i = 1; i < mip_count; ++i)
+    {
+        int32_t next_width = std::max(width >> 1, 1);
+        int32_t next_height = std::max(height >> 1, 1);
+
+        { // Transition to transfer dst optimal
             VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
                 VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
                 0,
@@ -648,33 +805,32 @@ bool Context::create_textures(Texture* textures, uint32_t count)
                 0,
                 VK_IMAGE_LAYOUT_UNDEFINED,
                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                t.image
+                t.image,
+                VK_IMAGE_ASPECT_COLOR_BIT,
+                i, 1
             );
 
             VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
             dep_info.imageMemoryBarrierCount = 1;
             dep_info.pImageMemoryBarriers = &barrier;
-            vkCmdPipelineBarrier2(transfer_command_buffer, &dep_info);
+            vkCmdPipelineBarrier2(cmd, &dep_info);
         }
-
-        VkBufferImageCopy2 region{ VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2 };
-        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        region.imageSubresource.mipLevel = 0;
-        region.imageSubresource.baseArrayLayer = 0;
-        region.imageSubresource.layerCount = 1;
-        region.imageExtent = { (uint32_t)t.width, (uint32_t)t.height, 1 };
-        region.imageOffset = { 0, 0, 0 };
-
-        VkCopyBufferToImageInfo2 copy_image{ VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2 };
-        copy_image.srcBuffer = staging_buffer.buffer;
-        copy_image.dstImage = t.image;
-        copy_image.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        copy_image.regionCount = 1;
-        copy_image.pRegions = &region;
-
-        vkCmdCopyBufferToImage2(transfer_command_buffer, &copy_image);
-
-        {
+        VkImageBlit region{};
+        region.srcOffsets[0] = { 0, 0, 0 };
+        region.srcOffsets[1] = { width, height, 1 };
+        region.dstOffsets[0] = { 0, 0, 0 };
+        region.dstOffsets[1] = { next_width, next_height, 1 };
+        region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.srcSubresource.mipLevel = i - 1;
+        region.srcSubresource.baseArrayLayer = 0;
+        region.srcSubresource.layerCount = 1;
+        region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.dstSubresource.mipLevel = i;
+        region.dstSubresource.baseArrayLayer = 0;
+        region.dstSubresource.layerCount = 1;
+        vkCmdBlitImage(cmd, t.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, t.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
+
+        { // Transition to transfer src optimal
             VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
                 VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
                 0,
@@ -682,100 +838,198 @@ bool Context::create_textures(Texture* textures, uint32_t count)
                 0,
                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                t.image
+                t.image,
+                VK_IMAGE_ASPECT_COLOR_BIT,
+                i, 1
             );
 
             VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
             dep_info.imageMemoryBarrierCount = 1;
             dep_info.pImageMemoryBarriers = &barrier;
-            vkCmdPipelineBarrier2(transfer_command_buffer, &dep_info);
+            vkCmdPipelineBarrier2(cmd, &dep_info);
         }
 
-        t.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        width = next_width;
+        height = next_height;
+    }
 
-        int32_t width = t.width;
-        int32_t height = t.height;
-        for (uint32_t i = 1; i < mip_count; ++i)
-        {
-            int32_t next_width = std::max(width >> 1, 1);
-            int32_t next_height = std::max(height >> 1, 1);
-
-            { // Transition to transfer dst optimal
-                VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                    0,
-                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                    0,
-                    VK_IMAGE_LAYOUT_UNDEFINED,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    t.image,
-                    VK_IMAGE_ASPECT_COLOR_BIT,
-                    i, 1
-                );
-
-                VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-                dep_info.imageMemoryBarrierCount = 1;
-                dep_info.pImageMemoryBarriers = &barrier;
-                vkCmdPipelineBarrier2(transfer_command_buffer, &dep_info);
-            }
-            VkImageBlit region{};
-            region.srcOffsets[0] = { 0, 0, 0 };
-            region.srcOffsets[1] = { width, height, 1 };
-            region.dstOffsets[0] = { 0, 0, 0 };
-            region.dstOffsets[1] = { next_width, next_height, 1 };
-            region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            region.srcSubresource.mipLevel = i - 1;
-            region.srcSubresource.baseArrayLayer = 0;
-            region.srcSubresource.layerCount = 1;
-            region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            region.dstSubresource.mipLevel = i;
-            region.dstSubresource.baseArrayLayer = 0;
-            region.dstSubresource.layerCount = 1;
-            vkCmdBlitImage(transfer_command_buffer, t.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, t.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, VK_FILTER_LINEAR);
-
-            { // Transition to transfer src optimal
-                VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                    0,
-                    VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                    0,
-                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    t.image,
-                    VK_IMAGE_ASPECT_COLOR_BIT,
-                    i, 1
-                );
-
-                VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-                dep_info.imageMemoryBarrierCount = 1;
-                dep_info.pImageMemoryBarriers = &barrier;
-                vkCmdPipelineBarrier2(transfer_command_buffer, &dep_info);
-            }
+    { // Transition to read only optimal
+        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            t.image,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            0, VK_REMAINING_MIP_LEVELS
+        );
+
+        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dep_info.imageMemoryBarrierCount = 1;
+        dep_info.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
+
+    return true;
+}
+
+bool Context::record_compressed_texture_upload(VkCommandBuffer cmd, Texture& t, const CompressedTexture& compressed, VkBuffer staging_buffer, VkDeviceSize staging_offset)
+{
+    VkImageUsageFlags image_usage_flags = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (!create_texture(t, compressed.width, compressed.height, 1, compressed.format, VK_IMAGE_TYPE_2D, image_usage_flags, compressed.mip_count, 1, compressed.swizzle))
+    {
+        return false;
+    }
+
+    {
+        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            t.image,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            0, VK_REMAINING_MIP_LEVELS
+        );
+
+        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dep_info.imageMemoryBarrierCount = 1;
+        dep_info.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
+
+    // Every mip is precomputed, so the whole chain is a single copy
+    VkBufferImageCopy2 regions[MAX_TEXTURE_MIPS];
+    for (uint32_t i = 0; i < compressed.mip_count; ++i)
+    {
+        VkBufferImageCopy2& region = regions[i];
+        region = { VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2 };
+        region.bufferOffset = staging_offset + compressed.levels[i].offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = i;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { std::max(compressed.width >> i, 1u), std::max(compressed.height >> i, 1u), 1 };
+        region.imageOffset = { 0, 0, 0 };
+    }
+
+    VkCopyBufferToImageInfo2 copy_image{ VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2 };
+    copy_image.srcBuffer = staging_buffer;
+    copy_image.dstImage = t.image;
+    copy_image.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    copy_image.regionCount = compressed.mip_count;
+    copy_image.pRegions = regions;
+
+    vkCmdCopyBufferToImage2(cmd, &copy_image);
 
-            width = next_width;
-            height = next_height;
+    {
+        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+            0,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            t.image,
+            VK_IMAGE_ASPECT_COLOR_BIT,
+            0, VK_REMAINING_MIP_LEVELS
+        );
+
+        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+        dep_info.imageMemoryBarrierCount = 1;
+        dep_info.pImageMemoryBarriers = &barrier;
+        vkCmdPipelineBarrier2(cmd, &dep_info);
+    }
+
+    t.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    return true;
+}
+
+VkDescriptorSet Context::create_imgui_descriptor_set(const Texture& texture)
+{
+    // The backend data lives in the ImGui context, ImGui_ImplVulkan_AddTexture dereferences it unchecked
+    if (!ImGui::GetCurrentContext() || !ImGui::GetIO().BackendRendererUserData)
+    {
+        return VK_NULL_HANDLE;
+    }
+    return ImGui_ImplVulkan_AddTexture(samplers.bilinear_clamp, texture.view, texture.layout);
+}
+
+bool Context::create_compressed_textures(Texture* textures, const CompressedTexture* compressed, uint32_t count)
+{
+    VkHelpers::begin_command_buffer(transfer_command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    std::vector<Buffer> staging_buffers(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Texture& t = textures[i];
+
+        BufferDesc desc{};
+        desc.size = compressed[i].size;
+        desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        desc.data = (void*)compressed[i].data;
+        Buffer& staging_buffer = staging_buffers[i];
+        staging_buffer = create_buffer(desc);
+
+        if (!record_compressed_texture_upload(transfer_command_buffer, t, compressed[i], staging_buffer.buffer, 0))
+        {
+            return false;
         }
 
-        { // Transition to read only optimal
-            VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                0,
-                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                0,
-                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-                t.image,
-                VK_IMAGE_ASPECT_COLOR_BIT,
-                0, VK_REMAINING_MIP_LEVELS
-            );
+        t.descriptor_set = create_imgui_descriptor_set(t);
+    }
 
-            VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-            dep_info.imageMemoryBarrierCount = 1;
-            dep_info.pImageMemoryBarriers = &barrier;
-            vkCmdPipelineBarrier2(transfer_command_buffer, &dep_info);
+    vkEndCommandBuffer(transfer_command_buffer);
+
+    VkSubmitInfo info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+    info.commandBufferCount = 1;
+    info.pCommandBuffers = &transfer_command_buffer;
+
+    VK_CHECK(vkQueueSubmit(transfer_queue, 1, &info, VK_NULL_HANDLE));
+
+    VK_CHECK(vkQueueWaitIdle(transfer_queue));
+
+    VK_CHECK(vkResetCommandPool(device, transfer_command_pool, 0));
+
+    for (auto& buffer : staging_buffers)
+    {
+        vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+    }
+
+    return true;
+}
+
+bool Context::create_textures(Texture* textures, uint32_t count)
+{
+    VkHelpers::begin_command_buffer(transfer_command_buffer, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+    std::vector<Buffer> staging_buffers(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        Texture& t = textures[i];
+        const uint32_t n_channels = 4;
+        uint32_t required_size = t.width * t.height * n_channels;
+
+        BufferDesc desc{};
+        desc.size = required_size;
+        desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+        desc.data = t.source;
+        Buffer& staging_buffer = staging_buffers[i];
+        staging_buffer = create_buffer(desc);
+
+        if (!record_texture_upload(transfer_command_buffer, t, staging_buffer.buffer, 0))
+        {
+            return false;
         }
 
-        t.descriptor_set = ImGui_ImplVulkan_AddTexture(samplers.bilinear_clamp, t.view, t.layout);
+        t.descriptor_set = create_imgui_descriptor_set(t);
     }
 
     vkEndCommandBuffer(transfer_command_buffer);
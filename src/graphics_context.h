@@ -8,10 +8,14 @@
 struct Buffer;
 struct BufferDesc;
 struct GPUBuffer;
+struct CompressedTexture;
 
 struct Context
 {
     static constexpr uint32_t frames_in_flight = 2;
+    // Stage that waits on the image acquired semaphore. The swapchain image's layout is left to the frame's
+    // command buffer: its first use has to wait on this stage, and it has to end in PRESENT_SRC (GENERAL when headless)
+    static constexpr VkPipelineStageFlags2 swapchain_wait_stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
     SDL_Window* window;
     int window_width, window_height;
     vkb::Instance instance;
@@ -26,6 +30,9 @@ struct Context
 
     VmaAllocator allocator;
 
+    // Shared by all pipeline builders, including hot reloads. Loaded in init and written back in shutdown
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
+
     struct
     {
         VkSampler bilinear;
@@ -51,14 +58,18 @@ struct Context
     VkFence frame_fences[frames_in_flight];
     VkSemaphore image_acquired_semaphore[frames_in_flight];
     VkSemaphore rendering_finished_semaphore[frames_in_flight];
-    VkQueryPool query_pool[frames_in_flight];
 
     struct radix_sort_vk* radix_sort_instance = nullptr;
 
-    double smoothed_frame_time_ns = 0.0;
+    double smoothed_frame_time_ns = 0.0; // From the GPU profiler, frames are timed there
+    bool calibrated_timestamps = false; // VK_EXT_calibrated_timestamps is enabled
     uint64_t frames_rendered = 0;
 
-    void init(int window_width, int window_height);
+    // No window, surface or swapchain. swapchain_textures then holds one offscreen image per frame in flight,
+    // so software drivers and machines without a display can run the whole frame
+    bool headless = false;
+
+    void init(int window_width, int window_height, bool headless = false);
 
     void shutdown();
 
@@ -68,9 +79,19 @@ struct Context
 
     inline Texture& get_swapchain_texture() { return swapchain_textures[swapchain_image_index]; }
 
-    bool create_texture(Texture& texture, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageType image_type, VkImageUsageFlags usage, uint32_t mip_levels = 1, uint32_t array_layers = 1);
+    bool create_texture(Texture& texture, uint32_t width, uint32_t height, uint32_t depth, VkFormat format, VkImageType image_type, VkImageUsageFlags usage, uint32_t mip_levels = 1, uint32_t array_layers = 1, VkComponentMapping swizzle = {});
 
     bool create_textures(Texture* textures, uint32_t count);
+    // Creates the image and records the copy from the staging buffer plus mip generation, leaving it shader read only
+    bool record_texture_upload(VkCommandBuffer cmd, Texture& texture, VkBuffer staging_buffer, VkDeviceSize staging_offset);
+
+    // Block compressed textures from the texture cache, the staging buffer holds the mip chain as laid out in compressed.data
+    bool create_compressed_textures(Texture* textures, const CompressedTexture* compressed, uint32_t count);
+    bool record_compressed_texture_upload(VkCommandBuffer cmd, Texture& texture, const CompressedTexture& compressed, VkBuffer staging_buffer, VkDeviceSize staging_offset);
+
+    // Descriptor set for showing the texture with ImGui::Image, VK_NULL_HANDLE while the ImGui Vulkan backend
+    // is not initialized, e.g. when running headless
+    VkDescriptorSet create_imgui_descriptor_set(const Texture& texture);
 
     Buffer create_buffer(const BufferDesc& desc, size_t alignment = 0);
     void destroy_buffer(Buffer& buffer);
@@ -1,217 +1,541 @@
 #include "hot_reload.h"
 #include <unordered_map>
 #include "timer.h"
+#include "misc.h"
+#include "job_system.h"
+#include "file_watcher.h"
+#include "cpu_profiler.h"
+#include <algorithm>
+#include <mutex>
+#include <thread>
 
-static inline uint32_t murmur_32_scramble(uint32_t k) {
-	k *= 0xcc9e2d51;
-	k = (k << 15) | (k >> 17);
-	k *= 0x1b873593;
-	return k;
-}
-
-uint32_t murmur3_32(const uint8_t* key, size_t len, uint32_t seed)
-{
-	uint32_t h = seed;
-	uint32_t k;
-	/* Read in groups of 4. */
-	for (size_t i = len >> 2; i; i--) {
-		// Here is a source of differing results across endiannesses.
-		// A swap here has no effects on hash properties though.
-		memcpy(&k, key, sizeof(uint32_t));
-		key += sizeof(uint32_t);
-		h ^= murmur_32_scramble(k);
-		h = (h << 13) | (h >> 19);
-		h = h * 5 + 0xe6546b64;
-	}
-	/* Read the rest. */
-	k = 0;
-	for (size_t i = len & 3; i; i--) {
-		k <<= 8;
-		k |= key[i - 1];
-	}
-	// A swap is *not* necessary here because the preceding loop already
-	// places the low bytes in the low places according to whatever endianness
-	// we use. Swaps only apply when the memory is copied in a chunk.
-	h ^= murmur_32_scramble(k);
-	/* Finalize. */
-	h ^= len;
-	h ^= h >> 16;
-	h *= 0x85ebca6b;
-	h ^= h >> 13;
-	h *= 0xc2b2ae35;
-	h ^= h >> 16;
-	return h;
-}
+// Mixed into the content hashes so that assets of different types never deduplicate into each other,
+// register_asset<T> casts whatever it finds to T
+enum AssetKind : uint32_t
+{
+	ASSET_KIND_GRAPHICS_PIPELINE = 1,
+	ASSET_KIND_COMPUTE_PIPELINE,
+};
 
 const std::set<std::filesystem::path>& GraphicsPipelineAsset::get_dependencies() const
 {
 	return dependencies;
 }
 
-bool GraphicsPipelineAsset::reload_asset()
+bool GraphicsPipelineAsset::build_staged()
+{
+	staged = Pipeline{};
+	return builder.build(&staged);
+}
+
+void GraphicsPipelineAsset::swap_staged()
 {
-	bool result = builder.build(&pipeline);
-	if (result)
+	assert(previous.pipeline == VK_NULL_HANDLE && "Previous version has not been destroyed yet");
+	previous = pipeline;
+	pipeline = staged;
+	staged = Pipeline{};
+
+	dependencies.clear();
+	for (uint32_t i = 0; i < builder.pipeline_create_info.stageCount; ++i)
 	{
-		dependencies.clear();
-		for (uint32_t i = 0; i < builder.pipeline_create_info.stageCount; ++i)
-		{
-			dependencies.insert(
-				builder.shader_sources[i].shader_source.dependencies.begin(),
-				builder.shader_sources[i].shader_source.dependencies.end()
-			);
-		}
+		dependencies.insert(
+			builder.shader_sources[i].shader_source.dependencies.begin(),
+			builder.shader_sources[i].shader_source.dependencies.end()
+		);
 	}
+}
 
-	return result;
+void GraphicsPipelineAsset::destroy_previous()
+{
+	builder.destroy_resources(previous);
 }
 
-size_t GraphicsPipelineAsset::get_hash()
+void GraphicsPipelineAsset::destroy()
 {
-	return murmur3_32((uint8_t*)this, sizeof(GraphicsPipelineAsset), 42);
+	builder.destroy_resources(previous);
+	builder.destroy_resources(staged);
+	builder.destroy_resources(pipeline);
 }
 
-GraphicsPipelineAsset::GraphicsPipelineAsset(GraphicsPipelineBuilder build)
-	: builder(build)
+uint64_t GraphicsPipelineAsset::get_content_hash() const
+{
+	return hash_value_fnv1a_64(ASSET_KIND_GRAPHICS_PIPELINE, builder.get_content_hash());
+}
+
+std::string GraphicsPipelineAsset::get_name() const
 {
-	if (!reload_asset())
+	std::string name;
+	for (uint32_t i = 0; i < builder.pipeline_create_info.stageCount; ++i)
 	{
-		assert(false);
-		exit(1);
+		const ShaderSource& source = builder.shader_sources[i].shader_source;
+		if (i) name += " + ";
+		name += source.filepath + ":" + source.entry_point;
 	}
+	return name;
+}
+
+GraphicsPipelineAsset::GraphicsPipelineAsset(GraphicsPipelineBuilder build)
+	: builder(build)
+{
 }
 
 struct RegisteredAsset
 {
 	IAsset* asset;
-	uint64_t last_file_write;
+	uint64_t content_hash = 0;
+	uint32_t ref_count = 0;
 	bool dirty = false;
+	bool pending = true; // Not built yet, dependencies are unknown until then
+	bool retiring = false; // Holds a replaced version until the frames that used it are done
+	uint64_t retire_frame = 0;
+};
+
+struct AssetBuild
+{
+	uint64_t content_hash; // Looked up again when done, the registry may have changed in the meantime
+	IAsset* asset;
+	double build_ms;
+	bool success;
 };
 
-static uint64_t get_file_timestamp(const std::filesystem::path& path, std::error_code& ec)
+// Guards everything below, dirty flags are set from the file watcher thread
+static std::mutex catalog_mutex;
+static std::vector<RegisteredAsset> registered_assets;
+static std::unordered_map<uint64_t, size_t> assets_by_hash; // Index into registered_assets
+static uint32_t shared_registrations = 0;
+static std::unordered_map<std::string, std::vector<size_t>> assets_by_file; // Reverse dependency index
+static std::atomic<bool> any_dirty = false;
+static bool watching = false;
+static std::vector<std::string> failed_assets;
+
+// Background rebuild of dirty assets. A dedicated thread instead of the job system, since the frame
+// thread helps out with jobs while waiting and could end up stuck in a shader compile
+static std::thread rebuild_thread;
+static std::vector<AssetBuild> rebuilds; // Owned by the rebuild thread while it runs
+static std::atomic<bool> rebuild_done = false;
+static bool rebuild_running = false;
+
+// Dependencies may change with every build, e.g. when an include is added, so this runs after each of them
+static void rebuild_dependency_index()
 {
-	std::filesystem::file_time_type ftime = std::filesystem::last_write_time(path, ec);
-	if (ec.value() != 0)
+	assets_by_file.clear();
+	for (size_t i = 0; i < registered_assets.size(); ++i)
 	{
-		LOG_ERROR("Get file timestamp failed: %s", ec.message().c_str());
+		if (registered_assets[i].pending) continue;
+
+		const auto& dependencies = registered_assets[i].asset->get_dependencies();
+		assert(!dependencies.empty() && "Logic error: Asset has no dependencies!");
+		for (const auto& d : dependencies)
+		{
+			assets_by_file[d.string()].push_back(i);
+		}
 	}
-	return ftime.time_since_epoch().count();
-}
 
-static std::vector<RegisteredAsset> registered_assets;
+	if (watching)
+	{
+		std::vector<std::filesystem::path> files;
+		files.reserve(assets_by_file.size());
+		for (const auto& f : assets_by_file) files.push_back(f.first);
+		FileWatcher::watch_files(files);
+	}
+}
 
-void AssetCatalog::register_asset(IAsset* asset)
+static void on_files_changed(const std::vector<std::string>& changed_files, void*)
 {
-	auto iter = std::find_if(registered_assets.begin(), registered_assets.end(), [=](const RegisteredAsset& a)
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	for (const auto& f : changed_files)
+	{
+		auto it = assets_by_file.find(f);
+		if (it == assets_by_file.end()) continue;
+
+		LOG_INFO("'%s' changed, %zu assets affected", f.c_str(), it->second.size());
+		for (size_t index : it->second)
 		{
-			return asset->get_hash() == a.asset->get_hash();
-		});
+			registered_assets[index].dirty = true;
+		}
+		any_dirty = true;
+	}
+}
 
-	if (iter != registered_assets.end())
+static void rebuild_hash_index()
+{
+	assets_by_hash.clear();
+	for (size_t i = 0; i < registered_assets.size(); ++i)
 	{
-		LOG_ERROR("Asset already registered!");
-		return;
+		assets_by_hash[registered_assets[i].content_hash] = i;
+	}
+}
+
+IAsset* AssetCatalog::register_asset(IAsset* asset)
+{
+	const uint64_t content_hash = asset->get_content_hash();
+
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	auto it = assets_by_hash.find(content_hash);
+	if (it != assets_by_hash.end())
+	{
+		RegisteredAsset& existing = registered_assets[it->second];
+		if (existing.asset == asset)
+		{
+			LOG_ERROR("Asset already registered!");
+			return asset;
+		}
+
+		existing.ref_count++;
+		shared_registrations++;
+		delete asset;
+		return existing.asset;
 	}
 
 	RegisteredAsset new_asset{};
 	new_asset.asset = asset;
-	std::error_code ec;
-	uint64_t timestamp = 0;
-	const auto& dependencies = asset->get_dependencies();
-	for (const auto& d : dependencies)
+	new_asset.content_hash = content_hash;
+	new_asset.ref_count = 1;
+	assets_by_hash[content_hash] = registered_assets.size();
+	registered_assets.push_back(new_asset);
+
+	return asset;
+}
+
+void AssetCatalog::release_asset(IAsset* asset)
+{
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	auto it = std::find_if(registered_assets.begin(), registered_assets.end(), [=](const RegisteredAsset& a) { return a.asset == asset; });
+	if (it == registered_assets.end())
 	{
-		timestamp = std::max(get_file_timestamp(d, ec), timestamp);
+		LOG_ERROR("Released an asset that is not registered!");
+		return;
 	}
-	new_asset.last_file_write = timestamp;
-	registered_assets.push_back(new_asset);
+
+	assert(it->ref_count > 0);
+	if (--it->ref_count > 0) return;
+
+	// The rebuild thread may be using the asset. Wait for it and drop the asset's build, finish_rebuilds
+	// must not touch the asset once it is deleted
+	if (rebuild_thread.joinable()) rebuild_thread.join();
+	rebuilds.erase(std::remove_if(rebuilds.begin(), rebuilds.end(), [=](const AssetBuild& b) { return b.asset == asset; }), rebuilds.end());
+
+	const std::string name = asset->get_name();
+	failed_assets.erase(std::remove(failed_assets.begin(), failed_assets.end(), name), failed_assets.end());
+	asset->destroy();
+	delete asset;
+
+	registered_assets.erase(it);
+	rebuild_hash_index();
+	rebuild_dependency_index();
 }
 
-bool AssetCatalog::check_for_dirty_assets()
+static void build_asset(AssetBuild& build)
 {
+	CPU_ZONE("Build asset");
 	Timer timer;
 	timer.tick();
+	build.success = build.asset->build_staged();
+	timer.tock();
+	build.build_ms = timer.get_elapsed_milliseconds();
+}
 
-	bool any_dirty = false;
+static void build_asset_job(void* data, uint32_t index)
+{
+	build_asset(((AssetBuild*)data)[index]);
+}
 
-	for (auto& asset : registered_assets)
+static void rebuild_assets()
+{
+	CPUProfiler::set_thread_name("Asset rebuild");
+	for (AssetBuild& build : rebuilds)
 	{
-		const auto& dependencies = asset.asset->get_dependencies();
-		assert(!dependencies.empty() && "Logic error: Asset has no dependencies!");
-		std::error_code ec;
-		uint64_t timestamp = 0;
-		for (const auto& d : dependencies)
+		build_asset(build);
+	}
+	rebuild_done = true;
+}
+
+// Swaps in successful rebuilds, failed ones keep their previous version
+static void finish_rebuilds(uint64_t frame)
+{
+	if (rebuild_thread.joinable()) rebuild_thread.join();
+	rebuild_running = false;
+
+	for (const AssetBuild& build : rebuilds)
+	{
+		// release_asset drops the builds of released assets. Checking the asset as well guards against a
+		// new registration that reused a released asset's hash
+		auto it = assets_by_hash.find(build.content_hash);
+		if (it == assets_by_hash.end() || registered_assets[it->second].asset != build.asset) continue;
+
+		RegisteredAsset& registered = registered_assets[it->second];
+		const std::string name = build.asset->get_name();
+		failed_assets.erase(std::remove(failed_assets.begin(), failed_assets.end(), name), failed_assets.end());
+		if (!build.success)
 		{
-			timestamp = std::max(get_file_timestamp(d, ec), timestamp);
+			LOG_ERROR("Failed to rebuild asset '%s', keeping the previous version", name.c_str());
+			failed_assets.push_back(name);
+			continue;
 		}
-		if (timestamp != asset.last_file_write)
+
+		build.asset->swap_staged();
+		registered.retiring = true;
+		registered.retire_frame = frame;
+		LOG_INFO("Rebuilt asset '%s' in %.2f ms", name.c_str(), build.build_ms);
+	}
+	rebuilds.clear();
+
+	rebuild_dependency_index();
+}
+
+bool AssetCatalog::build_pending_assets()
+{
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+
+	std::vector<AssetBuild> builds;
+	for (size_t i = 0; i < registered_assets.size(); ++i)
+	{
+		if (registered_assets[i].pending) builds.push_back(AssetBuild{ registered_assets[i].content_hash, registered_assets[i].asset, 0.0, false });
+	}
+	if (builds.empty()) return true;
+
+	Timer timer;
+	timer.tick();
+
+	// Each build compiles its shaders and creates its pipeline independently of the others
+	JobCounter counter;
+	JobSystem::dispatch(build_asset_job, builds.data(), (uint32_t)builds.size(), &counter);
+	JobSystem::wait(&counter);
+
+	timer.tock();
+
+	bool all_success = true;
+	double total_build_ms = 0.0;
+	for (const AssetBuild& build : builds)
+	{
+		total_build_ms += build.build_ms;
+		if (!build.success)
 		{
-			asset.dirty = true;
-			LOG_INFO("Asset has been updated!");
+			LOG_ERROR("Failed to build asset '%s'", build.asset->get_name().c_str());
+			all_success = false;
+			continue;
 		}
 
-		any_dirty = any_dirty || asset.dirty;
+		// Nothing is rendering with these yet, so the empty previous version can go right away
+		build.asset->swap_staged();
+		build.asset->destroy_previous();
+		registered_assets[assets_by_hash[build.content_hash]].pending = false;
+		build.asset->ready = true;
 	}
+	rebuild_dependency_index();
 
-	timer.tock();
-	//LOG_DEBUG("Checking for dirty assets took %f ms", timer.get_elapsed_milliseconds());
+	std::sort(builds.begin(), builds.end(), [](const AssetBuild& a, const AssetBuild& b) { return a.build_ms > b.build_ms; });
+	LOG_INFO("Built %zu assets in %.2f ms (%.2f ms of work on %u threads), %u registrations shared an existing asset:", builds.size(),
+		timer.get_elapsed_milliseconds(), total_build_ms, JobSystem::get_worker_count() + 1, shared_registrations);
+	for (const AssetBuild& build : builds)
+	{
+		LOG_INFO("  %9.2f ms  %s", build.build_ms, build.asset->get_name().c_str());
+	}
 
-	return any_dirty;
+	return all_success;
 }
 
-bool AssetCatalog::reload_dirty_assets()
+void AssetCatalog::start_watching(bool force_polling)
 {
-	bool all_success = true;
+	FileWatcher::init(on_files_changed, nullptr, force_polling);
+
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	watching = true;
+	rebuild_dependency_index();
+}
+
+void AssetCatalog::stop_watching()
+{
+	FileWatcher::shutdown();
+
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	watching = false;
+}
+
+void AssetCatalog::update(uint64_t frame, uint32_t frames_in_flight)
+{
+	CPU_ZONE("Asset catalog update");
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+
 	for (auto& a : registered_assets)
 	{
-		if (a.dirty)
+		if (a.retiring && frame >= a.retire_frame + frames_in_flight)
 		{
-			if (a.asset->reload_asset())
-			{
-				a.dirty = false;
-
-				std::error_code ec;
-				uint64_t timestamp = 0;
-				const auto& dependencies = a.asset->get_dependencies();
-				for (const auto& d : dependencies)
-				{
-					timestamp = std::max(get_file_timestamp(d, ec), timestamp);
-				}
-				a.last_file_write = timestamp;
-				LOG_INFO("Successfully reloaded asset");
-			}
-			else
-			{
-				LOG_ERROR("Failed to reload asset");
-				all_success = false;
-			}
+			a.asset->destroy_previous();
+			a.retiring = false;
 		}
 	}
-	return all_success;
+
+	if (rebuild_running && rebuild_done)
+	{
+		finish_rebuilds(frame);
+	}
+
+	if (rebuild_running || !any_dirty) return;
+
+	// Assets still holding a replaced version wait for it to be destroyed before they are rebuilt again
+	bool deferred = false;
+	for (size_t i = 0; i < registered_assets.size(); ++i)
+	{
+		RegisteredAsset& a = registered_assets[i];
+		if (!a.dirty) continue;
+		if (a.retiring)
+		{
+			deferred = true;
+			continue;
+		}
+
+		a.dirty = false;
+		rebuilds.push_back(AssetBuild{ a.content_hash, a.asset, 0.0, false });
+	}
+	any_dirty = deferred;
+
+	if (!rebuilds.empty())
+	{
+		rebuild_done = false;
+		rebuild_running = true;
+		rebuild_thread = std::thread(rebuild_assets);
+	}
 }
 
 void AssetCatalog::force_reload_all()
 {
-	for (auto& a : registered_assets) a.dirty = true;
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	for (auto& a : registered_assets)
+	{
+		if (!a.pending) a.dirty = true;
+	}
+	any_dirty = true;
+}
+
+std::vector<std::string> AssetCatalog::get_failed_assets()
+{
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+	return failed_assets;
+}
+
+void AssetCatalog::shutdown()
+{
+	std::lock_guard<std::mutex> lock(catalog_mutex);
+
+	if (rebuild_running)
+	{
+		finish_rebuilds(0);
+	}
+
+	for (auto& a : registered_assets)
+	{
+		if (a.retiring)
+		{
+			a.asset->destroy_previous();
+			a.retiring = false;
+		}
+	}
 }
 
 const std::set<std::filesystem::path>& ComputePipelineAsset::get_dependencies()  const
 {
-	return builder.shader_source.shader_source.dependencies;
+	return dependencies;
+}
+
+bool ComputePipelineAsset::build_staged()
+{
+	staged = Pipeline{};
+	return builder.build(&staged);
 }
 
-bool ComputePipelineAsset::reload_asset()
+void ComputePipelineAsset::swap_staged()
 {
-	return builder.build(&pipeline);
+	assert(previous.pipeline == VK_NULL_HANDLE && "Previous version has not been destroyed yet");
+	previous = pipeline;
+	pipeline = staged;
+	staged = Pipeline{};
+
+	// Copied so the catalog never reads the builder while a rebuild is writing to it
+	dependencies = builder.shader_source.shader_source.dependencies;
 }
 
-size_t ComputePipelineAsset::get_hash()
+void ComputePipelineAsset::destroy_previous()
 {
-	return murmur3_32((uint8_t*)this, sizeof(ComputePipelineAsset), 1337);
+	builder.destroy_resources(previous);
+}
+
+void ComputePipelineAsset::destroy()
+{
+	builder.destroy_resources(previous);
+	builder.destroy_resources(staged);
+	builder.destroy_resources(pipeline);
+}
+
+uint64_t ComputePipelineAsset::get_content_hash() const
+{
+	return hash_value_fnv1a_64(ASSET_KIND_COMPUTE_PIPELINE, builder.get_content_hash());
+}
+
+std::string ComputePipelineAsset::get_name() const
+{
+	const ShaderSource& source = builder.shader_source.shader_source;
+	return source.filepath + ":" + source.entry_point;
 }
 
 ComputePipelineAsset::ComputePipelineAsset(ComputePipelineBuilder build)
 	: builder(build)
 {
-	if (!reload_asset())
-		exit(1);
+}
+
+GraphicsPipelineVariants::GraphicsPipelineVariants(const GraphicsPipelineBuilder& base_builder, std::initializer_list<uint32_t> constant_ids)
+	: builder(base_builder), constant_ids(constant_ids)
+{
+	assert(this->constant_ids.size() <= 32);
+	request(0);
+}
+
+GraphicsPipelineAsset* GraphicsPipelineVariants::request(uint32_t variant_mask)
+{
+	auto it = variants.find(variant_mask);
+	if (it != variants.end()) return it->second;
+
+	GraphicsPipelineBuilder variant_builder = builder;
+	for (uint32_t i = 0; i < variant_builder.pipeline_create_info.stageCount; ++i)
+	{
+		ShaderSource& source = variant_builder.shader_sources[i].shader_source;
+		for (uint32_t c = 0; c < (uint32_t)constant_ids.size(); ++c)
+		{
+			source.add_specialization_constant(constant_ids[c], (variant_mask & (1u << c)) != 0);
+		}
+	}
+
+	GraphicsPipelineAsset* asset = AssetCatalog::register_asset(new GraphicsPipelineAsset(variant_builder));
+	variants[variant_mask] = asset;
+	return asset;
+}
+
+GraphicsPipelineAsset* GraphicsPipelineVariants::get(uint32_t variant_mask)
+{
+	if (failed_variants.count(variant_mask)) return variants[0];
+
+	GraphicsPipelineAsset* asset = request(variant_mask);
+	if (!asset->is_ready())
+	{
+		// The shaders are already compiled, so this only costs the pipeline creation
+		AssetCatalog::build_pending_assets();
+		if (!asset->is_ready())
+		{
+			LOG_ERROR("Failed to build pipeline variant %u of '%s'", variant_mask, asset->get_name().c_str());
+			AssetCatalog::release_asset(asset);
+			variants.erase(variant_mask);
+			failed_variants.insert(variant_mask);
+			return variants[0];
+		}
+	}
+	return asset;
+}
+
+void GraphicsPipelineVariants::destroy()
+{
+	for (auto& v : variants)
+	{
+		AssetCatalog::release_asset(v.second);
+	}
+	variants.clear();
 }
@@ -5,43 +5,116 @@
 
 #include <set>
 #include <filesystem>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
 
+// Assets are rebuilt next to their live version so that rendering can continue while shaders compile.
+// build_staged runs off the render thread, swap_staged and destroy_previous on it
 struct IAsset
 {
+	virtual ~IAsset() {}
+
 	virtual const std::set<std::filesystem::path>& get_dependencies() const = 0;
-	virtual bool reload_asset() = 0;
-	virtual size_t get_hash() = 0;
+	virtual bool build_staged() = 0;
+	virtual void swap_staged() = 0; // The replaced version stays alive until destroy_previous
+	virtual void destroy_previous() = 0;
+	virtual void destroy() = 0; // All versions
+	virtual uint64_t get_content_hash() const = 0; // Assets with equal hashes are interchangeable
+	virtual std::string get_name() const = 0;
+
+	bool is_ready() const { return ready; }
+
+	std::atomic<bool> ready = false; // Set once the first build succeeded
 };
 
 struct GraphicsPipelineAsset : IAsset
 {
 	virtual const std::set<std::filesystem::path>& get_dependencies() const override;
-	virtual bool reload_asset() override;
-	virtual size_t get_hash() override;
+	virtual bool build_staged() override;
+	virtual void swap_staged() override;
+	virtual void destroy_previous() override;
+	virtual void destroy() override;
+	virtual uint64_t get_content_hash() const override;
+	virtual std::string get_name() const override;
 
 	GraphicsPipelineAsset(GraphicsPipelineBuilder build);
 
 	std::set<std::filesystem::path> dependencies;
 	GraphicsPipelineBuilder builder;
 	Pipeline pipeline;
+	Pipeline staged;
+	Pipeline previous;
 };
 
 struct ComputePipelineAsset : IAsset
 {
 	virtual const std::set<std::filesystem::path>& get_dependencies() const override;
-	virtual bool reload_asset() override;
-	virtual size_t get_hash() override;
+	virtual bool build_staged() override;
+	virtual void swap_staged() override;
+	virtual void destroy_previous() override;
+	virtual void destroy() override;
+	virtual uint64_t get_content_hash() const override;
+	virtual std::string get_name() const override;
 
 	ComputePipelineAsset(ComputePipelineBuilder build);
 
+	std::set<std::filesystem::path> dependencies;
 	ComputePipelineBuilder builder;
 	Pipeline pipeline;
+	Pipeline staged;
+	Pipeline previous;
+};
+
+// Graphics pipelines that only differ in boolean specialization constants. The variants share the compiled
+// shaders of the base builder, since specialization happens at pipeline creation. The base variant is
+// registered right away, every other one when it is first requested.
+struct GraphicsPipelineVariants
+{
+	// Bit i of a variant mask sets specialization constant constant_ids[i] to true in every stage
+	GraphicsPipelineVariants(const GraphicsPipelineBuilder& base_builder, std::initializer_list<uint32_t> constant_ids);
+
+	// Builds the variant if it does not exist yet. Falls back to the base variant if that fails
+	GraphicsPipelineAsset* get(uint32_t variant_mask);
+	void destroy();
+
+	GraphicsPipelineBuilder builder;
+	std::vector<uint32_t> constant_ids;
+	std::unordered_map<uint32_t, GraphicsPipelineAsset*> variants;
+	std::unordered_set<uint32_t> failed_variants; // Not retried until restart
+
+private:
+	GraphicsPipelineAsset* request(uint32_t variant_mask);
 };
 
 namespace AssetCatalog
 {
-	void register_asset(IAsset* asset);
-	bool check_for_dirty_assets();
-	bool reload_dirty_assets();
+	// Registered assets are not built until build_pending_assets is called. If an asset with the same content
+	// is already registered, the passed one is deleted and the existing one is returned with its reference
+	// count increased. Always use the returned asset
+	IAsset* register_asset(IAsset* asset);
+	template <typename T>
+	T* register_asset(T* asset) { return static_cast<T*>(register_asset(static_cast<IAsset*>(asset))); }
+
+	// Destroys and deletes the asset once the last reference is released. The GPU must not be using it
+	void release_asset(IAsset* asset);
+
+	// Builds every asset registered since the last call in parallel on the job system and logs the cost of each.
+	// Returns false if any of them failed
+	bool build_pending_assets();
+
+	// Watches the dependencies of all built assets on a background thread. A changed file only marks the
+	// assets depending on it dirty
+	void start_watching(bool force_polling = false);
+	void stop_watching();
+
+	// Call once per frame before recording commands. Swaps in assets whose background rebuild finished,
+	// destroys versions the GPU can no longer be using and starts rebuilding dirty assets.
+	// A failed rebuild keeps the previous version and is listed by get_failed_assets until it succeeds
+	void update(uint64_t frame, uint32_t frames_in_flight);
 	void force_reload_all();
+	std::vector<std::string> get_failed_assets();
+
+	// Waits for a running rebuild and destroys all replaced versions. The GPU has to be idle
+	void shutdown();
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "job_system.h"
+#include "log.h"
+#include "cpu_profiler.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+
+struct JobQueue
+{
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+static std::vector<std::thread> workers;
+static std::vector<std::unique_ptr<JobQueue>> queues; // Index 0 belongs to the main thread
+static std::atomic<uint32_t> queued_jobs = 0;
+static std::atomic<uint32_t> next_queue = 0;
+static std::atomic<bool> should_quit = false;
+static std::mutex wake_mutex;
+static std::condition_variable wake_condition;
+
+static thread_local uint32_t thread_queue_index = 0;
+
+// Owner pops from the back for locality, thieves take from the front
+static bool pop_job(uint32_t queue_index, Job& out_job, bool steal)
+{
+	JobQueue& queue = *queues[queue_index];
+	std::lock_guard<std::mutex> lock(queue.mutex);
+	if (queue.jobs.empty()) return false;
+
+	if (steal)
+	{
+		out_job = queue.jobs.front();
+		queue.jobs.pop_front();
+	}
+	else
+	{
+		out_job = queue.jobs.back();
+		queue.jobs.pop_back();
+	}
+	queued_jobs--;
+	return true;
+}
+
+static bool get_job(Job& out_job)
+{
+	if (queued_jobs.load(std::memory_order_relaxed) == 0) return false;
+
+	const uint32_t queue_count = (uint32_t)queues.size();
+	if (pop_job(thread_queue_index, out_job, false)) return true;
+	for (uint32_t i = 1; i < queue_count; ++i)
+	{
+		if (pop_job((thread_queue_index + i) % queue_count, out_job, true)) return true;
+	}
+	return false;
+}
+
+static void execute_job(const Job& job)
+{
+	job.function(job.data, job.index);
+	job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static void worker_main(uint32_t queue_index)
+{
+	thread_queue_index = queue_index;
+	char thread_name[CPU_PROFILER_THREAD_NAME_LENGTH];
+	snprintf(thread_name, sizeof(thread_name), "Job worker %u", queue_index);
+	CPUProfiler::set_thread_name(thread_name);
+	while (true)
+	{
+		Job job;
+		if (get_job(job))
+		{
+			execute_job(job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		wake_condition.wait(lock, [] { return should_quit || queued_jobs > 0; });
+		if (should_quit) break;
+	}
+}
+
+void JobSystem::init(uint32_t worker_count)
+{
+	assert(workers.empty());
+	if (worker_count == UINT32_MAX)
+	{
+		const uint32_t cores = std::thread::hardware_concurrency();
+		worker_count = cores > 1 ? cores - 1 : 0;
+	}
+
+	should_quit = false;
+	queues.clear();
+	for (uint32_t i = 0; i < worker_count + 1; ++i) queues.push_back(std::make_unique<JobQueue>());
+	for (uint32_t i = 0; i < worker_count; ++i) workers.emplace_back(worker_main, i + 1);
+
+	LOG_INFO("Job system started with %u worker threads", worker_count);
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+		should_quit = true;
+	}
+	wake_condition.notify_all();
+	for (auto& w : workers) w.join();
+	workers.clear();
+	queues.clear();
+}
+
+uint32_t JobSystem::get_worker_count()
+{
+	return (uint32_t)workers.size();
+}
+
+void JobSystem::dispatch(JobFunction function, void* data, uint32_t job_count, JobCounter* counter)
+{
+	assert(counter);
+	if (job_count == 0) return;
+
+	counter->pending.fetch_add(job_count, std::memory_order_relaxed);
+
+	// Not initialized, run inline
+	if (queues.empty())
+	{
+		for (uint32_t i = 0; i < job_count; ++i) execute_job(Job{ function, data, i, counter });
+		return;
+	}
+
+	const uint32_t queue_count = (uint32_t)queues.size();
+	for (uint32_t i = 0; i < job_count; ++i)
+	{
+		JobQueue& queue = *queues[next_queue++ % queue_count];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(Job{ function, data, i, counter });
+		queued_jobs++;
+	}
+
+	// Taking the lock orders the notify after any worker that is between its queue check and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(wake_mutex);
+	}
+	wake_condition.notify_all();
+}
+
+void JobSystem::wait(JobCounter* counter)
+{
+	while (counter->pending.load(std::memory_order_acquire) != 0)
+	{
+		Job job;
+		if (get_job(job)) execute_job(job);
+		else std::this_thread::yield();
+	}
+}
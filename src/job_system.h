@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+typedef void (*JobFunction)(void* data, uint32_t job_index);
+
+// Tracks completion of a batch of jobs. Must outlive the jobs dispatched with it
+struct JobCounter
+{
+	std::atomic<uint32_t> pending = 0;
+};
+
+struct Job
+{
+	JobFunction function;
+	void* data;
+	uint32_t index;
+	JobCounter* counter;
+};
+
+// Work stealing job scheduler. Every worker owns a queue, jobs are spread round robin across queues and
+// idle workers steal from the others. The thread calling wait() executes jobs too, so dispatching
+// with zero workers degrades into running everything inline.
+namespace JobSystem
+{
+	void init(uint32_t worker_count = UINT32_MAX); // UINT32_MAX = one worker per core besides the main thread
+	void shutdown();
+	uint32_t get_worker_count();
+
+	// Runs function(data, i) for i in [0, job_count)
+	void dispatch(JobFunction function, void* data, uint32_t job_count, JobCounter* counter);
+	void wait(JobCounter* counter);
+}
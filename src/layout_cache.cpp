@@ -0,0 +1,231 @@
+#include "layout_cache.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+	// Keyed by the exact create parameters, serialized field by field so padding never takes part
+	template <typename T>
+	struct HandleCache
+	{
+		struct Entry
+		{
+			VkDevice device;
+			T handle;
+			uint32_t ref_count;
+		};
+
+		std::unordered_map<std::string, Entry> entries;
+		std::unordered_map<uint64_t, std::string> signatures; // By handle
+	};
+
+	struct Signature
+	{
+		std::string bytes;
+
+		template <typename V>
+		Signature& add(const V& value)
+		{
+			bytes.append((const char*)&value, sizeof(value));
+			return *this;
+		}
+	};
+
+	static std::mutex mutex;
+	static HandleCache<VkDescriptorSetLayout> set_layouts;
+	static HandleCache<VkPipelineLayout> pipeline_layouts;
+	static HandleCache<VkDescriptorUpdateTemplate> update_templates;
+	static LayoutCacheStats stats;
+}
+
+// Returns the cached handle with its reference count incremented, or VK_NULL_HANDLE on a miss
+template <typename T>
+static T acquire(HandleCache<T>& cache, const std::string& signature)
+{
+	auto it = cache.entries.find(signature);
+	if (it == cache.entries.end())
+	{
+		stats.misses++;
+		return VK_NULL_HANDLE;
+	}
+
+	stats.hits++;
+	it->second.ref_count++;
+	return it->second.handle;
+}
+
+template <typename T>
+static void insert(HandleCache<T>& cache, const std::string& signature, VkDevice device, T handle)
+{
+	cache.entries[signature] = { device, handle, 1 };
+	cache.signatures[(uint64_t)handle] = signature;
+}
+
+// Returns true if this was the last reference, the caller destroys the handle
+template <typename T>
+static bool release(HandleCache<T>& cache, T handle, VkDevice& out_device)
+{
+	auto signature = cache.signatures.find((uint64_t)handle);
+	if (signature == cache.signatures.end())
+	{
+		assert(false && "Handle was not acquired from the layout cache");
+		return false;
+	}
+
+	auto it = cache.entries.find(signature->second);
+	assert(it != cache.entries.end() && it->second.ref_count > 0);
+	if (--it->second.ref_count > 0) return false;
+
+	out_device = it->second.device;
+	cache.entries.erase(it);
+	cache.signatures.erase(signature);
+	return true;
+}
+
+namespace LayoutCache
+{
+
+void shutdown()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	const size_t leaked = update_templates.entries.size() + pipeline_layouts.entries.size() + set_layouts.entries.size();
+	if (leaked > 0) LOG_WARNING("%zu layout objects were never released", leaked);
+
+	for (const auto& e : update_templates.entries) vkDestroyDescriptorUpdateTemplate(e.second.device, e.second.handle, nullptr);
+	for (const auto& e : pipeline_layouts.entries) vkDestroyPipelineLayout(e.second.device, e.second.handle, nullptr);
+	for (const auto& e : set_layouts.entries) vkDestroyDescriptorSetLayout(e.second.device, e.second.handle, nullptr);
+
+	update_templates = {};
+	pipeline_layouts = {};
+	set_layouts = {};
+	stats = LayoutCacheStats{};
+}
+
+VkDescriptorSetLayout acquire_set_layout(VkDevice device, std::vector<VkDescriptorSetLayoutBinding> bindings)
+{
+	std::sort(bindings.begin(), bindings.end(), [](const VkDescriptorSetLayoutBinding& a, const VkDescriptorSetLayoutBinding& b)
+		{
+			return a.binding < b.binding;
+		});
+
+	Signature signature;
+	signature.add(device);
+	for (const auto& b : bindings)
+	{
+		assert(!b.pImmutableSamplers && "Immutable samplers are not part of the signature");
+		signature.add(b.binding).add(b.descriptorType).add(b.descriptorCount).add(b.stageFlags);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	VkDescriptorSetLayout layout = acquire(set_layouts, signature.bytes);
+	if (layout != VK_NULL_HANDLE) return layout;
+
+	VkDescriptorSetLayoutCreateInfo info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+	info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+	info.bindingCount = (uint32_t)bindings.size();
+	info.pBindings = bindings.data();
+	VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &layout));
+
+	insert(set_layouts, signature.bytes, device, layout);
+	stats.set_layouts++;
+	return layout;
+}
+
+VkPipelineLayout acquire_pipeline_layout(VkDevice device, const VkDescriptorSetLayout* layouts, uint32_t set_layout_count, const VkPushConstantRange& push_constants)
+{
+	// Set layouts are either cached or owned by the caller, so equal handles mean equal layouts
+	Signature signature;
+	signature.add(device).add(set_layout_count);
+	for (uint32_t i = 0; i < set_layout_count; ++i) signature.add(layouts[i]);
+	signature.add(push_constants.stageFlags).add(push_constants.offset).add(push_constants.size);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	VkPipelineLayout layout = acquire(pipeline_layouts, signature.bytes);
+	if (layout != VK_NULL_HANDLE) return layout;
+
+	VkPipelineLayoutCreateInfo info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+	info.setLayoutCount = set_layout_count;
+	info.pSetLayouts = layouts;
+	info.pPushConstantRanges = &push_constants;
+	info.pushConstantRangeCount = push_constants.size != 0 ? 1 : 0;
+	VK_CHECK(vkCreatePipelineLayout(device, &info, nullptr, &layout));
+
+	insert(pipeline_layouts, signature.bytes, device, layout);
+	stats.pipeline_layouts++;
+	return layout;
+}
+
+VkDescriptorUpdateTemplate acquire_update_template(VkDevice device, std::vector<VkDescriptorUpdateTemplateEntry> entries,
+	VkPipelineBindPoint bind_point, VkDescriptorSetLayout set_layout, VkPipelineLayout pipeline_layout)
+{
+	std::sort(entries.begin(), entries.end(), [](const VkDescriptorUpdateTemplateEntry& a, const VkDescriptorUpdateTemplateEntry& b)
+		{
+			return a.dstBinding < b.dstBinding;
+		});
+
+	Signature signature;
+	signature.add(device).add(bind_point).add(set_layout).add(pipeline_layout);
+	for (const auto& e : entries)
+	{
+		signature.add(e.dstBinding).add(e.dstArrayElement).add(e.descriptorCount).add(e.descriptorType).add(e.offset).add(e.stride);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	VkDescriptorUpdateTemplate update_template = acquire(update_templates, signature.bytes);
+	if (update_template != VK_NULL_HANDLE) return update_template;
+
+	VkDescriptorUpdateTemplateCreateInfo info{ VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+	info.descriptorUpdateEntryCount = (uint32_t)entries.size();
+	info.pDescriptorUpdateEntries = entries.data();
+	info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
+	info.descriptorSetLayout = set_layout;
+	info.pipelineBindPoint = bind_point;
+	info.pipelineLayout = pipeline_layout;
+	info.set = 0;
+	VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &info, nullptr, &update_template));
+
+	insert(update_templates, signature.bytes, device, update_template);
+	stats.update_templates++;
+	return update_template;
+}
+
+void release_set_layout(VkDescriptorSetLayout set_layout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	VkDevice device;
+	if (!release(set_layouts, set_layout, device)) return;
+
+	vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+	stats.set_layouts--;
+}
+
+void release_pipeline_layout(VkPipelineLayout pipeline_layout)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	VkDevice device;
+	if (!release(pipeline_layouts, pipeline_layout, device)) return;
+
+	vkDestroyPipelineLayout(device, pipeline_layout, nullptr);
+	stats.pipeline_layouts--;
+}
+
+void release_update_template(VkDescriptorUpdateTemplate update_template)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	VkDevice device;
+	if (!release(update_templates, update_template, device)) return;
+
+	vkDestroyDescriptorUpdateTemplate(device, update_template, nullptr);
+	stats.update_templates--;
+}
+
+LayoutCacheStats get_stats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return stats;
+}
+
+} // namespace LayoutCache
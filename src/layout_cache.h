@@ -0,0 +1,33 @@
+#pragma once
+#include "defines.h"
+#include <vector>
+
+struct LayoutCacheStats
+{
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	uint32_t set_layouts = 0; // Alive right now
+	uint32_t pipeline_layouts = 0;
+	uint32_t update_templates = 0;
+};
+
+// Shares descriptor set layouts, pipeline layouts and descriptor update templates between pipelines whose
+// reflected signatures are identical. Objects are reference counted, every acquire must be paired with a
+// release of the returned handle. Safe to call from multiple threads.
+namespace LayoutCache
+{
+	void shutdown(); // Destroys whatever was not released
+
+	// Push descriptor set layout. Binding order does not matter
+	VkDescriptorSetLayout acquire_set_layout(VkDevice device, std::vector<VkDescriptorSetLayoutBinding> bindings);
+	VkPipelineLayout acquire_pipeline_layout(VkDevice device, const VkDescriptorSetLayout* layouts, uint32_t set_layout_count, const VkPushConstantRange& push_constants);
+	// Push descriptor template for set 0
+	VkDescriptorUpdateTemplate acquire_update_template(VkDevice device, std::vector<VkDescriptorUpdateTemplateEntry> entries,
+		VkPipelineBindPoint bind_point, VkDescriptorSetLayout set_layout, VkPipelineLayout pipeline_layout);
+
+	void release_set_layout(VkDescriptorSetLayout set_layout);
+	void release_pipeline_layout(VkPipelineLayout pipeline_layout);
+	void release_update_template(VkDescriptorUpdateTemplate update_template);
+
+	LayoutCacheStats get_stats();
+}
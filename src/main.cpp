@@ -19,8 +19,11 @@
 #include "pipeline.h"
 #include "shaders.h"
 #include "sdf.h"
+#include "sdf_bake.h"
 #include "gmath.h"
 #include "hot_reload.h"
+#include "layout_cache.h"
+#include "file_watcher.h"
 #include "mesh.h"
 #include "buffer.h"
 #include "texture.h"
@@ -33,6 +36,12 @@
 #include "radix_sort.h"
 #include "camera.h"
 #include "timer.h"
+#include "job_system.h"
+#include "benchmark.h"
+#include "gpu_profiler.h"
+#include "cpu_profiler.h"
+#include "render_graph.h"
+#include "particle_benchmark.h"
 
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_sdl2.h"
@@ -46,9 +55,6 @@ constexpr uint32_t DEPTH_TEXTURE_SIZE = 2048;
 
 Context ctx;
 
-static std::atomic<bool> needs_hot_reload = false;
-static std::atomic<bool> hot_reload_watcher_should_quit = false;
-
 template <typename F>
 void traverse_tree(const cgltf_node* node, F&& f)
 {
@@ -71,12 +77,13 @@ bool init_imgui()
     info.MinImageCount = ctx.swapchain.requested_min_image_count;
     info.ImageCount = ctx.swapchain.image_count;
     info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    info.PipelineCache = ctx.pipeline_cache;
     info.UseDynamicRendering = true;
     VkFormat color_attachment_format = ctx.swapchain.image_format;
     info.PipelineRenderingCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
     info.PipelineRenderingCreateInfo.pColorAttachmentFormats = &color_attachment_format;
     info.PipelineRenderingCreateInfo.colorAttachmentCount = 1;
-    info.PipelineRenderingCreateInfo.depthAttachmentFormat = VK_FORMAT_D32_SFLOAT;
+    info.PipelineRenderingCreateInfo.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -135,16 +142,157 @@ namespace Input
     }
 }
 
+// Bakes every mesh instance of the default scene, in world space, into one SDF. Writing it to
+// PARTICLE_COLLISION_SDF_PATH makes it the collision volume of the CPU particle systems.
+// Without use_cache every run bakes, which is what timing runs want
+static bool bake_scene_sdf(const char* gltf_path, const char* output_path, bool use_cache)
+{
+    cgltf_options opt{};
+    cgltf_data* gltf_data = nullptr;
+    if (cgltf_parse_file(&opt, gltf_path, &gltf_data) != cgltf_result_success ||
+        cgltf_load_buffers(&opt, gltf_data, gltf_path) != cgltf_result_success)
+    {
+        LOG_ERROR("Failed to load glTF '%s'!", gltf_path);
+        cgltf_free(gltf_data);
+        return false;
+    }
+
+    std::vector<MeshGeometry> geometry(load_mesh_geometry(gltf_data, nullptr, 0));
+    load_mesh_geometry(gltf_data, geometry.data(), geometry.size());
+
+    MeshGeometry scene_geometry;
+    uint32_t instance_count = 0;
+    auto add_instance = [&](const cgltf_node* node)
+        {
+            if (!node->mesh) return;
+            const MeshGeometry& mesh = geometry[cgltf_mesh_index(gltf_data, node->mesh)];
+            glm::mat4 transform;
+            cgltf_node_transform_world(node, glm::value_ptr(transform));
+
+            // Indices stay relative to first_vertex, so only the primitive offsets need rebasing
+            const uint32_t first_vertex = (uint32_t)scene_geometry.position.size();
+            const uint32_t first_index = (uint32_t)scene_geometry.indices.size();
+            for (const glm::vec3& p : mesh.position) scene_geometry.position.push_back(glm::vec3(transform * glm::vec4(p, 1.0f)));
+            scene_geometry.indices.insert(scene_geometry.indices.end(), mesh.indices.begin(), mesh.indices.end());
+            for (Mesh::Primitive primitive : mesh.primitives)
+            {
+                primitive.first_vertex += first_vertex;
+                primitive.first_index += first_index;
+                scene_geometry.primitives.push_back(primitive);
+            }
+            ++instance_count;
+        };
+
+    const cgltf_scene* scene = gltf_data->scene ? gltf_data->scene : gltf_data->scenes;
+    for (size_t i = 0; scene && i < scene->nodes_count; ++i)
+    {
+        traverse_tree(scene->nodes[i], add_instance);
+    }
+    cgltf_free(gltf_data);
+
+    LOG_INFO("Baking %u mesh instances, %zu vertices", instance_count, scene_geometry.position.size());
+
+    SDFBakeSettings settings;
+    if (!use_cache) settings.cache_directory = nullptr;
+    SDF sdf;
+    Timer timer;
+    timer.tick();
+    if (!sdf_bake_mesh(sdf, scene_geometry, settings)) return false;
+    timer.tock();
+
+    // Cache hits are mapped from the .sdfb, fresh bakes live in sdf.data
+    const glm::uvec3 dims = sdf.dims;
+    if (sdf.mapped_file)
+    {
+        LOG_INFO("Loaded the %ux%ux%u bake from the cache in %.2f ms, run with --no-cache to time the bake", dims.x, dims.y, dims.z,
+            timer.get_elapsed_milliseconds());
+    }
+    else
+    {
+        LOG_INFO("Bake at resolution %u: %ux%ux%u voxels in %.2f ms, %.1f Mvoxels/s", settings.resolution, dims.x, dims.y, dims.z,
+            timer.get_elapsed_milliseconds(), (double)dims.x * dims.y * dims.z / (timer.get_elapsed_milliseconds() * 1000.0));
+    }
+
+    // Both the baker and its cache produce FLOAT32 payloads
+    assert(sdf.payload_format == SDFPayloadFormat::FLOAT32);
+    const bool written = sdf_write_binary(output_path, sdf.dims, sdf.grid_origin, sdf.grid_spacing, (const float*)sdf.payload, SDFPayloadFormat::FLOAT32);
+    if (written) LOG_INFO("Wrote '%s'", output_path);
+    sdf.unload();
+    return written;
+}
 
 int main(int argc, char** argv)
 {
-    if (argc != 2)
+    if (argc == 2 && strcmp(argv[1], "--zone-overhead") == 0)
+    { // Microbenchmark of an empty CPU_ZONE, no window or device needed
+        CPUProfiler::set_thread_name("Main");
+        const uint32_t zone_count = 10000000;
+        const double zone_ns = CPUProfiler::measure_zone_overhead(zone_count);
+        printf("CPU_ZONE overhead: %.2f ns per zone over %u zones\n", zone_ns, zone_count);
+        CPUProfiler::shutdown();
+        return 0;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "--watcher-benchmark") == 0)
+    { // Shader hot reload dirty check latency over a realistic number of watched files, no window or device needed
+        const uint32_t file_count = 1000;
+        FileWatcher::run_benchmark(file_count);
+        return 0;
+    }
+
+    if (argc >= 3 && argc <= 5 && strcmp(argv[1], "--bake-sdf") == 0)
+    { // Offline scene SDF bake, no window or device needed
+        const char* output_path = PARTICLE_COLLISION_SDF_PATH;
+        bool use_cache = true;
+        for (int i = 3; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "--no-cache") == 0) use_cache = false;
+            else output_path = argv[i];
+        }
+
+        CPUProfiler::set_thread_name("Main");
+        JobSystem::init();
+        const bool success = bake_scene_sdf(argv[2], output_path, use_cache);
+        JobSystem::shutdown();
+        CPUProfiler::shutdown();
+        return success ? 0 : EXIT_FAILURE;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--particle-benchmark") == 0)
+    { // CPU particle simulation microbenchmarks, no window or device needed
+        if (strcmp(argv[2], "layout") == 0)
+        {
+            ParticleBenchmark::run_layouts();
+            return 0;
+        }
+        if (strcmp(argv[2], "threads") == 0)
+        {
+            CPUProfiler::set_thread_name("Main");
+            ParticleBenchmark::run_thread_scaling();
+            CPUProfiler::shutdown();
+            return 0;
+        }
+        if (strcmp(argv[2], "random") == 0)
+        {
+            ParticleBenchmark::run_random();
+            return 0;
+        }
+        LOG_ERROR("Unknown particle benchmark '%s'", argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    BenchmarkSettings benchmark;
+    if (!Benchmark::parse_arguments(argc, argv, benchmark))
     {
-        printf("Usage: %s <path-to-glb-file>\n", argv[0]);
+        printf("Usage: %s <path-to-glb-file> [--textures dir] [--benchmark [--frames N] [--warmup N] [--resolution WxH] [--output file.json]]\n", argv[0]);
+        printf("       %s --zone-overhead\n", argv[0]);
+        printf("       %s --watcher-benchmark\n", argv[0]);
+        printf("       %s --particle-benchmark layout|threads|random\n", argv[0]);
+        printf("       %s --bake-sdf <path-to-glb-file> [output.sdfb] [--no-cache]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    const char* gltf_path = argv[1];
+    const char* gltf_path = benchmark.scene_path;
     cgltf_options opt{};
     cgltf_data* gltf_data = nullptr;
     cgltf_result res = cgltf_parse_file(&opt, gltf_path, &gltf_data);
@@ -162,13 +310,32 @@ int main(int argc, char** argv)
         exit(EXIT_FAILURE);
     }
 
-    ctx.init(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT);
+    Timer startup_timer;
+    startup_timer.tick();
 
-    init_imgui();
+    if (benchmark.enabled)
+    {
+        ctx.init(benchmark.width, benchmark.height, true);
+    }
+    else
+    {
+        ctx.init(INITIAL_WINDOW_WIDTH, INITIAL_WINDOW_HEIGHT);
+        init_imgui();
+    }
 
     // Init shader compiler
     Shaders::init();
 
+    CPUProfiler::set_thread_name("Main");
+    JobSystem::init();
+
+    // Decoding runs on its own threads, the first frame renders with placeholders
+    TextureCatalog texture_catalog{};
+    if (benchmark.texture_directory)
+    {
+        texture_catalog.init(&ctx, benchmark.texture_directory);
+    }
+
     VkSampler anisotropic_sampler = VK_NULL_HANDLE;
     {
         VkSamplerCreateInfo info{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
@@ -225,71 +392,24 @@ int main(int argc, char** argv)
     Texture shadowmap_texture{};
     ctx.create_texture(shadowmap_texture, DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE, 1u, VK_FORMAT_D32_SFLOAT, VK_IMAGE_TYPE_2D, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, 1, 4);
 
-    Texture hdr_render_target{};
-    ctx.create_texture(hdr_render_target, ctx.window_width, ctx.window_height, 1, RENDER_TARGET_FORMAT, VK_IMAGE_TYPE_2D, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT);
-    
-    { 
-        VkCommandBuffer cmd = ctx.allocate_and_begin_command_buffer();
-
-        // Transition depth buffer layout
-        // Nvidia hardware has no concept of image layouts, and that's what I'm using, so using VK_IMAGE_LAYOUT_GENERAL for now...
-        VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-            VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-            0,
-            VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT,
-            VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
-            VK_IMAGE_LAYOUT_UNDEFINED,
-            VK_IMAGE_LAYOUT_GENERAL,
-            depth_texture.image,
-            VK_IMAGE_ASPECT_DEPTH_BIT
-        );
-
-        VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-        dep_info.imageMemoryBarrierCount = 1;
-        dep_info.pImageMemoryBarriers = &barrier;
-        vkCmdPipelineBarrier2(cmd, &dep_info);
-
-        ctx.end_command_buffer_submit_and_free(cmd);
-    }
-
-    GraphicsPipelineAsset* depth_prepass = nullptr;
-    { // Depth prepass pipeline
-        GraphicsPipelineBuilder pipeline_builder(ctx.device, true);
-        pipeline_builder.set_vertex_shader_filepath("depth_prepass.hlsl")
-            .set_fragment_shader_filepath("depth_prepass.hlsl")
-            .set_cull_mode(VK_CULL_MODE_NONE)
-            .set_depth_format(VK_FORMAT_D32_SFLOAT)
-            .set_depth_test(VK_TRUE)
-            .set_depth_write(VK_TRUE)
-            .set_depth_compare_op(VK_COMPARE_OP_LESS)
-            .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
-
-        depth_prepass = new GraphicsPipelineAsset(pipeline_builder);
-        AssetCatalog::register_asset(depth_prepass);
-    }
+    // Layouts, barriers and the HDR target's memory are handled by the render graph in the frame loop
+    RenderGraph render_graph;
+    render_graph.init(&ctx);
 
-    // Variant with discard based on noise
-	GraphicsPipelineAsset* depth_prepass_disintegrate;
-	{
-		GraphicsPipelineBuilder pipeline_builder(ctx.device, true);
-        ShaderSource vertex_source("depth_prepass.hlsl", "vs_main");
-        vertex_source.add_specialization_constant(1, true);
-        ShaderSource fragment_source("depth_prepass.hlsl", "fs_main");
-        fragment_source.add_specialization_constant(1, true);
-		pipeline_builder
-            .set_vertex_shader_source(vertex_source)
-			.set_fragment_shader_source(fragment_source)
-			.set_cull_mode(VK_CULL_MODE_NONE)
-			.set_depth_format(VK_FORMAT_D32_SFLOAT)
-			.set_depth_test(VK_TRUE)
-			.set_depth_write(VK_TRUE)
-			.set_depth_compare_op(VK_COMPARE_OP_LESS)
-            .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
-		depth_prepass_disintegrate = new GraphicsPipelineAsset(pipeline_builder);
-		AssetCatalog::register_asset(depth_prepass_disintegrate);
-	}
+    // Variant bit 0 sets CAN_DISINTEGRATE, which discards based on noise
+    GraphicsPipelineBuilder depth_prepass_builder(ctx.device, true, ctx.pipeline_cache);
+    depth_prepass_builder.set_vertex_shader_filepath("depth_prepass.hlsl")
+        .set_fragment_shader_filepath("depth_prepass.hlsl")
+        .set_cull_mode(VK_CULL_MODE_NONE)
+        .set_depth_format(VK_FORMAT_D32_SFLOAT)
+        .set_depth_test(VK_TRUE)
+        .set_depth_write(VK_TRUE)
+        .set_depth_compare_op(VK_COMPARE_OP_LESS)
+        .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
+    GraphicsPipelineVariants depth_prepass_variants(depth_prepass_builder, { 1 });
+    GraphicsPipelineAsset* depth_prepass = depth_prepass_variants.variants[0];
 
-    GraphicsPipelineBuilder pipeline_builder(ctx.device, true);
+    GraphicsPipelineBuilder pipeline_builder(ctx.device, true, ctx.pipeline_cache);
     pipeline_builder
         .set_vertex_shader_filepath("forward.hlsl")
         .set_fragment_shader_filepath("forward.hlsl")
@@ -301,11 +421,11 @@ int main(int argc, char** argv)
         .set_depth_compare_op(VK_COMPARE_OP_EQUAL)
         .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
 
-    GraphicsPipelineAsset* pipeline = new GraphicsPipelineAsset(pipeline_builder);
-    AssetCatalog::register_asset(pipeline);
+    GraphicsPipelineAsset* pipeline = AssetCatalog::register_asset(new GraphicsPipelineAsset(pipeline_builder));
 
 
-    GraphicsPipelineBuilder shadowmap_builder(ctx.device, true);
+    // Same variant bits as the depth prepass
+    GraphicsPipelineBuilder shadowmap_builder(ctx.device, true, ctx.pipeline_cache);
     shadowmap_builder
         .set_vertex_shader_filepath("shadowmap.hlsl")
         .set_fragment_shader_filepath("shadowmap.hlsl")
@@ -316,46 +436,25 @@ int main(int argc, char** argv)
         .set_depth_compare_op(VK_COMPARE_OP_LESS)
         .set_view_mask(0b1111)
         .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
+    GraphicsPipelineVariants shadowmap_variants(shadowmap_builder, { 1 });
+    GraphicsPipelineAsset* shadowmap_pipeline = shadowmap_variants.variants[0];
 
-    GraphicsPipelineAsset* shadowmap_pipeline = new GraphicsPipelineAsset(shadowmap_builder);
-    AssetCatalog::register_asset(shadowmap_pipeline);
-
-    GraphicsPipelineAsset* shadowmap_disintegrate_pipeline = nullptr;
-    {
-        GraphicsPipelineBuilder builder(ctx.device, true);
-		ShaderSource fragment_source("shadowmap.hlsl", "fs_main");
-		fragment_source.add_specialization_constant(1, true);
-        builder
-            .set_vertex_shader_filepath("shadowmap.hlsl")
-			.set_fragment_shader_source(fragment_source)
-            .set_cull_mode(VK_CULL_MODE_NONE)
-            .set_depth_format(VK_FORMAT_D32_SFLOAT)
-            .set_depth_test(VK_TRUE)
-            .set_depth_write(VK_TRUE)
-            .set_depth_compare_op(VK_COMPARE_OP_LESS)
-            .set_view_mask(0b1111)
-            .set_descriptor_set_layout(1, ctx.bindless_descriptor_set_layout);
-        shadowmap_disintegrate_pipeline = new GraphicsPipelineAsset(builder);
-		AssetCatalog::register_asset(shadowmap_disintegrate_pipeline);
-    }
-
-    ComputePipelineBuilder compute_builder(ctx.device, true);
+    ComputePipelineBuilder compute_builder(ctx.device, true, ctx.pipeline_cache);
     compute_builder
         .set_shader_filepath("procedural_sky.hlsl");
-    ComputePipelineAsset* procedural_skybox_pipeline = new ComputePipelineAsset(compute_builder);
-    AssetCatalog::register_asset(procedural_skybox_pipeline);
+    ComputePipelineAsset* procedural_skybox_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(compute_builder));
 
     ComputePipelineAsset* tonemap_pipeline = nullptr;
     {
-        ComputePipelineBuilder compute_builder(ctx.device, true);
+        ComputePipelineBuilder compute_builder(ctx.device, true, ctx.pipeline_cache);
         compute_builder.set_shader_filepath("tonemap.hlsl");
-        tonemap_pipeline = new ComputePipelineAsset(compute_builder);
-        AssetCatalog::register_asset(tonemap_pipeline);
+        tonemap_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(compute_builder));
     }
 
     std::vector<Mesh> meshes;
     meshes.resize(gltf_data->meshes_count);
-    load_meshes(ctx, gltf_data, meshes.data(), meshes.size());
+    MeshArena mesh_arena;
+    load_meshes(ctx, gltf_data, meshes.data(), meshes.size(), mesh_arena);
 
     std::vector<Material> materials;
     materials.resize(gltf_data->materials_count);
@@ -390,7 +489,6 @@ int main(int argc, char** argv)
     float movement_speed = 1.0f;
 
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-    ImGuiIO& io = ImGui::GetIO();
 
     std::vector<IConfigUI*> config_uis;
     constexpr uint32_t particle_capacity = 1048576;
@@ -444,7 +542,7 @@ int main(int argc, char** argv)
         config.emit_indirect_dispatch_handled_externally = true;
         config.additional_descriptors = {
             DescriptorInfo(mesh_disintegrate_spawn_positions.buffer),
-            DescriptorInfo(depth_texture.view, VK_IMAGE_LAYOUT_GENERAL),
+            DescriptorInfo(depth_texture.view, VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL), // Sampled in the Particle Manager update pass
             DescriptorInfo(point_sampler)
         };
         disintegrator_system_index = particle_manager.systems.size();
@@ -456,23 +554,37 @@ int main(int argc, char** argv)
     std::vector<MeshInstance> mesh_draws;
 
     // Test acceleration structure
-    ComputePipelineBuilder builder(ctx.device, true);
+    ComputePipelineBuilder builder(ctx.device, true, ctx.pipeline_cache);
     builder.set_shader_filepath("test_acceleration_structure.hlsl", "test_acceleration_structure");
-    ComputePipelineAsset* test_pipeline = new ComputePipelineAsset(builder);
-    AssetCatalog::register_asset(test_pipeline);
+    ComputePipelineAsset* test_pipeline = AssetCatalog::register_asset(new ComputePipelineAsset(builder));
 
-    // Separate thread for checking need for hot reload
-    std::thread hot_reload_watcher([]() {
-        while (!hot_reload_watcher_should_quit)
-        {
-            if (!needs_hot_reload)
-            {
-                needs_hot_reload = AssetCatalog::check_for_dirty_assets();
-            }
+    // Shaders and pipelines of everything registered above are compiled in parallel here
+    if (!AssetCatalog::build_pending_assets())
+    {
+        exit(EXIT_FAILURE);
+    }
 
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-        }
-    });
+    {
+        startup_timer.tock();
+        const ShaderCompileStats& shader_stats = Shaders::get_stats();
+        LOG_INFO("Startup took %.2f ms. Shader modules: %u from archive, %u from cache, %u compiled in %.2f ms, %u reused by other pipelines",
+            startup_timer.get_elapsed_milliseconds(), shader_stats.archive_hits, shader_stats.cache_hits, shader_stats.cache_misses,
+            shader_stats.compile_ms, shader_stats.module_reuses);
+
+        const LayoutCacheStats layout_stats = LayoutCache::get_stats();
+        LOG_INFO("Layouts: %u set layouts, %u pipeline layouts, %u update templates (%u cache hits, %u misses)",
+            layout_stats.set_layouts, layout_stats.pipeline_layouts, layout_stats.update_templates, layout_stats.hits, layout_stats.misses);
+    }
+
+    if (benchmark.enabled)
+    {
+        Benchmark::init(&ctx, benchmark);
+    }
+    else
+    {
+        // Shader edits are picked up on a background thread
+        AssetCatalog::start_watching();
+    }
 
     glm::vec3 sundir = glm::normalize(glm::vec3(1.0f));
     bool running = true;
@@ -505,155 +617,200 @@ int main(int argc, char** argv)
     smoke_system.smoke_dir = smoke_dir;
 
     bool configurator_open = true;
+    bool gpu_profiler_open = false;
+    bool texture_browser_open = false;
 
     while (running)
     {
         Timer timer;
         timer.tick();
-        VkCommandBuffer command_buffer = ctx.begin_frame();
+        VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+        {
+            CPU_ZONE("Wait for frame");
+            command_buffer = ctx.begin_frame();
+        }
         Texture& swapchain_texture = ctx.get_swapchain_texture();
+        if (benchmark.enabled) Benchmark::begin_frame(command_buffer);
+        {
+            CPU_ZONE("Texture streaming");
+            texture_catalog.update();
+        }
 
-        VkHelpers::begin_label(command_buffer, "Frame start", glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+        uint64_t tick = SDL_GetPerformanceCounter();
+        double delta_time = (tick - current_tick) * inv_pfreq;
+        double elapsed_time = (tick - start_tick) * inv_pfreq;
+        current_tick = tick;
+        if (benchmark.enabled)
+        { // Fixed timestep so every run simulates and renders the same frames
+            delta_time = BENCHMARK_TIMESTEP;
+            elapsed_time = Benchmark::get_time();
+        }
 
-        ImGui_ImplVulkan_NewFrame();
-        ImGui_ImplSDL2_NewFrame();
-        ImGui::NewFrame();
+        const float disintegrate_alpha_reference = glm::fract(elapsed_time * 0.1f);
+		const float disintegrate_prev_alpha_reference = glm::fract((elapsed_time - delta_time) * 0.1f);
 
-        SDL_Event e;
-        while (SDL_PollEvent(&e))
+        if (benchmark.enabled)
         {
-            ImGui_ImplSDL2_ProcessEvent(&e);
-            switch (e.type)
-            {
-            case SDL_QUIT:
-                running = false;
-                break;
-            case SDL_KEYDOWN:
-            {
-                if (io.WantCaptureKeyboard) break;
+            Benchmark::update_camera(smoke_origin, camera);
+        }
+        else
+        {
+            CPU_ZONE("Input and UI");
+            ImGuiIO& io = ImGui::GetIO();
+
+            ImGui_ImplVulkan_NewFrame();
+            ImGui_ImplSDL2_NewFrame();
+            ImGui::NewFrame();
 
-                switch (e.key.keysym.scancode)
+            SDL_Event e;
+            while (SDL_PollEvent(&e))
+            {
+                ImGui_ImplSDL2_ProcessEvent(&e);
+                switch (e.type)
                 {
-                case SDL_SCANCODE_ESCAPE:
+                case SDL_QUIT:
                     running = false;
                     break;
-                case SDL_SCANCODE_F5:
-                    AssetCatalog::force_reload_all();
-                    break;
-                case SDL_SCANCODE_F10:
-                    show_imgui_demo = !show_imgui_demo;
+                case SDL_KEYDOWN:
+                {
+                    if (io.WantCaptureKeyboard) break;
+
+                    switch (e.key.keysym.scancode)
+                    {
+                    case SDL_SCANCODE_ESCAPE:
+                        running = false;
+                        break;
+                    case SDL_SCANCODE_F5:
+                        AssetCatalog::force_reload_all();
+                        break;
+                    case SDL_SCANCODE_F8:
+                        texture_browser_open = !texture_browser_open && benchmark.texture_directory;
+                        break;
+                    case SDL_SCANCODE_F9:
+                        gpu_profiler_open = !gpu_profiler_open;
+                        break;
+                    case SDL_SCANCODE_F10:
+                        show_imgui_demo = !show_imgui_demo;
+                        break;
+                    case SDL_SCANCODE_F11:
+                        configurator_open = !configurator_open;
+                        break;
+                    default:
+                        break;
+                    }
+                } break;
+                case SDL_KEYUP:
+                {
+
+                } break;
+                case SDL_MOUSEWHEEL:
+                    if (io.WantCaptureMouse) break;
+                    movement_speed += e.wheel.y * 0.1f;
                     break;
-                case SDL_SCANCODE_F11:
-                    configurator_open = !configurator_open;
+                case SDL_MOUSEBUTTONDOWN:
+                case SDL_MOUSEBUTTONUP:
+                    if (io.WantCaptureMouse) break;
+                    if (e.button.button == SDL_BUTTON_LEFT)
+                        SDL_SetRelativeMouseMode(e.type == SDL_MOUSEBUTTONDOWN ? SDL_TRUE : SDL_FALSE);
                     break;
                 default:
                     break;
                 }
-            } break;
-            case SDL_KEYUP:
-            {
-
-            } break;
-            case SDL_MOUSEWHEEL:
-                if (io.WantCaptureMouse) break;
-                movement_speed += e.wheel.y * 0.1f;
-                break;
-            case SDL_MOUSEBUTTONDOWN:
-            case SDL_MOUSEBUTTONUP:
-                if (io.WantCaptureMouse) break;
-                if (e.button.button == SDL_BUTTON_LEFT)
-                    SDL_SetRelativeMouseMode(e.type == SDL_MOUSEBUTTONDOWN ? SDL_TRUE : SDL_FALSE);
-                break;
-            default:
-                break;
             }
-        }
 
-        if (configurator_open)
-        { // Configurator window
-            ImGui::Begin("GPU Particle System", &configurator_open);
-            ImGui::Text("GPU frame time: %f ms", ctx.smoothed_frame_time_ns * 1e-6f);
-            ImGui::Text("CPU frame time: %f ms", cpu_time_ms);
-            ImGui::Separator();
-            static int selected_system = 0;
-            if (ImGui::BeginCombo("Particle system", config_uis[selected_system]->get_display_name()))
-            {
-                for (int i = 0; i < config_uis.size(); ++i)
+            if (configurator_open)
+            { // Configurator window
+                ImGui::Begin("GPU Particle System", &configurator_open);
+                ImGui::Text("GPU frame time: %f ms", ctx.smoothed_frame_time_ns * 1e-6f);
+                ImGui::Text("CPU frame time: %f ms", cpu_time_ms);
+                ImGui::Checkbox("GPU profiler (F9)", &gpu_profiler_open);
+                ImGui::SameLine();
+                if (ImGui::Button("Export CPU trace")) CPUProfiler::export_chrome_trace(CPU_PROFILER_DEFAULT_TRACE_PATH);
+                const FileWatcherStats watcher_stats = FileWatcher::get_stats();
+                ImGui::Text("Hot reload: %s, %u files in %u directories", watcher_stats.backend, watcher_stats.watched_files, watcher_stats.watched_directories);
+                const LayoutCacheStats layout_stats = LayoutCache::get_stats();
+                ImGui::Text("Layouts: %u set, %u pipeline, %u templates (%u hits, %u misses)", layout_stats.set_layouts,
+                    layout_stats.pipeline_layouts, layout_stats.update_templates, layout_stats.hits, layout_stats.misses);
+                const RenderGraphStats& graph_stats = render_graph.stats;
+                ImGui::Text("Render graph: %u passes (%u culled), %u barriers, %u split, %u image barriers", graph_stats.pass_count,
+                    graph_stats.culled_pass_count, graph_stats.barrier_count, graph_stats.event_count, graph_stats.image_barrier_count);
+                ImGui::Text("Transient memory: %.1f MB, %.1f MB without aliasing", graph_stats.transient_memory / (1024.0 * 1024.0),
+                    graph_stats.transient_memory_unaliased / (1024.0 * 1024.0));
+                for (const auto& name : AssetCatalog::get_failed_assets())
+                {
+                    ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Shader error, using previous version: %s", name.c_str());
+                }
+                ImGui::Separator();
+                static int selected_system = 0;
+                if (ImGui::BeginCombo("Particle system", config_uis[selected_system]->get_display_name()))
                 {
-                    if (ImGui::Selectable(config_uis[i]->get_display_name(), selected_system == i))
+                    for (int i = 0; i < config_uis.size(); ++i)
                     {
-                        selected_system = i;
+                        if (ImGui::Selectable(config_uis[i]->get_display_name(), selected_system == i))
+                        {
+                            selected_system = i;
+                        }
                     }
-                }
 
-                ImGui::EndCombo();
+                    ImGui::EndCombo();
+                }
+                config_uis[selected_system]->draw_config_ui();
+                ImGui::End();
             }
-            config_uis[selected_system]->draw_config_ui();
-            ImGui::End();
-        }
-
-        Input::update();
 
+            Input::update();
 
-        if (show_imgui_demo)
-            ImGui::ShowDemoWindow(&show_imgui_demo);
 
-        movement_speed = std::max(movement_speed, 0.0f);
+            if (show_imgui_demo)
+                ImGui::ShowDemoWindow(&show_imgui_demo);
 
-        int numkeys = 0;
-        const uint8_t* keyboard = SDL_GetKeyboardState(&numkeys);
+            if (gpu_profiler_open)
+                GPUProfiler::draw_ui(&gpu_profiler_open);
 
-        int mousex, mousey;
-        uint32_t mouse_buttons = SDL_GetRelativeMouseState(&mousex, &mousey);
+            if (texture_browser_open)
+                texture_catalog.draw_ui(&texture_browser_open);
 
-        constexpr float mouse_sensitivity = 0.1f;
-        if (!io.WantCaptureMouse && (mouse_buttons & SDL_BUTTON_LMASK))
-        {
-            yaw -= mousex * mouse_sensitivity;
-            pitch += mousey * mouse_sensitivity;
+            movement_speed = std::max(movement_speed, 0.0f);
 
-            if (glm::abs(yaw) > 180.0f) yaw -= glm::sign(yaw) * 360.0f;
-            if (glm::abs(pitch) > 180.0f) pitch -= glm::sign(pitch) * 360.0f;
-        }
+            int numkeys = 0;
+            const uint8_t* keyboard = SDL_GetKeyboardState(&numkeys);
 
-        glm::mat4 rotation = glm::yawPitchRoll(glm::radians(yaw), glm::radians(pitch), 0.0f);
-        camera.forward = -rotation[2];
+            int mousex, mousey;
+            uint32_t mouse_buttons = SDL_GetRelativeMouseState(&mousex, &mousey);
 
-        glm::vec3 movement = glm::vec3(0.0f);
-        if (!io.WantCaptureKeyboard)
-        {
-            if (keyboard[SDL_SCANCODE_W])       movement.z -= 1.0f;
-            if (keyboard[SDL_SCANCODE_S])       movement.z += 1.0f;
-            if (keyboard[SDL_SCANCODE_A])       movement.x -= 1.0f;
-            if (keyboard[SDL_SCANCODE_D])       movement.x += 1.0f;
-            if (keyboard[SDL_SCANCODE_SPACE])   movement.y += 1.0f;
-            if (keyboard[SDL_SCANCODE_LCTRL])   movement.y -= 1.0f;
-        }
-
-        if (glm::length(movement) != 0.0f) movement = glm::normalize(movement);
+            constexpr float mouse_sensitivity = 0.1f;
+            if (!io.WantCaptureMouse && (mouse_buttons & SDL_BUTTON_LMASK))
+            {
+                yaw -= mousex * mouse_sensitivity;
+                pitch += mousey * mouse_sensitivity;
 
-        uint64_t tick = SDL_GetPerformanceCounter();
-        double delta_time = (tick - current_tick) * inv_pfreq;
-        double elapsed_time = (tick - start_tick) * inv_pfreq;
-        current_tick = tick;
+                if (glm::abs(yaw) > 180.0f) yaw -= glm::sign(yaw) * 360.0f;
+                if (glm::abs(pitch) > 180.0f) pitch -= glm::sign(pitch) * 360.0f;
+            }
 
-        const float disintegrate_alpha_reference = glm::fract(elapsed_time * 0.1f);
-		const float disintegrate_prev_alpha_reference = glm::fract((elapsed_time - delta_time) * 0.1f);
+            glm::mat4 rotation = glm::yawPitchRoll(glm::radians(yaw), glm::radians(pitch), 0.0f);
+            camera.forward = -rotation[2];
 
-        if (needs_hot_reload)
-        {
-            VK_CHECK(vkDeviceWaitIdle(ctx.device));
-            while (!AssetCatalog::reload_dirty_assets())
+            glm::vec3 movement = glm::vec3(0.0f);
+            if (!io.WantCaptureKeyboard)
             {
-                SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Shader compilation error", "Shader compilation failed!\nRetry?", ctx.window);
+                if (keyboard[SDL_SCANCODE_W])       movement.z -= 1.0f;
+                if (keyboard[SDL_SCANCODE_S])       movement.z += 1.0f;
+                if (keyboard[SDL_SCANCODE_A])       movement.x -= 1.0f;
+                if (keyboard[SDL_SCANCODE_D])       movement.x += 1.0f;
+                if (keyboard[SDL_SCANCODE_SPACE])   movement.y += 1.0f;
+                if (keyboard[SDL_SCANCODE_LCTRL])   movement.y -= 1.0f;
             }
 
-            needs_hot_reload = false;
+            if (glm::length(movement) != 0.0f) movement = glm::normalize(movement);
+
+            camera.position += glm::vec3(rotation * glm::vec4(movement, 0.0f)) * (float)delta_time * movement_speed;
         }
 
-        camera.position += glm::vec3(rotation * glm::vec4(movement, 0.0f)) * (float)delta_time * movement_speed;
+        AssetCatalog::update(ctx.frames_rendered, Context::frames_in_flight);
 
         { // Collect mesh instances from scene
+            CPU_ZONE("Collect mesh draws");
             mesh_draws.clear();
             auto get_meshes = [&](const cgltf_node* node)
                 {
@@ -686,8 +843,7 @@ int main(int argc, char** argv)
         glm::mat4 shadow_views[4];
         glm::mat4 shadow_view_projs[4];
         { // Update global uniform buffer
-            glm::ivec2 resolution;
-			SDL_GetWindowSizeInPixels(ctx.window, &resolution.x, &resolution.y);
+            glm::ivec2 resolution = glm::ivec2(ctx.window_width, ctx.window_height);
             ShaderGlobals globals{};
             globals.view = glm::lookAt(camera.position, camera.position + camera.forward, camera.up);
             globals.view_inverse = glm::inverse(globals.view);
@@ -746,410 +902,445 @@ int main(int argc, char** argv)
             ctx.map_buffer(globals_buffer, &mapped);
             memcpy(mapped, &globals, sizeof(globals));
             ctx.unmap_buffer(globals_buffer);
-            ctx.upload_buffer(globals_buffer, command_buffer);
-            VkHelpers::memory_barrier(command_buffer,
-                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
-                VK_ACCESS_TRANSFER_WRITE_BIT, 0);
         }
 
-        VkHelpers::end_label(command_buffer);
-
-        smoke_system.simulate(command_buffer, (float)delta_time, camera, shadow_views[1], shadow_projs[1]);
-        trail_blazer.simulate(command_buffer, (float)delta_time);
-
-		particle_manager.update_systems(command_buffer, (float)delta_time);
-
-        {
-            // Clear dispatch count because depth prepass will write it
-            vkCmdFillBuffer(command_buffer, disintegrator_system->emit_indirect_dispatch_buffer.buffer, 0, sizeof(uint32_t), 0);
-			VkHelpers::memory_barrier(command_buffer,
-				VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-				VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
-        }
-
-        { // Transition render target
-            VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                0,
-                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
-                VK_ACCESS_SHADER_WRITE_BIT,
-                VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_IMAGE_LAYOUT_GENERAL,
-                hdr_render_target.image,
-                VK_IMAGE_ASPECT_COLOR_BIT
-            );
-
-            VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-            dep_info.imageMemoryBarrierCount = 1;
-            dep_info.pImageMemoryBarriers = &barrier;
-            vkCmdPipelineBarrier2(command_buffer, &dep_info);
-        }
-
-        { // Procedural sky box
-            VkHelpers::begin_label(command_buffer, "Procedural sky box", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-           
-            DescriptorInfo descriptor_info[] = {
-                DescriptorInfo(globals_buffer),
-                DescriptorInfo(hdr_render_target.view, VK_IMAGE_LAYOUT_GENERAL)
-            };
+        // Passes declare what they read and write, the render graph derives image layouts and barriers from that.
+        // Buffers are tracked per group, a group's buffers are always synchronized together
+        render_graph.reset();
+        RGBuffer globals = render_graph.import_buffer("Globals");
+        RGBuffer smoke_particles = render_graph.import_buffer("Smoke particles");
+        RGBuffer trail_particles = render_graph.import_buffer("Trail Blazer particles");
+        RGBuffer manager_particles = render_graph.import_buffer("Particle Manager particles");
+        RGBuffer disintegrate_emit = render_graph.import_buffer("Disintegrate emit"); // Spawn positions and dispatch size found by the depth prepass
+        RGImage depth = render_graph.import_image("Depth", depth_texture);
+        RGImage shadowmap = render_graph.import_image("Shadow map", shadowmap_texture);
+        RGImage smoke_target = render_graph.import_image("Smoke render target", smoke_system.particle_render_target);
+        RGImage smoke_light = render_graph.import_image("Smoke light buffer", smoke_system.light_render_target);
+        RGImage swapchain = render_graph.import_swapchain_image("Swapchain", swapchain_texture, Context::swapchain_wait_stage,
+            ctx.headless ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        RGImage hdr = render_graph.create_image("HDR", { (uint32_t)ctx.window_width, (uint32_t)ctx.window_height, RENDER_TARGET_FORMAT });
+
+        const VkPipelineStageFlags2 graphics_stages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+
+        render_graph.add_pass("Upload globals")
+            .write(globals, RGAccess::Transfer)
+            .execute([&](VkCommandBuffer cmd) { ctx.upload_buffer(globals_buffer, cmd); });
+
+        render_graph.add_pass("Smoke simulate")
+            .read(globals, RGAccess::Uniform, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .write(smoke_particles, RGAccess::Transfer)
+            .write(smoke_particles, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .read(smoke_particles, RGAccess::Indirect)
+            .execute([&](VkCommandBuffer cmd) { smoke_system.simulate(cmd, (float)delta_time, camera, shadow_views[1], shadow_projs[1]); });
+
+        render_graph.add_pass("Trail Blazer simulate")
+            .read(globals, RGAccess::Uniform, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .read(trail_particles, RGAccess::Transfer)
+            .write(trail_particles, RGAccess::Transfer)
+            .write(trail_particles, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .read(trail_particles, RGAccess::Indirect)
+            .execute([&](VkCommandBuffer cmd) { trail_blazer.simulate(cmd, (float)delta_time); });
+
+        // The disintegrator emits from what the previous frame's depth prepass found
+        render_graph.add_pass("Particle Manager update")
+            .read(globals, RGAccess::Uniform, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .write(manager_particles, RGAccess::Transfer)
+            .write(manager_particles, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .read(manager_particles, RGAccess::Indirect)
+            .read(disintegrate_emit, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .read(disintegrate_emit, RGAccess::Indirect)
+            .read(depth, RGAccess::Sampled, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .execute([&](VkCommandBuffer cmd) { particle_manager.update_systems(cmd, (float)delta_time); });
+
+        // Clear dispatch count because depth prepass will write it
+        render_graph.add_pass("Clear disintegrate dispatch")
+            .write(disintegrate_emit, RGAccess::Transfer)
+            .execute([&](VkCommandBuffer cmd) { vkCmdFillBuffer(cmd, disintegrator_system->emit_indirect_dispatch_buffer.buffer, 0, sizeof(uint32_t), 0); });
+
+        render_graph.add_pass("Procedural sky box")
+            .read(globals, RGAccess::Uniform, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .write(hdr, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .execute([&](VkCommandBuffer cmd)
+            {
+                DescriptorInfo descriptor_info[] = {
+                    DescriptorInfo(globals_buffer),
+                    DescriptorInfo(render_graph.get_texture(hdr).view, render_graph.get_layout(hdr))
+                };
 
-            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, procedural_skybox_pipeline->pipeline.descriptor_update_template, procedural_skybox_pipeline->pipeline.layout, 0, descriptor_info);
-            
-            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, procedural_skybox_pipeline->pipeline.pipeline);
+                vkCmdPushDescriptorSetWithTemplateKHR(cmd, procedural_skybox_pipeline->pipeline.descriptor_update_template, procedural_skybox_pipeline->pipeline.layout, 0, descriptor_info);
 
-            uint32_t dispatch_x = get_golden_dispatch_size(ctx.window_width);
-            uint32_t dispatch_y = get_golden_dispatch_size(ctx.window_height);
-            vkCmdDispatch(command_buffer, dispatch_x, dispatch_y, 1);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, procedural_skybox_pipeline->pipeline.pipeline);
 
-            VkHelpers::end_label(command_buffer);
-        }
+                uint32_t dispatch_x = get_golden_dispatch_size(ctx.window_width);
+                uint32_t dispatch_y = get_golden_dispatch_size(ctx.window_height);
+                vkCmdDispatch(cmd, dispatch_x, dispatch_y, 1);
+            });
 
-        { // Shadowmap
-            VkHelpers::begin_label(command_buffer, "Cascaded shadow map", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-            VkImageMemoryBarrier2 barrier = VkHelpers::image_memory_barrier2(
-                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                0,
-                VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
-                0,
-                VK_IMAGE_LAYOUT_UNDEFINED,
-                VK_IMAGE_LAYOUT_GENERAL,
-                shadowmap_texture.image,
-                VK_IMAGE_ASPECT_DEPTH_BIT,
-                0,
-                1,
-                0,
-                4
-            );
-
-            VkDependencyInfo dep_info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
-            dep_info.imageMemoryBarrierCount = 1;
-            dep_info.pImageMemoryBarriers = &barrier;
-            vkCmdPipelineBarrier2(command_buffer, &dep_info);
-
-            VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            depth_info.imageView = shadowmap_texture.view;
-            depth_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            depth_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            depth_info.clearValue.depthStencil.depth = 1.0f;
-
-            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
-            rendering_info.renderArea = { {0, 0}, {DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE} };
-            rendering_info.layerCount = 4;
-            rendering_info.viewMask = 0b1111;
-            rendering_info.pDepthAttachment = &depth_info;
-
-            VkRect2D scissor = { {0, 0}, {DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE} };
-            vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-            VkViewport viewport = { 0.0f, (float)DEPTH_TEXTURE_SIZE, (float)DEPTH_TEXTURE_SIZE, -(float)DEPTH_TEXTURE_SIZE, 0.0f, 1.0f };
-            vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-
-            vkCmdBeginRendering(command_buffer, &rendering_info);
-
-            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_pipeline->pipeline.pipeline);
-            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_pipeline->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
-
-            DescriptorInfo descriptor_info[] = {
-                DescriptorInfo(anisotropic_sampler),
-                DescriptorInfo(globals_buffer),
-                DescriptorInfo(materials_buffer.buffer)
-            };
+        render_graph.add_pass("Cascaded shadow map")
+            .read(globals, RGAccess::Uniform, graphics_stages)
+            .write(shadowmap, RGAccess::Attachment)
+            .execute([&](VkCommandBuffer cmd)
+            {
+                VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+                depth_info.imageView = shadowmap_texture.view;
+                depth_info.imageLayout = render_graph.get_layout(shadowmap);
+                depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                depth_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                depth_info.clearValue.depthStencil.depth = 1.0f;
+
+                VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+                rendering_info.renderArea = { {0, 0}, {DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE} };
+                rendering_info.layerCount = 4;
+                rendering_info.viewMask = 0b1111;
+                rendering_info.pDepthAttachment = &depth_info;
+
+                VkRect2D scissor = { {0, 0}, {DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE} };
+                vkCmdSetScissor(cmd, 0, 1, &scissor);
+                VkViewport viewport = { 0.0f, (float)DEPTH_TEXTURE_SIZE, (float)DEPTH_TEXTURE_SIZE, -(float)DEPTH_TEXTURE_SIZE, 0.0f, 1.0f };
+                vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+                vkCmdBeginRendering(cmd, &rendering_info);
+
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_pipeline->pipeline.pipeline);
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_pipeline->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
+
+                DescriptorInfo descriptor_info[] = {
+                    DescriptorInfo(anisotropic_sampler),
+                    DescriptorInfo(globals_buffer),
+                    DescriptorInfo(materials_buffer.buffer)
+                };
 
-            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, shadowmap_pipeline->pipeline.descriptor_update_template, shadowmap_pipeline->pipeline.layout, 0, descriptor_info);
+                vkCmdPushDescriptorSetWithTemplateKHR(cmd, shadowmap_pipeline->pipeline.descriptor_update_template, shadowmap_pipeline->pipeline.layout, 0, descriptor_info);
 
-            for (const auto& mi : mesh_draws)
-            {
-				if (mi.variant_index == 1) vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_disintegrate_pipeline->pipeline.pipeline);
+                vkCmdBindIndexBuffer(cmd, mesh_arena.buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+                for (const auto& mi : mesh_draws)
+                {
+                    if (mi.variant_index == 1) vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowmap_variants.get(mi.variant_index)->pipeline.pipeline);
 
-                const Mesh& mesh = meshes[mi.mesh_index];
+                    const Mesh& mesh = meshes[mi.mesh_index];
 
-                DepthPrepassPushConstants pc{};
-                static_assert(sizeof(pc) <= 128);
+                    DepthPrepassPushConstants pc{};
+                    static_assert(sizeof(pc) <= 128);
 
-                pc.model = mi.transform;
-                pc.position_buffer = ctx.buffer_device_address(mesh.position);
-				pc.alpha_reference = disintegrate_alpha_reference;
-                pc.prev_alpha_reference = disintegrate_prev_alpha_reference;
-                if (mesh.texcoord0) pc.texcoord0_buffer = ctx.buffer_device_address(mesh.texcoord0);
+                    pc.model = mi.transform;
+                    pc.position_buffer = mesh.position;
+                    pc.alpha_reference = disintegrate_alpha_reference;
+                    pc.prev_alpha_reference = disintegrate_prev_alpha_reference;
+                    pc.texcoord0_buffer = mesh.texcoord0;
 
-                vkCmdBindIndexBuffer(command_buffer, mesh.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-                for (const auto& primitive : mesh.primitives)
-                {
-                    pc.noise_texture_index = materials[primitive.material].basecolor_texture;
-                    if (mi.variant_index == 1)
+                    for (const auto& primitive : mesh.primitives)
                     {
-                        assert(pc.noise_texture_index >= 0);
-                    }
+                        pc.noise_texture_index = materials[primitive.material].basecolor_texture;
+                        if (mi.variant_index == 1)
+                        {
+                            assert(pc.noise_texture_index >= 0);
+                        }
 
-                    vkCmdPushConstants(command_buffer, shadowmap_pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
-                    vkCmdDrawIndexed(command_buffer, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
+                        vkCmdPushConstants(cmd, shadowmap_pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
+                        vkCmdDrawIndexed(cmd, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
+                    }
                 }
-            }
 
-            vkCmdEndRendering(command_buffer);
+                vkCmdEndRendering(cmd);
+            });
 
-            VkHelpers::end_label(command_buffer);
-        }
+        // Disintegrating meshes write where they spawn particles
+        render_graph.add_pass("Depth prepass")
+            .read(globals, RGAccess::Uniform, graphics_stages)
+            .read(manager_particles, RGAccess::Storage, graphics_stages)
+            .write(disintegrate_emit, RGAccess::Storage, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT)
+            .write(depth, RGAccess::Attachment)
+            .execute([&](VkCommandBuffer cmd)
+            {
+                VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+                depth_info.imageView = depth_texture.view;
+                depth_info.imageLayout = render_graph.get_layout(depth);
+                depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                depth_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                depth_info.clearValue.depthStencil.depth = 1.0f;
+
+                VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+                rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
+                rendering_info.layerCount = 1;
+                rendering_info.viewMask = 0;
+                rendering_info.pDepthAttachment = &depth_info;
+
+                vkCmdBeginRendering(cmd, &rendering_info);
+
+                VkRect2D scissor = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
+                vkCmdSetScissor(cmd, 0, 1, &scissor);
+                VkViewport viewport = { 0.0f, (float)ctx.window_height, (float)ctx.window_width, -(float)ctx.window_height, 0.0f, 1.0f };
+                vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass->pipeline.pipeline);
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
+                DescriptorInfo descriptor_info[] = {
+                    DescriptorInfo(globals_buffer),
+                    DescriptorInfo(bilinear_sampler),
+                    DescriptorInfo(particle_manager.system_states_buffer[0],
+                        sizeof(GPUParticleSystemState) * disintegrator_system_index,
+                        sizeof(GPUParticleSystemState)
+                    ),
+                    DescriptorInfo(disintegrator_system->emit_indirect_dispatch_buffer.buffer),
+                    DescriptorInfo(mesh_disintegrate_spawn_positions.buffer),
+                };
 
-        { // Depth prepass
-            VkHelpers::begin_label(command_buffer, "Depth prepass", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-
-            VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            depth_info.imageView = depth_texture.view;
-            depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-            depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            depth_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            depth_info.clearValue.depthStencil.depth = 1.0f;
-
-            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
-            rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
-            rendering_info.layerCount = 1;
-            rendering_info.viewMask = 0;
-            rendering_info.pDepthAttachment = &depth_info;
-
-            vkCmdBeginRendering(command_buffer, &rendering_info);
-
-            VkRect2D scissor = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
-            vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-            VkViewport viewport = { 0.0f, (float)ctx.window_height, (float)ctx.window_width, -(float)ctx.window_height, 0.0f, 1.0f };
-            vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-
-            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass->pipeline.pipeline);
-			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
-            DescriptorInfo descriptor_info[] = {
-                DescriptorInfo(globals_buffer),
-                DescriptorInfo(bilinear_sampler),
-                DescriptorInfo(particle_manager.system_states_buffer[0],
-                    sizeof(GPUParticleSystemState) * disintegrator_system_index,
-                    sizeof(GPUParticleSystemState)
-                ),
-                DescriptorInfo(disintegrator_system->emit_indirect_dispatch_buffer.buffer),
-				DescriptorInfo(mesh_disintegrate_spawn_positions.buffer),
-            };
+                vkCmdPushDescriptorSetWithTemplateKHR(cmd, depth_prepass->pipeline.descriptor_update_template,
+                    depth_prepass->pipeline.layout, 0, descriptor_info);
 
-            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, depth_prepass->pipeline.descriptor_update_template, 
-                depth_prepass->pipeline.layout, 0, descriptor_info);
+                vkCmdBindIndexBuffer(cmd, mesh_arena.buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+                for (const auto& mi : mesh_draws)
+                {
+                    const Mesh& mesh = meshes[mi.mesh_index];
 
-            for (const auto& mi : mesh_draws)
-            {
-                const Mesh& mesh = meshes[mi.mesh_index];
-                
-                if (mi.variant_index == 1) vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass_disintegrate->pipeline.pipeline);
+                    if (mi.variant_index == 1) vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, depth_prepass_variants.get(mi.variant_index)->pipeline.pipeline);
 
-                DepthPrepassPushConstants pc{};
-                static_assert(sizeof(pc) <= 128);
+                    DepthPrepassPushConstants pc{};
+                    static_assert(sizeof(pc) <= 128);
 
-                pc.model = mi.transform;
-                pc.position_buffer = ctx.buffer_device_address(mesh.position);
-                pc.alpha_reference = disintegrate_alpha_reference;
-                pc.prev_alpha_reference = disintegrate_prev_alpha_reference;
-                if (mesh.texcoord0) pc.texcoord0_buffer = ctx.buffer_device_address(mesh.texcoord0);
+                    pc.model = mi.transform;
+                    pc.position_buffer = mesh.position;
+                    pc.alpha_reference = disintegrate_alpha_reference;
+                    pc.prev_alpha_reference = disintegrate_prev_alpha_reference;
+                    pc.texcoord0_buffer = mesh.texcoord0;
 
-                vkCmdBindIndexBuffer(command_buffer, mesh.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-                for (const auto& primitive : mesh.primitives)
-                {
-                    pc.noise_texture_index = materials[primitive.material].basecolor_texture;
-                    if (mi.variant_index == 1)
+                    for (const auto& primitive : mesh.primitives)
                     {
-                        assert(pc.noise_texture_index >= 0);
+                        pc.noise_texture_index = materials[primitive.material].basecolor_texture;
+                        if (mi.variant_index == 1)
+                        {
+                            assert(pc.noise_texture_index >= 0);
+                        }
+                        vkCmdPushConstants(cmd, pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
+                        vkCmdDrawIndexed(cmd, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
                     }
-                    vkCmdPushConstants(command_buffer, pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
-                    vkCmdDrawIndexed(command_buffer, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
                 }
-            }
-
-            vkCmdEndRendering(command_buffer);
-
-            VkImageMemoryBarrier2 image_barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
-            image_barrier.srcStageMask = VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT;
-            image_barrier.srcAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-            image_barrier.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-            image_barrier.dstAccessMask = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
-            image_barrier.image = depth_texture.image;
-            image_barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-            image_barrier.subresourceRange.baseArrayLayer = 0;
-            image_barrier.subresourceRange.baseMipLevel = 0;
-            image_barrier.subresourceRange.layerCount = 1;
-            image_barrier.subresourceRange.levelCount = 1;
-
-            VkDependencyInfo dependency_info{VK_STRUCTURE_TYPE_DEPENDENCY_INFO};
-            dependency_info.imageMemoryBarrierCount = 1;
-            dependency_info.pImageMemoryBarriers = &image_barrier;
-
-            vkCmdPipelineBarrier2(command_buffer, &dependency_info);
 
-            VkHelpers::end_label(command_buffer);
-        }
-
-        smoke_system.render(command_buffer, depth_texture);
-
-        { // Forward pass
-            VkHelpers::begin_label(command_buffer, "Forward pass", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-
-            VkRenderingAttachmentInfo color_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            color_info.imageView = hdr_render_target.view;
-            color_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            color_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            color_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            color_info.clearValue.color = { 0.1f, 0.1f, 0.2f, 1.0f };
-
-            VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            depth_info.imageView = depth_texture.view;
-            depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-            depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            depth_info.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
-            depth_info.clearValue.depthStencil.depth = 1.0f;
-
-            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
-            rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
-            rendering_info.layerCount = 1;
-            rendering_info.viewMask = 0;
-            rendering_info.colorAttachmentCount = 1;
-            rendering_info.pColorAttachments = &color_info;
-            rendering_info.pDepthAttachment = &depth_info;
-
-            vkCmdBeginRendering(command_buffer, &rendering_info);
-
-            VkRect2D scissor = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
-            vkCmdSetScissor(command_buffer, 0, 1, &scissor);
-            VkViewport viewport = { 0.0f, (float)ctx.window_height, (float)ctx.window_width, -(float)ctx.window_height, 0.0f, 1.0f };
-            vkCmdSetViewport(command_buffer, 0, 1, &viewport);
-
-            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline.pipeline);
-            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
-
-            DescriptorInfo descriptor_info[] = {
-                DescriptorInfo(anisotropic_sampler),
-                DescriptorInfo(globals_buffer),
-                DescriptorInfo(materials_buffer.buffer),
-                DescriptorInfo(shadowmap_texture.view, VK_IMAGE_LAYOUT_GENERAL),
-                DescriptorInfo(shadow_sampler),
-                DescriptorInfo(point_sampler),
-                DescriptorInfo(smoke_system.light_render_target.view, VK_IMAGE_LAYOUT_GENERAL),
-            };
-
-            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, pipeline->pipeline.descriptor_update_template, pipeline->pipeline.layout, 0, descriptor_info);
-
-            for (const auto& mi : mesh_draws)
+                vkCmdEndRendering(cmd);
+            });
+
+        // Half angle slices: the light buffer is cleared, rendered to and sampled in turns, so it stays in GENERAL.
+        // Depth is tested against the scene depth and the shadow cascade without writing either
+        render_graph.add_pass("Smoke render")
+            .read(globals, RGAccess::Uniform, graphics_stages)
+            .read(smoke_particles, RGAccess::Storage, graphics_stages)
+            .read(smoke_particles, RGAccess::Indirect)
+            .write(smoke_target, RGAccess::Attachment)
+            .write(smoke_light, RGAccess::Transfer)
+            .write(smoke_light, RGAccess::Attachment)
+            .read(smoke_light, RGAccess::Sampled, VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT)
+            .read(depth, RGAccess::Attachment)
+            .read(shadowmap, RGAccess::Attachment)
+            .execute([&](VkCommandBuffer cmd) { smoke_system.render(cmd, depth_texture); });
+
+        // Includes the particle systems drawn into the same rendering
+        render_graph.add_pass("Forward pass")
+            .read(globals, RGAccess::Uniform, graphics_stages)
+            .write(hdr, RGAccess::Attachment)
+            .read(depth, RGAccess::Attachment)
+            .read(shadowmap, RGAccess::Sampled, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT)
+            .read(smoke_light, RGAccess::Sampled, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT)
+            .read(trail_particles, RGAccess::Storage, graphics_stages)
+            .read(trail_particles, RGAccess::Indirect)
+            .read(manager_particles, RGAccess::Storage, graphics_stages)
+            .read(manager_particles, RGAccess::Indirect)
+            .execute([&](VkCommandBuffer cmd)
             {
-                const Mesh& mesh = meshes[mi.mesh_index];
-
-                PushConstantsForward pc{};
-                static_assert(sizeof(pc) <= 128);
+                VkRenderingAttachmentInfo color_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+                color_info.imageView = render_graph.get_texture(hdr).view;
+                color_info.imageLayout = render_graph.get_layout(hdr);
+                color_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                color_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                color_info.clearValue.color = { 0.1f, 0.1f, 0.2f, 1.0f };
+
+                VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+                depth_info.imageView = depth_texture.view;
+                depth_info.imageLayout = render_graph.get_layout(depth);
+                depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depth_info.storeOp = VK_ATTACHMENT_STORE_OP_NONE;
+                depth_info.clearValue.depthStencil.depth = 1.0f;
+
+                VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+                rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
+                rendering_info.layerCount = 1;
+                rendering_info.viewMask = 0;
+                rendering_info.colorAttachmentCount = 1;
+                rendering_info.pColorAttachments = &color_info;
+                rendering_info.pDepthAttachment = &depth_info;
+
+                vkCmdBeginRendering(cmd, &rendering_info);
+
+                VkRect2D scissor = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
+                vkCmdSetScissor(cmd, 0, 1, &scissor);
+                VkViewport viewport = { 0.0f, (float)ctx.window_height, (float)ctx.window_width, -(float)ctx.window_height, 0.0f, 1.0f };
+                vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline.pipeline);
+                vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->pipeline.layout, 1, 1, &ctx.bindless_descriptor_set, 0, nullptr);
+
+                DescriptorInfo descriptor_info[] = {
+                    DescriptorInfo(anisotropic_sampler),
+                    DescriptorInfo(globals_buffer),
+                    DescriptorInfo(materials_buffer.buffer),
+                    DescriptorInfo(shadowmap_texture.view, render_graph.get_layout(shadowmap)),
+                    DescriptorInfo(shadow_sampler),
+                    DescriptorInfo(point_sampler),
+                    DescriptorInfo(smoke_system.light_render_target.view, render_graph.get_layout(smoke_light)),
+                };
 
-                pc.model = mi.transform;
-                pc.position_buffer = ctx.buffer_device_address(mesh.position);
-                pc.disintegrate_alpha_reference = mi.variant_index != 0 ? disintegrate_alpha_reference : -100.0f;
-                if (mesh.normal) pc.normal_buffer = ctx.buffer_device_address(mesh.normal);
-                if (mesh.tangent) pc.tangent_buffer = ctx.buffer_device_address(mesh.tangent);
-                if (mesh.texcoord0) pc.texcoord0_buffer = ctx.buffer_device_address(mesh.texcoord0);
-                if (mesh.texcoord1) pc.texcoord1_buffer = ctx.buffer_device_address(mesh.texcoord1);
+                vkCmdPushDescriptorSetWithTemplateKHR(cmd, pipeline->pipeline.descriptor_update_template, pipeline->pipeline.layout, 0, descriptor_info);
 
-                vkCmdBindIndexBuffer(command_buffer, mesh.indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-                for (const auto& primitive : mesh.primitives)
+                vkCmdBindIndexBuffer(cmd, mesh_arena.buffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+                for (const auto& mi : mesh_draws)
                 {
-                    pc.material_index = primitive.material;
+                    const Mesh& mesh = meshes[mi.mesh_index];
 
-                    vkCmdPushConstants(command_buffer, pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
-                    vkCmdDrawIndexed(command_buffer, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
-                }
-            }
+                    PushConstantsForward pc{};
+                    static_assert(sizeof(pc) <= 128);
 
-            VkHelpers::end_label(command_buffer);
-        }
+                    pc.model = mi.transform;
+                    pc.position_buffer = mesh.position;
+                    pc.disintegrate_alpha_reference = mi.variant_index != 0 ? disintegrate_alpha_reference : -100.0f;
+                    pc.normal_buffer = mesh.normal;
+                    pc.tangent_buffer = mesh.tangent;
+                    pc.texcoord0_buffer = mesh.texcoord0;
+                    pc.texcoord1_buffer = mesh.texcoord1;
 
-        trail_blazer.render(command_buffer);
-		particle_manager.render_systems(command_buffer);
+                    for (const auto& primitive : mesh.primitives)
+                    {
+                        pc.material_index = primitive.material;
+
+                        vkCmdPushConstants(cmd, pipeline->pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(pc), &pc);
+                        vkCmdDrawIndexed(cmd, primitive.index_count, 1, primitive.first_index, primitive.first_vertex, 0);
+                    }
+                }
 
-        vkCmdEndRendering(command_buffer);
+                trail_blazer.render(cmd);
+                particle_manager.render_systems(cmd);
 
-        smoke_system.composite(command_buffer, hdr_render_target);
+                vkCmdEndRendering(cmd);
+            });
 
-        {
-            VkHelpers::begin_label(command_buffer, "Tonemap", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
+        render_graph.add_pass("Smoke composite")
+            .read(smoke_target, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .write(hdr, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .execute([&](VkCommandBuffer cmd) { smoke_system.composite(cmd, render_graph.get_texture(hdr)); });
 
-            DescriptorInfo descriptor_info[] = {
-                DescriptorInfo(hdr_render_target.view, VK_IMAGE_LAYOUT_GENERAL),
-                DescriptorInfo(swapchain_texture.view, VK_IMAGE_LAYOUT_GENERAL)
-            };
+        render_graph.add_pass("Tonemap")
+            .read(hdr, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .write(swapchain, RGAccess::Storage, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT)
+            .execute([&](VkCommandBuffer cmd)
+            {
+                DescriptorInfo descriptor_info[] = {
+                    DescriptorInfo(render_graph.get_texture(hdr).view, render_graph.get_layout(hdr)),
+                    DescriptorInfo(swapchain_texture.view, render_graph.get_layout(swapchain))
+                };
 
-            PushConstantsTonemap pc{};
-            pc.size = glm::uvec2(ctx.window_width, ctx.window_height);
+                PushConstantsTonemap pc{};
+                pc.size = glm::uvec2(ctx.window_width, ctx.window_height);
 
-            vkCmdPushDescriptorSetWithTemplateKHR(command_buffer, tonemap_pipeline->pipeline.descriptor_update_template, tonemap_pipeline->pipeline.layout, 0, descriptor_info);
-            vkCmdPushConstants(command_buffer, tonemap_pipeline->pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
-            vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, tonemap_pipeline->pipeline.pipeline);
+                vkCmdPushDescriptorSetWithTemplateKHR(cmd, tonemap_pipeline->pipeline.descriptor_update_template, tonemap_pipeline->pipeline.layout, 0, descriptor_info);
+                vkCmdPushConstants(cmd, tonemap_pipeline->pipeline.layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+                vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, tonemap_pipeline->pipeline.pipeline);
 
-            uint32_t dispatch_x = get_golden_dispatch_size(ctx.window_width);
-            uint32_t dispatch_y = get_golden_dispatch_size(ctx.window_height);
-            vkCmdDispatch(command_buffer, dispatch_x, dispatch_y, 1);
+                uint32_t dispatch_x = get_golden_dispatch_size(ctx.window_width);
+                uint32_t dispatch_y = get_golden_dispatch_size(ctx.window_height);
+                vkCmdDispatch(cmd, dispatch_x, dispatch_y, 1);
+            });
 
-            VkHelpers::end_label(command_buffer);
+        if (benchmark.enabled)
+        {
+            render_graph.add_pass("Particle count readback")
+                .read(smoke_particles, RGAccess::Transfer)
+                .read(trail_particles, RGAccess::Transfer)
+                .read(manager_particles, RGAccess::Transfer)
+                .side_effects()
+                .execute([&](VkCommandBuffer cmd)
+                {
+                    const VkDeviceSize count_offset = offsetof(GPUParticleSystemState, active_particle_count);
+                    Benchmark::record_particle_count(cmd, smoke_system.get_display_name(), smoke_system.particle_system_state[0].buffer, count_offset);
+                    Benchmark::record_particle_count(cmd, trail_blazer.get_display_name(), trail_blazer.particle_system_state[0].buffer, count_offset);
+                    Benchmark::record_particle_count(cmd, "Trail Blazer children", trail_blazer.child_particle_system_state[0].buffer, count_offset);
+                    for (size_t i = 0; i < particle_manager.systems.size(); ++i)
+                    {
+                        Benchmark::record_particle_count(cmd, particle_manager.systems[i]->get_display_name(), particle_manager.system_states_buffer[0],
+                            sizeof(GPUParticleSystemState) * i + count_offset);
+                    }
+                });
         }
-
+        else
         {
-            VkHelpers::begin_label(command_buffer, "ImGui render", glm::vec4(1.0f, 0.0f, 0.0f, 1.0f));
-
-            // ImGui rendering
-            VkRenderingAttachmentInfo color_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            color_info.imageView = swapchain_texture.view;
-            color_info.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-            color_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            color_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-            VkRenderingAttachmentInfo depth_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
-            depth_info.imageView = depth_texture.view;
-            depth_info.imageLayout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
-            depth_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
-            depth_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            depth_info.clearValue.depthStencil.depth = 1.0f;
-
-            VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
-            rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
-            rendering_info.layerCount = 1;
-            rendering_info.viewMask = 0;
-            rendering_info.colorAttachmentCount = 1;
-            rendering_info.pColorAttachments = &color_info;
-            rendering_info.pDepthAttachment = &depth_info;
+            render_graph.add_pass("ImGui render")
+                .write(swapchain, RGAccess::Attachment)
+                .execute([&](VkCommandBuffer cmd)
+                {
+                    VkRenderingAttachmentInfo color_info{ VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO };
+                    color_info.imageView = swapchain_texture.view;
+                    color_info.imageLayout = render_graph.get_layout(swapchain);
+                    color_info.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                    color_info.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 
-            vkCmdBeginRendering(command_buffer, &rendering_info);
+                    VkRenderingInfo rendering_info{ VK_STRUCTURE_TYPE_RENDERING_INFO };
+                    rendering_info.renderArea = { {0, 0}, {(uint32_t)ctx.window_width, (uint32_t)ctx.window_height} };
+                    rendering_info.layerCount = 1;
+                    rendering_info.viewMask = 0;
+                    rendering_info.colorAttachmentCount = 1;
+                    rendering_info.pColorAttachments = &color_info;
 
-            ImGui::Render();
-            ImDrawData* draw_data = ImGui::GetDrawData();
+                    vkCmdBeginRendering(cmd, &rendering_info);
 
-            // Record dear imgui primitives into command buffer
-            ImGui_ImplVulkan_RenderDrawData(draw_data, command_buffer);
+                    ImGui::Render();
+                    ImDrawData* draw_data = ImGui::GetDrawData();
 
-            vkCmdEndRendering(command_buffer);
+                    // Record dear imgui primitives into command buffer
+                    ImGui_ImplVulkan_RenderDrawData(draw_data, cmd);
 
-            VkHelpers::end_label(command_buffer);
+                    vkCmdEndRendering(cmd);
+                });
         }
 
-        ctx.end_frame(command_buffer);
+        if (render_graph.compile())
+        {
+            if (frame_index == 0)
+            {
+                const RenderGraphStats& stats = render_graph.stats;
+                LOG_INFO("Render graph: %u passes, %u culled, %u barriers, %u events, %u image barriers", stats.pass_count,
+                    stats.culled_pass_count, stats.barrier_count, stats.event_count, stats.image_barrier_count);
+            }
+            render_graph.execute(command_buffer);
+        }
+        if (benchmark.enabled) Benchmark::end_frame(command_buffer);
+        {
+            CPU_ZONE("Submit and present");
+            ctx.end_frame(command_buffer);
+        }
         frame_index++;
 
         timer.tock();
         cpu_time_ms = glm::mix(timer.get_elapsed_milliseconds(), cpu_time_ms, 0.95f);
+        CPUProfiler::end_frame();
+
+        if (benchmark.enabled && Benchmark::is_finished()) running = false;
+    }
+
+    bool benchmark_written = true;
+    if (benchmark.enabled)
+    {
+        benchmark_written = Benchmark::write_results();
+        Benchmark::shutdown();
     }
 
-    hot_reload_watcher_should_quit = true;
-    hot_reload_watcher.join();
+    AssetCatalog::stop_watching();
 
     vkDeviceWaitIdle(ctx.device);
+    if (benchmark.texture_directory) texture_catalog.shutdown();
+    AssetCatalog::shutdown();
     vmaDestroyImage(ctx.allocator, shadowmap_texture.image, shadowmap_texture.allocation);
     vkDestroyImageView(ctx.device, shadowmap_texture.view, nullptr);
     vmaDestroyImage(ctx.allocator, depth_texture.image, depth_texture.allocation);
     vkDestroyImageView(ctx.device, depth_texture.view, nullptr);
-    hdr_render_target.destroy(ctx.device, ctx.allocator);
-    for (auto& m : meshes)
-    {
-        vmaDestroyBuffer(ctx.allocator, m.indices.buffer, m.indices.allocation);
-        vmaDestroyBuffer(ctx.allocator, m.position.buffer, m.position.allocation);
-        vmaDestroyBuffer(ctx.allocator, m.normal.buffer, m.normal.allocation);
-        vmaDestroyBuffer(ctx.allocator, m.tangent.buffer, m.tangent.allocation);
-        vmaDestroyBuffer(ctx.allocator, m.texcoord0.buffer, m.texcoord0.allocation);
-        vmaDestroyBuffer(ctx.allocator, m.texcoord1.buffer, m.texcoord1.allocation);
-    }
+    render_graph.destroy();
+    ctx.destroy_buffer(mesh_arena.buffer);
     ctx.destroy_buffer(materials_buffer);
     ctx.destroy_buffer(globals_buffer);
     ctx.destroy_buffer(mesh_disintegrate_spawn_positions);
@@ -1165,16 +1356,19 @@ int main(int argc, char** argv)
     smoke_system.destroy();
     trail_blazer.destroy();
     particle_manager.destroy();
-    depth_prepass_disintegrate->builder.destroy_resources(depth_prepass_disintegrate->pipeline);
-    depth_prepass->builder.destroy_resources(depth_prepass->pipeline);
-    pipeline->builder.destroy_resources(pipeline->pipeline);
-    shadowmap_pipeline->builder.destroy_resources(shadowmap_pipeline->pipeline);
-    shadowmap_disintegrate_pipeline->builder.destroy_resources(shadowmap_disintegrate_pipeline->pipeline);
-    procedural_skybox_pipeline->builder.destroy_resources(procedural_skybox_pipeline->pipeline);
-    tonemap_pipeline->builder.destroy_resources(tonemap_pipeline->pipeline);
-    test_pipeline->builder.destroy_resources(test_pipeline->pipeline);
+    depth_prepass_variants.destroy();
+    AssetCatalog::release_asset(pipeline);
+    shadowmap_variants.destroy();
+    AssetCatalog::release_asset(procedural_skybox_pipeline);
+    AssetCatalog::release_asset(tonemap_pipeline);
+    AssetCatalog::release_asset(test_pipeline);
+
+    LayoutCache::shutdown();
+    Shaders::shutdown();
+    JobSystem::shutdown();
+    CPUProfiler::shutdown();
 
     ctx.shutdown();
 
-    return 0;
+    return benchmark_written ? 0 : EXIT_FAILURE;
 }
\ No newline at end of file
@@ -14,12 +14,33 @@ struct Mesh
         uint32_t index_count;
     };
 
+    // first_index points into the arena index range, first_vertex is relative to the mesh attribute addresses
     std::vector<Primitive> primitives;
 
-    Buffer indices;
-    Buffer position;
-    Buffer normal;
-    Buffer tangent;
-    Buffer texcoord0;
-    Buffer texcoord1;
+    // Into the MeshArena, 0 if the mesh does not have the attribute
+    VkDeviceAddress position = 0;
+    VkDeviceAddress normal = 0;
+    VkDeviceAddress tangent = 0;
+    VkDeviceAddress texcoord0 = 0;
+    VkDeviceAddress texcoord1 = 0;
+};
+
+// Index and vertex data of every mesh in one device local buffer. The index range starts at offset 0 so the
+// buffer can be bound as index buffer once, each vertex attribute has its own range after it
+struct MeshArena
+{
+    Buffer buffer;
+    VkDeviceAddress address = 0;
+};
+
+// CPU side vertex data unpacked from glTF. Indices are relative to the first_vertex of their primitive
+struct MeshGeometry
+{
+    std::vector<Mesh::Primitive> primitives;
+    std::vector<glm::vec3> position;
+    std::vector<glm::vec3> normal;
+    std::vector<glm::vec4> tangent;
+    std::vector<glm::vec2> texcoord0;
+    std::vector<glm::vec2> texcoord1;
+    std::vector<uint32_t> indices;
 };
\ No newline at end of file
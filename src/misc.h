@@ -1,6 +1,9 @@
 #pragma once 
 #include "defines.h"
 #include <cmath>
+#if _MSC_VER
+#include <intrin.h>
+#endif
 
 inline uint32_t get_mip_count(uint32_t texture_width, uint32_t texture_height)
 {
@@ -14,12 +17,80 @@ inline size_t align_power_of_2(size_t size, size_t alignment)
     return (size + mask) & ~(mask);
 }
 
+inline uint32_t count_trailing_zeros(uint32_t x)
+{
+    assert(x != 0);
+#if _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+#define FNV1A_64_OFFSET_BASIS 14695981039346656037ull
+#define FNV1A_64_PRIME 1099511628211ull
+
+// Chain calls by passing the previous result as hash
+inline uint64_t hash_fnv1a_64(const void* data, size_t size, uint64_t hash = FNV1A_64_OFFSET_BASIS)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; ++i) hash = (hash ^ bytes[i]) * FNV1A_64_PRIME;
+    return hash;
+}
+
+// Only for scalars and structs without padding, padding bytes are not guaranteed to be zero
+template <typename T>
+inline uint64_t hash_value_fnv1a_64(const T& value, uint64_t hash)
+{
+    return hash_fnv1a_64(&value, sizeof(T), hash);
+}
+
+inline uint64_t hash_string_fnv1a_64(const std::string& str, uint64_t hash)
+{
+    // Include the length so that consecutive strings can not shift into each other
+    hash = hash_value_fnv1a_64(str.size(), hash);
+    return hash_fnv1a_64(str.data(), str.size(), hash);
+}
+
+// Quoted and escaped for JSON output
+inline void write_json_string(FILE* f, const char* s)
+{
+    fputc('"', f);
+    for (; *s; ++s)
+    {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        if ((unsigned char)*s < 0x20) fprintf(f, "\\u%04x", *s);
+        else fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
 inline uint32_t get_golden_dispatch_size(uint32_t size)
 {
     constexpr uint32_t golden_workgroup_size = 8;
     return align_power_of_2(size, golden_workgroup_size) / golden_workgroup_size;
 }
 
+inline void* aligned_malloc(size_t size, size_t alignment)
+{
+#if _WIN32
+    return _aligned_malloc(size, alignment);
+#else
+    return aligned_alloc(alignment, align_power_of_2(size, alignment));
+#endif
+}
+
+inline void aligned_free(void* ptr)
+{
+#if _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
 inline uint8_t* read_entire_file(const char* filepath, size_t* size)
 {
     assert(size);
@@ -0,0 +1,77 @@
+#include "particle_arena.h"
+#include "particle_streams.h"
+#include "misc.h"
+#include "imgui/imgui.h"
+#include <algorithm>
+
+static uint32_t get_size_class(size_t size)
+{
+	uint32_t size_class = 0;
+	while (((size_t)PARTICLE_ARENA_CHUNK_SIZE << size_class) < size) ++size_class;
+	return size_class;
+}
+
+ParticleBlock ParticleArena::allocate(size_t size)
+{
+	ParticleBlock block{};
+	block.size_class = get_size_class(size);
+	if (block.size_class >= PARTICLE_ARENA_SIZE_CLASS_COUNT)
+	{
+		LOG_ERROR("Particle arena allocation of %zu bytes exceeds the largest size class!", size);
+		return ParticleBlock{};
+	}
+
+	std::vector<void*>& free_list = free_blocks[block.size_class];
+	if (!free_list.empty())
+	{
+		block.memory = free_list.back();
+		free_list.pop_back();
+	}
+	else
+	{
+		block.memory = aligned_malloc(block.size(), PARTICLE_STREAM_ALIGNMENT);
+		if (!block.memory)
+		{
+			LOG_ERROR("Particle arena failed to allocate %zu bytes!", block.size());
+			return ParticleBlock{};
+		}
+		heap_blocks.push_back(block.memory);
+		reserved_bytes += block.size();
+	}
+
+	used_bytes += block.size();
+	high_water_bytes = std::max(high_water_bytes, used_bytes);
+	live_blocks++;
+
+	return block;
+}
+
+void ParticleArena::free(ParticleBlock& block)
+{
+	if (!block) return;
+
+	assert(block.size_class < PARTICLE_ARENA_SIZE_CLASS_COUNT);
+	assert(used_bytes >= block.size());
+	free_blocks[block.size_class].push_back(block.memory);
+	used_bytes -= block.size();
+	live_blocks--;
+
+	block = ParticleBlock{};
+}
+
+void ParticleArena::shutdown()
+{
+	assert(live_blocks == 0);
+	for (void* memory : heap_blocks) aligned_free(memory);
+	heap_blocks.clear();
+	for (auto& free_list : free_blocks) free_list.clear();
+	reserved_bytes = 0;
+	used_bytes = 0;
+}
+
+void ParticleArena::draw_ui()
+{
+	constexpr double to_kb = 1.0 / 1024.0;
+	ImGui::Text("Particle memory: %.1f KB used / %.1f KB reserved", used_bytes * to_kb, reserved_bytes * to_kb);
+	ImGui::Text("High-water mark: %.1f KB (%u live blocks)", high_water_bytes * to_kb, live_blocks);
+}
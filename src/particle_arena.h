@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define PARTICLE_ARENA_CHUNK_SIZE (16 * 1024)
+#define PARTICLE_ARENA_SIZE_CLASS_COUNT 20
+
+struct ParticleBlock
+{
+	void* memory = nullptr;
+	uint32_t size_class = 0;
+
+	size_t size() const { return (size_t)PARTICLE_ARENA_CHUNK_SIZE << size_class; }
+	operator bool() const { return memory != nullptr; }
+};
+
+// Pool for particle stream memory shared by all CPU particle systems. Blocks are power of two multiples
+// of the chunk size and are recycled through per size class free lists, so systems that come and go
+// reuse the same memory instead of hitting the heap. Not thread safe, systems only grow on the thread
+// that runs ParticleSystemManager::update.
+struct ParticleArena
+{
+	std::vector<void*> free_blocks[PARTICLE_ARENA_SIZE_CLASS_COUNT];
+	std::vector<void*> heap_blocks;
+
+	size_t reserved_bytes = 0;
+	size_t used_bytes = 0;
+	size_t high_water_bytes = 0;
+	uint32_t live_blocks = 0;
+
+	ParticleBlock allocate(size_t size);
+	void free(ParticleBlock& block);
+	void shutdown();
+
+	void draw_ui();
+};
@@ -0,0 +1,269 @@
+#include "particle_benchmark.h"
+#include "particle_streams.h"
+#include "particle_system.h"
+#include "job_system.h"
+#include "../shaders/shared.h"
+#include "random.h"
+#include "timer.h"
+#include "misc.h"
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+
+constexpr float BENCHMARK_DT = 1.0f / 60.0f;
+constexpr uint64_t BENCHMARK_SEED = 0x853c49e6748fea9bull;
+
+// Particle layout and update loop from before the streams, kept here as the baseline
+struct ParticleAoS
+{
+	glm::vec3 position;
+	glm::vec3 velocity;
+	glm::vec3 acceleration;
+	glm::vec4 color;
+	float lifetime;
+	float size;
+	float rotation;
+	int flipbook_index;
+};
+
+static uint32_t update_aos(ParticleAoS* particles, uint32_t particle_count, float dt)
+{
+	for (uint32_t i = 0; i < particle_count;)
+	{
+		ParticleAoS& p = particles[i];
+		p.velocity += p.acceleration * dt;
+		p.position += p.velocity * dt;
+		p.lifetime -= dt;
+		if (p.lifetime <= 0.0f)
+		{
+			p = particles[--particle_count];
+		}
+		else
+		{
+			++i;
+		}
+	}
+	return particle_count;
+}
+
+// Lifetimes run up to twice the simulated time, so about half the particles die during a repetition
+// and both compaction schemes get exercised
+static void generate_particles(std::vector<ParticleAoS>& out, uint32_t count)
+{
+	pcg32_random_t rng;
+	random_seed(&rng, BENCHMARK_SEED, count);
+	out.resize(count);
+	for (ParticleAoS& p : out)
+	{
+		p.position = random_vector<glm::vec3>(&rng);
+		p.velocity = random_vector<glm::vec3>(&rng) * 5.0f;
+		p.acceleration = glm::vec3(0.0f, -9.81f, 0.0f);
+		p.color = random_vector<glm::vec4>(&rng);
+		p.lifetime = random_in_range(&rng, 0.0f, 2.0f * PARTICLE_BENCHMARK_STEPS * BENCHMARK_DT);
+		p.size = random_in_range(&rng, 0.01f, 0.1f);
+		p.rotation = random_in_range(&rng, 0.0f, 2.0f * M_PI);
+		p.flipbook_index = 0;
+	}
+}
+
+static void copy_to_streams(const std::vector<ParticleAoS>& source, ParticleStreams& streams)
+{
+	streams.count = (uint32_t)source.size();
+	for (uint32_t i = 0; i < streams.count; ++i)
+	{
+		const ParticleAoS& p = source[i];
+		const float values[PARTICLE_STREAM_COUNT] = {
+			p.position.x, p.position.y, p.position.z,
+			p.velocity.x, p.velocity.y, p.velocity.z,
+			p.acceleration.x, p.acceleration.y, p.acceleration.z,
+			p.color.r, p.color.g, p.color.b, p.color.a,
+			p.lifetime, p.size, p.rotation, (float)p.flipbook_index,
+		};
+		for (int s = 0; s < PARTICLE_STREAM_COUNT; ++s)
+		{
+			streams.streams[s][i] = values[s];
+		}
+	}
+}
+
+void ParticleBenchmark::run_layouts()
+{
+	const uint32_t particle_counts[] = { 512, 64 * 1024, 1024 * 1024 };
+
+	printf("CPU particle update, %u steps per repetition, %s streams\n", PARTICLE_BENCHMARK_STEPS,
+		PARTICLE_SIMD_WIDTH == 8 ? "AVX" : "SSE");
+	printf("%10s %12s %12s %10s\n", "particles", "AoS ns/p", "SoA ns/p", "speedup");
+
+	for (uint32_t particle_count : particle_counts)
+	{
+		std::vector<ParticleAoS> source;
+		generate_particles(source, particle_count);
+
+		std::vector<ParticleAoS> aos(particle_count);
+		void* memory = aligned_malloc(ParticleStreams::required_memory(particle_count), PARTICLE_STREAM_ALIGNMENT);
+		ParticleStreams soa;
+		soa.bind_memory(memory, particle_count);
+
+		const uint32_t work_per_repetition = particle_count * PARTICLE_BENCHMARK_STEPS;
+		const uint32_t repetitions = std::max(1u, PARTICLE_BENCHMARK_MIN_WORK / work_per_repetition);
+
+		double aos_seconds = 0.0;
+		double soa_seconds = 0.0;
+		uint64_t aos_survivors = 0;
+		uint64_t soa_survivors = 0;
+		Timer timer;
+		for (uint32_t r = 0; r < repetitions; ++r)
+		{
+			std::copy(source.begin(), source.end(), aos.begin());
+			uint32_t count = particle_count;
+			timer.tick();
+			for (uint32_t step = 0; step < PARTICLE_BENCHMARK_STEPS; ++step)
+			{
+				count = update_aos(aos.data(), count, BENCHMARK_DT);
+			}
+			timer.tock();
+			aos_seconds += timer.get_elapsed_seconds();
+			aos_survivors += count;
+
+			copy_to_streams(source, soa);
+			timer.tick();
+			for (uint32_t step = 0; step < PARTICLE_BENCHMARK_STEPS; ++step)
+			{
+				soa.integrate(BENCHMARK_DT);
+				soa.compact();
+			}
+			timer.tock();
+			soa_seconds += timer.get_elapsed_seconds();
+			soa_survivors += soa.count;
+		}
+
+		aligned_free(memory);
+
+		// Both layouts kill the same particles, only their order differs
+		if (aos_survivors != soa_survivors)
+		{
+			LOG_WARNING("Particle benchmark layouts disagree on survivors: %llu vs %llu", (unsigned long long)aos_survivors, (unsigned long long)soa_survivors);
+		}
+
+		const double particle_steps = (double)work_per_repetition * repetitions;
+		const double aos_ns = aos_seconds * 1e9 / particle_steps;
+		const double soa_ns = soa_seconds * 1e9 / particle_steps;
+		printf("%10u %12.3f %12.3f %9.2fx\n", particle_count, aos_ns, soa_ns, aos_ns / soa_ns);
+	}
+}
+
+// Cone emitters above the Trail Blazer sphere with gravity, so the collision path sees real contacts
+static void create_benchmark_scene(ParticleSystemManager& manager)
+{
+	manager.renderer = nullptr;
+	manager.bake_collision_sphere(TRAIL_BLAZER_SPHERE_CENTER, TRAIL_BLAZER_SPHERE_RADIUS, PARTICLE_COLLISION_SDF_RESOLUTION);
+	for (uint32_t i = 0; i < PARTICLE_BENCHMARK_SYSTEM_COUNT; ++i)
+	{
+		ParticleSystem* system = new ParticleSystem(nullptr, &manager.arena);
+		snprintf(system->name, sizeof(system->name), "benchmark_%u", i);
+		system->capacity = PARTICLE_BENCHMARK_SYSTEM_CAPACITY;
+		system->position = TRAIL_BLAZER_SPHERE_CENTER + glm::vec3(0.0f, 2.0f, 0.0f);
+		system->shape_settings.shape = EmissionShape::CONE;
+		system->shape_settings.angle = glm::radians(30.0f);
+		system->shape_settings.radius = 0.25f;
+		system->initial_speed = 2.0f;
+		system->gravity_modifier = 1.0f;
+		system->particle_lifetime = 2.0f;
+		system->emission_rate = 1.1f * PARTICLE_BENCHMARK_SYSTEM_CAPACITY / system->particle_lifetime;
+		system->sdf_collision = true;
+		system->reset();
+		manager.catalog.insert(std::make_pair(std::string(system->name), system));
+		manager.enabled_systems.push_back(system);
+	}
+}
+
+static uint32_t count_particles(const ParticleSystemManager& manager)
+{
+	uint32_t count = 0;
+	for (const auto& ps : manager.catalog) count += ps.second->particles.count;
+	return count;
+}
+
+void ParticleBenchmark::run_thread_scaling(uint32_t max_threads)
+{
+	if (max_threads == UINT32_MAX) max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	printf("ParticleSystemManager::update, %u systems of up to %u particles with SDF collision, %u frames\n",
+		PARTICLE_BENCHMARK_SYSTEM_COUNT, PARTICLE_BENCHMARK_SYSTEM_CAPACITY, PARTICLE_BENCHMARK_FRAMES);
+	printf("%8s %12s %14s %12s %10s\n", "threads", "ms/frame", "Mparticles/s", "particles", "speedup");
+
+	double single_thread_ms = 0.0;
+	for (uint32_t threads = 1; threads <= max_threads; ++threads)
+	{
+		JobSystem::init(threads - 1);
+
+		ParticleSystemManager manager;
+		create_benchmark_scene(manager);
+		for (uint32_t frame = 0; frame < PARTICLE_BENCHMARK_WARMUP_FRAMES; ++frame)
+		{
+			manager.update(BENCHMARK_DT);
+		}
+
+		// Systems are seeded by name and jobs only touch their own ranges, so every thread count
+		// has to simulate exactly the same particles
+		uint64_t particle_updates = 0;
+		Timer timer;
+		timer.tick();
+		for (uint32_t frame = 0; frame < PARTICLE_BENCHMARK_FRAMES; ++frame)
+		{
+			manager.update(BENCHMARK_DT);
+			particle_updates += count_particles(manager);
+		}
+		timer.tock();
+
+		manager.shutdown();
+		JobSystem::shutdown();
+
+		const double seconds = timer.get_elapsed_seconds();
+		const double ms_per_frame = seconds * 1000.0 / PARTICLE_BENCHMARK_FRAMES;
+		if (threads == 1) single_thread_ms = ms_per_frame;
+		printf("%8u %12.3f %14.1f %12llu %9.2fx\n", threads, ms_per_frame, particle_updates / seconds * 1e-6,
+			(unsigned long long)particle_updates, single_thread_ms / ms_per_frame);
+	}
+}
+
+void ParticleBenchmark::run_random()
+{
+	std::vector<float> buffer(PARTICLE_BENCHMARK_RANDOM_BUFFER);
+	const uint32_t fills = PARTICLE_BENCHMARK_RANDOM_VALUES / PARTICLE_BENCHMARK_RANDOM_BUFFER;
+	Timer timer;
+
+	// Summed so the generated values can't be optimized away
+	float scalar_sum = 0.0f;
+	pcg32_srandom(BENCHMARK_SEED, 0);
+	timer.tick();
+	for (uint32_t f = 0; f < fills; ++f)
+	{
+		for (float& value : buffer) value = random_in_range(-1.0f, 1.0f);
+		scalar_sum += buffer[f % buffer.size()];
+	}
+	timer.tock();
+	const double scalar_seconds = timer.get_elapsed_seconds();
+
+	float batch_sum = 0.0f;
+	RandomBatch rng;
+	random_batch_seed(&rng, BENCHMARK_SEED, 0);
+	timer.tick();
+	for (uint32_t f = 0; f < fills; ++f)
+	{
+		random_batch_fill(&rng, buffer.data(), (uint32_t)buffer.size(), -1.0f, 1.0f);
+		batch_sum += buffer[f % buffer.size()];
+	}
+	timer.tock();
+	const double batch_seconds = timer.get_elapsed_seconds();
+
+	const double values = (double)fills * buffer.size();
+	const double scalar_ns = scalar_seconds * 1e9 / values;
+	const double batch_ns = batch_seconds * 1e9 / values;
+	printf("Uniform floats in [-1, 1), %u values in bursts of %u\n", (uint32_t)values, PARTICLE_BENCHMARK_RANDOM_BUFFER);
+	printf("%20s %10s %14s\n", "generator", "ns/value", "Mvalues/s");
+	printf("%20s %10.3f %14.1f\n", "pcg32_random", scalar_ns, 1e3 / scalar_ns);
+	printf("%20s %10.3f %14.1f\n", "random_batch_fill", batch_ns, 1e3 / batch_ns);
+	printf("Speedup %.2fx (checksums %.3f, %.3f)\n", scalar_ns / batch_ns, scalar_sum, batch_sum);
+}
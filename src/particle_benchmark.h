@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+// Steps simulated per repetition of a CPU particle microbenchmark, a second of simulation at 60Hz
+#define PARTICLE_BENCHMARK_STEPS 60
+// Particle steps each case is run for at minimum, small cases repeat until they reach it
+#define PARTICLE_BENCHMARK_MIN_WORK (64u * 1024u * 1024u)
+// Scene for the thread scaling run, every system emits enough to stay at capacity
+#define PARTICLE_BENCHMARK_SYSTEM_COUNT 8
+#define PARTICLE_BENCHMARK_SYSTEM_CAPACITY (128 * 1024)
+#define PARTICLE_BENCHMARK_WARMUP_FRAMES 150 // Past one particle lifetime, so every system is at capacity
+#define PARTICLE_BENCHMARK_FRAMES 300
+// Values drawn per generator in the random number benchmark, in buffers the size of one emission burst
+#define PARTICLE_BENCHMARK_RANDOM_VALUES (64u * 1024u * 1024u)
+#define PARTICLE_BENCHMARK_RANDOM_BUFFER 4096
+
+// CPU microbenchmarks of the particle simulation, run from the command line without a window or device.
+// Results are printed to stdout.
+namespace ParticleBenchmark
+{
+	// Structure-of-arrays streams against the array-of-structs update they replaced, at 512, 64K and 1M particles
+	void run_layouts();
+
+	// ParticleSystemManager::update with SDF collision at 1..max_threads threads, the calling thread included.
+	// UINT32_MAX = one thread per core
+	void run_thread_scaling(uint32_t max_threads = UINT32_MAX);
+
+	// RandomBatch fills against the global pcg32 generator emission used to call once per value
+	void run_random();
+}
@@ -0,0 +1,163 @@
+#include "particle_streams.h"
+#include "misc.h"
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+
+#if defined(__AVX2__) || defined(__AVX__)
+#include <immintrin.h>
+typedef __m256 simd_float;
+#define simd_load _mm256_load_ps
+#define simd_loadu _mm256_loadu_ps
+#define simd_store _mm256_store_ps
+#define simd_storeu _mm256_storeu_ps
+#define simd_set1 _mm256_set1_ps
+#define simd_add _mm256_add_ps
+#define simd_sub _mm256_sub_ps
+#define simd_mul _mm256_mul_ps
+#define simd_alive_mask(x) _mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ))
+#else
+#include <emmintrin.h>
+typedef __m128 simd_float;
+#define simd_load _mm_load_ps
+#define simd_loadu _mm_loadu_ps
+#define simd_store _mm_store_ps
+#define simd_storeu _mm_storeu_ps
+#define simd_set1 _mm_set1_ps
+#define simd_add _mm_add_ps
+#define simd_sub _mm_sub_ps
+#define simd_mul _mm_mul_ps
+#define simd_alive_mask(x) _mm_movemask_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()))
+#endif
+
+// Stride is rounded to 8 floats so every stream starts on a 32 byte boundary regardless of SIMD width
+static inline size_t stream_stride(uint32_t capacity)
+{
+	return align_power_of_2(capacity, 8);
+}
+
+size_t ParticleStreams::required_memory(uint32_t capacity)
+{
+	return stream_stride(capacity) * sizeof(float) * PARTICLE_STREAM_COUNT;
+}
+
+uint32_t ParticleStreams::capacity_for_memory(size_t size)
+{
+	const size_t capacity = size / (sizeof(float) * PARTICLE_STREAM_COUNT);
+	return (uint32_t)std::min(capacity & ~(size_t)7, (size_t)UINT32_MAX & ~(size_t)7);
+}
+
+void ParticleStreams::bind_memory(void* memory, uint32_t capacity)
+{
+	assert(((uintptr_t)memory & (PARTICLE_STREAM_ALIGNMENT - 1)) == 0);
+
+	// Zero so that padding lanes read by the kernels are well defined
+	if (capacity) memset(memory, 0, required_memory(capacity));
+
+	const size_t stride = stream_stride(capacity);
+	float* base = (float*)memory;
+	for (int i = 0; i < PARTICLE_STREAM_COUNT; ++i)
+	{
+		streams[i] = capacity ? base + stride * i : nullptr;
+	}
+
+	this->capacity = capacity;
+	this->count = 0;
+}
+
+void ParticleStreams::migrate(void* memory, uint32_t capacity)
+{
+	assert(count <= capacity);
+
+	float* old_streams[PARTICLE_STREAM_COUNT];
+	memcpy(old_streams, streams, sizeof(streams));
+	const uint32_t old_count = count;
+
+	bind_memory(memory, capacity);
+	for (int i = 0; i < PARTICLE_STREAM_COUNT; ++i)
+	{
+		if (old_count) memcpy(streams[i], old_streams[i], old_count * sizeof(float));
+	}
+	count = old_count;
+}
+
+void ParticleStreams::integrate(uint32_t begin, uint32_t end, float dt)
+{
+	assert(begin % PARTICLE_SIMD_WIDTH == 0);
+
+	float* px = streams[PARTICLE_STREAM_POSITION_X];
+	float* py = streams[PARTICLE_STREAM_POSITION_Y];
+	float* pz = streams[PARTICLE_STREAM_POSITION_Z];
+	float* vx = streams[PARTICLE_STREAM_VELOCITY_X];
+	float* vy = streams[PARTICLE_STREAM_VELOCITY_Y];
+	float* vz = streams[PARTICLE_STREAM_VELOCITY_Z];
+	const float* ax = streams[PARTICLE_STREAM_ACCELERATION_X];
+	const float* ay = streams[PARTICLE_STREAM_ACCELERATION_Y];
+	const float* az = streams[PARTICLE_STREAM_ACCELERATION_Z];
+	float* life = streams[PARTICLE_STREAM_LIFETIME];
+
+	const simd_float vdt = simd_set1(dt);
+
+	// Padding lanes past count are integrated too, they are never read back
+	for (uint32_t i = begin; i < end; i += PARTICLE_SIMD_WIDTH)
+	{
+		simd_float x = simd_load(vx + i);
+		simd_float y = simd_load(vy + i);
+		simd_float z = simd_load(vz + i);
+		x = simd_add(x, simd_mul(simd_load(ax + i), vdt));
+		y = simd_add(y, simd_mul(simd_load(ay + i), vdt));
+		z = simd_add(z, simd_mul(simd_load(az + i), vdt));
+		simd_store(vx + i, x);
+		simd_store(vy + i, y);
+		simd_store(vz + i, z);
+
+		simd_store(px + i, simd_add(simd_load(px + i), simd_mul(x, vdt)));
+		simd_store(py + i, simd_add(simd_load(py + i), simd_mul(y, vdt)));
+		simd_store(pz + i, simd_add(simd_load(pz + i), simd_mul(z, vdt)));
+
+		simd_store(life + i, simd_sub(simd_load(life + i), vdt));
+	}
+}
+
+uint32_t ParticleStreams::compact(uint32_t begin, uint32_t end)
+{
+	assert(begin % PARTICLE_SIMD_WIDTH == 0);
+	const float* life = streams[PARTICLE_STREAM_LIFETIME];
+	constexpr int full_mask = (1 << PARTICLE_SIMD_WIDTH) - 1;
+
+	// Holes are filled from the back of the range, so only dead particles and the ones moved into
+	// their place are touched. Shifting the survivors down instead rewrites every stream once the
+	// first particle dies, which dominates large systems
+	uint32_t i = begin;
+	while (i < end)
+	{
+		if (i % PARTICLE_SIMD_WIDTH == 0 && end - i >= PARTICLE_SIMD_WIDTH && simd_alive_mask(simd_load(life + i)) == full_mask)
+		{
+			i += PARTICLE_SIMD_WIDTH;
+		}
+		else if (life[i] > 0.0f)
+		{
+			++i;
+		}
+		else
+		{
+			// The particle moved in is checked again on the next iteration
+			--end;
+			for (int s = 0; s < PARTICLE_STREAM_COUNT; ++s)
+			{
+				streams[s][i] = streams[s][end];
+			}
+		}
+	}
+
+	return end;
+}
+
+void ParticleStreams::move(uint32_t dst, uint32_t src, uint32_t count)
+{
+	if (dst == src || count == 0) return;
+	for (int s = 0; s < PARTICLE_STREAM_COUNT; ++s)
+	{
+		memmove(streams[s] + dst, streams[s] + src, count * sizeof(float));
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Batch width of the update kernels. Streams are padded to a multiple of this so that
+// kernels can always process full batches without a scalar tail.
+#if defined(__AVX2__) || defined(__AVX__)
+#define PARTICLE_SIMD_WIDTH 8
+#else
+#define PARTICLE_SIMD_WIDTH 4
+#endif
+
+#define PARTICLE_STREAM_ALIGNMENT 32
+
+enum ParticleStream
+{
+	PARTICLE_STREAM_POSITION_X = 0,
+	PARTICLE_STREAM_POSITION_Y,
+	PARTICLE_STREAM_POSITION_Z,
+	PARTICLE_STREAM_VELOCITY_X,
+	PARTICLE_STREAM_VELOCITY_Y,
+	PARTICLE_STREAM_VELOCITY_Z,
+	PARTICLE_STREAM_ACCELERATION_X,
+	PARTICLE_STREAM_ACCELERATION_Y,
+	PARTICLE_STREAM_ACCELERATION_Z,
+	PARTICLE_STREAM_COLOR_R,
+	PARTICLE_STREAM_COLOR_G,
+	PARTICLE_STREAM_COLOR_B,
+	PARTICLE_STREAM_COLOR_A,
+	PARTICLE_STREAM_LIFETIME,
+	PARTICLE_STREAM_SIZE,
+	PARTICLE_STREAM_ROTATION,
+	PARTICLE_STREAM_FLIPBOOK_INDEX, // Stored as float, exact for any realistic flipbook size
+	PARTICLE_STREAM_COUNT
+};
+
+// Structure-of-arrays particle storage. Does not own its memory, bind_memory() points
+// every stream into a single caller provided block.
+struct ParticleStreams
+{
+	float* streams[PARTICLE_STREAM_COUNT] = {};
+	uint32_t capacity = 0;
+	uint32_t count = 0;
+
+	inline float* operator[](ParticleStream s) { return streams[s]; }
+	inline const float* operator[](ParticleStream s) const { return streams[s]; }
+
+	// Size in bytes of the block bind_memory() expects for the given capacity
+	static size_t required_memory(uint32_t capacity);
+
+	// Largest capacity whose streams fit in the given number of bytes
+	static uint32_t capacity_for_memory(size_t size);
+
+	// Memory has to be PARTICLE_STREAM_ALIGNMENT aligned and at least required_memory(capacity) bytes
+	void bind_memory(void* memory, uint32_t capacity);
+
+	// Rebinds to a new block and copies over the live particles. New capacity has to fit the current count
+	void migrate(void* memory, uint32_t capacity);
+
+	// Returns the index of the new particle, or UINT32_MAX if full
+	inline uint32_t allocate() { return count < capacity ? count++ : UINT32_MAX; }
+
+	// Integrates velocity and position and ages particles. Dead particles are left in place until compact()
+	void integrate(float dt) { integrate(0, count, dt); }
+
+	// Removes particles with lifetime <= 0 by moving particles from the end into their place. Does not preserve order
+	void compact() { count = compact(0, count); }
+
+	// Range versions for splitting a system across jobs. Begin has to be a multiple of PARTICLE_SIMD_WIDTH
+	void integrate(uint32_t begin, uint32_t end, float dt);
+	uint32_t compact(uint32_t begin, uint32_t end); // Returns the new end of the range
+
+	// Moves count particles from src to dst in every stream, ranges may overlap
+	void move(uint32_t dst, uint32_t src, uint32_t count);
+};
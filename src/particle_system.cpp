@@ -7,69 +7,197 @@
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_vulkan.h"
 #include "texture_catalog.h"
+#include "timer.h"
+#include "misc.h"
+#include "job_system.h"
+#include "sdf.h"
+#include "cpu_profiler.h"
 #include <fstream>
 #include <sstream>
+#include <filesystem>
+#include <algorithm>
 
 constexpr glm::vec3 GRAVITY = glm::vec3(0.0f, -9.81f, 0.0f);
 
-ParticleSystem::ParticleSystem(ParticleRenderer* renderer)
-	: renderer(renderer)
+// Smallest block handed out to a system, grown by doubling from there on
+constexpr uint32_t INITIAL_PARTICLE_BLOCK_CAPACITY = 64;
+
+ParticleSystem::ParticleSystem(ParticleRenderer* renderer, ParticleArena* arena)
+	: renderer(renderer), arena(arena)
+{
+
+}
+
+ParticleSystem::~ParticleSystem()
 {
+	release_memory();
+}
+
+// Moves the particles into the next larger arena block, up to the configured capacity.
+// Idle systems hold no memory at all until they first emit.
+bool ParticleSystem::grow()
+{
+	assert(arena);
+	if (particles.capacity >= capacity) return false;
+
+	size_t size = particle_block
+		? particle_block.size() * 2
+		: ParticleStreams::required_memory(std::min(capacity, INITIAL_PARTICLE_BLOCK_CAPACITY));
+	size = std::min(size, ParticleStreams::required_memory(capacity));
 
+	ParticleBlock block = arena->allocate(size);
+	if (!block) return false;
+
+	const uint32_t new_capacity = std::min(ParticleStreams::capacity_for_memory(block.size()), capacity);
+	particles.migrate(block.memory, new_capacity);
+	arena->free(particle_block);
+	particle_block = block;
+
+	return true;
+}
+
+void ParticleSystem::release_memory()
+{
+	if (arena) arena->free(particle_block);
+	particles = ParticleStreams{};
 }
 
 void ParticleSystem::update(float dt)
 {
-	if (lifetime <= 0.0f) return;
+	if (!begin_update(dt)) return;
+
+	particles.integrate(dt);
+	particles.compact();
+
+	emit(dt);
+}
+
+bool ParticleSystem::begin_update(float dt)
+{
+	if (lifetime <= 0.0f) return false;
 	
 	lifetime -= dt;
 	while (lifetime <= 0.0f && looping) lifetime += duration;
+	return true;
+}
 
-	for (uint32_t i = 0; i < particle_count;)
+void ParticleSystem::emit(float dt)
+{
+	spawn(reserve_emission(dt, particles.count));
+}
+
+uint32_t ParticleSystem::reserve_emission(float dt, uint32_t live_count)
+{
+	time_until_spawn -= dt;
+	if (time_until_spawn >= 0.0f || emission_rate <= 0.0f) return 0;
+
+	// Spawn everything that is due this step in one batch
+	uint32_t spawn_count = (uint32_t)ceilf(-time_until_spawn * emission_rate);
+	while (live_count + spawn_count > particles.capacity && grow());
+	spawn_count = std::min(spawn_count, particles.capacity - live_count);
+	time_until_spawn += spawn_count / emission_rate;
+
+	// Out of room, don't let the deficit build up into a burst once particles die
+	if (time_until_spawn < 0.0f) time_until_spawn = 0.0f;
+	return spawn_count;
+}
+
+void ParticleSystem::spawn(uint32_t spawn_count)
+{
+	assert(particles.count + spawn_count <= particles.capacity);
+	if (spawn_count == 0) return;
+
+	const uint32_t first = particles.count;
+	particles.count += spawn_count;
+
+	auto fill = [&](ParticleStream stream, float value)
 	{
-		Particle& p = particles[i];
-		p.velocity += p.acceleration * dt;
-		p.position += p.velocity * dt;
-		p.lifetime -= dt;
-		if (p.lifetime <= 0.0f)
-		{
-			p = particles[--particle_count];
-		}
-		else
+		std::fill_n(particles[stream] + first, spawn_count, value);
+	};
+	auto fill_random = [&](ParticleStream stream, float low, float high)
+	{
+		random_batch_fill(&rng, particles[stream] + first, spawn_count, low, high);
+	};
+
+	float* px = particles[PARTICLE_STREAM_POSITION_X] + first;
+	float* py = particles[PARTICLE_STREAM_POSITION_Y] + first;
+	float* pz = particles[PARTICLE_STREAM_POSITION_Z] + first;
+	float* vx = particles[PARTICLE_STREAM_VELOCITY_X] + first;
+	float* vy = particles[PARTICLE_STREAM_VELOCITY_Y] + first;
+	float* vz = particles[PARTICLE_STREAM_VELOCITY_Z] + first;
+
+	switch (shape_settings.shape)
+	{
+	case EmissionShape::NONE:
+		fill(PARTICLE_STREAM_VELOCITY_X, 0.0f);
+		fill(PARTICLE_STREAM_VELOCITY_Y, initial_speed);
+		fill(PARTICLE_STREAM_VELOCITY_Z, 0.0f);
+		fill(PARTICLE_STREAM_POSITION_X, position.x);
+		fill(PARTICLE_STREAM_POSITION_Y, position.y);
+		fill(PARTICLE_STREAM_POSITION_Z, position.z);
+		break;
+	case EmissionShape::CONE:
+	{
+		// Random inputs are staged in the streams they end up transforming into
+		fill_random(PARTICLE_STREAM_VELOCITY_X, cosf(shape_settings.angle), 1.0f);
+		fill_random(PARTICLE_STREAM_VELOCITY_Y, 0.0f, 2.0f * M_PI);
+		fill_random(PARTICLE_STREAM_POSITION_X, 0.0f, shape_settings.arc);
+		fill_random(PARTICLE_STREAM_POSITION_Z, 0.0f, shape_settings.radius);
+		for (uint32_t i = 0; i < spawn_count; ++i)
 		{
-			++i;
+			const float z = vx[i];
+			const float phi = vy[i];
+			const float s = sqrtf(1.0f - z * z);
+			const glm::vec3 v = orient_cone_sample(glm::vec3(s * cosf(phi), s * sinf(phi), z), glm::vec3(0.0f, 1.0f, 0.0f)) * initial_speed;
+			vx[i] = v.x;
+			vy[i] = v.y;
+			vz[i] = v.z;
+
+			const float arc = px[i];
+			const float r = pz[i];
+			px[i] = position.x + cosf(arc) * r;
+			py[i] = position.y;
+			pz[i] = position.z + sinf(arc) * r;
 		}
+	} break;
+	default:
+		assert(false);
+		break;
 	}
 
-	time_until_spawn -= dt;
-	if (time_until_spawn < 0.0f && particle_count < MAX_PARTICLES)
+	if (random_color)
 	{
-		Particle& p = particles[particle_count++];
-		p.lifetime = particle_lifetime;
-		switch (shape_settings.shape)
-		{
-		case EmissionShape::NONE:
-			p.velocity = glm::vec3(0.0f, 1.0f, 0.0f) * initial_speed;
-			p.position = position;
-			break;
-		case EmissionShape::CONE:
+		fill_random(PARTICLE_STREAM_COLOR_R, 0.0f, 1.0f);
+		fill_random(PARTICLE_STREAM_COLOR_G, 0.0f, 1.0f);
+		fill_random(PARTICLE_STREAM_COLOR_B, 0.0f, 1.0f);
+		fill_random(PARTICLE_STREAM_COLOR_A, 0.0f, 1.0f);
+	}
+	else
+	{
+		// Lerp factor staged in the alpha stream
+		fill_random(PARTICLE_STREAM_COLOR_A, 0.0f, 1.0f);
+		float* r = particles[PARTICLE_STREAM_COLOR_R] + first;
+		float* g = particles[PARTICLE_STREAM_COLOR_G] + first;
+		float* b = particles[PARTICLE_STREAM_COLOR_B] + first;
+		float* a = particles[PARTICLE_STREAM_COLOR_A] + first;
+		for (uint32_t i = 0; i < spawn_count; ++i)
 		{
-			p.velocity = random_vector_in_oriented_cone(cosf(shape_settings.angle), glm::vec3(0.0, 1.0f, 0.0f)) * initial_speed;
-			float arc = random_in_range(0.0f, shape_settings.arc);
-			float r = random_in_range(0.0f, shape_settings.radius);
-			p.position = position + glm::vec3(cosf(arc), 0.0f, sinf(arc)) * r;
-		} break;
-		default:
-			assert(false);
-			break;
+			const glm::vec4 color = glm::lerp(particle_color0, particle_color1, a[i]);
+			r[i] = color.r;
+			g[i] = color.g;
+			b[i] = color.b;
+			a[i] = color.a;
 		}
-		p.color = random_color ? random_vector<glm::vec4>() : glm::lerp(particle_color0, particle_color1, uniform_random());
-		p.acceleration = GRAVITY * gravity_modifier;
-		p.size = random_in_range(start_size.x, start_size.y);
-		p.flipbook_index = flipbook_index; //random_int_in_range(0, flipbook_size.x * flipbook_size.y);
-		p.rotation = glm::radians(random_in_range(start_rotation.x, start_rotation.y));
-		time_until_spawn += 1.0f / emission_rate;	
 	}
+
+	const glm::vec3 acceleration = GRAVITY * gravity_modifier;
+	fill(PARTICLE_STREAM_ACCELERATION_X, acceleration.x);
+	fill(PARTICLE_STREAM_ACCELERATION_Y, acceleration.y);
+	fill(PARTICLE_STREAM_ACCELERATION_Z, acceleration.z);
+	fill(PARTICLE_STREAM_LIFETIME, particle_lifetime);
+	fill(PARTICLE_STREAM_FLIPBOOK_INDEX, (float)flipbook_index); //random_int_in_range(0, flipbook_size.x * flipbook_size.y);
+	fill_random(PARTICLE_STREAM_SIZE, start_size.x, start_size.y);
+	fill_random(PARTICLE_STREAM_ROTATION, glm::radians(start_rotation.x), glm::radians(start_rotation.y));
 }
 
 static void set_renderer_settings(ParticleSystem& ps)
@@ -94,11 +222,14 @@ void ParticleSystem::draw_ui()
 	ImGui::Checkbox("looping", &looping);
 	ImGui::DragFloat3("emitter position", glm::value_ptr(position), 0.1f, -1000.0f, 1000.0f);
 	ImGui::DragFloat("particle lifetime", &particle_lifetime, 0.1f, 0.0f, 100.0f);
+	ImGui::DragScalar("capacity", ImGuiDataType_U32, &capacity, 1.0f);
 	ImGui::DragFloat2("start size", glm::value_ptr(start_size), 0.01f, 0.0f, 100.0f);
 	if (ImGui::DragFloat("emission rate", &emission_rate, 0.1f, 0.0f, 1000.0f)) time_until_spawn = 1.0f / emission_rate;
 	ImGui::DragFloat("initial speed", &initial_speed, 0.1f, 0.0f, 1000.0f);
 	ImGui::DragFloat("gravity_modifier", &gravity_modifier, 0.1f, 0.0f, 100.0f);
 	ImGui::DragFloat2("start rotation", glm::value_ptr(start_rotation), 0.0f, 360.0f);
+	ImGui::Checkbox("SDF collision", &sdf_collision);
+	if (sdf_collision) ImGui::DragFloat("collision restitution", &collision_restitution, 0.01f, 0.0f, 1.0f);
 
 	if (ImGui::CollapsingHeader("Shape"))
 	{
@@ -229,6 +360,9 @@ std::ostream& operator<<(std::ostream& os, const ParticleSystem& ps)
 	os << "start_rotation: " << ps.start_rotation << "\n";
 	os << "shape: " << (int)ps.shape_settings.shape << "\n";
 	os << "arc: " << ps.shape_settings.arc << "\n";
+	os << "capacity: " << ps.capacity << "\n";
+	os << "sdf_collision: " << ps.sdf_collision << "\n";
+	os << "collision_restitution: " << ps.collision_restitution << "\n";
  
 	if (ps.texture) os << "texture: " << ps.texture->name << "\n";
 	if (ps.emission_map) os << "emission_map: " << ps.emission_map->name << "\n";
@@ -334,15 +468,18 @@ bool ParticleSystem::load(const char* filepath)
 		READ_FLOATS(duration, "duration", 1);
 		READ_FLOATS(start_rotation, "start_rotation", 2);
 		READ_FLOATS(shape_settings.arc, "arc", 1);
+		READ_FLOATS(collision_restitution, "collision_restitution", 1);
 		READ_INTS(flipbook_size, "flipbook_size", 2);
 		READ_INTS(flipbook_index, "flipbook_index", 1);
 		READ_INTS(blend_mode, "blend_mode", 1);
 		READ_INTS(shape_settings.shape, "shape", 1);
+		READ_INTS(capacity, "capacity", 1);
 		READ_BOOL(random_color, "random_color");
 		READ_BOOL(emission_enabled, "emission");
 		READ_BOOL(flipbook_frame_blending, "flipbook_frame_blending");
 		READ_BOOL(use_flipbook_animation, "use_flipbook_animation");
 		READ_BOOL(looping, "looping");
+		READ_BOOL(sdf_collision, "sdf_collision");
 		if (parameter == "texture")
 		{
 			texture = renderer->texture_catalog->get_texture(split[0].c_str());
@@ -372,9 +509,13 @@ error:
 
 void ParticleSystem::reset()
 {
-	particle_count = 0;
+	release_memory();
 	time_until_spawn = 0.0f;
 	lifetime = duration;
+
+	// Each system draws from its own stream keyed by name so emission does not depend on update order
+	const uint64_t stream = hash_fnv1a_64(name, strlen(name));
+	random_batch_seed(&rng, PARTICLE_RANDOM_SEED, stream);
 }
 
 void ParticleRenderer::init(Context* ctx, VkBuffer globals_buffer, VkFormat render_target_format)
@@ -382,7 +523,7 @@ void ParticleRenderer::init(Context* ctx, VkBuffer globals_buffer, VkFormat rend
 	shader_globals = globals_buffer;
 	this->ctx = ctx;
 
-	GraphicsPipelineBuilder builder(ctx->device, true);
+	GraphicsPipelineBuilder builder(ctx->device, true, ctx->pipeline_cache);
 	builder
 		.set_vertex_shader_filepath("particles.hlsl")
 		.set_fragment_shader_filepath("particles.hlsl")
@@ -424,11 +565,9 @@ void ParticleRenderer::init(Context* ctx, VkBuffer globals_buffer, VkFormat rend
 		ctx->create_textures(white_texture, 1);
 	}
 
-	additive_blend_pipeline = new GraphicsPipelineAsset(builder);
+	additive_blend_pipeline = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 	builder.set_blend_preset(BlendPreset::ALPHA);
-	alpha_blend_pipeline = new GraphicsPipelineAsset(builder);
-	AssetCatalog::register_asset(additive_blend_pipeline);
-	AssetCatalog::register_asset(alpha_blend_pipeline);
+	alpha_blend_pipeline = AssetCatalog::register_asset(new GraphicsPipelineAsset(builder));
 
 	BufferDesc desc{};
 	ParticleRenderSettings default_settings{};
@@ -443,8 +582,8 @@ void ParticleRenderer::init(Context* ctx, VkBuffer globals_buffer, VkFormat rend
 
 void ParticleRenderer::shutdown()
 {
-	additive_blend_pipeline->builder.destroy_resources(additive_blend_pipeline->pipeline);
-	alpha_blend_pipeline->builder.destroy_resources(alpha_blend_pipeline->pipeline);
+	AssetCatalog::release_asset(additive_blend_pipeline);
+	AssetCatalog::release_asset(alpha_blend_pipeline);
 	vkDestroySampler(ctx->device, texture_sampler, nullptr);
 	white_texture->destroy(ctx->device, ctx->allocator);
 	vmaDestroyBuffer(ctx->allocator, renderer_settings.buffer, renderer_settings.allocation);
@@ -468,24 +607,25 @@ void ParticleRenderer::render(VkCommandBuffer command_buffer, const ParticleSyst
 
 	int flipbook_range = particle_system.flipbook_size.x * particle_system.flipbook_size.y;
 	const float inv_particle_lifetime = 1.0f / particle_system.particle_lifetime;
-	for (uint32_t i = 0; i < particle_system.particle_count; ++i)
+	const ParticleStreams& p = particle_system.particles;
+	for (uint32_t i = 0; i < p.count; ++i)
 	{
-		const Particle& p = particle_system.particles[i];
+		const int flipbook_index = (int)p[PARTICLE_STREAM_FLIPBOOK_INDEX][i];
 
 		PushCostantsParticles pc{};
-		pc.color = p.color;
-		pc.position = glm::vec4(p.position, 1.0f);
+		pc.color = glm::vec4(p[PARTICLE_STREAM_COLOR_R][i], p[PARTICLE_STREAM_COLOR_G][i], p[PARTICLE_STREAM_COLOR_B][i], p[PARTICLE_STREAM_COLOR_A][i]);
+		pc.position = glm::vec4(p[PARTICLE_STREAM_POSITION_X][i], p[PARTICLE_STREAM_POSITION_Y][i], p[PARTICLE_STREAM_POSITION_Z][i], 1.0f);
 		pc.flipbook_size = particle_system.flipbook_size;
-		pc.size = p.size;
-		pc.normalized_lifetime = glm::clamp(p.lifetime * inv_particle_lifetime, 0.0f, 1.0f);
+		pc.size = p[PARTICLE_STREAM_SIZE][i];
+		pc.normalized_lifetime = glm::clamp(p[PARTICLE_STREAM_LIFETIME][i] * inv_particle_lifetime, 0.0f, 1.0f);
 		float age = 1.0f - pc.normalized_lifetime;
-		pc.flipbook_index0 = pc.flipbook_index1 = p.flipbook_index;
-		pc.rotation = p.rotation;
+		pc.flipbook_index0 = pc.flipbook_index1 = flipbook_index;
+		pc.rotation = p[PARTICLE_STREAM_ROTATION][i];
 		if (particle_system.use_flipbook_animation)
 		{
 			float lerp = glm::fract(age * (float)flipbook_range);
 			int flipbook_offset = std::min((int)(age * flipbook_range), flipbook_range - 1);
-			pc.flipbook_index0 = (p.flipbook_index + flipbook_offset) % flipbook_range;
+			pc.flipbook_index0 = (flipbook_index + flipbook_offset) % flipbook_range;
 			if (particle_system.flipbook_frame_blending)
 			{
 				pc.flipbook_index1 = std::min((int)pc.flipbook_index0 + 1, flipbook_range - 1);
@@ -529,6 +669,7 @@ static void reload(ParticleSystemManager& manager)
 	}
 
 	manager.catalog.clear();
+	manager.enabled_systems.clear();
 
 	for (const auto& f : std::filesystem::directory_iterator(path))
 	{
@@ -540,7 +681,7 @@ static void reload(ParticleSystemManager& manager)
 				printf("%s\n", f.path().string().c_str());
 				std::string name = f.path().filename().string();
 
-				ParticleSystem* ps = new ParticleSystem(manager.renderer);
+				ParticleSystem* ps = new ParticleSystem(manager.renderer, &manager.arena);
 				if (ps->load(f.path().string().c_str()))
 				{
 					manager.catalog.insert(std::make_pair(name, ps));
@@ -574,6 +715,79 @@ void ParticleSystemManager::init(ParticleRenderer* renderer)
 	this->directory = PARTICLE_SYSTEM_DIRECTORY;
 
 	reload(*this);
+
+	// Collide with the same surface as the GPU systems unless a collision volume has been converted for the scene
+	std::error_code ec;
+	if (!std::filesystem::exists(PARTICLE_COLLISION_SDF_PATH, ec) || !load_collision_sdf(PARTICLE_COLLISION_SDF_PATH))
+	{
+		bake_collision_sphere(TRAIL_BLAZER_SPHERE_CENTER, TRAIL_BLAZER_SPHERE_RADIUS, PARTICLE_COLLISION_SDF_RESOLUTION);
+	}
+}
+
+static void set_collision_volume(ParticleSystemManager& manager, SDF* sdf)
+{
+	if (manager.collision_volume)
+	{
+		manager.collision_volume->unload();
+		delete manager.collision_volume;
+	}
+	manager.collision_volume = sdf;
+	manager.collision_sdf = sdf ? &sdf->query : nullptr;
+}
+
+bool ParticleSystemManager::load_collision_sdf(const char* filepath)
+{
+	SDF* sdf = new SDF();
+	if (!sdf_load_from_file(*sdf, filepath) || !sdf->init_queries())
+	{
+		sdf->unload();
+		delete sdf;
+		return false;
+	}
+
+	set_collision_volume(*this, sdf);
+	return true;
+}
+
+// Samples the sphere at the texel centers of a grid twice its diameter wide
+void ParticleSystemManager::bake_collision_sphere(const glm::vec3& center, float radius, uint32_t resolution)
+{
+	SDF* sdf = new SDF();
+	sdf->dims = glm::uvec3(resolution);
+	sdf->grid_spacing = radius * 4.0f / resolution;
+	sdf->grid_origin = center - glm::vec3(radius * 2.0f);
+	sdf->data.resize((size_t)resolution * resolution * resolution);
+	for (uint32_t z = 0; z < resolution; ++z)
+	{
+		for (uint32_t y = 0; y < resolution; ++y)
+		{
+			for (uint32_t x = 0; x < resolution; ++x)
+			{
+				const glm::vec3 p = sdf->grid_origin + (glm::vec3(x, y, z) + 0.5f) * sdf->grid_spacing;
+				sdf->data[((size_t)z * resolution + y) * resolution + x] = glm::length(p - center) - radius;
+			}
+		}
+	}
+	sdf->payload = sdf->data.data();
+	sdf->payload_format = SDFPayloadFormat::FLOAT32;
+	sdf->init_queries();
+
+	set_collision_volume(*this, sdf);
+}
+
+void ParticleSystemManager::shutdown()
+{
+	for (auto& ps : catalog)
+	{
+		delete ps.second;
+	}
+
+	catalog.clear();
+	active_system = nullptr;
+	enabled_systems.clear();
+	arena.shutdown();
+
+	set_collision_volume(*this, nullptr);
 }
 
 void ParticleSystemManager::draw_ui()
@@ -643,21 +857,155 @@ void ParticleSystemManager::draw_ui()
 	if (active_system)
 	{
 		ImGui::Text("Playback time: %f", active_system->duration - active_system->lifetime);
+		ImGui::Text("Particles: %u / %u (capacity %u)", active_system->particles.count, active_system->particles.capacity, active_system->capacity);
 	}
+	ImGui::Text("CPU update: %.3f ms (%u job workers)", update_time_ms, JobSystem::get_worker_count());
+	if (collision_sdf) ImGui::Text("Collision SDF: %ux%ux%u", collision_sdf->dims.x, collision_sdf->dims.y, collision_sdf->dims.z);
+	arena.draw_ui();
 
 	ImGui::End();
 }
 
+// Pushes particles out of the SDF and reflects the velocity component going into the surface
+static void collide_with_sdf(ParticleStreams& particles, uint32_t begin, uint32_t end, const SDFQuery& sdf, float restitution)
+{
+	constexpr uint32_t chunk_size = 256;
+	float distance[chunk_size];
+	float gradient[3][chunk_size];
+
+	float* position[3] = { particles[PARTICLE_STREAM_POSITION_X], particles[PARTICLE_STREAM_POSITION_Y], particles[PARTICLE_STREAM_POSITION_Z] };
+	float* velocity[3] = { particles[PARTICLE_STREAM_VELOCITY_X], particles[PARTICLE_STREAM_VELOCITY_Y], particles[PARTICLE_STREAM_VELOCITY_Z] };
+	const float* size = particles[PARTICLE_STREAM_SIZE];
+
+	for (uint32_t chunk = begin; chunk < end; chunk += chunk_size)
+	{
+		const uint32_t n = std::min(chunk_size, end - chunk);
+		sdf.sample_gradient_batch(position[0] + chunk, position[1] + chunk, position[2] + chunk, distance, gradient[0], gradient[1], gradient[2], n);
+
+		for (uint32_t j = 0; j < n; ++j)
+		{
+			const uint32_t i = chunk + j;
+			const float penetration = size[i] * 0.5f - distance[j];
+			if (penetration <= 0.0f) continue;
+
+			glm::vec3 normal(gradient[0][j], gradient[1][j], gradient[2][j]);
+			const float length = glm::length(normal);
+			if (length < 1e-6f) continue;
+			normal /= length;
+
+			glm::vec3 v(velocity[0][i], velocity[1][i], velocity[2][i]);
+			const float vn = glm::dot(v, normal);
+			if (vn < 0.0f) v -= normal * ((1.0f + restitution) * vn);
+
+			for (int k = 0; k < 3; ++k)
+			{
+				position[k][i] += normal[k] * penetration;
+				velocity[k][i] = v[k];
+			}
+		}
+	}
+}
+
+static void integrate_range_job(void* data, uint32_t index)
+{
+	CPU_ZONE("Integrate particles");
+	ParticleUpdateData& update = *(ParticleUpdateData*)data;
+	ParticleUpdateRange& range = update.ranges[index];
+	range.system->particles.integrate(range.begin, range.end, update.dt);
+	if (update.collision_sdf && range.system->sdf_collision)
+	{
+		collide_with_sdf(range.system->particles, range.begin, range.end, *update.collision_sdf, range.system->collision_restitution);
+	}
+	range.end = range.system->particles.compact(range.begin, range.end);
+}
+
+static void finish_system_job(void* data, uint32_t index)
+{
+	CPU_ZONE("Finish particle system");
+	ParticleUpdateData& update = *(ParticleUpdateData*)data;
+	ParticleSystem* system = update.systems[index];
+
+	// Close the gaps left between the independently compacted ranges
+	uint32_t count = 0;
+	for (uint32_t i = update.first_range[index]; i < update.first_range[index + 1]; ++i)
+	{
+		const ParticleUpdateRange& range = update.ranges[i];
+		system->particles.move(count, range.begin, range.end - range.begin);
+		count += range.end - range.begin;
+	}
+	system->particles.count = count;
+
+	system->spawn(update.spawn_counts[index]);
+}
+
 void ParticleSystemManager::update(float dt)
 {
+	CPU_ZONE("Particle update");
 	float t = !paused ? dt * playback_speed : 0.0f;
-	if (active_system)
-		active_system->update(t);
+	Timer timer;
+	timer.tick();
+
+	ParticleUpdateData& update = update_data;
+	update.dt = t;
+	update.collision_sdf = collision_sdf && collision_sdf->is_valid() ? collision_sdf : nullptr;
+	update.systems.clear();
+	update.ranges.clear();
+	update.first_range.clear();
+
+	// The active system is simulated whether or not it is enabled as well
+	update.candidates.assign(enabled_systems.begin(), enabled_systems.end());
+	if (active_system && std::find(enabled_systems.begin(), enabled_systems.end(), active_system) == enabled_systems.end())
+	{
+		update.candidates.push_back(active_system);
+	}
+
+	for (ParticleSystem* system : update.candidates)
+	{
+		if (!system->begin_update(t)) continue;
+
+		update.first_range.push_back((uint32_t)update.ranges.size());
+		update.systems.push_back(system);
+		for (uint32_t begin = 0; begin < system->particles.count; begin += PARTICLE_JOB_RANGE_SIZE)
+		{
+			const uint32_t end = std::min(begin + PARTICLE_JOB_RANGE_SIZE, system->particles.count);
+			update.ranges.push_back(ParticleUpdateRange{ system, begin, end });
+		}
+	}
+	update.first_range.push_back((uint32_t)update.ranges.size());
+
+	JobCounter counter;
+	JobSystem::dispatch(integrate_range_job, &update, (uint32_t)update.ranges.size(), &counter);
+	JobSystem::wait(&counter);
+
+	// Growing a system allocates from the arena, which is not thread safe, so room for this step's
+	// emission is made here on the calling thread before the systems finish in parallel
+	update.spawn_counts.resize(update.systems.size());
+	for (uint32_t i = 0; i < update.systems.size(); ++i)
+	{
+		uint32_t live_count = 0;
+		for (uint32_t r = update.first_range[i]; r < update.first_range[i + 1]; ++r)
+		{
+			live_count += update.ranges[r].end - update.ranges[r].begin;
+		}
+		update.spawn_counts[i] = update.systems[i]->reserve_emission(t, live_count);
+	}
+
+	JobSystem::dispatch(finish_system_job, &update, (uint32_t)update.systems.size(), &counter);
+	JobSystem::wait(&counter);
+
+	timer.tock();
+	update_time_ms = timer.get_elapsed_milliseconds();
 }
 
 void ParticleSystemManager::render(VkCommandBuffer cmd)
 {
-	if (renderer && active_system)
+	if (!renderer) return;
+
+	for (ParticleSystem* system : enabled_systems)
+	{
+		if (system != active_system) renderer->render(cmd, *system);
+	}
+	if (active_system)
 	{
 		renderer->render(cmd, *active_system);
 	}
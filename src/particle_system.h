@@ -3,13 +3,22 @@
 #include <vector>
 #include <unordered_map>
 #include "buffer.h"
+#include "particle_streams.h"
+#include "particle_arena.h"
+#include "random.h"
 
-#define MAX_PARTICLES 512
+#define DEFAULT_PARTICLE_CAPACITY 512
+#define PARTICLE_RANDOM_SEED 0x853c49e6748fea9bull
+
+// Systems larger than this are split into several integration jobs
+#define PARTICLE_JOB_RANGE_SIZE 16384
 
 struct ParticleSystem;
 struct ParticleRenderer;
 
 struct Context;
+struct SDF;
+struct SDFQuery;
 struct GraphicsPipelineAsset;
 struct Texture;
 struct TextureCatalog;
@@ -17,18 +26,51 @@ struct TextureCatalog;
 struct ParticleRenderSettings;
 
 #define PARTICLE_SYSTEM_DIRECTORY "data/particle_systems"
+// Loaded as the collision SDF when present, otherwise the Trail Blazer's sphere is baked at this resolution
+#define PARTICLE_COLLISION_SDF_PATH "data/collision.sdfb"
+#define PARTICLE_COLLISION_SDF_RESOLUTION 32
+
+struct ParticleUpdateRange
+{
+	ParticleSystem* system;
+	uint32_t begin;
+	uint32_t end;
+};
+
+// Per frame job data of ParticleSystemManager::update
+struct ParticleUpdateData
+{
+	float dt;
+	const SDFQuery* collision_sdf;
+	std::vector<ParticleSystem*> candidates; // Enabled systems plus the active one
+	std::vector<ParticleSystem*> systems; // Candidates that are still running this frame
+	std::vector<ParticleUpdateRange> ranges;
+	std::vector<uint32_t> first_range; // Per system index into ranges, with one extra entry at the end
+	std::vector<uint32_t> spawn_counts; // Per system, reserved before the systems finish in parallel
+};
 
 struct ParticleSystemManager
 {
 	ParticleSystem* active_system = nullptr;
+	// Updated and rendered every frame along with active_system, e.g. the systems of a benchmark scene.
+	// Systems in catalog that are in neither are not simulated
+	std::vector<ParticleSystem*> enabled_systems;
 	std::unordered_map<std::string, ParticleSystem*> catalog;
 	const char* directory = nullptr;
 	ParticleRenderer* renderer;
+	ParticleArena arena;
+	const SDFQuery* collision_sdf = nullptr; // Systems with sdf_collision enabled collide against this
+	SDF* collision_volume = nullptr; // Grid behind collision_sdf when the manager loaded or baked it
 
 	float playback_speed = 1.0f;
 	bool paused = false;
+	double update_time_ms = 0.0;
+	ParticleUpdateData update_data; // Reused across frames to avoid reallocating
 
 	void init(ParticleRenderer* renderer);
+	void shutdown();
+	bool load_collision_sdf(const char* filepath);
+	void bake_collision_sphere(const glm::vec3& center, float radius, uint32_t resolution);
 	void draw_ui();
 	void update(float dt);
 	void render(VkCommandBuffer cmd);
@@ -53,18 +95,6 @@ struct ParticleRenderer
 	void set_render_settings(const ParticleRenderSettings& render_settings);
 };
 
-struct Particle
-{
-	glm::vec3 position;
-	glm::vec3 velocity;
-	glm::vec3 acceleration;
-	glm::vec4 color;
-	float lifetime;
-	float size;
-	float rotation;
-	int flipbook_index;
-};
-
 #define MAX_NAME_LENGTH 64
 
 
@@ -85,8 +115,11 @@ struct ShapeSettings
 
 struct ParticleSystem
 {
-	Particle particles[MAX_PARTICLES];
-	uint32_t particle_count = 0;
+	ParticleStreams particles;
+	ParticleArena* arena = nullptr;
+	ParticleBlock particle_block;
+	uint32_t capacity = DEFAULT_PARTICLE_CAPACITY;
+	RandomBatch rng = {};
 
 	char name[64] = { 0 };
 
@@ -107,6 +140,8 @@ struct ParticleSystem
 	float particle_lifetime = 5.0f;
 	glm::vec2 start_size = glm::vec2(0.01f);
 	bool random_color = false;
+	bool sdf_collision = false;
+	float collision_restitution = 0.5f;
 
 
 	enum BlendMode
@@ -128,8 +163,17 @@ struct ParticleSystem
 	int flipbook_index = 0;
 	float time_until_spawn = 0.0f;
 
-	ParticleSystem(ParticleRenderer* renderer);
+	ParticleSystem(ParticleRenderer* renderer, ParticleArena* arena);
+	~ParticleSystem();
 	void update(float dt);
+	bool begin_update(float dt); // Returns false if the system has finished
+	void emit(float dt);
+	// Advances the spawn timer and grows the particle block to fit what is due, returns how many to spawn.
+	// Allocates from the shared arena, so only call it from one thread at a time
+	uint32_t reserve_emission(float dt, uint32_t live_count);
+	void spawn(uint32_t spawn_count);
+	bool grow();
+	void release_memory();
 	void draw_ui();
 	bool save();
 	bool load(const char* filepath);
@@ -1,5 +1,7 @@
 #include "pipeline.h"
 #include "shaders.h"
+#include "misc.h"
+#include "layout_cache.h"
 #include <filesystem>
 #include <optional>
 
@@ -9,8 +11,8 @@ static uint64_t get_file_timestamp(const std::string& path)
     return ftime.time_since_epoch().count();
 }
 
-GraphicsPipelineBuilder::GraphicsPipelineBuilder(VkDevice dev, bool enable_shader_hot_reload)
-    : device(dev)
+GraphicsPipelineBuilder::GraphicsPipelineBuilder(VkDevice dev, bool enable_shader_hot_reload, VkPipelineCache cache)
+    : device(dev), pipeline_cache(cache)
 {
     // Set default values
 
@@ -345,25 +347,13 @@ bool GraphicsPipelineBuilder::build(Pipeline* out_pipeline)
             set_layout_count++;
 
             if (set_layout_passed_from_outside[i]) continue;
-            VkDescriptorSetLayoutCreateInfo info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-            info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
-            info.bindingCount = bindings[i].size();
-            info.pBindings = bindings[i].data();
-            VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set_layouts[i]));
+            set_layouts[i] = LayoutCache::acquire_set_layout(device, bindings[i]);
         }
 
-
-
-        VkPipelineLayoutCreateInfo info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-        info.setLayoutCount = set_layout_count;
-        info.pSetLayouts = set_layouts;
         VkPushConstantRange range{};
         range.stageFlags = push_constant_stage_flags;
         range.size = push_constant_size;
-        info.pPushConstantRanges = &range;
-        info.pushConstantRangeCount = push_constant_size != 0 ? 1 : 0;
-        VkPipelineLayout layout = VK_NULL_HANDLE;
-        VK_CHECK(vkCreatePipelineLayout(device, &info, nullptr, &layout));
+        VkPipelineLayout layout = LayoutCache::acquire_pipeline_layout(device, set_layouts, set_layout_count, range);
         pipeline_create_info.layout = layout;
         pp.layout = layout;
         pp.descriptor_set_count = set_layout_count;
@@ -372,16 +362,8 @@ bool GraphicsPipelineBuilder::build(Pipeline* out_pipeline)
         memcpy(pp.set_layouts, set_layouts, sizeof(VkDescriptorSetLayout) * set_layout_count);
     }
 
-    VkDescriptorUpdateTemplateCreateInfo desc_template_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
-    desc_template_info.descriptorUpdateEntryCount = descriptor_template_entries.size();
-    desc_template_info.pDescriptorUpdateEntries = descriptor_template_entries.data();
-    desc_template_info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
-    desc_template_info.descriptorSetLayout = pp.set_layouts[0];
-    desc_template_info.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    desc_template_info.pipelineLayout = pp.layout;
-    desc_template_info.set = 0;
-
-    VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &desc_template_info, nullptr, &pp.descriptor_update_template));
+    pp.descriptor_update_template = LayoutCache::acquire_update_template(device, descriptor_template_entries,
+        VK_PIPELINE_BIND_POINT_GRAPHICS, pp.set_layouts[0], pp.layout);
 
     VK_CHECK(vkCreateGraphicsPipelines(device, pipeline_cache, 1, &pipeline_create_info, nullptr, &pp.pipeline));
 
@@ -401,14 +383,14 @@ void GraphicsPipelineBuilder::destroy_resources(Pipeline& pipeline)
     {
         if (!set_layout_passed_from_outside[i] && pipeline.set_layouts[i] != VK_NULL_HANDLE)
         {
-            vkDestroyDescriptorSetLayout(device, pipeline.set_layouts[i], nullptr);
+            LayoutCache::release_set_layout(pipeline.set_layouts[i]);
             pipeline.set_layouts[i] = VK_NULL_HANDLE;
         }
     }
 
     if (pipeline.layout != VK_NULL_HANDLE)
     {
-        vkDestroyPipelineLayout(device, pipeline.layout, nullptr);
+        LayoutCache::release_pipeline_layout(pipeline.layout);
         pipeline.layout = VK_NULL_HANDLE;
     }
 
@@ -420,12 +402,79 @@ void GraphicsPipelineBuilder::destroy_resources(Pipeline& pipeline)
 
     if (pipeline.descriptor_update_template != VK_NULL_HANDLE)
     {
-        vkDestroyDescriptorUpdateTemplate(device, pipeline.descriptor_update_template, nullptr);
+        LayoutCache::release_update_template(pipeline.descriptor_update_template);
         pipeline.descriptor_update_template = VK_NULL_HANDLE;
     }
 }
 
 
+uint64_t GraphicsPipelineBuilder::get_content_hash() const
+{
+    // Hashed field by field, the create info structs contain pointers and padding
+    uint64_t hash = hash_value_fnv1a_64(device, FNV1A_64_OFFSET_BASIS);
+    hash = hash_value_fnv1a_64(pipeline_create_info.flags, hash);
+    hash = hash_value_fnv1a_64(pipeline_create_info.stageCount, hash);
+    for (uint32_t i = 0; i < pipeline_create_info.stageCount; ++i)
+    {
+        hash = hash_value_fnv1a_64(shader_stage_create_info[i].stage, hash);
+        hash = shader_sources[i].shader_source.get_content_hash(hash);
+    }
+
+    hash = hash_value_fnv1a_64(input_assembly_state.topology, hash);
+    hash = hash_value_fnv1a_64(input_assembly_state.primitiveRestartEnable, hash);
+    hash = hash_value_fnv1a_64(tesselation_state.patchControlPoints, hash);
+    hash = hash_value_fnv1a_64(viewport_state.viewportCount, hash);
+    hash = hash_value_fnv1a_64(viewport_state.scissorCount, hash);
+
+    hash = hash_value_fnv1a_64(rasterization_state.depthClampEnable, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.rasterizerDiscardEnable, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.polygonMode, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.cullMode, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.frontFace, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.depthBiasEnable, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.depthBiasConstantFactor, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.depthBiasClamp, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.depthBiasSlopeFactor, hash);
+    hash = hash_value_fnv1a_64(rasterization_state.lineWidth, hash);
+
+    hash = hash_value_fnv1a_64(multisample_state.rasterizationSamples, hash);
+    hash = hash_value_fnv1a_64(multisample_state.sampleShadingEnable, hash);
+    hash = hash_value_fnv1a_64(multisample_state.minSampleShading, hash);
+    hash = hash_value_fnv1a_64(multisample_state.alphaToCoverageEnable, hash);
+    hash = hash_value_fnv1a_64(multisample_state.alphaToOneEnable, hash);
+
+    hash = hash_value_fnv1a_64(depth_stencil_state.depthTestEnable, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.depthWriteEnable, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.depthCompareOp, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.depthBoundsTestEnable, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.stencilTestEnable, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.front, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.back, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.minDepthBounds, hash);
+    hash = hash_value_fnv1a_64(depth_stencil_state.maxDepthBounds, hash);
+
+    hash = hash_value_fnv1a_64(color_blend_state.logicOpEnable, hash);
+    hash = hash_value_fnv1a_64(color_blend_state.logicOp, hash);
+    hash = hash_value_fnv1a_64(color_blend_state.blendConstants, hash);
+    hash = hash_value_fnv1a_64(color_attachment_count, hash);
+    hash = hash_fnv1a_64(color_blend_attachments, sizeof(color_blend_attachments[0]) * color_attachment_count, hash);
+    hash = hash_fnv1a_64(color_attachment_formats, sizeof(color_attachment_formats[0]) * color_attachment_count, hash);
+    hash = hash_value_fnv1a_64(rendering_create_info.viewMask, hash);
+    hash = hash_value_fnv1a_64(rendering_create_info.depthAttachmentFormat, hash);
+    hash = hash_value_fnv1a_64(rendering_create_info.stencilAttachmentFormat, hash);
+
+    hash = hash_value_fnv1a_64(dynamic_state_count, hash);
+    hash = hash_fnv1a_64(dynamic_states, sizeof(dynamic_states[0]) * dynamic_state_count, hash);
+
+    for (uint32_t i = 0; i < max_descriptor_set_layouts; ++i)
+    {
+        hash = hash_value_fnv1a_64(set_layout_passed_from_outside[i], hash);
+        if (set_layout_passed_from_outside[i]) hash = hash_value_fnv1a_64(set_layouts[i], hash);
+    }
+
+    return hash;
+}
+
 ComputePipelineBuilder& ComputePipelineBuilder::set_shader_filepath(const char* filepath, const char* entry_point)
 {
     return set_shader_source(ShaderSource(filepath, entry_point));
@@ -445,11 +494,12 @@ ComputePipelineBuilder& ComputePipelineBuilder::set_shader_source(const ShaderSo
     return *this;
 }
 
-ComputePipelineBuilder::ComputePipelineBuilder(VkDevice device, bool enable_shader_hot_reload)
+ComputePipelineBuilder::ComputePipelineBuilder(VkDevice device, bool enable_shader_hot_reload, VkPipelineCache cache)
 {
     hot_reloadable = true;
     create_info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
     this->device = device;
+    this->pipeline_cache = cache;
 }
 
 bool ComputePipelineBuilder::build(Pipeline* out_pipeline)
@@ -518,41 +568,22 @@ bool ComputePipelineBuilder::build(Pipeline* out_pipeline)
         for (uint32_t i = 0; i < descriptor_set_layout_count; ++i)
         {
             if (set_layout_passed_from_outside[i]) continue;
-            VkDescriptorSetLayoutCreateInfo info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
-            info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
-            info.bindingCount = bindings[i].size();
-            info.pBindings = bindings[i].data();
-            VK_CHECK(vkCreateDescriptorSetLayout(device, &info, nullptr, &set_layouts[i]));
+            set_layouts[i] = LayoutCache::acquire_set_layout(device, bindings[i]);
         }
 
-
-        VkPipelineLayout layout = VK_NULL_HANDLE;
-        VkPipelineLayoutCreateInfo info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
-        info.setLayoutCount = descriptor_set_layout_count;
-        info.pSetLayouts = set_layouts;
         VkPushConstantRange range{};
         range.stageFlags = pc_stage_flags;
         range.size = pc_size;
-        info.pPushConstantRanges = &range;
-        info.pushConstantRangeCount = pc_size != 0 ? 1 : 0;
-        VK_CHECK(vkCreatePipelineLayout(device, &info, nullptr, &layout));
+        VkPipelineLayout layout = LayoutCache::acquire_pipeline_layout(device, set_layouts, descriptor_set_layout_count, range);
         create_info.layout = layout;
         pp.layout = layout;
         memcpy(pp.set_layouts, set_layouts, sizeof(VkDescriptorSetLayout) * descriptor_set_layout_count);
     }
 
-    VkDescriptorUpdateTemplateCreateInfo desc_template_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
-    desc_template_info.descriptorUpdateEntryCount = descriptor_template_entries.size();
-    desc_template_info.pDescriptorUpdateEntries = descriptor_template_entries.data();
-    desc_template_info.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_PUSH_DESCRIPTORS_KHR;
-    desc_template_info.descriptorSetLayout = pp.set_layouts[0];
-    desc_template_info.pipelineBindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
-    desc_template_info.pipelineLayout = pp.layout;
-    desc_template_info.set = 0;
-
-    VK_CHECK(vkCreateDescriptorUpdateTemplate(device, &desc_template_info, nullptr, &pp.descriptor_update_template));
+    pp.descriptor_update_template = LayoutCache::acquire_update_template(device, descriptor_template_entries,
+        VK_PIPELINE_BIND_POINT_COMPUTE, pp.set_layouts[0], pp.layout);
 
-    VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &create_info, nullptr, &pp.pipeline));
+    VK_CHECK(vkCreateComputePipelines(device, pipeline_cache, 1, &create_info, nullptr, &pp.pipeline));
 
     destroy_resources(old_pipeline);
 
@@ -567,14 +598,14 @@ void ComputePipelineBuilder::destroy_resources(Pipeline& pipeline)
     {
         if (!set_layout_passed_from_outside[i] && pipeline.set_layouts[i] != VK_NULL_HANDLE)
         {
-            vkDestroyDescriptorSetLayout(device, pipeline.set_layouts[i], nullptr);
+            LayoutCache::release_set_layout(pipeline.set_layouts[i]);
             pipeline.set_layouts[i] = VK_NULL_HANDLE;
         }
     }
 
     if (pipeline.layout != VK_NULL_HANDLE)
     {
-        vkDestroyPipelineLayout(device, pipeline.layout, nullptr);
+        LayoutCache::release_pipeline_layout(pipeline.layout);
         pipeline.layout = VK_NULL_HANDLE;
     }
 
@@ -586,8 +617,21 @@ void ComputePipelineBuilder::destroy_resources(Pipeline& pipeline)
 
     if (pipeline.descriptor_update_template != VK_NULL_HANDLE)
     {
-        vkDestroyDescriptorUpdateTemplate(device, pipeline.descriptor_update_template, nullptr);
+        LayoutCache::release_update_template(pipeline.descriptor_update_template);
         pipeline.descriptor_update_template = VK_NULL_HANDLE;
     }
 }
 
+uint64_t ComputePipelineBuilder::get_content_hash() const
+{
+    uint64_t hash = hash_value_fnv1a_64(device, FNV1A_64_OFFSET_BASIS);
+    hash = hash_value_fnv1a_64(create_info.flags, hash);
+    hash = shader_source.shader_source.get_content_hash(hash);
+    for (uint32_t i = 0; i < max_descriptor_set_layouts; ++i)
+    {
+        hash = hash_value_fnv1a_64(set_layout_passed_from_outside[i], hash);
+        if (set_layout_passed_from_outside[i]) hash = hash_value_fnv1a_64(set_layouts[i], hash);
+    }
+
+    return hash;
+}
@@ -102,7 +102,7 @@ struct GraphicsPipelineBuilder
     VkDescriptorSetLayout set_layouts[max_descriptor_set_layouts] = {};
     bool set_layout_passed_from_outside[max_descriptor_set_layouts] = { false };
 
-    GraphicsPipelineBuilder(VkDevice dev, bool enable_shader_hot_reload);
+    GraphicsPipelineBuilder(VkDevice dev, bool enable_shader_hot_reload, VkPipelineCache cache);
 
     GraphicsPipelineBuilder& add_color_attachment(VkFormat format);
     GraphicsPipelineBuilder& set_depth_format(VkFormat format);
@@ -127,12 +127,16 @@ struct GraphicsPipelineBuilder
 
     bool build(Pipeline* pipeline);
     void destroy_resources(Pipeline& pipeline);
+
+    // Hash of the pipeline description, builders with equal hashes produce interchangeable pipelines
+    uint64_t get_content_hash() const;
 };
 
 struct ComputePipelineBuilder
 {
     VkDevice device;
     bool hot_reloadable;
+    VkPipelineCache pipeline_cache = VK_NULL_HANDLE;
     VkComputePipelineCreateInfo create_info{};
     struct {
         uint32_t* spirv;
@@ -149,9 +153,11 @@ struct ComputePipelineBuilder
     ComputePipelineBuilder& set_shader_filepath(const char* filepath, const char* entry_point = "cs_main");
 
     ComputePipelineBuilder& set_shader_source(const ShaderSource& shader_source);
-    ComputePipelineBuilder(VkDevice device, bool enable_shader_hot_reload);
+    ComputePipelineBuilder(VkDevice device, bool enable_shader_hot_reload, VkPipelineCache cache);
 
     bool build(Pipeline* pipeline);
     void destroy_resources(Pipeline& pipeline);
+
+    uint64_t get_content_hash() const;
 };
 
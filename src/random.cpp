@@ -0,0 +1,177 @@
+#include "random.h"
+#include <string.h>
+#include <algorithm>
+
+// pcg32 needs 64 bit integer multiplies, which SSE and AVX2 only have as 32x32->64 bit. AVX alone has no
+// 256 bit integer ops, so unlike the float code elsewhere this falls back to SSE unless AVX2 is available
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define RANDOM_SIMD_STATES 4 // 64 bit states per register
+#define RANDOM_SIMD_OUTPUT_LANES 8 // 32 bit outputs per register
+typedef __m256i simd_int;
+typedef __m256 simd_float;
+#define simd_loadu_int(p) _mm256_loadu_si256((const simd_int*)(p))
+#define simd_storeu_int(p, x) _mm256_storeu_si256((simd_int*)(p), x)
+#define simd_set1_int64 _mm256_set1_epi64x
+#define simd_mul_epu32 _mm256_mul_epu32
+#define simd_add_int64 _mm256_add_epi64
+#define simd_srli_int64 _mm256_srli_epi64
+#define simd_slli_int64 _mm256_slli_epi64
+#define simd_srli_int32 _mm256_srli_epi32
+#define simd_xor_int _mm256_xor_si256
+#define simd_to_float _mm256_cvtepi32_ps
+#define simd_set1 _mm256_set1_ps
+#define simd_add _mm256_add_ps
+#define simd_mul _mm256_mul_ps
+#define simd_storeu _mm256_storeu_ps
+#else
+#include <emmintrin.h>
+#define RANDOM_SIMD_STATES 2
+#define RANDOM_SIMD_OUTPUT_LANES 4
+typedef __m128i simd_int;
+typedef __m128 simd_float;
+#define simd_loadu_int(p) _mm_loadu_si128((const simd_int*)(p))
+#define simd_storeu_int(p, x) _mm_storeu_si128((simd_int*)(p), x)
+#define simd_set1_int64 _mm_set1_epi64x
+#define simd_mul_epu32 _mm_mul_epu32
+#define simd_add_int64 _mm_add_epi64
+#define simd_srli_int64 _mm_srli_epi64
+#define simd_slli_int64 _mm_slli_epi64
+#define simd_srli_int32 _mm_srli_epi32
+#define simd_xor_int _mm_xor_si128
+#define simd_to_float _mm_cvtepi32_ps
+#define simd_set1 _mm_set1_ps
+#define simd_add _mm_add_ps
+#define simd_mul _mm_mul_ps
+#define simd_storeu _mm_storeu_ps
+#endif
+
+#define RANDOM_SIMD_REGISTERS (RANDOM_BATCH_LANES / RANDOM_SIMD_STATES)
+#define RANDOM_SIMD_OUTPUTS (RANDOM_BATCH_LANES / RANDOM_SIMD_OUTPUT_LANES)
+#define PCG32_MULTIPLIER 6364136223846793005ULL
+
+void random_batch_seed(RandomBatch* batch, uint64_t seed, uint64_t stream)
+{
+	for (uint32_t lane = 0; lane < RANDOM_BATCH_LANES; ++lane)
+	{
+		pcg32_random_t rng;
+		pcg32_srandom_r(&rng, seed, stream * RANDOM_BATCH_LANES + lane);
+		batch->state[lane] = rng.state;
+		batch->inc[lane] = rng.inc;
+	}
+}
+
+static inline void load_batch(const RandomBatch* batch, simd_int state[RANDOM_SIMD_REGISTERS], simd_int inc[RANDOM_SIMD_REGISTERS])
+{
+	for (uint32_t r = 0; r < RANDOM_SIMD_REGISTERS; ++r)
+	{
+		state[r] = simd_loadu_int(batch->state + r * RANDOM_SIMD_STATES);
+		inc[r] = simd_loadu_int(batch->inc + r * RANDOM_SIMD_STATES);
+	}
+}
+
+static inline void store_batch(RandomBatch* batch, const simd_int state[RANDOM_SIMD_REGISTERS])
+{
+	for (uint32_t r = 0; r < RANDOM_SIMD_REGISTERS; ++r) simd_storeu_int(batch->state + r * RANDOM_SIMD_STATES, state[r]);
+}
+
+// Low 64 bits of a * b, with the 32 bit halves of b in b_low and b_high
+static inline simd_int mul_int64(simd_int a, simd_int b_low, simd_int b_high)
+{
+	const simd_int cross = simd_add_int64(simd_mul_epu32(simd_srli_int64(a, 32), b_low), simd_mul_epu32(a, b_high));
+	return simd_add_int64(simd_mul_epu32(a, b_low), simd_slli_int64(cross, 32));
+}
+
+// Low 32 bits of each 64 bit element of a and then b, in lane order
+static inline simd_int pack_low_halves(simd_int a, simd_int b)
+{
+#if defined(__AVX2__)
+	// Unpacking works within 128 bit halves, giving lanes 0 1 4 5 2 3 6 7
+	const simd_int packed = _mm256_unpacklo_epi64(_mm256_shuffle_epi32(a, _MM_SHUFFLE(2, 0, 2, 0)), _mm256_shuffle_epi32(b, _MM_SHUFFLE(2, 0, 2, 0)));
+	return _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+#else
+	return _mm_unpacklo_epi64(_mm_shuffle_epi32(a, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 0, 2, 0)));
+#endif
+}
+
+#if defined(__AVX2__)
+static inline simd_int rotate_right(simd_int x, simd_int rot)
+{
+	// Shifting by 32 gives 0, so a rotation by 0 needs no special case
+	return _mm256_or_si256(_mm256_srlv_epi32(x, rot), _mm256_sllv_epi32(x, _mm256_sub_epi32(_mm256_set1_epi32(32), rot)));
+}
+#else
+// SSE2 has no per element shift counts. Rotating left by s = (32 - rot) & 31 instead is a multiply by 2^s,
+// whose 64 bit product holds x << s in the low and x >> (32 - s) in the high half. Takes 64 bit elements
+// with x and rot in their low halves, returns the rotation in the low halves
+static inline simd_int rotate_right_int64(simd_int x, simd_int rot)
+{
+	const simd_int s = _mm_and_si128(_mm_sub_epi64(_mm_setzero_si128(), rot), _mm_set1_epi64x(31));
+	const simd_int one = _mm_set1_epi64x(1);
+	const simd_int low = _mm_sll_epi64(one, s);
+	const simd_int high = _mm_sll_epi64(one, _mm_unpackhi_epi64(s, s));
+	const simd_int power = _mm_castpd_si128(_mm_move_sd(_mm_castsi128_pd(high), _mm_castsi128_pd(low)));
+	const simd_int product = _mm_mul_epu32(x, power);
+	return _mm_or_si128(product, _mm_srli_epi64(product, 32));
+}
+#endif
+
+// One pcg32_random_r step of every lane, out holds the outputs in lane order
+static inline void step_batch(simd_int state[RANDOM_SIMD_REGISTERS], const simd_int inc[RANDOM_SIMD_REGISTERS], simd_int out[RANDOM_SIMD_OUTPUTS])
+{
+	const simd_int multiplier_low = simd_set1_int64((long long)(PCG32_MULTIPLIER & 0xFFFFFFFFull));
+	const simd_int multiplier_high = simd_set1_int64((long long)(PCG32_MULTIPLIER >> 32));
+
+	simd_int xorshifted[RANDOM_SIMD_REGISTERS], rot[RANDOM_SIMD_REGISTERS];
+	for (uint32_t r = 0; r < RANDOM_SIMD_REGISTERS; ++r)
+	{
+		const simd_int old = state[r];
+		state[r] = simd_add_int64(mul_int64(old, multiplier_low, multiplier_high), inc[r]);
+		xorshifted[r] = simd_srli_int64(simd_xor_int(simd_srli_int64(old, 18), old), 27);
+		rot[r] = simd_srli_int64(old, 59);
+	}
+
+	for (uint32_t o = 0; o < RANDOM_SIMD_OUTPUTS; ++o)
+	{
+#if defined(__AVX2__)
+		out[o] = rotate_right(pack_low_halves(xorshifted[2 * o], xorshifted[2 * o + 1]), pack_low_halves(rot[2 * o], rot[2 * o + 1]));
+#else
+		out[o] = pack_low_halves(rotate_right_int64(xorshifted[2 * o], rot[2 * o]), rotate_right_int64(xorshifted[2 * o + 1], rot[2 * o + 1]));
+#endif
+	}
+}
+
+void random_batch_next(RandomBatch* batch, uint32_t out[RANDOM_BATCH_LANES])
+{
+	simd_int state[RANDOM_SIMD_REGISTERS], inc[RANDOM_SIMD_REGISTERS], bits[RANDOM_SIMD_OUTPUTS];
+	load_batch(batch, state, inc);
+	step_batch(state, inc, bits);
+	store_batch(batch, state);
+	for (uint32_t o = 0; o < RANDOM_SIMD_OUTPUTS; ++o) simd_storeu_int(out + o * RANDOM_SIMD_OUTPUT_LANES, bits[o]);
+}
+
+void random_batch_fill(RandomBatch* batch, float* out, uint32_t count, float low, float high)
+{
+	if (high < low) std::swap(low, high);
+
+	// Top 24 bits map exactly onto float mantissa, so the result never rounds up to 1.0
+	const simd_float scale = simd_set1(ldexpf(1.0f, -24) * (high - low));
+	const simd_float offset = simd_set1(low);
+
+	simd_int state[RANDOM_SIMD_REGISTERS], inc[RANDOM_SIMD_REGISTERS], bits[RANDOM_SIMD_OUTPUTS];
+	load_batch(batch, state, inc);
+	for (uint32_t i = 0; i < count; i += RANDOM_BATCH_LANES)
+	{
+		step_batch(state, inc, bits);
+
+		alignas(32) float values[RANDOM_BATCH_LANES];
+		const bool full = count - i >= RANDOM_BATCH_LANES;
+		for (uint32_t o = 0; o < RANDOM_SIMD_OUTPUTS; ++o)
+		{
+			const simd_float v = simd_add(simd_mul(simd_to_float(simd_srli_int32(bits[o], 8)), scale), offset);
+			simd_storeu(full ? out + i + o * RANDOM_SIMD_OUTPUT_LANES : values + o * RANDOM_SIMD_OUTPUT_LANES, v);
+		}
+		if (!full) memcpy(out + i, values, (count - i) * sizeof(float));
+	}
+	store_batch(batch, state);
+}
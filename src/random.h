@@ -4,12 +4,47 @@
 #include <math.h>
 #include "gmath.h"
 
+#define RANDOM_BATCH_LANES 8
+
+// Eight independent pcg32 streams stepped in lockstep with SSE or AVX2. Each lane produces exactly the sequence
+// pcg32_random_r would for the same state.
+struct RandomBatch
+{
+	uint64_t state[RANDOM_BATCH_LANES];
+	uint64_t inc[RANDOM_BATCH_LANES];
+};
+
+void random_batch_seed(RandomBatch* batch, uint64_t seed, uint64_t stream);
+void random_batch_next(RandomBatch* batch, uint32_t out[RANDOM_BATCH_LANES]);
+
+// Fills out[0..count) with uniform floats in [low, high). Consumes whole batches, so the sequence only
+// depends on the order and sizes of the calls
+void random_batch_fill(RandomBatch* batch, float* out, uint32_t count, float low = 0.0f, float high = 1.0f);
+
+inline void random_seed(pcg32_random_t* rng, uint64_t seed, uint64_t stream)
+{
+	pcg32_srandom_r(rng, seed, stream);
+}
+
 inline float uniform_random()
 {
 	const float scale = ldexpf(1.0f, -32);
 	return pcg32_random() * scale;
 }
 
+inline float uniform_random(pcg32_random_t* rng)
+{
+	const float scale = ldexpf(1.0f, -32);
+	return pcg32_random_r(rng) * scale;
+}
+
+inline float random_in_range(pcg32_random_t* rng, float low, float high)
+{
+	if (high < low) std::swap(low, high);
+	float range = high - low;
+	return uniform_random(rng) * range + low;
+}
+
 inline float random_in_range(float low, float high)
 {
 	if (high < low) std::swap(low, high);
@@ -25,6 +60,16 @@ inline int random_int_in_range(int low, int high)
 }
 
 // Returns a random vector within a cone oriented towards the +z axis
+inline glm::vec3 random_vector_in_cone(pcg32_random_t* rng, float min_angle_cos)
+{
+	assert(min_angle_cos >= -1.0f);
+	assert(min_angle_cos <= 1.0f);
+	const float z = random_in_range(rng, min_angle_cos, 1.0f);
+	const float phi = random_in_range(rng, 0.0f, 2.0f * M_PI);
+	const float s = sqrtf(1.0f - z * z);
+	return glm::vec3(s * cosf(phi), s * sinf(phi), z);
+}
+
 inline glm::vec3 random_vector_in_cone(float min_angle_cos)
 {
 	assert(min_angle_cos >= -1.0f);
@@ -35,11 +80,9 @@ inline glm::vec3 random_vector_in_cone(float min_angle_cos)
 	return glm::vec3(s * cosf(phi), s * sinf(phi), z);
 }
 
-inline glm::vec3 random_vector_in_oriented_cone(float min_angle_cos, glm::vec3 cone_dir)
+// Rotates a vector sampled around +z so that the cone points towards cone_dir
+inline glm::vec3 orient_cone_sample(glm::vec3 v, glm::vec3 cone_dir)
 {
-	assert(near_one(cone_dir));
-	glm::vec3 v = random_vector_in_cone(min_angle_cos);
-	
 	const glm::vec3 z_axis = glm::vec3(0.0f, 0.0f, 1.0f);
 	float cos_theta = glm::dot(cone_dir, z_axis);
 	if (fabsf(cos_theta) > 0.99f)
@@ -55,6 +98,31 @@ inline glm::vec3 random_vector_in_oriented_cone(float min_angle_cos, glm::vec3 c
 	}
 }
 
+inline glm::vec3 random_vector_in_oriented_cone(pcg32_random_t* rng, float min_angle_cos, glm::vec3 cone_dir)
+{
+	assert(near_one(cone_dir));
+	return orient_cone_sample(random_vector_in_cone(rng, min_angle_cos), cone_dir);
+}
+
+inline glm::vec3 random_vector_in_oriented_cone(float min_angle_cos, glm::vec3 cone_dir)
+{
+	assert(near_one(cone_dir));
+	return orient_cone_sample(random_vector_in_cone(min_angle_cos), cone_dir);
+}
+
+template <typename T>
+inline T random_vector(pcg32_random_t* rng)
+{
+	T type;
+	constexpr size_t len = type.length();
+	for (size_t i = 0; i < len; ++i)
+	{
+		type[i] = uniform_random(rng);
+	}
+
+	return type;
+}
+
 template <typename T>
 inline T random_vector()
 {
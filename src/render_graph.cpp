@@ -0,0 +1,1224 @@
+#include "render_graph.h"
+#include "graphics_context.h"
+#include "benchmark.h"
+#include "cpu_profiler.h"
+#include "vk_helpers.h"
+#include "misc.h"
+#include "log.h"
+#include <string.h>
+#include <algorithm>
+
+static const VkAccessFlags2 write_access_mask = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+	VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT |
+	VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+static bool translate_use(const RGResource& resource, RGAccess access, bool write, VkPipelineStageFlags2 stages, RGUse& use)
+{
+	use.write = write;
+	use.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	switch (access)
+	{
+	case RGAccess::Attachment:
+		if (!resource.is_image) return false;
+		if (resource.aspect & VK_IMAGE_ASPECT_DEPTH_BIT)
+		{
+			use.stages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+			use.access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | (write ? VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0);
+			use.layout = write ? VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
+		}
+		else
+		{
+			if (!write) return false;
+			use.stages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+			use.access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT; // Load and store ops
+			use.layout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL;
+		}
+		return true;
+	case RGAccess::Sampled:
+		if (write || stages == 0) return false;
+		use.stages = stages;
+		use.access = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+		if (resource.is_image) use.layout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
+		return true;
+	case RGAccess::Storage:
+		if (stages == 0) return false;
+		use.stages = stages;
+		use.access = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | (write ? VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT : 0);
+		if (resource.is_image) use.layout = VK_IMAGE_LAYOUT_GENERAL;
+		return true;
+	case RGAccess::Uniform:
+		if (write || stages == 0 || resource.is_image) return false;
+		use.stages = stages;
+		use.access = VK_ACCESS_2_UNIFORM_READ_BIT;
+		return true;
+	case RGAccess::Transfer:
+		use.stages = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+		use.access = write ? VK_ACCESS_2_TRANSFER_WRITE_BIT : VK_ACCESS_2_TRANSFER_READ_BIT;
+		if (resource.is_image) use.layout = write ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		return true;
+	case RGAccess::Indirect:
+		if (write || resource.is_image) return false;
+		use.stages = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+		use.access = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+		return true;
+	}
+	return false;
+}
+
+static RGPass& add_use(RGPass& pass, uint32_t resource_index, RGAccess access, bool write, VkPipelineStageFlags2 stages)
+{
+	assert(resource_index < pass.graph->resources.size());
+	const RGResource& resource = pass.graph->resources[resource_index];
+
+	RGUse use{};
+	use.resource = resource_index;
+	if (!translate_use(resource, access, write, stages, use))
+	{
+		LOG_ERROR("Render graph: pass %s declares an invalid %s of %s", pass.name, write ? "write" : "read", resource.name);
+		assert(false);
+		return pass;
+	}
+
+	for (RGUse& existing : pass.uses)
+	{
+		if (existing.resource != resource_index) continue;
+		existing.stages |= use.stages;
+		existing.access |= use.access;
+		existing.write |= use.write;
+		if (existing.layout != use.layout) existing.layout = VK_IMAGE_LAYOUT_GENERAL;
+		return pass;
+	}
+	pass.uses.push_back(use);
+	return pass;
+}
+
+RGPass& RGPass::read(RGImage image, RGAccess access, VkPipelineStageFlags2 stages) { return add_use(*this, image.index, access, false, stages); }
+RGPass& RGPass::write(RGImage image, RGAccess access, VkPipelineStageFlags2 stages) { return add_use(*this, image.index, access, true, stages); }
+RGPass& RGPass::read(RGBuffer buffer, RGAccess access, VkPipelineStageFlags2 stages) { return add_use(*this, buffer.index, access, false, stages); }
+RGPass& RGPass::write(RGBuffer buffer, RGAccess access, VkPipelineStageFlags2 stages) { return add_use(*this, buffer.index, access, true, stages); }
+
+RGPass& RGPass::side_effects()
+{
+	has_side_effects = true;
+	return *this;
+}
+
+RGPass& RGPass::execute(std::function<void(VkCommandBuffer)> fn)
+{
+	callback = std::move(fn);
+	return *this;
+}
+
+static const RGUse* find_use(const RGPass& pass, uint32_t resource_index)
+{
+	for (const RGUse& use : pass.uses)
+	{
+		if (use.resource == resource_index) return &use;
+	}
+	return nullptr;
+}
+
+// Meta stages spelled out, so that masks can be compared bit by bit
+static VkPipelineStageFlags2 expand_stages(VkPipelineStageFlags2 stages)
+{
+	if (stages & VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT) return ~(VkPipelineStageFlags2)0;
+	if (stages & VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT)
+	{
+		stages |= VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT |
+			VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT |
+			VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_2_TASK_SHADER_BIT_EXT | VK_PIPELINE_STAGE_2_MESH_SHADER_BIT_EXT;
+	}
+	if (stages & VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT)
+	{
+		stages |= VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_RESOLVE_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT;
+	}
+	if (stages & VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT)
+	{
+		stages |= VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT;
+	}
+	if (stages & VK_PIPELINE_STAGE_2_PRE_RASTERIZATION_SHADERS_BIT)
+	{
+		stages |= VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_TESSELLATION_CONTROL_SHADER_BIT |
+			VK_PIPELINE_STAGE_2_TESSELLATION_EVALUATION_SHADER_BIT | VK_PIPELINE_STAGE_2_GEOMETRY_SHADER_BIT;
+	}
+	return stages;
+}
+
+static bool lifetimes_overlap(int32_t first_a, int32_t last_a, int32_t first_b, int32_t last_b)
+{
+	return first_a <= last_b && first_b <= last_a;
+}
+
+static bool memory_overlaps(const RGPhysicalImage& a, const RGPhysicalImage& b)
+{
+	return a.heap == b.heap && a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+void RenderGraph::init(Context* context)
+{
+	ctx = context;
+	event_pools.resize(Context::frames_in_flight);
+	events_used.resize(Context::frames_in_flight, 0);
+}
+
+static void destroy_transients(RenderGraph& rg)
+{
+	for (RGPhysicalImage& physical : rg.physical_images)
+	{
+		vkDestroyImageView(rg.ctx->device, physical.texture.view, nullptr);
+		vkDestroyImage(rg.ctx->device, physical.texture.image, nullptr);
+	}
+	for (VmaAllocation heap : rg.transient_heaps)
+	{
+		vmaFreeMemory(rg.ctx->allocator, heap);
+	}
+	rg.physical_images.clear();
+	rg.transient_heaps.clear();
+}
+
+void RenderGraph::destroy()
+{
+	destroy_transients(*this);
+	for (std::vector<VkEvent>& pool : event_pools)
+	{
+		for (VkEvent event : pool) vkDestroyEvent(ctx->device, event, nullptr);
+		pool.clear();
+	}
+	imported_states.clear();
+	reset();
+}
+
+void RenderGraph::reset()
+{
+	resources.clear();
+	passes.clear();
+	steps.clear();
+	barriers.clear();
+	batches.clear();
+	image_barriers.clear();
+	initial_states.clear();
+	current_step = -1;
+	compiled = false;
+}
+
+static uint32_t add_resource(RenderGraph& rg, const char* name, bool is_image, bool imported)
+{
+	assert(!rg.compiled && "Declare resources before compiling, reset() starts the next frame");
+	uint64_t key = hash_fnv1a_64(name, strlen(name));
+	for (uint32_t i = 0; i < rg.resources.size(); i++)
+	{
+		if (rg.resources[i].key != key) continue;
+		// Importing the same resource twice gives the same handle
+		if (imported && rg.resources[i].imported && rg.resources[i].is_image == is_image) return i;
+		LOG_ERROR("Render graph: resource %s declared twice", name);
+		assert(false);
+	}
+
+	RGResource resource{};
+	resource.name = name;
+	resource.key = key;
+	resource.is_image = is_image;
+	resource.imported = imported;
+	resource.first_step = -1;
+	resource.last_step = -1;
+	resource.physical = UINT32_MAX;
+	rg.resources.push_back(resource);
+	return (uint32_t)rg.resources.size() - 1;
+}
+
+RGImage RenderGraph::import_image(const char* name, const Texture& texture)
+{
+	uint32_t index = add_resource(*this, name, true, true);
+	RGResource& resource = resources[index];
+	resource.texture = texture;
+	resource.desc.width = texture.width;
+	resource.desc.height = texture.height;
+	resource.desc.format = texture.format;
+	resource.aspect = determine_image_aspect(texture.format);
+	return RGImage{ index };
+}
+
+RGImage RenderGraph::import_swapchain_image(const char* name, const Texture& texture, VkPipelineStageFlags2 acquire_wait_stage, VkImageLayout present_layout)
+{
+	RGImage image = import_image(name, texture);
+	RGResource& resource = resources[image.index];
+	resource.swapchain = true;
+	resource.acquire_wait_stage = acquire_wait_stage;
+	resource.final_layout = present_layout;
+	return image;
+}
+
+RGBuffer RenderGraph::import_buffer(const char* name)
+{
+	return RGBuffer{ add_resource(*this, name, false, true) };
+}
+
+RGImage RenderGraph::create_image(const char* name, const RGImageDesc& desc)
+{
+	uint32_t index = add_resource(*this, name, true, false);
+	RGResource& resource = resources[index];
+	resource.desc = desc;
+	resource.aspect = determine_image_aspect(desc.format);
+	return RGImage{ index };
+}
+
+RGPass& RenderGraph::add_pass(const char* name)
+{
+	assert(!compiled && "Declare passes before compiling, reset() starts the next frame");
+	RGPass pass{};
+	pass.name = name;
+	pass.graph = this;
+	passes.push_back(std::move(pass));
+	return passes.back();
+}
+
+// Walks the passes backwards and keeps those with side effects, those that write an imported resource and those
+// that write something a kept pass uses. Writes count as read-modify-write, so earlier writers are kept as well
+static void cull_passes(RenderGraph& rg)
+{
+	std::vector<bool> needed(rg.resources.size(), false);
+	std::vector<bool> live(rg.passes.size(), false);
+	for (int32_t i = (int32_t)rg.passes.size() - 1; i >= 0; i--)
+	{
+		const RGPass& pass = rg.passes[i];
+		bool is_live = pass.has_side_effects;
+		for (const RGUse& use : pass.uses)
+		{
+			if (use.write && (rg.resources[use.resource].imported || needed[use.resource])) is_live = true;
+		}
+		if (!is_live) continue;
+
+		live[i] = true;
+		for (const RGUse& use : pass.uses)
+		{
+			needed[use.resource] = true;
+		}
+	}
+
+	rg.steps.clear();
+	for (uint32_t i = 0; i < rg.passes.size(); i++)
+	{
+		if (live[i]) rg.steps.push_back(i);
+	}
+
+	for (uint32_t step = 0; step < rg.steps.size(); step++)
+	{
+		for (const RGUse& use : rg.passes[rg.steps[step]].uses)
+		{
+			RGResource& resource = rg.resources[use.resource];
+			if (resource.first_step < 0) resource.first_step = step;
+			resource.last_step = step;
+		}
+	}
+}
+
+static VkImageCreateInfo get_image_create_info(const RGImageDesc& desc, VkImageUsageFlags usage)
+{
+	VkImageCreateInfo info{ VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
+	info.imageType = VK_IMAGE_TYPE_2D;
+	info.format = desc.format;
+	info.extent = { desc.width, desc.height, 1 };
+	info.mipLevels = 1;
+	info.arrayLayers = desc.layer_count;
+	info.samples = VK_SAMPLE_COUNT_1_BIT;
+	info.tiling = VK_IMAGE_TILING_OPTIMAL;
+	info.usage = usage;
+	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	return info;
+}
+
+static VkImageUsageFlags get_image_usage(const RenderGraph& rg, uint32_t resource_index)
+{
+	VkImageUsageFlags usage = 0;
+	for (uint32_t pass_index : rg.steps)
+	{
+		const RGUse* use = find_use(rg.passes[pass_index], resource_index);
+		if (!use) continue;
+		if (use->access & (VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT)) usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		if (use->access & (VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT)) usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		if (use->access & VK_ACCESS_2_SHADER_SAMPLED_READ_BIT) usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+		if (use->access & (VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT)) usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+		if (use->access & VK_ACCESS_2_TRANSFER_READ_BIT) usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		if (use->access & VK_ACCESS_2_TRANSFER_WRITE_BIT) usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+	return usage;
+}
+
+// Gives every transient image that survived culling a physical image. Images whose lifetimes do not overlap are
+// placed at overlapping offsets of one allocation, largest first. The placement only changes when the set of
+// transients, their descriptions or their lifetimes do, then the old images are destroyed after a device wait
+static bool allocate_transients(RenderGraph& rg)
+{
+	std::vector<RGPhysicalImage> wanted;
+	for (uint32_t i = 0; i < rg.resources.size(); i++)
+	{
+		RGResource& resource = rg.resources[i];
+		if (!resource.is_image || resource.imported || resource.first_step < 0) continue;
+
+		RGPhysicalImage physical{};
+		physical.desc = resource.desc;
+		physical.usage = get_image_usage(rg, i);
+		physical.first_step = resource.first_step;
+		physical.last_step = resource.last_step;
+		resource.physical = (uint32_t)wanted.size();
+		wanted.push_back(physical);
+	}
+
+	bool unchanged = wanted.size() == rg.physical_images.size();
+	for (uint32_t i = 0; unchanged && i < wanted.size(); i++)
+	{
+		const RGPhysicalImage& a = wanted[i];
+		const RGPhysicalImage& b = rg.physical_images[i];
+		unchanged = a.desc.width == b.desc.width && a.desc.height == b.desc.height && a.desc.format == b.desc.format &&
+			a.desc.layer_count == b.desc.layer_count && a.usage == b.usage && a.first_step == b.first_step && a.last_step == b.last_step;
+	}
+
+	if (!unchanged)
+	{
+		if (!rg.physical_images.empty())
+		{
+			LOG_DEBUG("Render graph: transient images changed, recreating them");
+			vkDeviceWaitIdle(rg.ctx->device);
+			destroy_transients(rg);
+		}
+
+		uint32_t memory_type_bits = UINT32_MAX;
+		std::vector<VkMemoryRequirements> requirements(wanted.size());
+		for (uint32_t i = 0; i < wanted.size(); i++)
+		{
+			VkImageCreateInfo image_info = get_image_create_info(wanted[i].desc, wanted[i].usage);
+			VkDeviceImageMemoryRequirements requirements_info{ VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS };
+			requirements_info.pCreateInfo = &image_info;
+			VkMemoryRequirements2 requirements2{ VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+			vkGetDeviceImageMemoryRequirements(rg.ctx->device, &requirements_info, &requirements2);
+			requirements[i] = requirements2.memoryRequirements;
+			memory_type_bits &= requirements[i].memoryTypeBits;
+		}
+
+		bool alias = memory_type_bits != 0;
+		if (!alias && !wanted.empty())
+		{
+			LOG_WARNING("Render graph: transient images share no memory type, they are not aliased");
+		}
+
+		std::vector<uint32_t> order(wanted.size());
+		for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return requirements[a].size > requirements[b].size; });
+
+		std::vector<VkMemoryRequirements> heap_requirements;
+		for (uint32_t n = 0; n < order.size(); n++)
+		{
+			uint32_t i = order[n];
+			RGPhysicalImage& physical = wanted[i];
+			physical.size = requirements[i].size;
+			if (!alias || heap_requirements.empty())
+			{
+				heap_requirements.push_back({ 0, 1, alias ? memory_type_bits : requirements[i].memoryTypeBits });
+			}
+			physical.heap = (uint32_t)heap_requirements.size() - 1;
+
+			// Lowest offset that does not overlap an image that is alive at the same time
+			physical.offset = 0;
+			for (bool moved = true; moved;)
+			{
+				moved = false;
+				for (uint32_t m = 0; m < n; m++)
+				{
+					const RGPhysicalImage& placed = wanted[order[m]];
+					if (!memory_overlaps(physical, placed)) continue;
+					if (!lifetimes_overlap(physical.first_step, physical.last_step, placed.first_step, placed.last_step)) continue;
+					physical.offset = align_power_of_2(placed.offset + placed.size, requirements[i].alignment);
+					moved = true;
+				}
+			}
+
+			VkMemoryRequirements& heap = heap_requirements[physical.heap];
+			heap.size = std::max(heap.size, physical.offset + physical.size);
+			heap.alignment = std::max(heap.alignment, requirements[i].alignment);
+		}
+
+		for (const VkMemoryRequirements& heap_requirement : heap_requirements)
+		{
+			VmaAllocationCreateInfo allocation_info{};
+			allocation_info.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+			VmaAllocation heap = VK_NULL_HANDLE;
+			if (vmaAllocateMemory(rg.ctx->allocator, &heap_requirement, &allocation_info, &heap, nullptr) != VK_SUCCESS)
+			{
+				LOG_ERROR("Render graph: failed to allocate %llu bytes for transient images", (unsigned long long)heap_requirement.size);
+				for (VmaAllocation allocated : rg.transient_heaps) vmaFreeMemory(rg.ctx->allocator, allocated);
+				rg.transient_heaps.clear();
+				return false;
+			}
+			rg.transient_heaps.push_back(heap);
+		}
+
+		for (RGPhysicalImage& physical : wanted)
+		{
+			VkImageCreateInfo image_info = get_image_create_info(physical.desc, physical.usage);
+			VK_CHECK(vkCreateImage(rg.ctx->device, &image_info, nullptr, &physical.texture.image));
+			VK_CHECK(vmaBindImageMemory2(rg.ctx->allocator, rg.transient_heaps[physical.heap], physical.offset, physical.texture.image, nullptr));
+
+			VkImageViewCreateInfo view_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+			view_info.image = physical.texture.image;
+			view_info.viewType = physical.desc.layer_count == 1 ? VK_IMAGE_VIEW_TYPE_2D : VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+			view_info.format = physical.desc.format;
+			view_info.subresourceRange = { (VkImageAspectFlags)determine_image_aspect(physical.desc.format), 0, 1, 0, physical.desc.layer_count };
+			VK_CHECK(vkCreateImageView(rg.ctx->device, &view_info, nullptr, &physical.texture.view));
+
+			physical.texture.width = physical.desc.width;
+			physical.texture.height = physical.desc.height;
+			physical.texture.format = physical.desc.format;
+			physical.texture.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		rg.physical_images = std::move(wanted);
+
+		rg.stats.transient_image_count = (uint32_t)rg.physical_images.size();
+		rg.stats.transient_memory = 0;
+		rg.stats.transient_memory_unaliased = 0;
+		for (const VkMemoryRequirements& heap_requirement : heap_requirements) rg.stats.transient_memory += heap_requirement.size;
+		for (const RGPhysicalImage& physical : rg.physical_images) rg.stats.transient_memory_unaliased += physical.size;
+	}
+
+	for (RGResource& resource : rg.resources)
+	{
+		if (resource.physical == UINT32_MAX) continue;
+		resource.texture = rg.physical_images[resource.physical].texture;
+		resource.texture.name = resource.name;
+	}
+	return true;
+}
+
+// Consecutive uses of a resource that can share one barrier: a single write, or a run of reads in the same layout
+struct AccessGroup
+{
+	uint32_t first_step;
+	uint32_t last_step;
+	VkPipelineStageFlags2 stages;
+	VkAccessFlags2 access;
+	VkImageLayout layout;
+	bool write;
+};
+
+static void get_access_groups(const RenderGraph& rg, uint32_t resource_index, std::vector<AccessGroup>& groups)
+{
+	groups.clear();
+	for (uint32_t step = 0; step < rg.steps.size(); step++)
+	{
+		const RGUse* use = find_use(rg.passes[rg.steps[step]], resource_index);
+		if (!use) continue;
+
+		if (!use->write && !groups.empty() && !groups.back().write && groups.back().layout == use->layout)
+		{
+			AccessGroup& group = groups.back();
+			group.last_step = step;
+			group.stages |= use->stages;
+			group.access |= use->access;
+			continue;
+		}
+		groups.push_back({ step, step, use->stages, use->access, use->layout, use->write });
+	}
+}
+
+// Tracks every resource through its access groups and emits a barrier wherever the next group writes, changes the
+// layout or reads something that has not been made visible to it yet. The source scope is whatever the resource
+// was last used for, which may lie in the previous frame
+static void generate_barriers(RenderGraph& rg)
+{
+	const uint32_t end_step = (uint32_t)rg.steps.size();
+
+	std::vector<uint32_t> order;
+	for (uint32_t i = 0; i < rg.resources.size(); i++)
+	{
+		if (rg.resources[i].first_step >= 0 || rg.resources[i].swapchain) order.push_back(i);
+	}
+	// Transients that share memory wait on the ones before them, which have to be done by then
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return rg.resources[a].first_step < rg.resources[b].first_step; });
+
+	rg.initial_states.assign(rg.resources.size(), RGState{});
+	std::vector<RGState> end_states(rg.resources.size());
+	std::vector<int32_t> end_signals(rg.resources.size(), -1);
+	std::vector<RGPhysicalImage> physical_finals = rg.physical_images;
+	std::vector<AccessGroup> groups;
+
+	for (uint32_t resource_index : order)
+	{
+		const RGResource& resource = rg.resources[resource_index];
+		RGState state{};
+		int32_t signal = -1;
+
+		if (resource.swapchain)
+		{
+			// The presentation engine's writes are made visible by the acquire semaphore
+			state.write_stages = resource.acquire_wait_stage;
+		}
+		else if (resource.imported)
+		{
+			auto it = rg.imported_states.find(resource.key);
+			if (it != rg.imported_states.end()) state = it->second;
+			else state.layout = resource.texture.layout;
+		}
+		else
+		{
+			const RGPhysicalImage& physical = rg.physical_images[resource.physical];
+			for (const RGPhysicalImage& other : rg.physical_images)
+			{
+				if (!memory_overlaps(physical, other)) continue;
+				state.write_stages |= other.final_stages;
+				state.write_access |= other.final_write_access;
+			}
+			// The validator tracks the aliasing predecessors of this frame itself
+			rg.initial_states[resource_index] = state;
+			for (uint32_t other_index = 0; other_index < rg.resources.size(); other_index++)
+			{
+				const RGResource& other = rg.resources[other_index];
+				if (other_index == resource_index || other.physical == UINT32_MAX) continue;
+				if (other.last_step >= resource.first_step || !memory_overlaps(physical, rg.physical_images[other.physical])) continue;
+				state.write_stages |= end_states[other_index].write_stages | end_states[other_index].read_stages;
+				state.write_access |= end_states[other_index].write_access;
+				signal = std::max(signal, end_signals[other_index]);
+			}
+			state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+		if (resource.imported) rg.initial_states[resource_index] = state;
+
+		get_access_groups(rg, resource_index, groups);
+		for (const AccessGroup& group : groups)
+		{
+			bool layout_change = resource.is_image && group.layout != state.layout;
+			bool accessed_before = (state.write_stages | state.read_stages) != 0 || state.dirty;
+			bool visible = (group.stages & ~state.visible_stages) == 0 && (group.access & ~state.visible_access) == 0;
+			bool needed = layout_change || (accessed_before && (group.write || (state.dirty && !visible)));
+
+			if (needed)
+			{
+				RGBarrier barrier{};
+				barrier.resource = resource_index;
+				barrier.src_stages = state.write_stages | state.read_stages;
+				barrier.src_access = state.write_access;
+				barrier.dst_stages = group.stages;
+				barrier.dst_access = group.access;
+				barrier.old_layout = state.layout;
+				barrier.new_layout = group.layout;
+				barrier.signal_step = signal;
+				barrier.wait_step = group.first_step;
+				rg.barriers.push_back(barrier);
+			}
+
+			if (group.write)
+			{
+				state.write_stages = group.stages;
+				state.write_access = group.access & write_access_mask;
+				state.read_stages = 0;
+				state.visible_stages = 0;
+				state.visible_access = 0;
+				state.dirty = true;
+			}
+			else
+			{
+				state.read_stages |= group.stages;
+				if (needed)
+				{
+					state.visible_stages |= group.stages;
+					state.visible_access |= group.access;
+				}
+				state.dirty |= layout_change;
+			}
+			state.layout = group.layout;
+			signal = (int32_t)group.last_step;
+		}
+
+		if (resource.swapchain && state.layout != resource.final_layout)
+		{
+			RGBarrier barrier{};
+			barrier.resource = resource_index;
+			barrier.src_stages = state.write_stages | state.read_stages;
+			barrier.src_access = state.write_access;
+			barrier.old_layout = state.layout;
+			barrier.new_layout = resource.final_layout;
+			barrier.signal_step = signal;
+			barrier.wait_step = end_step;
+			rg.barriers.push_back(barrier);
+		}
+
+		end_states[resource_index] = state;
+		end_signals[resource_index] = signal;
+		if (resource.imported && !resource.swapchain)
+		{
+			rg.imported_states[resource.key] = state;
+		}
+		else if (!resource.imported)
+		{
+			physical_finals[resource.physical].final_stages = state.write_stages | state.read_stages;
+			physical_finals[resource.physical].final_write_access = state.write_access;
+		}
+	}
+
+	for (uint32_t i = 0; i < rg.physical_images.size(); i++)
+	{
+		rg.physical_images[i].final_stages = physical_finals[i].final_stages;
+		rg.physical_images[i].final_write_access = physical_finals[i].final_write_access;
+	}
+}
+
+// Decides where each barrier is recorded. Dependencies on the pass right before go into a pipeline barrier in
+// front of the consumer. Dependencies that skip passes join that barrier when the consumer has one anyway and
+// otherwise become an event, so the passes in between are not held up. Dependencies on the previous frame are
+// moved up to the nearest earlier pipeline barrier, the previous frame has long finished by the time it runs
+static void place_barriers(RenderGraph& rg)
+{
+	const uint32_t end_step = (uint32_t)rg.steps.size();
+	std::vector<int32_t> regular_batches(end_step + 1, -1);
+
+	auto new_batch = [&](bool split, int32_t signal_step, uint32_t wait_step) -> uint32_t {
+		RGBatch batch{};
+		batch.split = split;
+		batch.signal_step = signal_step;
+		batch.wait_step = wait_step;
+		batch.memory_barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER_2 };
+		rg.batches.push_back(batch);
+		return (uint32_t)rg.batches.size() - 1;
+	};
+	auto get_regular_batch = [&](uint32_t wait_step) -> uint32_t {
+		if (regular_batches[wait_step] < 0) regular_batches[wait_step] = new_batch(false, (int32_t)wait_step - 1, wait_step);
+		return regular_batches[wait_step];
+	};
+
+	for (RGBarrier& barrier : rg.barriers)
+	{
+		barrier.batch = UINT32_MAX;
+		if (barrier.signal_step < 0) continue;
+		if (!RENDER_GRAPH_SPLIT_BARRIERS || barrier.signal_step + 1 == (int32_t)barrier.wait_step)
+		{
+			barrier.batch = get_regular_batch(barrier.wait_step);
+		}
+	}
+
+	for (RGBarrier& barrier : rg.barriers)
+	{
+		if (barrier.signal_step >= 0) continue;
+		uint32_t wait_step = barrier.wait_step;
+		// Acquired images are waited on by a semaphore at a late stage, an earlier barrier would stall everything after it
+		if (!rg.resources[barrier.resource].swapchain)
+		{
+			for (int32_t step = (int32_t)barrier.wait_step; step >= 0; step--)
+			{
+				if (regular_batches[step] < 0) continue;
+				wait_step = step;
+				break;
+			}
+		}
+		barrier.batch = get_regular_batch(wait_step);
+	}
+
+	for (RGBarrier& barrier : rg.barriers)
+	{
+		if (barrier.batch != UINT32_MAX) continue;
+		if (regular_batches[barrier.wait_step] >= 0)
+		{
+			barrier.batch = regular_batches[barrier.wait_step];
+			continue;
+		}
+		for (uint32_t i = 0; i < rg.batches.size(); i++)
+		{
+			const RGBatch& batch = rg.batches[i];
+			if (batch.split && batch.signal_step == barrier.signal_step && batch.wait_step == barrier.wait_step) barrier.batch = i;
+		}
+		if (barrier.batch == UINT32_MAX) barrier.batch = new_batch(true, barrier.signal_step, barrier.wait_step);
+	}
+}
+
+static void build_batches(RenderGraph& rg)
+{
+	uint32_t event_count = 0;
+	for (uint32_t batch_index = 0; batch_index < rg.batches.size(); batch_index++)
+	{
+		RGBatch& batch = rg.batches[batch_index];
+		batch.first_image_barrier = (uint32_t)rg.image_barriers.size();
+		if (batch.split) batch.event_index = event_count++;
+
+		for (const RGBarrier& barrier : rg.barriers)
+		{
+			if (barrier.batch != batch_index) continue;
+			const RGResource& resource = rg.resources[barrier.resource];
+			if (resource.is_image)
+			{
+				VkImageMemoryBarrier2 image_barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+				image_barrier.srcStageMask = barrier.src_stages;
+				image_barrier.srcAccessMask = barrier.src_access;
+				image_barrier.dstStageMask = barrier.dst_stages;
+				image_barrier.dstAccessMask = barrier.dst_access;
+				image_barrier.oldLayout = barrier.old_layout;
+				image_barrier.newLayout = barrier.new_layout;
+				image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+				image_barrier.image = resource.texture.image;
+				image_barrier.subresourceRange = { resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+				rg.image_barriers.push_back(image_barrier);
+			}
+			else
+			{
+				batch.memory_barrier.srcStageMask |= barrier.src_stages;
+				batch.memory_barrier.srcAccessMask |= barrier.src_access;
+				batch.memory_barrier.dstStageMask |= barrier.dst_stages;
+				batch.memory_barrier.dstAccessMask |= barrier.dst_access;
+			}
+		}
+		batch.image_barrier_count = (uint32_t)rg.image_barriers.size() - batch.first_image_barrier;
+	}
+}
+
+static bool has_memory_barrier(const RGBatch& batch)
+{
+	return (batch.memory_barrier.srcStageMask | batch.memory_barrier.dstStageMask) != 0;
+}
+
+bool RenderGraph::compile()
+{
+	CPU_ZONE("Render graph compile");
+	assert(!compiled);
+
+	cull_passes(*this);
+	if (!allocate_transients(*this)) return false;
+	generate_barriers(*this);
+	place_barriers(*this);
+	build_batches(*this);
+	compiled = true;
+
+	stats.pass_count = (uint32_t)steps.size();
+	stats.culled_pass_count = (uint32_t)(passes.size() - steps.size());
+	stats.barrier_count = 0;
+	stats.wait_count = 0;
+	stats.event_count = 0;
+	stats.image_barrier_count = (uint32_t)image_barriers.size();
+	std::vector<bool> waited(steps.size() + 1, false);
+	for (const RGBatch& batch : batches)
+	{
+		if (batch.split)
+		{
+			stats.event_count++;
+			if (!waited[batch.wait_step]) stats.wait_count++;
+			waited[batch.wait_step] = true;
+		}
+		else
+		{
+			stats.barrier_count++;
+		}
+	}
+
+#if RENDER_GRAPH_VALIDATE
+	stats.validation_errors = validate();
+#endif
+	return true;
+}
+
+static VkDependencyInfo get_dependency_info(const RenderGraph& rg, const RGBatch& batch)
+{
+	VkDependencyInfo info{ VK_STRUCTURE_TYPE_DEPENDENCY_INFO };
+	if (has_memory_barrier(batch))
+	{
+		info.memoryBarrierCount = 1;
+		info.pMemoryBarriers = &batch.memory_barrier;
+	}
+	info.imageMemoryBarrierCount = batch.image_barrier_count;
+	info.pImageMemoryBarriers = batch.image_barrier_count ? &rg.image_barriers[batch.first_image_barrier] : nullptr;
+	return info;
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+	assert(compiled);
+
+	// The frame's fence has been waited on in Context::begin_frame, nothing uses the slot's events anymore
+	std::vector<VkEvent>& events = event_pools[ctx->frame_index];
+	for (uint32_t i = 0; i < events_used[ctx->frame_index]; i++)
+	{
+		VK_CHECK(vkResetEvent(ctx->device, events[i]));
+	}
+	while (events.size() < stats.event_count)
+	{
+		VkEventCreateInfo event_info{ VK_STRUCTURE_TYPE_EVENT_CREATE_INFO };
+		VkEvent event = VK_NULL_HANDLE;
+		VK_CHECK(vkCreateEvent(ctx->device, &event_info, nullptr, &event));
+		events.push_back(event);
+	}
+	events_used[ctx->frame_index] = stats.event_count;
+
+	std::vector<VkEvent> wait_events;
+	std::vector<VkDependencyInfo> wait_infos;
+	for (uint32_t step = 0; step <= steps.size(); step++)
+	{
+		wait_events.clear();
+		wait_infos.clear();
+		for (const RGBatch& batch : batches)
+		{
+			if (!batch.split || batch.wait_step != step) continue;
+			wait_events.push_back(events[batch.event_index]);
+			wait_infos.push_back(get_dependency_info(*this, batch));
+		}
+		if (!wait_events.empty())
+		{
+			vkCmdWaitEvents2(cmd, (uint32_t)wait_events.size(), wait_events.data(), wait_infos.data());
+		}
+
+		for (const RGBatch& batch : batches)
+		{
+			if (batch.split || batch.wait_step != step) continue;
+			VkDependencyInfo info = get_dependency_info(*this, batch);
+			vkCmdPipelineBarrier2(cmd, &info);
+		}
+
+		if (step == steps.size()) break;
+
+		current_step = step;
+		RGPass& pass = passes[steps[step]];
+		VkHelpers::begin_label(cmd, pass.name, glm::vec4(1.0f));
+		Benchmark::begin_pass(cmd, pass.name);
+		if (pass.callback) pass.callback(cmd);
+		Benchmark::end_pass(cmd);
+		VkHelpers::end_label(cmd);
+
+		for (const RGBatch& batch : batches)
+		{
+			if (!batch.split || batch.signal_step != (int32_t)step) continue;
+			VkDependencyInfo info = get_dependency_info(*this, batch);
+			vkCmdSetEvent2(cmd, events[batch.event_index], &info);
+		}
+	}
+	current_step = -1;
+}
+
+const Texture& RenderGraph::get_texture(RGImage image) const
+{
+	assert(image.index < resources.size() && resources[image.index].is_image);
+	return resources[image.index].texture;
+}
+
+VkImageLayout RenderGraph::get_layout(RGImage image) const
+{
+	assert(current_step >= 0 && "Layouts are only known while a pass executes");
+	const RGUse* use = find_use(passes[steps[current_step]], image.index);
+	if (!use)
+	{
+		LOG_ERROR("Render graph: pass %s uses %s without declaring it", passes[steps[current_step]].name, resources[image.index].name);
+		assert(false);
+		return VK_IMAGE_LAYOUT_GENERAL;
+	}
+	return use->layout;
+}
+
+// Validation replays the recorded commands against its own model: every resource keeps the accesses that are
+// not known to be complete yet, with the stages that are ordered after them and, for writes, where they are
+// visible. It only looks at the Vulkan structures the graph emits and at the declared uses, not at how the
+// barriers were derived
+struct ValidationAccess
+{
+	uint32_t id;
+	VkPipelineStageFlags2 stages; // 0 for a layout transition, only reachable through ordered
+	VkAccessFlags2 write_access;
+	bool write;
+	VkPipelineStageFlags2 ordered;
+	VkPipelineStageFlags2 visible_stages;
+	VkAccessFlags2 visible_access;
+};
+
+struct ValidationResource
+{
+	std::vector<ValidationAccess> pending;
+	VkImageLayout layout;
+};
+
+// What a dependency does, decided when its first scope is taken: at the barrier, or when the event is set
+struct ValidationEffect
+{
+	uint32_t resource;
+	uint32_t access_id;
+	VkPipelineStageFlags2 ordered;
+	VkPipelineStageFlags2 visible_stages;
+	VkAccessFlags2 visible_access;
+};
+
+struct ValidationTransition
+{
+	uint32_t resource;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+	VkPipelineStageFlags2 dst_stages;
+	VkAccessFlags2 dst_access;
+	std::vector<uint32_t> covered_ids; // Accesses of the image, and of images it aliases, that the transition waits for
+};
+
+struct ValidationSnapshot
+{
+	std::vector<ValidationEffect> effects;
+	std::vector<ValidationTransition> transitions;
+};
+
+struct Validator
+{
+	const RenderGraph& rg;
+	std::vector<ValidationResource> resources;
+	uint32_t next_id = 0;
+	uint32_t errors = 0;
+
+	Validator(const RenderGraph& graph) : rg(graph) {}
+
+	bool covers(const ValidationAccess& access, VkPipelineStageFlags2 src_stages) const
+	{
+		VkPipelineStageFlags2 src = expand_stages(src_stages);
+		VkPipelineStageFlags2 stages = expand_stages(access.stages);
+		return (access.stages != 0 && (stages & ~src) == 0) || (access.ordered & src) != 0;
+	}
+
+	bool makes_available(const ValidationAccess& access, VkAccessFlags2 src_access) const
+	{
+		if (!access.write || (src_access & VK_ACCESS_2_MEMORY_WRITE_BIT)) return true;
+		if (src_access & VK_ACCESS_2_SHADER_WRITE_BIT) src_access |= VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+		return (access.write_access & ~src_access) == 0;
+	}
+
+	bool aliases(uint32_t a, uint32_t b) const
+	{
+		const RGResource& resource_a = rg.resources[a];
+		const RGResource& resource_b = rg.resources[b];
+		if (resource_a.physical == UINT32_MAX || resource_b.physical == UINT32_MAX) return false;
+		return memory_overlaps(rg.physical_images[resource_a.physical], rg.physical_images[resource_b.physical]);
+	}
+
+	void add_effects(uint32_t resource_index, VkPipelineStageFlags2 src_stages, VkAccessFlags2 src_access,
+		VkPipelineStageFlags2 dst_stages, VkAccessFlags2 dst_access, ValidationSnapshot& snapshot)
+	{
+		for (const ValidationAccess& access : resources[resource_index].pending)
+		{
+			if (!covers(access, src_stages)) continue;
+			ValidationEffect effect{ resource_index, access.id, expand_stages(dst_stages), 0, 0 };
+			if (access.write && makes_available(access, src_access))
+			{
+				effect.visible_stages = expand_stages(dst_stages);
+				effect.visible_access = dst_access;
+			}
+			snapshot.effects.push_back(effect);
+		}
+	}
+
+	int32_t find_resource(VkImage image) const
+	{
+		for (uint32_t i = 0; i < rg.resources.size(); i++)
+		{
+			if (rg.resources[i].is_image && rg.resources[i].texture.image == image) return i;
+		}
+		return -1;
+	}
+
+	ValidationSnapshot take_first_scope(const RGBatch& batch, const char* where)
+	{
+		ValidationSnapshot snapshot;
+		if (has_memory_barrier(batch))
+		{
+			const VkMemoryBarrier2& barrier = batch.memory_barrier;
+			for (uint32_t i = 0; i < resources.size(); i++)
+			{
+				add_effects(i, barrier.srcStageMask, barrier.srcAccessMask, barrier.dstStageMask, barrier.dstAccessMask, snapshot);
+			}
+		}
+		for (uint32_t i = 0; i < batch.image_barrier_count; i++)
+		{
+			const VkImageMemoryBarrier2& barrier = rg.image_barriers[batch.first_image_barrier + i];
+			int32_t resource_index = find_resource(barrier.image);
+			if (resource_index < 0)
+			{
+				LOG_ERROR("Render graph validation: barrier %s on an image the graph does not know", where);
+				errors++;
+				continue;
+			}
+			add_effects(resource_index, barrier.srcStageMask, barrier.srcAccessMask, barrier.dstStageMask, barrier.dstAccessMask, snapshot);
+			if (barrier.oldLayout == barrier.newLayout) continue;
+
+			ValidationTransition transition{ (uint32_t)resource_index, barrier.oldLayout, barrier.newLayout, expand_stages(barrier.dstStageMask), barrier.dstAccessMask };
+			for (uint32_t other = 0; other < resources.size(); other++)
+			{
+				if (other != (uint32_t)resource_index && !(barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && aliases(other, resource_index))) continue;
+				for (const ValidationAccess& access : resources[other].pending)
+				{
+					if (covers(access, barrier.srcStageMask) && makes_available(access, barrier.srcAccessMask)) transition.covered_ids.push_back(access.id);
+				}
+			}
+			snapshot.transitions.push_back(std::move(transition));
+		}
+		return snapshot;
+	}
+
+	void apply(const ValidationSnapshot& snapshot, const char* where)
+	{
+		for (const ValidationEffect& effect : snapshot.effects)
+		{
+			for (ValidationAccess& access : resources[effect.resource].pending)
+			{
+				if (access.id != effect.access_id) continue;
+				access.ordered |= effect.ordered;
+				access.visible_stages |= effect.visible_stages;
+				access.visible_access |= effect.visible_access;
+			}
+		}
+
+		for (const ValidationTransition& transition : snapshot.transitions)
+		{
+			ValidationResource& resource = resources[transition.resource];
+			const char* name = rg.resources[transition.resource].name;
+			if (transition.old_layout != VK_IMAGE_LAYOUT_UNDEFINED && transition.old_layout != resource.layout)
+			{
+				LOG_ERROR("Render graph validation: %s transitions %s from layout %d, but it is in %d", where, name, transition.old_layout, resource.layout);
+				errors++;
+			}
+
+			for (uint32_t other = 0; other < resources.size(); other++)
+			{
+				if (other != transition.resource && !(transition.old_layout == VK_IMAGE_LAYOUT_UNDEFINED && aliases(other, transition.resource))) continue;
+				for (const ValidationAccess& access : resources[other].pending)
+				{
+					if (std::find(transition.covered_ids.begin(), transition.covered_ids.end(), access.id) != transition.covered_ids.end()) continue;
+					LOG_ERROR("Render graph validation: layout transition of %s %s races with an earlier access to %s", name, where, rg.resources[other].name);
+					errors++;
+				}
+				if (other != transition.resource)
+				{
+					// Aliased memory was just overwritten
+					resources[other].pending.clear();
+					resources[other].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				}
+			}
+
+			ValidationAccess access{ next_id++, 0, 0, true, transition.dst_stages, transition.dst_stages, transition.dst_access };
+			resource.pending.clear();
+			resource.pending.push_back(access);
+			resource.layout = transition.new_layout;
+		}
+	}
+
+	void check_use(const RGUse& use, const char* pass_name)
+	{
+		ValidationResource& resource = resources[use.resource];
+		const char* name = rg.resources[use.resource].name;
+		if (rg.resources[use.resource].is_image && resource.layout != use.layout)
+		{
+			LOG_ERROR("Render graph validation: pass %s uses %s in layout %d, but it is in %d", pass_name, name, use.layout, resource.layout);
+			errors++;
+		}
+
+		VkPipelineStageFlags2 stages = expand_stages(use.stages);
+		for (const ValidationAccess& access : resource.pending)
+		{
+			if (access.write)
+			{
+				bool ordered = (stages & ~access.ordered) == 0;
+				bool visible = (stages & ~access.visible_stages) == 0 && (use.access & ~access.visible_access) == 0;
+				if (!ordered || !visible)
+				{
+					LOG_ERROR("Render graph validation: pass %s %s %s before an earlier write to it is %s", pass_name,
+						use.write ? "writes" : "reads", name, ordered ? "visible" : "complete");
+					errors++;
+				}
+			}
+			else if (use.write && (stages & ~access.ordered) != 0)
+			{
+				LOG_ERROR("Render graph validation: pass %s writes %s while an earlier read may still be running", pass_name, name);
+				errors++;
+			}
+		}
+
+		ValidationAccess access{ next_id++, use.stages, use.access & write_access_mask, use.write, 0, 0, 0 };
+		if (use.write) resource.pending.clear();
+		resource.pending.push_back(access);
+	}
+
+	void init_resource(uint32_t resource_index)
+	{
+		const RGResource& resource = rg.resources[resource_index];
+		const RGState& state = rg.initial_states[resource_index];
+		ValidationResource& validation = resources[resource_index];
+		validation.layout = state.layout;
+		if (state.write_stages || state.dirty)
+		{
+			// Whatever waited for the write saw it
+			ValidationAccess write{ next_id++, state.write_stages, state.write_access, true, state.visible_stages, state.visible_stages, state.visible_access };
+			if (resource.swapchain)
+			{
+				write.visible_stages = ~(VkPipelineStageFlags2)0;
+				write.visible_access = ~(VkAccessFlags2)0;
+			}
+			validation.pending.push_back(write);
+		}
+		if (state.read_stages)
+		{
+			validation.pending.push_back({ next_id++, state.read_stages, 0, false, 0, 0, 0 });
+		}
+	}
+
+	uint32_t run()
+	{
+		resources.resize(rg.resources.size());
+		for (uint32_t i = 0; i < rg.resources.size(); i++) init_resource(i);
+
+		std::vector<ValidationSnapshot> event_snapshots(rg.batches.size());
+		std::vector<bool> event_set(rg.batches.size(), false);
+		char where[128];
+
+		for (uint32_t step = 0; step <= rg.steps.size(); step++)
+		{
+			const char* pass_name = step < rg.steps.size() ? rg.passes[rg.steps[step]].name : "the end of the frame";
+			snprintf(where, sizeof(where), "before %s", pass_name);
+
+			for (uint32_t i = 0; i < rg.batches.size(); i++)
+			{
+				const RGBatch& batch = rg.batches[i];
+				if (!batch.split || batch.wait_step != step) continue;
+				if (!event_set[i])
+				{
+					LOG_ERROR("Render graph validation: %s waits on an event that was never set", where);
+					errors++;
+					continue;
+				}
+				apply(event_snapshots[i], where);
+			}
+			for (const RGBatch& batch : rg.batches)
+			{
+				if (batch.split || batch.wait_step != step) continue;
+				apply(take_first_scope(batch, where), where);
+			}
+
+			if (step == rg.steps.size()) break;
+
+			for (const RGUse& use : rg.passes[rg.steps[step]].uses)
+			{
+				check_use(use, pass_name);
+			}
+
+			snprintf(where, sizeof(where), "after %s", pass_name);
+			for (uint32_t i = 0; i < rg.batches.size(); i++)
+			{
+				const RGBatch& batch = rg.batches[i];
+				if (!batch.split || batch.signal_step != (int32_t)step) continue;
+				event_snapshots[i] = take_first_scope(batch, where);
+				event_set[i] = true;
+			}
+		}
+
+		for (uint32_t i = 0; i < rg.resources.size(); i++)
+		{
+			const RGResource& resource = rg.resources[i];
+			if (resource.swapchain && resources[i].layout != resource.final_layout)
+			{
+				LOG_ERROR("Render graph validation: %s ends the frame in layout %d instead of %d", resource.name, resources[i].layout, resource.final_layout);
+				errors++;
+			}
+		}
+		return errors;
+	}
+};
+
+uint32_t RenderGraph::validate() const
+{
+	assert(compiled);
+	Validator validator(*this);
+	return validator.run();
+}
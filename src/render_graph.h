@@ -0,0 +1,217 @@
+#pragma once
+#include "defines.h"
+#include "texture.h"
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Dependencies that skip over other passes signal an event after the producer and wait on it before the consumer,
+// so the passes in between keep running. Only used when the consumer would otherwise get a barrier of its own
+#define RENDER_GRAPH_SPLIT_BARRIERS 1
+// Replays every compiled frame against an independent hazard model and logs each access it leaves unsynchronized
+#if _DEBUG
+#define RENDER_GRAPH_VALIDATE 1
+#else
+#define RENDER_GRAPH_VALIDATE 0
+#endif
+
+struct Context;
+struct RenderGraph;
+
+struct RGImage { uint32_t index = UINT32_MAX; };
+struct RGBuffer { uint32_t index = UINT32_MAX; };
+
+// How a pass touches a resource. Together with read or write and the shader stages it gives the access mask,
+// and for images the layout: attachment writes use ATTACHMENT_OPTIMAL, read only access READ_ONLY_OPTIMAL,
+// storage GENERAL. An image used in several ways by one pass is kept in GENERAL for that pass
+enum class RGAccess : uint8_t
+{
+	Attachment, // Color or depth attachment, by the image format. A read is a depth test without depth writes
+	Sampled,    // Sampled image or uniform texel buffer, read only
+	Storage,    // Storage image or buffer
+	Uniform,    // Uniform buffer, read only
+	Transfer,   // Copies, fills and clears
+	Indirect,   // Indirect dispatch and draw arguments, read only
+};
+
+struct RGImageDesc
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t layer_count = 1;
+};
+
+struct RGUse
+{
+	uint32_t resource;
+	VkPipelineStageFlags2 stages;
+	VkAccessFlags2 access;
+	VkImageLayout layout; // VK_IMAGE_LAYOUT_UNDEFINED for buffers
+	bool write;
+};
+
+// Returned by RenderGraph::add_pass, the reference is valid until the next add_pass
+struct RGPass
+{
+	const char* name;
+	RenderGraph* graph;
+	std::vector<RGUse> uses; // One per resource, repeated declarations are merged
+	std::function<void(VkCommandBuffer)> callback;
+	bool has_side_effects;
+
+	// Stages are only needed for Sampled, Storage and Uniform, the other accesses imply theirs
+	RGPass& read(RGImage image, RGAccess access, VkPipelineStageFlags2 stages = 0);
+	RGPass& write(RGImage image, RGAccess access, VkPipelineStageFlags2 stages = 0);
+	RGPass& read(RGBuffer buffer, RGAccess access, VkPipelineStageFlags2 stages = 0);
+	RGPass& write(RGBuffer buffer, RGAccess access, VkPipelineStageFlags2 stages = 0);
+
+	// Never culled. Passes that write an imported resource are kept anyway
+	RGPass& side_effects();
+	RGPass& execute(std::function<void(VkCommandBuffer)> fn);
+};
+
+// Synchronization state of a resource, carried from one frame to the next for imported resources
+struct RGState
+{
+	VkPipelineStageFlags2 write_stages = 0; // Last write or layout transition
+	VkAccessFlags2 write_access = 0;
+	VkPipelineStageFlags2 read_stages = 0; // Reads since the last write
+	VkPipelineStageFlags2 visible_stages = 0; // Where the last write has been made visible
+	VkAccessFlags2 visible_access = 0;
+	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	bool dirty = false; // The last write is not visible everywhere yet
+};
+
+struct RGResource
+{
+	const char* name;
+	uint64_t key; // Hash of the name, imported resources keep their state across frames under it
+	bool is_image;
+	bool imported;
+	bool swapchain; // Starts every frame undefined behind the acquire semaphore, ends in final_layout
+
+	// Images. Transient images get their texture when the graph is compiled
+	Texture texture;
+	RGImageDesc desc;
+	VkImageAspectFlags aspect;
+	VkPipelineStageFlags2 acquire_wait_stage;
+	VkImageLayout final_layout;
+
+	// Filled by compile
+	int32_t first_step;
+	int32_t last_step;
+	uint32_t physical; // Index into physical_images for transient images
+};
+
+// Backing of a transient image. Images whose lifetimes do not overlap share memory
+struct RGPhysicalImage
+{
+	Texture texture;
+	RGImageDesc desc;
+	VkImageUsageFlags usage;
+	int32_t first_step;
+	int32_t last_step;
+	uint32_t heap;
+	VkDeviceSize offset;
+	VkDeviceSize size;
+	// Last access of the previous frame, the next frame's first use waits on it
+	VkPipelineStageFlags2 final_stages;
+	VkAccessFlags2 final_write_access;
+};
+
+// One dependency of one resource, from the state the resource was left in to its next access group
+struct RGBarrier
+{
+	uint32_t resource;
+	VkPipelineStageFlags2 src_stages;
+	VkAccessFlags2 src_access;
+	VkPipelineStageFlags2 dst_stages;
+	VkAccessFlags2 dst_access;
+	VkImageLayout old_layout;
+	VkImageLayout new_layout;
+	int32_t signal_step; // Last step in the source scope, -1 when it lies in an earlier frame
+	uint32_t wait_step; // The step the barrier is recorded before, steps.size() for the end of the frame
+	uint32_t batch;
+};
+
+// One vkCmdPipelineBarrier2, or one event set after signal_step and waited on before wait_step
+struct RGBatch
+{
+	bool split;
+	int32_t signal_step;
+	uint32_t wait_step;
+	uint32_t first_image_barrier;
+	uint32_t image_barrier_count;
+	VkMemoryBarrier2 memory_barrier; // Every buffer dependency of the batch, unused while both stage masks are 0
+	uint32_t event_index;
+};
+
+struct RenderGraphStats
+{
+	uint32_t pass_count = 0;
+	uint32_t culled_pass_count = 0;
+	uint32_t barrier_count = 0; // vkCmdPipelineBarrier2 calls
+	uint32_t wait_count = 0; // vkCmdWaitEvents2 calls
+	uint32_t event_count = 0; // Split barriers, one vkCmdSetEvent2 each
+	uint32_t image_barrier_count = 0;
+	uint32_t transient_image_count = 0;
+	VkDeviceSize transient_memory = 0;
+	VkDeviceSize transient_memory_unaliased = 0;
+	uint32_t validation_errors = 0;
+};
+
+// Frame graph for the command buffer of one frame. Every frame the passes are declared again together with the
+// resources they read and write, compile() then culls passes nothing depends on, places transient images in
+// shared memory and derives layouts and the minimal set of barriers, and execute() records it all.
+// Buffers only get global memory barriers, so one buffer resource can stand for a group of buffers that are
+// always used together, like the buffers of a particle system.
+struct RenderGraph
+{
+	Context* ctx = nullptr;
+
+	std::vector<RGResource> resources;
+	std::vector<RGPass> passes;
+	std::vector<uint32_t> steps; // Passes that survived culling, in declaration order
+	std::vector<RGBarrier> barriers;
+	std::vector<RGBatch> batches;
+	std::vector<VkImageMemoryBarrier2> image_barriers;
+
+	std::unordered_map<uint64_t, RGState> imported_states;
+	std::vector<RGState> initial_states; // Per resource, the state the compiled frame starts from
+	std::vector<RGPhysicalImage> physical_images;
+	std::vector<VmaAllocation> transient_heaps;
+
+	// One pool per frame in flight, reset once the frame's fence has been waited on
+	std::vector<std::vector<VkEvent>> event_pools;
+	std::vector<uint32_t> events_used;
+
+	int32_t current_step = -1;
+	bool compiled = false;
+	RenderGraphStats stats;
+
+	void init(Context* ctx);
+	void destroy();
+
+	// Drops the passes and resources declared for the previous frame
+	void reset();
+
+	RGImage import_image(const char* name, const Texture& texture);
+	// The first use waits on the stage the acquire semaphore is waited on, the end of the frame leaves the image in present_layout
+	RGImage import_swapchain_image(const char* name, const Texture& texture, VkPipelineStageFlags2 acquire_wait_stage, VkImageLayout present_layout);
+	RGBuffer import_buffer(const char* name);
+	// Contents do not survive the frame. Usage flags come from the passes that use it
+	RGImage create_image(const char* name, const RGImageDesc& desc);
+
+	RGPass& add_pass(const char* name);
+
+	bool compile();
+	void execute(VkCommandBuffer cmd);
+
+	// Valid while a pass executes
+	const Texture& get_texture(RGImage image) const;
+	VkImageLayout get_layout(RGImage image) const;
+
+	// Checks the compiled barriers, logs every hazard and returns the number found
+	uint32_t validate() const;
+};
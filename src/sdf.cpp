@@ -1,89 +1,128 @@
 #include "sdf.h"
-#include <fstream>
-#include <string>
-#include <sstream>
+#include <filesystem>
+#include <glm/gtc/packing.hpp>
 #include "log.h"
+#include "timer.h"
 #include "graphics_context.h"
 #include "buffer.h"
 #include "vk_helpers.h"
 
 bool sdf_load_from_file(SDF& out_sdf, const char* filepath)
 {
-    std::fstream f(filepath);
-    if (!f.is_open())
-    {
-        LOG_ERROR("Failed to open file '%s'", filepath);
-        return false;
-    }
-
-    std::string line;
+    Timer timer;
+    timer.tick();
 
+    out_sdf.unload();
 
-    std::vector<uint32_t> dims;
-    std::vector<float> origins;
-    float grid_spacing = 0.0f;
-    std::vector<float> distance_values;
-
-    if (!std::getline(f, line)) { LOG_ERROR("Invalid file!"); return false; }
-    // Read dims
+    if (std::filesystem::path(filepath).extension() == ".sdfb")
     {
-        std::stringstream ss(line);
-        for (std::string token; std::getline(ss, token, ' '); )
-        {
-            uint32_t d = std::atoi(token.c_str());
-            assert(d != 0);
-            dims.push_back(d);
-        }
+        SDFBinaryHeader header;
+        if (!sdf_map_binary(filepath, out_sdf.mapped_file, header, &out_sdf.payload)) return false;
 
-        assert(dims.size() == 3);
+        out_sdf.dims = glm::uvec3(header.dims[0], header.dims[1], header.dims[2]);
+        out_sdf.grid_origin = glm::vec3(header.grid_origin[0], header.grid_origin[1], header.grid_origin[2]);
+        out_sdf.grid_spacing = header.grid_spacing;
+        out_sdf.payload_format = header.payload_format;
     }
-
-    if (!std::getline(f, line)) { LOG_ERROR("Invalid file!"); return false; }
-    // Read origin
+    else
     {
-        std::stringstream ss(line);
-        for (std::string token; std::getline(ss, token, ' '); )
+        SDFParseResult result = sdf_parse_text(filepath, out_sdf.dims, out_sdf.grid_origin, out_sdf.grid_spacing, out_sdf.data);
+        if (result != SDFParseResult::SUCCESS)
         {
-            float o = std::atof(token.c_str());
-            origins.push_back(o);
+            LOG_ERROR("Failed to parse SDF '%s': %s", filepath, sdf_parse_result_string(result));
+            return false;
         }
 
-        assert(origins.size() == 3);
+        out_sdf.payload = out_sdf.data.data();
+        out_sdf.payload_format = SDFPayloadFormat::FLOAT32;
     }
 
-    if (!std::getline(f, line)) { LOG_ERROR("Invalid file!"); return false; }
-    // Read grid spacing
-    grid_spacing = std::atof(line.c_str());
+    timer.tock();
+    LOG_INFO("Loaded SDF '%s' (%ux%ux%u) in %.2f ms", filepath, out_sdf.dims.x, out_sdf.dims.y, out_sdf.dims.z, timer.get_elapsed_milliseconds());
 
-    assert(grid_spacing > 0.0f);
+    return true;
+}
 
-    // Read values
-    while (std::getline(f, line))
+void SDF::unload()
+{
+    unmap_file(mapped_file);
+    data.clear();
+    data.shrink_to_fit();
+    payload = nullptr;
+    query = SDFQuery{};
+}
+
+bool SDF::init_queries()
+{
+    if (!payload)
     {
-        distance_values.push_back(std::atof(line.c_str()));
+        LOG_ERROR("SDF has to be loaded before it can be queried");
+        return false;
+    }
+    if (dims.x < 2 || dims.y < 2 || dims.z < 2)
+    {
+        LOG_ERROR("SDF needs at least 2 samples per axis to be queried");
+        return false;
     }
 
-    uint32_t total_grid_size = dims[0] * dims[1] * dims[2];
-    assert(distance_values.size() == total_grid_size);
+    if (payload_format == SDFPayloadFormat::FLOAT16)
+    {
+        const size_t voxel_count = (size_t)dims.x * dims.y * dims.z;
+        const uint16_t* halfs = (const uint16_t*)payload;
+        data.resize(voxel_count);
+        for (size_t i = 0; i < voxel_count; ++i) data[i] = glm::unpackHalf1x16(halfs[i]);
+        query.values = data.data();
+    }
+    else
+    {
+        query.values = (const float*)payload;
+    }
 
-    out_sdf.dims = glm::uvec3(dims[0], dims[1], dims[2]);
-    out_sdf.grid_origin = glm::vec3(origins[0], origins[1], origins[2]);
-    out_sdf.grid_spacing = grid_spacing;
-    out_sdf.data = std::move(distance_values);
+    query.dims = dims;
+    query.grid_origin = grid_origin;
+    query.grid_spacing = grid_spacing;
 
     return true;
 }
 
 bool SDF::init_texture(Context& ctx)
 {
-    ctx.create_texture(texture, dims.x, dims.y, dims.z, VK_FORMAT_R32_SFLOAT, VK_IMAGE_TYPE_3D, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    assert(payload);
+    const size_t voxel_count = (size_t)dims.x * dims.y * dims.z;
+    VkFormat format = payload_format == SDFPayloadFormat::FLOAT16 ? VK_FORMAT_R16_SFLOAT : VK_FORMAT_R32_SFLOAT;
+    const void* upload_data = payload;
+    size_t buffer_size = voxel_count * sdf_payload_element_size(payload_format);
+
+    // R16_SFLOAT storage images are optional, expand to floats where the device lacks them
+    std::vector<float> expanded;
+    if (format == VK_FORMAT_R16_SFLOAT)
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(ctx.physical_device.physical_device, format, &properties);
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+        if ((properties.optimalTilingFeatures & required) != required)
+        {
+            LOG_WARNING("R16_SFLOAT storage images are not supported, uploading the SDF as R32_SFLOAT");
+            format = VK_FORMAT_R32_SFLOAT;
+            if (data.size() != voxel_count)
+            { // init_queries decodes into data already, otherwise decode just for the upload
+                const uint16_t* halfs = (const uint16_t*)payload;
+                expanded.resize(voxel_count);
+                for (size_t i = 0; i < voxel_count; ++i) expanded[i] = glm::unpackHalf1x16(halfs[i]);
+            }
+            upload_data = data.size() == voxel_count ? data.data() : expanded.data();
+            buffer_size = voxel_count * sizeof(float);
+        }
+    }
+
+    ctx.create_texture(texture, dims.x, dims.y, dims.z, format, VK_IMAGE_TYPE_3D, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT);
 
-    size_t buffer_size = dims.x * dims.y * dims.z * sizeof(float);
+    // Payload is copied straight from the file mapping into the staging buffer
     BufferDesc desc{};
     desc.size = buffer_size;
     desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
     desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
-    desc.data = data.data();
+    desc.data = (void*)upload_data;
     Buffer staging_buffer = ctx.create_buffer(desc);
 
     VkCommandBuffer cmd = ctx.allocate_and_begin_command_buffer();
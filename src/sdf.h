@@ -4,6 +4,8 @@
 #include <vector>
 
 #include "texture.h"
+#include "sdf_file.h"
+#include "sdf_query.h"
 
 struct Context;
 
@@ -13,13 +15,23 @@ struct SDF
 	glm::uvec3 dims = glm::uvec3(0);
 	glm::vec3 grid_origin = glm::vec3(0.0f);
 	float grid_spacing = 0.0f;
-	std::vector<float> data;
+	std::vector<float> data; // Filled when loaded from text, baked or when a half payload is decoded for queries
+
+	// Voxel values in payload_format. Points either into data or into the mapped .sdfb file
+	const void* payload = nullptr;
+	SDFPayloadFormat payload_format = SDFPayloadFormat::FLOAT32;
+	MappedFile mapped_file;
+
+	// CPU distance queries, valid after init_queries()
+	SDFQuery query;
 
 	Texture texture = {};
 
 	bool init_texture(Context& ctx);
+	bool init_queries(); // Half payloads are decoded into data
+	void unload();
 };
 
-// Loads .sdf file generated by SDFGen
+// Loads either a binary .sdfb file or the text .sdf file generated by SDFGen
 // https://github.com/christopherbatty/SDFGen
 bool sdf_load_from_file(SDF& out_sdf, const char* filepath);
@@ -0,0 +1,432 @@
+#include "sdf_bake.h"
+#include "sdf.h"
+#include "mesh.h"
+#include "job_system.h"
+#include "timer.h"
+#include "log.h"
+#include "misc.h"
+#include <unordered_map>
+#include <algorithm>
+#include <filesystem>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+// Bump when the baking algorithm changes to invalidate cached results
+#define SDF_BAKE_VERSION 2
+
+#define BVH_LEAF_SIZE 4
+
+enum TriangleFeature
+{
+	FEATURE_VERTEX0 = 0,
+	FEATURE_VERTEX1,
+	FEATURE_VERTEX2,
+	FEATURE_EDGE01,
+	FEATURE_EDGE12,
+	FEATURE_EDGE20,
+	FEATURE_FACE,
+};
+
+// Triangle with the angle weighted pseudo-normals of its features. The pseudo-normal of the feature
+// closest to a query point gives a robust inside/outside test even at edges and vertices.
+struct BakeTriangle
+{
+	glm::vec3 v[3];
+	glm::vec3 face_normal;
+	glm::vec3 vertex_normal[3];
+	glm::vec3 edge_normal[3]; // 01, 12, 20
+};
+
+struct BVHNode
+{
+	glm::vec3 min;
+	uint32_t first; // First triangle for leaves, left child otherwise. Right child is always left + 1
+	glm::vec3 max;
+	uint32_t count; // Zero for interior nodes
+};
+
+struct BakeContext
+{
+	std::vector<BakeTriangle> triangles;
+	std::vector<BVHNode> nodes;
+
+	glm::uvec3 dims;
+	glm::vec3 origin; // Position of the first sample, half a voxel inside the grid origin
+	float spacing;
+	float* values;
+};
+
+static glm::vec3 closest_point_on_triangle(const glm::vec3& p, const BakeTriangle& t, TriangleFeature& out_feature)
+{
+	// Real-Time Collision Detection, Ericson, 5.1.5
+	const glm::vec3& a = t.v[0];
+	const glm::vec3& b = t.v[1];
+	const glm::vec3& c = t.v[2];
+	const glm::vec3 ab = b - a;
+	const glm::vec3 ac = c - a;
+	const glm::vec3 ap = p - a;
+	const float d1 = glm::dot(ab, ap);
+	const float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f) { out_feature = FEATURE_VERTEX0; return a; }
+
+	const glm::vec3 bp = p - b;
+	const float d3 = glm::dot(ab, bp);
+	const float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3) { out_feature = FEATURE_VERTEX1; return b; }
+
+	const float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+	{
+		out_feature = FEATURE_EDGE01;
+		return a + ab * (d1 / (d1 - d3));
+	}
+
+	const glm::vec3 cp = p - c;
+	const float d5 = glm::dot(ab, cp);
+	const float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6) { out_feature = FEATURE_VERTEX2; return c; }
+
+	const float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+	{
+		out_feature = FEATURE_EDGE20;
+		return a + ac * (d2 / (d2 - d6));
+	}
+
+	const float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+	{
+		out_feature = FEATURE_EDGE12;
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+	}
+
+	out_feature = FEATURE_FACE;
+	const float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+static glm::vec3 get_feature_normal(const BakeTriangle& t, TriangleFeature feature)
+{
+	switch (feature)
+	{
+	case FEATURE_VERTEX0: return t.vertex_normal[0];
+	case FEATURE_VERTEX1: return t.vertex_normal[1];
+	case FEATURE_VERTEX2: return t.vertex_normal[2];
+	case FEATURE_EDGE01: return t.edge_normal[0];
+	case FEATURE_EDGE12: return t.edge_normal[1];
+	case FEATURE_EDGE20: return t.edge_normal[2];
+	default: return t.face_normal;
+	}
+}
+
+static float distance_squared_to_aabb(const glm::vec3& p, const glm::vec3& min, const glm::vec3& max)
+{
+	const glm::vec3 d = glm::max(glm::max(min - p, p - max), glm::vec3(0.0f));
+	return glm::dot(d, d);
+}
+
+struct PositionHash
+{
+	size_t operator()(const glm::vec3& v) const
+	{
+		uint32_t bits[3];
+		memcpy(bits, &v, sizeof(bits));
+		return (size_t)bits[0] * 73856093u ^ (size_t)bits[1] * 19349663u ^ (size_t)bits[2] * 83492791u;
+	}
+};
+
+// Welds vertices by position so pseudo-normals are shared across glTF attribute seams
+static void build_triangles(const MeshGeometry& geometry, std::vector<BakeTriangle>& out_triangles)
+{
+	std::unordered_map<glm::vec3, uint32_t, PositionHash> welded_ids;
+	std::vector<uint32_t> triangle_ids;
+
+	for (const Mesh::Primitive& primitive : geometry.primitives)
+	{
+		for (uint32_t i = 0; i + 2 < primitive.index_count; i += 3)
+		{
+			BakeTriangle t{};
+			uint32_t ids[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				t.v[k] = geometry.position[primitive.first_vertex + geometry.indices[primitive.first_index + i + k]];
+				ids[k] = welded_ids.emplace(t.v[k], (uint32_t)welded_ids.size()).first->second;
+			}
+
+			const glm::vec3 n = glm::cross(t.v[1] - t.v[0], t.v[2] - t.v[0]);
+			const float len = glm::length(n);
+			if (len <= 0.0f) continue; // Degenerate
+
+			t.face_normal = n / len;
+			out_triangles.push_back(t);
+			triangle_ids.insert(triangle_ids.end(), ids, ids + 3);
+		}
+	}
+
+	std::vector<glm::vec3> vertex_normals(welded_ids.size(), glm::vec3(0.0f));
+	std::unordered_map<uint64_t, glm::vec3> edge_normals;
+	auto edge_key = [](uint32_t a, uint32_t b) { return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a; };
+
+	for (size_t i = 0; i < out_triangles.size(); ++i)
+	{
+		const BakeTriangle& t = out_triangles[i];
+		const uint32_t* ids = &triangle_ids[i * 3];
+		for (int k = 0; k < 3; ++k)
+		{
+			const glm::vec3 e0 = glm::normalize(t.v[(k + 1) % 3] - t.v[k]);
+			const glm::vec3 e1 = glm::normalize(t.v[(k + 2) % 3] - t.v[k]);
+			const float angle = acosf(glm::clamp(glm::dot(e0, e1), -1.0f, 1.0f));
+			vertex_normals[ids[k]] += t.face_normal * angle;
+			edge_normals[edge_key(ids[k], ids[(k + 1) % 3])] += t.face_normal;
+		}
+	}
+
+	for (size_t i = 0; i < out_triangles.size(); ++i)
+	{
+		BakeTriangle& t = out_triangles[i];
+		const uint32_t* ids = &triangle_ids[i * 3];
+		for (int k = 0; k < 3; ++k)
+		{
+			t.vertex_normal[k] = vertex_normals[ids[k]];
+			t.edge_normal[k] = edge_normals[edge_key(ids[k], ids[(k + 1) % 3])];
+		}
+	}
+}
+
+static void build_bvh(BakeContext& bake)
+{
+	std::vector<BakeTriangle>& triangles = bake.triangles;
+	std::vector<BVHNode>& nodes = bake.nodes;
+	nodes.reserve(triangles.size() * 2 / BVH_LEAF_SIZE + 1);
+
+	struct BuildItem { uint32_t node; uint32_t first; uint32_t count; };
+	std::vector<BuildItem> stack;
+	nodes.push_back(BVHNode{});
+	stack.push_back(BuildItem{ 0, 0, (uint32_t)triangles.size() });
+
+	while (!stack.empty())
+	{
+		const BuildItem item = stack.back();
+		stack.pop_back();
+
+		glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+		glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+		for (uint32_t i = item.first; i < item.first + item.count; ++i)
+		{
+			const BakeTriangle& t = triangles[i];
+			const glm::vec3 centroid = (t.v[0] + t.v[1] + t.v[2]) * (1.0f / 3.0f);
+			for (int k = 0; k < 3; ++k)
+			{
+				min = glm::min(min, t.v[k]);
+				max = glm::max(max, t.v[k]);
+			}
+			centroid_min = glm::min(centroid_min, centroid);
+			centroid_max = glm::max(centroid_max, centroid);
+		}
+
+		nodes[item.node].min = min;
+		nodes[item.node].max = max;
+
+		if (item.count <= BVH_LEAF_SIZE)
+		{
+			nodes[item.node].first = item.first;
+			nodes[item.node].count = item.count;
+			continue;
+		}
+
+		// Median split along the axis with the largest centroid spread
+		const glm::vec3 extent = centroid_max - centroid_min;
+		const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		const uint32_t half = item.count / 2;
+		std::nth_element(triangles.begin() + item.first, triangles.begin() + item.first + half, triangles.begin() + item.first + item.count,
+			[axis](const BakeTriangle& a, const BakeTriangle& b)
+			{
+				return a.v[0][axis] + a.v[1][axis] + a.v[2][axis] < b.v[0][axis] + b.v[1][axis] + b.v[2][axis];
+			});
+
+		const uint32_t left = (uint32_t)nodes.size();
+		nodes.push_back(BVHNode{});
+		nodes.push_back(BVHNode{});
+		nodes[item.node].first = left;
+		nodes[item.node].count = 0;
+		stack.push_back(BuildItem{ left, item.first, half });
+		stack.push_back(BuildItem{ left + 1, item.first + half, item.count - half });
+	}
+}
+
+// Returns the signed distance to the closest triangle. Max_distance has to be an upper bound of the
+// true distance, it is only used to prune the traversal
+static float query_signed_distance(const BakeContext& bake, const glm::vec3& p, float max_distance)
+{
+	float best_d2 = max_distance * max_distance;
+	float best_sign = 1.0f;
+	bool found = false;
+
+	uint32_t stack[64];
+	uint32_t stack_size = 0;
+	stack[stack_size++] = 0;
+
+	while (stack_size)
+	{
+		const BVHNode& node = bake.nodes[stack[--stack_size]];
+		if (distance_squared_to_aabb(p, node.min, node.max) > best_d2) continue;
+
+		if (node.count)
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; ++i)
+			{
+				const BakeTriangle& t = bake.triangles[i];
+				TriangleFeature feature;
+				const glm::vec3 closest = closest_point_on_triangle(p, t, feature);
+				const glm::vec3 d = p - closest;
+				const float d2 = glm::dot(d, d);
+				if (d2 <= best_d2)
+				{
+					best_d2 = d2;
+					best_sign = glm::dot(d, get_feature_normal(t, feature)) < 0.0f ? -1.0f : 1.0f;
+					found = true;
+				}
+			}
+		}
+		else
+		{
+			// Push the farther child first so the nearer one is visited first
+			const BVHNode& left = bake.nodes[node.first];
+			const BVHNode& right = bake.nodes[node.first + 1];
+			const float dl = distance_squared_to_aabb(p, left.min, left.max);
+			const float dr = distance_squared_to_aabb(p, right.min, right.max);
+			assert(stack_size + 2 <= std::size(stack));
+			if (dl < dr)
+			{
+				stack[stack_size++] = node.first + 1;
+				stack[stack_size++] = node.first;
+			}
+			else
+			{
+				stack[stack_size++] = node.first;
+				stack[stack_size++] = node.first + 1;
+			}
+		}
+	}
+
+	if (!found) return query_signed_distance(bake, p, FLT_MAX);
+	return sqrtf(best_d2) * best_sign;
+}
+
+static void bake_slab_job(void* data, uint32_t z)
+{
+	const BakeContext& bake = *(const BakeContext*)data;
+	float* out = bake.values + (size_t)z * bake.dims.x * bake.dims.y;
+
+	// Distance is 1-Lipschitz, so the distance at a neighbouring voxel bounds the search radius
+	auto search_bound = [&bake](float neighbour) { return (fabsf(neighbour) + bake.spacing) * 1.001f + 1e-6f; };
+
+	float row_start = query_signed_distance(bake, bake.origin + glm::vec3(0.0f, 0.0f, (float)z) * bake.spacing, FLT_MAX);
+	for (uint32_t y = 0; y < bake.dims.y; ++y)
+	{
+		if (y) row_start = query_signed_distance(bake, bake.origin + glm::vec3(0.0f, (float)y, (float)z) * bake.spacing, search_bound(row_start));
+
+		float previous = row_start;
+		*out++ = previous;
+		for (uint32_t x = 1; x < bake.dims.x; ++x)
+		{
+			const glm::vec3 p = bake.origin + glm::vec3(x, y, z) * bake.spacing;
+			previous = query_signed_distance(bake, p, search_bound(previous));
+			*out++ = previous;
+		}
+	}
+}
+
+static uint64_t hash_bake_input(const MeshGeometry& geometry, const SDFBakeSettings& settings)
+{
+	const uint32_t version = SDF_BAKE_VERSION;
+	uint64_t hash = hash_fnv1a_64(&version, sizeof(version));
+	hash = hash_fnv1a_64(&settings.resolution, sizeof(settings.resolution), hash);
+	hash = hash_fnv1a_64(&settings.padding, sizeof(settings.padding), hash);
+	for (const Mesh::Primitive& primitive : geometry.primitives)
+	{
+		hash = hash_fnv1a_64(&primitive.first_vertex, sizeof(primitive.first_vertex), hash);
+		hash = hash_fnv1a_64(&primitive.first_index, sizeof(primitive.first_index), hash);
+		hash = hash_fnv1a_64(&primitive.index_count, sizeof(primitive.index_count), hash);
+	}
+	hash = hash_fnv1a_64(geometry.position.data(), geometry.position.size() * sizeof(glm::vec3), hash);
+	hash = hash_fnv1a_64(geometry.indices.data(), geometry.indices.size() * sizeof(uint32_t), hash);
+	return hash;
+}
+
+bool sdf_bake_mesh(SDF& out_sdf, const MeshGeometry& geometry, const SDFBakeSettings& settings)
+{
+	if (settings.resolution < 2 || geometry.position.empty() || geometry.indices.empty())
+	{
+		LOG_ERROR("Invalid SDF bake input!");
+		return false;
+	}
+
+	std::filesystem::path cache_path;
+	if (settings.cache_directory)
+	{
+		char filename[32];
+		snprintf(filename, sizeof(filename), "%016llx.sdfb", (unsigned long long)hash_bake_input(geometry, settings));
+		cache_path = std::filesystem::path(settings.cache_directory) / filename;
+
+		std::error_code ec;
+		if (std::filesystem::exists(cache_path, ec) && sdf_load_from_file(out_sdf, cache_path.string().c_str()))
+		{
+			return true;
+		}
+	}
+
+	Timer timer;
+	timer.tick();
+
+	BakeContext bake;
+	build_triangles(geometry, bake.triangles);
+	if (bake.triangles.empty())
+	{
+		LOG_ERROR("Mesh has no valid triangles to bake!");
+		return false;
+	}
+	build_bvh(bake);
+
+	glm::vec3 min = bake.nodes[0].min;
+	glm::vec3 max = bake.nodes[0].max;
+	const glm::vec3 extent = max - min;
+	const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+	const float padding = settings.padding * longest;
+	min -= glm::vec3(padding);
+	max += glm::vec3(padding);
+
+	bake.spacing = (longest + 2.0f * padding) / (float)(settings.resolution - 1);
+	bake.origin = min;
+	for (int i = 0; i < 3; ++i)
+	{
+		bake.dims[i] = std::max((uint32_t)ceilf((max[i] - min[i]) / bake.spacing) + 1, 2u);
+	}
+
+	out_sdf.unload();
+	out_sdf.dims = bake.dims;
+	// Values are texel centers for the queries and the 3D texture, so the grid starts half a voxel before the first sample
+	out_sdf.grid_origin = bake.origin - glm::vec3(0.5f * bake.spacing);
+	out_sdf.grid_spacing = bake.spacing;
+	out_sdf.data.resize((size_t)bake.dims.x * bake.dims.y * bake.dims.z);
+	out_sdf.payload = out_sdf.data.data();
+	out_sdf.payload_format = SDFPayloadFormat::FLOAT32;
+	bake.values = out_sdf.data.data();
+
+	JobCounter counter;
+	JobSystem::dispatch(bake_slab_job, &bake, bake.dims.z, &counter);
+	JobSystem::wait(&counter);
+
+	timer.tock();
+	LOG_INFO("Baked %ux%ux%u SDF from %zu triangles in %.2f ms", bake.dims.x, bake.dims.y, bake.dims.z, bake.triangles.size(), timer.get_elapsed_milliseconds());
+
+	if (!cache_path.empty())
+	{
+		std::error_code ec;
+		std::filesystem::create_directories(cache_path.parent_path(), ec);
+		sdf_write_binary(cache_path.string().c_str(), out_sdf.dims, out_sdf.grid_origin, out_sdf.grid_spacing, out_sdf.data.data(), SDFPayloadFormat::FLOAT32);
+	}
+
+	return true;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+struct SDF;
+struct MeshGeometry;
+
+#define SDF_BAKE_CACHE_DIRECTORY "data/sdf_cache"
+
+struct SDFBakeSettings
+{
+	uint32_t resolution = 128; // Voxels along the longest axis of the padded bounds
+	float padding = 0.1f; // Space added around the mesh bounds, relative to the longest axis
+	const char* cache_directory = SDF_BAKE_CACHE_DIRECTORY; // nullptr disables the disk cache
+};
+
+// Bakes a signed distance field from triangle geometry, e.g. the output of load_mesh_geometry.
+// Distances come from a BVH accelerated closest triangle query, the sign from angle weighted pseudo-normals.
+// Grid slabs are baked in parallel on the job system. Results are cached on disk as .sdfb keyed by a hash
+// of the geometry and settings.
+bool sdf_bake_mesh(SDF& out_sdf, const MeshGeometry& geometry, const SDFBakeSettings& settings = SDFBakeSettings());
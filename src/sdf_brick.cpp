@@ -0,0 +1,245 @@
+#include "sdf_brick.h"
+#include "job_system.h"
+#include "timer.h"
+#include "log.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+struct BrickBuildJobData
+{
+	BrickedSDF* sdf;
+	const float* values;
+	float band;
+	uint32_t levels;
+};
+
+static inline size_t dense_index(glm::uvec3 dims, uint32_t x, uint32_t y, uint32_t z)
+{
+	return ((size_t)z * dims.y + y) * dims.x + x;
+}
+
+// Brick samples past the end of the grid replicate the last sample
+static inline uint32_t brick_sample_coord(uint32_t brick, uint32_t local, uint32_t dim)
+{
+	return std::min(brick * SDF_BRICK_CELLS + local, dim - 1);
+}
+
+template <typename F>
+static void for_each_brick_sample(const BrickedSDF& sdf, const float* values, uint32_t bx, uint32_t by, uint32_t bz, F&& f)
+{
+	for (uint32_t z = 0; z < SDF_BRICK_SIZE; ++z)
+	{
+		const uint32_t gz = brick_sample_coord(bz, z, sdf.dims.z);
+		for (uint32_t y = 0; y < SDF_BRICK_SIZE; ++y)
+		{
+			const uint32_t gy = brick_sample_coord(by, y, sdf.dims.y);
+			for (uint32_t x = 0; x < SDF_BRICK_SIZE; ++x)
+			{
+				const uint32_t gx = brick_sample_coord(bx, x, sdf.dims.x);
+				f(values[dense_index(sdf.dims, gx, gy, gz)]);
+			}
+		}
+	}
+}
+
+static void classify_bricks_job(void* data, uint32_t bz)
+{
+	BrickBuildJobData& job = *(BrickBuildJobData*)data;
+	BrickedSDF& sdf = *job.sdf;
+
+	for (uint32_t by = 0; by < sdf.brick_dims.y; ++by)
+	{
+		for (uint32_t bx = 0; bx < sdf.brick_dims.x; ++bx)
+		{
+			float min = FLT_MAX, max = -FLT_MAX, closest = FLT_MAX;
+			for_each_brick_sample(sdf, job.values, bx, by, bz, [&](float v)
+			{
+				min = std::min(min, v);
+				max = std::max(max, v);
+				if (fabsf(v) < fabsf(closest)) closest = v;
+			});
+
+			SDFBrick& brick = sdf.bricks[dense_index(sdf.brick_dims, bx, by, bz)];
+			if (fabsf(closest) <= job.band)
+			{
+				brick.min = min;
+				brick.scale = (max - min) / (float)job.levels;
+				brick.data_offset = 0; // Assigned after all bricks are classified
+			}
+			else
+			{
+				// Trilinear interpolation never goes below the smallest sample, so this stays a safe step for sphere tracing
+				brick.min = closest;
+				brick.scale = 0.0f;
+				brick.data_offset = SDF_BRICK_EMPTY;
+			}
+		}
+	}
+}
+
+template <typename T>
+static void quantize_bricks(BrickBuildJobData& job, uint32_t bz)
+{
+	BrickedSDF& sdf = *job.sdf;
+	T* samples = (T*)sdf.samples.data();
+
+	for (uint32_t by = 0; by < sdf.brick_dims.y; ++by)
+	{
+		for (uint32_t bx = 0; bx < sdf.brick_dims.x; ++bx)
+		{
+			const SDFBrick& brick = sdf.bricks[dense_index(sdf.brick_dims, bx, by, bz)];
+			if (brick.data_offset == SDF_BRICK_EMPTY) continue;
+
+			const float inv_scale = brick.scale > 0.0f ? 1.0f / brick.scale : 0.0f;
+			T* out = samples + brick.data_offset;
+			for_each_brick_sample(sdf, job.values, bx, by, bz, [&](float v)
+			{
+				const float q = (v - brick.min) * inv_scale + 0.5f;
+				*out++ = (T)std::min((uint32_t)q, job.levels);
+			});
+		}
+	}
+}
+
+static void quantize_bricks_job(void* data, uint32_t bz)
+{
+	BrickBuildJobData& job = *(BrickBuildJobData*)data;
+	if (job.sdf->bits == 8) quantize_bricks<uint8_t>(job, bz);
+	else quantize_bricks<uint16_t>(job, bz);
+}
+
+bool BrickedSDF::build(const float* values, glm::uvec3 in_dims, glm::vec3 origin, float spacing, const SDFBrickSettings& settings)
+{
+	if (in_dims.x < 2 || in_dims.y < 2 || in_dims.z < 2)
+	{
+		LOG_ERROR("SDF needs at least 2 samples per axis to be bricked");
+		return false;
+	}
+	if (settings.bits != 8 && settings.bits != 16)
+	{
+		LOG_ERROR("Unsupported SDF brick quantization: %u bits", settings.bits);
+		return false;
+	}
+
+	Timer timer;
+	timer.tick();
+
+	dims = in_dims;
+	grid_origin = origin;
+	grid_spacing = spacing;
+	bits = settings.bits;
+	brick_dims = (dims - glm::uvec3(2)) / (uint32_t)SDF_BRICK_CELLS + glm::uvec3(1);
+	bricks.assign((size_t)brick_dims.x * brick_dims.y * brick_dims.z, SDFBrick{});
+
+	BrickBuildJobData job;
+	job.sdf = this;
+	job.values = values;
+	job.band = settings.band_voxels * spacing;
+	job.levels = (1u << bits) - 1;
+
+	JobCounter counter;
+	JobSystem::dispatch(classify_bricks_job, &job, brick_dims.z, &counter);
+	JobSystem::wait(&counter);
+
+	stored_brick_count = 0;
+	for (SDFBrick& brick : bricks)
+	{
+		if (brick.data_offset == SDF_BRICK_EMPTY) continue;
+		brick.data_offset = stored_brick_count++ * SDF_BRICK_SAMPLES;
+	}
+	samples.assign((size_t)stored_brick_count * SDF_BRICK_SAMPLES * (bits / 8), 0);
+
+	JobSystem::dispatch(quantize_bricks_job, &job, brick_dims.z, &counter);
+	JobSystem::wait(&counter);
+
+	timer.tock();
+	LOG_INFO("Bricked %ux%ux%u SDF: %u of %zu bricks stored, %.2f MB -> %.2f MB (%.1fx) in %.2f ms",
+		dims.x, dims.y, dims.z, stored_brick_count, bricks.size(),
+		dense_memory_bytes() / (1024.0 * 1024.0), memory_bytes() / (1024.0 * 1024.0),
+		(double)dense_memory_bytes() / (double)memory_bytes(), timer.get_elapsed_milliseconds());
+
+	return true;
+}
+
+// Texel centers sit at origin + (i + 0.5) * spacing, matching linear filtering of the 3D texture
+static inline void get_texel_cell(glm::uvec3 dims, glm::vec3 origin, float spacing, const glm::vec3& p, glm::uvec3& out_cell, glm::vec3& out_t)
+{
+	const glm::vec3 coord = glm::clamp((p - origin) / spacing - glm::vec3(0.5f), glm::vec3(0.0f), glm::vec3(dims - glm::uvec3(1)));
+	for (int i = 0; i < 3; ++i)
+	{
+		out_cell[i] = std::min((uint32_t)coord[i], dims[i] - 2);
+		out_t[i] = coord[i] - (float)out_cell[i];
+	}
+}
+
+static inline float trilinear(const float c[8], const glm::vec3& t)
+{
+	const float x00 = c[0] + (c[1] - c[0]) * t.x;
+	const float x10 = c[2] + (c[3] - c[2]) * t.x;
+	const float x01 = c[4] + (c[5] - c[4]) * t.x;
+	const float x11 = c[6] + (c[7] - c[6]) * t.x;
+	const float y0 = x00 + (x10 - x00) * t.y;
+	const float y1 = x01 + (x11 - x01) * t.y;
+	return y0 + (y1 - y0) * t.z;
+}
+
+template <typename T>
+static inline float sample_brick(const T* samples, glm::uvec3 local, const glm::vec3& t)
+{
+	const T* s = samples + (local.z * SDF_BRICK_SIZE + local.y) * SDF_BRICK_SIZE + local.x;
+	constexpr uint32_t dy = SDF_BRICK_SIZE;
+	constexpr uint32_t dz = SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+	const float c[8] = {
+		(float)s[0], (float)s[1], (float)s[dy], (float)s[dy + 1],
+		(float)s[dz], (float)s[dz + 1], (float)s[dz + dy], (float)s[dz + dy + 1],
+	};
+	return trilinear(c, t);
+}
+
+float BrickedSDF::sample(const glm::vec3& p) const
+{
+	glm::uvec3 cell;
+	glm::vec3 t;
+	get_texel_cell(dims, grid_origin, grid_spacing, p, cell, t);
+
+	const glm::uvec3 brick_coord = cell / (uint32_t)SDF_BRICK_CELLS;
+	const SDFBrick& brick = bricks[dense_index(brick_dims, brick_coord.x, brick_coord.y, brick_coord.z)];
+	if (brick.data_offset == SDF_BRICK_EMPTY) return brick.min;
+
+	// Dequantization is linear, so it can be applied after interpolating the raw values
+	const glm::uvec3 local = cell - brick_coord * (uint32_t)SDF_BRICK_CELLS;
+	const float q = bits == 8
+		? sample_brick((const uint8_t*)samples.data() + brick.data_offset, local, t)
+		: sample_brick((const uint16_t*)samples.data() + brick.data_offset, local, t);
+	return brick.min + q * brick.scale;
+}
+
+glm::vec3 BrickedSDF::gradient(const glm::vec3& p, float eps) const
+{
+	const glm::vec3 dx(eps, 0.0f, 0.0f);
+	const glm::vec3 dy(0.0f, eps, 0.0f);
+	const glm::vec3 dz(0.0f, 0.0f, eps);
+	return glm::vec3(
+		sample(p + dx) - sample(p - dx),
+		sample(p + dy) - sample(p - dy),
+		sample(p + dz) - sample(p - dz)) / (2.0f * eps);
+}
+
+size_t BrickedSDF::memory_bytes() const
+{
+	return bricks.size() * sizeof(SDFBrick) + samples.size();
+}
+
+float sdf_sample_dense(const float* values, glm::uvec3 dims, glm::vec3 origin, float spacing, const glm::vec3& p)
+{
+	glm::uvec3 cell;
+	glm::vec3 t;
+	get_texel_cell(dims, origin, spacing, p, cell, t);
+
+	const float* s = values + dense_index(dims, cell.x, cell.y, cell.z);
+	const size_t dy = dims.x;
+	const size_t dz = (size_t)dims.x * dims.y;
+	const float c[8] = { s[0], s[1], s[dy], s[dy + 1], s[dz], s[dz + 1], s[dz + dy], s[dz + dy + 1] };
+	return trilinear(c, t);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <stdint.h>
+
+// Sparse SDF made of 8^3 sample bricks that are only stored within a narrow band around the surface.
+// Neighbouring bricks share their border samples so a trilinear lookup never has to touch more than one
+// brick. Bricks outside the band collapse to a single conservative distance.
+
+#define SDF_BRICK_SIZE 8
+#define SDF_BRICK_CELLS (SDF_BRICK_SIZE - 1)
+#define SDF_BRICK_SAMPLES (SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE)
+#define SDF_BRICK_EMPTY UINT32_MAX
+
+struct SDFBrickSettings
+{
+	float band_voxels = 4.0f; // Bricks with a sample closer than this many voxels to the surface are stored
+	uint32_t bits = 8; // 8 or 16 bits per quantized sample
+};
+
+struct SDFBrick
+{
+	float min; // Distance of quantized zero. For empty bricks the smallest distance within the brick
+	float scale; // Distance per quantization step, zero for empty bricks
+	uint32_t data_offset; // First sample in BrickedSDF::samples or SDF_BRICK_EMPTY
+};
+
+struct BrickedSDF
+{
+	glm::uvec3 dims = glm::uvec3(0);
+	glm::vec3 grid_origin = glm::vec3(0.0f);
+	float grid_spacing = 0.0f;
+
+	glm::uvec3 brick_dims = glm::uvec3(0);
+	std::vector<SDFBrick> bricks; // Indirection grid, x varying fastest
+	std::vector<uint8_t> samples; // Quantized samples of all stored bricks, 1 or 2 bytes each
+	uint32_t bits = 8;
+	uint32_t stored_brick_count = 0;
+
+	// Builds bricks from a dense float grid laid out like the SDFGen/.sdfb payload
+	bool build(const float* values, glm::uvec3 dims, glm::vec3 origin, float spacing, const SDFBrickSettings& settings = SDFBrickSettings());
+
+	// Trilinear lookup with the same texel convention and clamp to edge behaviour as sampling the
+	// SDF texture with grid_uv = (p - origin) / (spacing * dims) in the shaders
+	float sample(const glm::vec3& p) const;
+
+	// Central differences like sdf_normal in the shaders, not normalized
+	glm::vec3 gradient(const glm::vec3& p, float eps = 0.001f) const;
+
+	size_t memory_bytes() const;
+	size_t dense_memory_bytes() const { return (size_t)dims.x * dims.y * dims.z * sizeof(float); }
+};
+
+// Reference lookup into a dense float grid with the same conventions as BrickedSDF::sample
+float sdf_sample_dense(const float* values, glm::uvec3 dims, glm::vec3 origin, float spacing, const glm::vec3& p);
@@ -0,0 +1,267 @@
+#include "sdf_file.h"
+#include "job_system.h"
+#include <charconv>
+#include <string.h>
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
+#include "log.h"
+
+const char* sdf_parse_result_string(SDFParseResult result)
+{
+    switch (result)
+    {
+    case SDFParseResult::SUCCESS: return "success";
+    case SDFParseResult::FILE_ERROR: return "failed to read file";
+    case SDFParseResult::INVALID_DIMS: return "invalid dimensions";
+    case SDFParseResult::INVALID_ORIGIN: return "invalid origin";
+    case SDFParseResult::INVALID_SPACING: return "invalid grid spacing";
+    case SDFParseResult::INVALID_VALUE: return "invalid distance value";
+    case SDFParseResult::VALUE_COUNT_MISMATCH: return "value count does not match dimensions";
+    default: return "unknown error";
+    }
+}
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Parses exactly count whitespace separated numbers from the line starting at p and advances p past the line
+template <typename T>
+static bool parse_header_line(const char*& p, const char* end, T* out, int count)
+{
+    const char* line_end = (const char*)memchr(p, '\n', end - p);
+    if (!line_end) line_end = end;
+
+    int parsed = 0;
+    while (true)
+    {
+        while (p < line_end && is_space(*p)) ++p;
+        if (p == line_end) break;
+        if (parsed == count) return false;
+
+        std::from_chars_result res = std::from_chars(p, line_end, out[parsed]);
+        if (res.ec != std::errc() || (res.ptr < line_end && !is_space(*res.ptr))) return false;
+        p = res.ptr;
+        ++parsed;
+    }
+
+    p = line_end < end ? line_end + 1 : end;
+    return parsed == count;
+}
+
+struct SDFParseChunk
+{
+    const char* begin;
+    const char* end;
+    size_t first_value;
+    size_t value_count;
+};
+
+struct SDFParseJobData
+{
+    std::vector<SDFParseChunk> chunks;
+    float* values;
+    std::atomic<bool> failed = false;
+};
+
+static void count_values_job(void* data, uint32_t index)
+{
+    SDFParseJobData& job = *(SDFParseJobData*)data;
+    SDFParseChunk& chunk = job.chunks[index];
+
+    size_t count = 0;
+    bool in_token = false;
+    for (const char* p = chunk.begin; p < chunk.end; ++p)
+    {
+        const bool space = is_space(*p);
+        count += !space && !in_token;
+        in_token = !space;
+    }
+    chunk.value_count = count;
+}
+
+static void parse_values_job(void* data, uint32_t index)
+{
+    SDFParseJobData& job = *(SDFParseJobData*)data;
+    const SDFParseChunk& chunk = job.chunks[index];
+
+    float* out = job.values + chunk.first_value;
+    const char* p = chunk.begin;
+    while (true)
+    {
+        while (p < chunk.end && is_space(*p)) ++p;
+        if (p == chunk.end) break;
+
+        std::from_chars_result res = std::from_chars(p, chunk.end, *out++);
+        if (res.ec != std::errc() || (res.ptr < chunk.end && !is_space(*res.ptr)))
+        {
+            job.failed = true;
+            return;
+        }
+        p = res.ptr;
+    }
+}
+
+SDFParseResult sdf_parse_text(const char* filepath, glm::uvec3& out_dims, glm::vec3& out_origin, float& out_spacing, std::vector<float>& out_values)
+{
+    MappedFile file;
+    if (!map_file(filepath, file)) return SDFParseResult::FILE_ERROR;
+
+    const char* p = (const char*)file.data;
+    const char* end = p + file.size;
+
+    SDFParseResult result = SDFParseResult::SUCCESS;
+    uint32_t dims[3] = {};
+    float origin[3] = {};
+    float spacing = 0.0f;
+    size_t total_grid_size = 0;
+
+    if (!parse_header_line(p, end, dims, 3) || dims[0] == 0 || dims[1] == 0 || dims[2] == 0) result = SDFParseResult::INVALID_DIMS;
+    else if (!parse_header_line(p, end, origin, 3)) result = SDFParseResult::INVALID_ORIGIN;
+    else if (!parse_header_line(p, end, &spacing, 1) || !(spacing > 0.0f)) result = SDFParseResult::INVALID_SPACING;
+
+    if (result != SDFParseResult::SUCCESS)
+    {
+        unmap_file(file);
+        return result;
+    }
+
+    total_grid_size = (size_t)dims[0] * dims[1] * dims[2];
+
+    // Split the value section into roughly equal chunks, each ending on a line boundary
+    constexpr size_t min_chunk_size = 1 << 20;
+    const size_t max_chunks = (JobSystem::get_worker_count() + 1) * 4;
+    const size_t chunk_count = std::clamp((size_t)(end - p) / min_chunk_size, (size_t)1, max_chunks);
+    const size_t chunk_size = (end - p) / chunk_count + 1;
+
+    SDFParseJobData job;
+    while (p < end)
+    {
+        const char* chunk_end = p + std::min(chunk_size, (size_t)(end - p));
+        const char* newline = (const char*)memchr(chunk_end, '\n', end - chunk_end);
+        chunk_end = newline ? newline + 1 : end;
+        job.chunks.push_back(SDFParseChunk{ p, chunk_end, 0, 0 });
+        p = chunk_end;
+    }
+
+    JobCounter counter;
+    JobSystem::dispatch(count_values_job, &job, (uint32_t)job.chunks.size(), &counter);
+    JobSystem::wait(&counter);
+
+    size_t value_count = 0;
+    for (auto& chunk : job.chunks)
+    {
+        chunk.first_value = value_count;
+        value_count += chunk.value_count;
+    }
+
+    if (value_count != total_grid_size)
+    {
+        unmap_file(file);
+        return SDFParseResult::VALUE_COUNT_MISMATCH;
+    }
+
+    out_values.resize(total_grid_size);
+    job.values = out_values.data();
+    JobSystem::dispatch(parse_values_job, &job, (uint32_t)job.chunks.size(), &counter);
+    JobSystem::wait(&counter);
+
+    unmap_file(file);
+
+    if (job.failed) return SDFParseResult::INVALID_VALUE;
+
+    out_dims = glm::uvec3(dims[0], dims[1], dims[2]);
+    out_origin = glm::vec3(origin[0], origin[1], origin[2]);
+    out_spacing = spacing;
+
+    return SDFParseResult::SUCCESS;
+}
+
+bool sdf_write_binary(const char* filepath, glm::uvec3 dims, glm::vec3 origin, float spacing, const float* values, SDFPayloadFormat format)
+{
+    const size_t voxel_count = (size_t)dims.x * dims.y * dims.z;
+
+    SDFBinaryHeader header{};
+    header.magic = SDF_BINARY_MAGIC;
+    header.version = SDF_BINARY_VERSION;
+    header.dims[0] = dims.x;
+    header.dims[1] = dims.y;
+    header.dims[2] = dims.z;
+    header.grid_origin[0] = origin.x;
+    header.grid_origin[1] = origin.y;
+    header.grid_origin[2] = origin.z;
+    header.grid_spacing = spacing;
+    header.payload_format = format;
+    header.payload_offset = (sizeof(SDFBinaryHeader) + SDF_BINARY_PAYLOAD_ALIGNMENT - 1) & ~(uint64_t)(SDF_BINARY_PAYLOAD_ALIGNMENT - 1);
+    header.payload_size = voxel_count * sdf_payload_element_size(format);
+
+    FILE* f = fopen(filepath, "wb");
+    if (!f)
+    {
+        LOG_ERROR("Failed to open file '%s' for writing", filepath);
+        return false;
+    }
+
+    bool success = fwrite(&header, sizeof(header), 1, f) == 1;
+
+    const uint8_t padding[SDF_BINARY_PAYLOAD_ALIGNMENT] = {};
+    const size_t padding_size = header.payload_offset - sizeof(header);
+    if (padding_size) success = success && fwrite(padding, padding_size, 1, f) == 1;
+
+    if (format == SDFPayloadFormat::FLOAT32)
+    {
+        success = success && fwrite(values, sizeof(float), voxel_count, f) == voxel_count;
+    }
+    else
+    {
+        // Convert in chunks to keep memory use flat for large grids
+        constexpr size_t chunk_size = 65536;
+        std::vector<uint16_t> halfs(chunk_size);
+        for (size_t i = 0; i < voxel_count && success; i += chunk_size)
+        {
+            const size_t n = std::min(chunk_size, voxel_count - i);
+            for (size_t j = 0; j < n; ++j) halfs[j] = glm::packHalf1x16(values[i + j]);
+            success = fwrite(halfs.data(), sizeof(uint16_t), n, f) == n;
+        }
+    }
+
+    fclose(f);
+
+    if (!success) LOG_ERROR("Failed to write file '%s'", filepath);
+    return success;
+}
+
+bool sdf_map_binary(const char* filepath, MappedFile& out_file, SDFBinaryHeader& out_header, const void** out_payload)
+{
+    if (!map_file(filepath, out_file)) return false;
+
+    const char* error = nullptr;
+    if (out_file.size < sizeof(SDFBinaryHeader))
+    {
+        error = "file too small";
+    }
+    else
+    {
+        memcpy(&out_header, out_file.data, sizeof(SDFBinaryHeader));
+        const size_t voxel_count = (size_t)out_header.dims[0] * out_header.dims[1] * out_header.dims[2];
+
+        if (out_header.magic != SDF_BINARY_MAGIC) error = "bad magic";
+        else if (out_header.version != SDF_BINARY_VERSION) error = "unsupported version";
+        else if (out_header.payload_format != SDFPayloadFormat::FLOAT32 && out_header.payload_format != SDFPayloadFormat::FLOAT16) error = "unknown payload format";
+        else if (voxel_count == 0 || !(out_header.grid_spacing > 0.0f)) error = "invalid grid";
+        else if (out_header.payload_offset % SDF_BINARY_PAYLOAD_ALIGNMENT != 0) error = "misaligned payload";
+        else if (out_header.payload_size != voxel_count * sdf_payload_element_size(out_header.payload_format)) error = "payload size does not match dims";
+        else if (out_header.payload_offset > out_file.size || out_header.payload_size > out_file.size - out_header.payload_offset) error = "truncated payload";
+    }
+
+    if (error)
+    {
+        LOG_ERROR("Invalid SDF file '%s': %s", filepath, error);
+        unmap_file(out_file);
+        return false;
+    }
+
+    *out_payload = out_file.data + out_header.payload_offset;
+    return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <stdint.h>
+#include "file_mapping.h"
+
+// File IO for SDFs, kept free of graphics dependencies so that tools can link it
+
+#define SDF_BINARY_MAGIC 0x42464453u // "SDFB"
+#define SDF_BINARY_VERSION 1
+#define SDF_BINARY_PAYLOAD_ALIGNMENT 16
+
+enum class SDFPayloadFormat : uint32_t
+{
+	FLOAT32 = 0,
+	FLOAT16 = 1,
+};
+
+// Layout of a .sdfb file. Header is followed by the raw voxel payload at payload_offset,
+// x varying fastest like in the SDFGen text format
+struct SDFBinaryHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t dims[3];
+	float grid_origin[3];
+	float grid_spacing;
+	SDFPayloadFormat payload_format;
+	uint64_t payload_offset;
+	uint64_t payload_size;
+};
+
+inline size_t sdf_payload_element_size(SDFPayloadFormat format)
+{
+	return format == SDFPayloadFormat::FLOAT16 ? sizeof(uint16_t) : sizeof(float);
+}
+
+enum class SDFParseResult
+{
+	SUCCESS = 0,
+	FILE_ERROR,
+	INVALID_DIMS,
+	INVALID_ORIGIN,
+	INVALID_SPACING,
+	INVALID_VALUE,
+	VALUE_COUNT_MISMATCH,
+};
+
+const char* sdf_parse_result_string(SDFParseResult result);
+
+// Parses the text format written by SDFGen. The file is mapped and the value section is split at line
+// boundaries and parsed in parallel on the job system
+SDFParseResult sdf_parse_text(const char* filepath, glm::uvec3& out_dims, glm::vec3& out_origin, float& out_spacing, std::vector<float>& out_values);
+
+bool sdf_write_binary(const char* filepath, glm::uvec3 dims, glm::vec3 origin, float spacing, const float* values, SDFPayloadFormat format);
+
+// Maps a .sdfb file and validates its header. On success out_payload points into the mapping
+bool sdf_map_binary(const char* filepath, MappedFile& out_file, SDFBinaryHeader& out_header, const void** out_payload);
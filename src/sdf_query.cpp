@@ -0,0 +1,269 @@
+#include "sdf_query.h"
+#include <algorithm>
+#include <assert.h>
+#include <float.h>
+
+#if defined(__AVX2__) || defined(__AVX__)
+#include <immintrin.h>
+#define SDF_SIMD_WIDTH 8
+typedef __m256 simd_float;
+typedef __m256i simd_int;
+#define simd_loadu _mm256_loadu_ps
+#define simd_load _mm256_load_ps
+#define simd_storeu _mm256_storeu_ps
+#define simd_set1 _mm256_set1_ps
+#define simd_add _mm256_add_ps
+#define simd_sub _mm256_sub_ps
+#define simd_mul _mm256_mul_ps
+#define simd_min _mm256_min_ps
+#define simd_max _mm256_max_ps
+#define simd_truncate _mm256_cvttps_epi32
+#define simd_to_float _mm256_cvtepi32_ps
+#define simd_store_int(p, x) _mm256_store_si256((simd_int*)(p), x)
+#else
+#include <emmintrin.h>
+#define SDF_SIMD_WIDTH 4
+typedef __m128 simd_float;
+typedef __m128i simd_int;
+#define simd_loadu _mm_loadu_ps
+#define simd_load _mm_load_ps
+#define simd_storeu _mm_storeu_ps
+#define simd_set1 _mm_set1_ps
+#define simd_add _mm_add_ps
+#define simd_sub _mm_sub_ps
+#define simd_mul _mm_mul_ps
+#define simd_min _mm_min_ps
+#define simd_max _mm_max_ps
+#define simd_truncate _mm_cvttps_epi32
+#define simd_to_float _mm_cvtepi32_ps
+#define simd_store_int(p, x) _mm_store_si128((simd_int*)(p), x)
+#endif
+
+// AVX2 can fetch the corners with hardware gathers, otherwise the cell indices go through memory
+#if defined(__AVX2__)
+#define SDF_SIMD_GATHER 1
+#endif
+
+static inline simd_float simd_lerp(simd_float a, simd_float b, simd_float t)
+{
+	return simd_add(a, simd_mul(simd_sub(b, a), t));
+}
+
+// Texel centers sit at origin + (i + 0.5) * spacing, matching linear filtering of the 3D texture
+static inline void get_cell(const SDFQuery& query, const glm::vec3& p, glm::uvec3& out_cell, glm::vec3& out_t)
+{
+	const glm::vec3 coord = glm::clamp((p - query.grid_origin) / query.grid_spacing - glm::vec3(0.5f), glm::vec3(0.0f), glm::vec3(query.dims - glm::uvec3(1)));
+	for (int i = 0; i < 3; ++i)
+	{
+		out_cell[i] = std::min((uint32_t)coord[i], query.dims[i] - 2);
+		out_t[i] = coord[i] - (float)out_cell[i];
+	}
+}
+
+// Corners ordered x fastest: c[0] = (0,0,0), c[1] = (1,0,0), c[2] = (0,1,0), ... c[7] = (1,1,1)
+static inline void fetch_corners(const SDFQuery& query, const glm::uvec3& cell, float c[8])
+{
+	const size_t dy = query.dims.x;
+	const size_t dz = (size_t)query.dims.x * query.dims.y;
+	const float* s = query.values + cell.z * dz + cell.y * dy + cell.x;
+	c[0] = s[0];
+	c[1] = s[1];
+	c[2] = s[dy];
+	c[3] = s[dy + 1];
+	c[4] = s[dz];
+	c[5] = s[dz + 1];
+	c[6] = s[dz + dy];
+	c[7] = s[dz + dy + 1];
+}
+
+float SDFQuery::sample(const glm::vec3& p) const
+{
+	assert(values);
+	glm::uvec3 cell;
+	glm::vec3 t;
+	get_cell(*this, p, cell, t);
+
+	float c[8];
+	fetch_corners(*this, cell, c);
+	const float x00 = c[0] + (c[1] - c[0]) * t.x;
+	const float x10 = c[2] + (c[3] - c[2]) * t.x;
+	const float x01 = c[4] + (c[5] - c[4]) * t.x;
+	const float x11 = c[6] + (c[7] - c[6]) * t.x;
+	const float y0 = x00 + (x10 - x00) * t.y;
+	const float y1 = x01 + (x11 - x01) * t.y;
+	return y0 + (y1 - y0) * t.z;
+}
+
+glm::vec3 SDFQuery::gradient(const glm::vec3& p) const
+{
+	assert(values);
+	glm::uvec3 cell;
+	glm::vec3 t;
+	get_cell(*this, p, cell, t);
+
+	float c[8];
+	fetch_corners(*this, cell, c);
+	const float x00 = c[0] + (c[1] - c[0]) * t.x;
+	const float x10 = c[2] + (c[3] - c[2]) * t.x;
+	const float x01 = c[4] + (c[5] - c[4]) * t.x;
+	const float x11 = c[6] + (c[7] - c[6]) * t.x;
+	const float dx0 = (c[1] - c[0]) + ((c[3] - c[2]) - (c[1] - c[0])) * t.y;
+	const float dx1 = (c[5] - c[4]) + ((c[7] - c[6]) - (c[5] - c[4])) * t.y;
+	const float dy0 = x10 - x00;
+	const float dy1 = x11 - x01;
+	const float y0 = x00 + dy0 * t.y;
+	const float y1 = x01 + dy1 * t.y;
+
+	return glm::vec3(dx0 + (dx1 - dx0) * t.z, dy0 + (dy1 - dy0) * t.z, y1 - y0) / grid_spacing;
+}
+
+bool SDFQuery::raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, float& out_t) const
+{
+	assert(values);
+
+	// Clip the ray against the volume covered by the texture
+	const glm::vec3 box_min = grid_origin;
+	const glm::vec3 box_max = grid_origin + glm::vec3(dims) * grid_spacing;
+	float t_enter = 0.0f;
+	float t_exit = max_t;
+	for (int i = 0; i < 3; ++i)
+	{
+		const float inv_dir = 1.0f / dir[i];
+		float t0 = (box_min[i] - origin[i]) * inv_dir;
+		float t1 = (box_max[i] - origin[i]) * inv_dir;
+		if (t0 > t1) std::swap(t0, t1);
+		t_enter = std::max(t_enter, t0);
+		t_exit = std::min(t_exit, t1);
+	}
+	if (!(t_enter <= t_exit)) return false;
+
+	const float hit_distance = grid_spacing * 0.01f;
+	float t = t_enter;
+	for (int i = 0; i < SDF_RAYCAST_MAX_STEPS && t <= t_exit; ++i)
+	{
+		const float d = sample(origin + dir * t);
+		if (d < hit_distance)
+		{
+			out_t = t;
+			return true;
+		}
+		t += d;
+	}
+
+	return false;
+}
+
+template <bool WITH_GRADIENT>
+static void query_batch(const SDFQuery& query, const float* x, const float* y, const float* z,
+	float* out_distance, float* out_gx, float* out_gy, float* out_gz, uint32_t count)
+{
+	assert(query.values);
+
+	const simd_float origin[3] = { simd_set1(query.grid_origin.x), simd_set1(query.grid_origin.y), simd_set1(query.grid_origin.z) };
+	const simd_float max_coord[3] = { simd_set1((float)(query.dims.x - 1)), simd_set1((float)(query.dims.y - 1)), simd_set1((float)(query.dims.z - 1)) };
+	const simd_float max_cell[3] = { simd_set1((float)(query.dims.x - 2)), simd_set1((float)(query.dims.y - 2)), simd_set1((float)(query.dims.z - 2)) };
+	const simd_float inv_spacing = simd_set1(1.0f / query.grid_spacing);
+	const simd_float half = simd_set1(0.5f);
+	const simd_float zero = simd_set1(0.0f);
+	const float* positions[3] = { x, y, z };
+
+#if SDF_SIMD_GATHER
+	const simd_int dy = _mm256_set1_epi32((int)query.dims.x);
+	const simd_int dz = _mm256_set1_epi32((int)(query.dims.x * query.dims.y));
+	const simd_int one = _mm256_set1_epi32(1);
+#else
+	const size_t dy = query.dims.x;
+	const size_t dz = (size_t)query.dims.x * query.dims.y;
+#endif
+
+	uint32_t i = 0;
+	for (; i + SDF_SIMD_WIDTH <= count; i += SDF_SIMD_WIDTH)
+	{
+		simd_float t[3];
+		simd_int cell[3];
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			simd_float coord = simd_sub(simd_mul(simd_sub(simd_loadu(positions[axis] + i), origin[axis]), inv_spacing), half);
+			coord = simd_min(simd_max(coord, zero), max_coord[axis]);
+			const simd_float cell_f = simd_min(simd_to_float(simd_truncate(coord)), max_cell[axis]);
+			t[axis] = simd_sub(coord, cell_f);
+			cell[axis] = simd_truncate(cell_f);
+		}
+
+		simd_float c[8];
+#if SDF_SIMD_GATHER
+		const simd_int base = _mm256_add_epi32(cell[0], _mm256_add_epi32(_mm256_mullo_epi32(cell[1], dy), _mm256_mullo_epi32(cell[2], dz)));
+		const simd_int base_y = _mm256_add_epi32(base, dy);
+		const simd_int base_z = _mm256_add_epi32(base, dz);
+		const simd_int base_yz = _mm256_add_epi32(base_z, dy);
+		c[0] = _mm256_i32gather_ps(query.values, base, 4);
+		c[1] = _mm256_i32gather_ps(query.values, _mm256_add_epi32(base, one), 4);
+		c[2] = _mm256_i32gather_ps(query.values, base_y, 4);
+		c[3] = _mm256_i32gather_ps(query.values, _mm256_add_epi32(base_y, one), 4);
+		c[4] = _mm256_i32gather_ps(query.values, base_z, 4);
+		c[5] = _mm256_i32gather_ps(query.values, _mm256_add_epi32(base_z, one), 4);
+		c[6] = _mm256_i32gather_ps(query.values, base_yz, 4);
+		c[7] = _mm256_i32gather_ps(query.values, _mm256_add_epi32(base_yz, one), 4);
+#else
+		alignas(32) int32_t cells[3][SDF_SIMD_WIDTH];
+		alignas(32) float corners[8][SDF_SIMD_WIDTH];
+		for (int axis = 0; axis < 3; ++axis) simd_store_int(cells[axis], cell[axis]);
+		for (int lane = 0; lane < SDF_SIMD_WIDTH; ++lane)
+		{
+			const float* s = query.values + cells[2][lane] * dz + cells[1][lane] * dy + cells[0][lane];
+			corners[0][lane] = s[0];
+			corners[1][lane] = s[1];
+			corners[2][lane] = s[dy];
+			corners[3][lane] = s[dy + 1];
+			corners[4][lane] = s[dz];
+			corners[5][lane] = s[dz + 1];
+			corners[6][lane] = s[dz + dy];
+			corners[7][lane] = s[dz + dy + 1];
+		}
+		for (int k = 0; k < 8; ++k) c[k] = simd_load(corners[k]);
+#endif
+
+		const simd_float x00 = simd_lerp(c[0], c[1], t[0]);
+		const simd_float x10 = simd_lerp(c[2], c[3], t[0]);
+		const simd_float x01 = simd_lerp(c[4], c[5], t[0]);
+		const simd_float x11 = simd_lerp(c[6], c[7], t[0]);
+		const simd_float y0 = simd_lerp(x00, x10, t[1]);
+		const simd_float y1 = simd_lerp(x01, x11, t[1]);
+		simd_storeu(out_distance + i, simd_lerp(y0, y1, t[2]));
+
+		if constexpr (WITH_GRADIENT)
+		{
+			const simd_float dx0 = simd_lerp(simd_sub(c[1], c[0]), simd_sub(c[3], c[2]), t[1]);
+			const simd_float dx1 = simd_lerp(simd_sub(c[5], c[4]), simd_sub(c[7], c[6]), t[1]);
+			const simd_float dy0 = simd_sub(x10, x00);
+			const simd_float dy1 = simd_sub(x11, x01);
+			simd_storeu(out_gx + i, simd_mul(simd_lerp(dx0, dx1, t[2]), inv_spacing));
+			simd_storeu(out_gy + i, simd_mul(simd_lerp(dy0, dy1, t[2]), inv_spacing));
+			simd_storeu(out_gz + i, simd_mul(simd_sub(y1, y0), inv_spacing));
+		}
+	}
+
+	for (; i < count; ++i)
+	{
+		const glm::vec3 p(x[i], y[i], z[i]);
+		out_distance[i] = query.sample(p);
+		if constexpr (WITH_GRADIENT)
+		{
+			const glm::vec3 g = query.gradient(p);
+			out_gx[i] = g.x;
+			out_gy[i] = g.y;
+			out_gz[i] = g.z;
+		}
+	}
+}
+
+void SDFQuery::sample_batch(const float* x, const float* y, const float* z, float* out_distance, uint32_t count) const
+{
+	query_batch<false>(*this, x, y, z, out_distance, nullptr, nullptr, nullptr, count);
+}
+
+void SDFQuery::sample_gradient_batch(const float* x, const float* y, const float* z, float* out_distance,
+	float* out_gradient_x, float* out_gradient_y, float* out_gradient_z, uint32_t count) const
+{
+	query_batch<true>(*this, x, y, z, out_distance, out_gradient_x, out_gradient_y, out_gradient_z, count);
+}
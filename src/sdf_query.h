@@ -0,0 +1,35 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <stdint.h>
+
+#define SDF_RAYCAST_MAX_STEPS 128
+
+// CPU queries against a dense float SDF grid. Sampling uses the same texel convention and clamp to edge
+// behaviour as the shaders sampling the SDF texture, so CPU and GPU systems collide with the same surface.
+// Kept free of graphics dependencies so that tools can link it.
+struct SDFQuery
+{
+	const float* values = nullptr; // x varying fastest, not owned
+	glm::uvec3 dims = glm::uvec3(0);
+	glm::vec3 grid_origin = glm::vec3(0.0f);
+	float grid_spacing = 0.0f;
+
+	bool is_valid() const { return values != nullptr; }
+
+	// Trilinearly interpolated distance
+	float sample(const glm::vec3& p) const;
+
+	// Analytic gradient of the trilinear interpolant, not normalized
+	glm::vec3 gradient(const glm::vec3& p) const;
+
+	// Sphere traces the ray within the grid bounds. Returns true and the hit distance along the ray if the
+	// surface is closer than max_t. Dir has to be normalized
+	bool raycast(const glm::vec3& origin, const glm::vec3& dir, float max_t, float& out_t) const;
+
+	// Batched versions take SoA positions so particle streams can be passed in directly.
+	// Any count is accepted, the tail that does not fill a SIMD register is handled by the scalar path
+	void sample_batch(const float* x, const float* y, const float* z, float* out_distance, uint32_t count) const;
+	void sample_gradient_batch(const float* x, const float* y, const float* z, float* out_distance,
+		float* out_gradient_x, float* out_gradient_y, float* out_gradient_z, uint32_t count) const;
+};
@@ -0,0 +1,312 @@
+#include "shader_archive.h"
+#include "file_mapping.h"
+#include "misc.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+
+#define SPIRV_MAGIC 0x07230203u
+
+static MappedFile archive_file;
+static const ShaderArchiveHeader* header = nullptr;
+static const ShaderArchiveSlot* slots = nullptr;
+static std::filesystem::file_time_type archive_timestamp;
+
+static bool is_range_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+	return offset <= file_size && size <= file_size - offset;
+}
+
+// Checks every slot once so lookups can trust the offsets
+static const char* validate_archive(const MappedFile& file)
+{
+	if (file.size < sizeof(ShaderArchiveHeader)) return "file too small";
+
+	const ShaderArchiveHeader* h = (const ShaderArchiveHeader*)file.data;
+	if (h->magic != SHADER_ARCHIVE_MAGIC) return "bad magic";
+	if (h->version != SHADER_ARCHIVE_VERSION) return "unsupported version";
+	if (h->file_size != file.size) return "truncated";
+	if (h->table_size == 0 || (h->table_size & (h->table_size - 1)) != 0 || h->entry_count > h->table_size) return "bad table size";
+	if (!is_range_valid(sizeof(ShaderArchiveHeader), (uint64_t)h->table_size * sizeof(ShaderArchiveSlot), file.size)) return "truncated table";
+
+	const ShaderArchiveSlot* s = (const ShaderArchiveSlot*)(file.data + sizeof(ShaderArchiveHeader));
+	for (uint32_t i = 0; i < h->table_size; ++i)
+	{
+		if (s[i].key == 0) continue;
+		if (s[i].spirv_offset % SHADER_ARCHIVE_ALIGNMENT != 0 || s[i].spirv_size % sizeof(uint32_t) != 0) return "misaligned module";
+		if (!is_range_valid(s[i].spirv_offset, s[i].spirv_size, file.size)) return "module out of bounds";
+
+		// Dependency strings are walked without bounds checks later, so make sure every one is terminated
+		uint64_t offset = s[i].dependencies_offset;
+		for (uint32_t d = 0; d < s[i].dependency_count; ++d)
+		{
+			if (offset >= file.size) return "dependencies out of bounds";
+			const void* end = memchr(file.data + offset, '\0', file.size - offset);
+			if (!end) return "unterminated dependency";
+			offset = (const uint8_t*)end - file.data + 1;
+		}
+	}
+
+	return nullptr;
+}
+
+static const char* get_stage_name(VkShaderStageFlagBits stage)
+{
+	switch (stage)
+	{
+	case VK_SHADER_STAGE_VERTEX_BIT:
+		return "vertex";
+	case VK_SHADER_STAGE_FRAGMENT_BIT:
+		return "fragment";
+	case VK_SHADER_STAGE_COMPUTE_BIT:
+		return "compute";
+	default:
+		assert(false);
+		return "";
+	}
+}
+
+static bool parse_stage_name(const std::string& name, VkShaderStageFlagBits& out_stage)
+{
+	if (name == "vertex") out_stage = VK_SHADER_STAGE_VERTEX_BIT;
+	else if (name == "fragment") out_stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	else if (name == "compute") out_stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	else return false;
+	return true;
+}
+
+namespace ShaderArchive
+{
+
+bool open(const char* path)
+{
+	close();
+
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec)) return false;
+
+	if (!map_file(path, archive_file))
+	{
+		LOG_ERROR("Failed to map shader archive '%s'", path);
+		return false;
+	}
+
+	if (const char* error = validate_archive(archive_file))
+	{
+		LOG_ERROR("Ignoring shader archive '%s': %s", path, error);
+		unmap_file(archive_file);
+		return false;
+	}
+
+	header = (const ShaderArchiveHeader*)archive_file.data;
+	slots = (const ShaderArchiveSlot*)(archive_file.data + sizeof(ShaderArchiveHeader));
+	archive_timestamp = std::filesystem::last_write_time(path, ec);
+
+	return true;
+}
+
+void close()
+{
+	if (archive_file) unmap_file(archive_file);
+	header = nullptr;
+	slots = nullptr;
+}
+
+bool is_open()
+{
+	return header != nullptr;
+}
+
+std::filesystem::file_time_type get_timestamp()
+{
+	return archive_timestamp;
+}
+
+bool find(uint64_t key, ShaderArchiveModule& out_module)
+{
+	if (!header || key == 0) return false;
+
+	const uint32_t mask = header->table_size - 1;
+	for (uint32_t i = (uint32_t)key & mask, probes = 0; probes < header->table_size; i = (i + 1) & mask, ++probes)
+	{
+		const ShaderArchiveSlot& slot = slots[i];
+		if (slot.key == 0) return false;
+		if (slot.key != key) continue;
+
+		const uint32_t* spirv = (const uint32_t*)(archive_file.data + slot.spirv_offset);
+		if (slot.spirv_size < sizeof(uint32_t) || spirv[0] != SPIRV_MAGIC)
+		{
+			LOG_WARNING("Corrupt shader archive module %016llx", (unsigned long long)key);
+			return false;
+		}
+
+		out_module.spirv = spirv;
+		out_module.size = slot.spirv_size;
+		out_module.dependencies = (const char*)archive_file.data + slot.dependencies_offset;
+		out_module.dependency_count = slot.dependency_count;
+		return true;
+	}
+
+	return false;
+}
+
+bool write(const char* path, const std::vector<ShaderArchiveEntry>& entries)
+{
+	uint32_t table_size = 1;
+	while (table_size < entries.size() * 2) table_size <<= 1;
+
+	std::vector<ShaderArchiveSlot> table(table_size, ShaderArchiveSlot{});
+	std::vector<uint8_t> data(sizeof(ShaderArchiveHeader) + VECTOR_SIZE_BYTES(table));
+
+	auto append = [&data](const void* bytes, size_t size) -> uint32_t
+	{
+		data.resize(align_power_of_2(data.size(), SHADER_ARCHIVE_ALIGNMENT));
+		const uint32_t offset = (uint32_t)data.size();
+		data.insert(data.end(), (const uint8_t*)bytes, (const uint8_t*)bytes + size);
+		return offset;
+	};
+
+	for (const ShaderArchiveEntry& e : entries)
+	{
+		assert(e.key != 0);
+
+		uint32_t index = (uint32_t)e.key & (table_size - 1);
+		while (table[index].key != 0)
+		{
+			if (table[index].key == e.key)
+			{
+				LOG_ERROR("Duplicate shader archive key %016llx", (unsigned long long)e.key);
+				return false;
+			}
+			index = (index + 1) & (table_size - 1);
+		}
+
+		std::string dependencies;
+		for (const auto& d : e.dependencies)
+		{
+			dependencies += d;
+			dependencies.push_back('\0');
+		}
+
+		ShaderArchiveSlot& slot = table[index];
+		slot.key = e.key;
+		slot.dependency_count = (uint32_t)e.dependencies.size();
+		slot.dependencies_offset = e.dependencies.empty() ? 0 : append(dependencies.data(), dependencies.size());
+		slot.spirv_offset = append(e.spirv.data(), VECTOR_SIZE_BYTES(e.spirv));
+		slot.spirv_size = (uint32_t)VECTOR_SIZE_BYTES(e.spirv);
+	}
+
+	ShaderArchiveHeader h{};
+	h.magic = SHADER_ARCHIVE_MAGIC;
+	h.version = SHADER_ARCHIVE_VERSION;
+	h.entry_count = (uint32_t)entries.size();
+	h.table_size = table_size;
+	h.file_size = data.size();
+	memcpy(data.data(), &h, sizeof(h));
+	memcpy(data.data() + sizeof(h), table.data(), VECTOR_SIZE_BYTES(table));
+
+	// The running app may have the old archive mapped, so write a new file and rename it over
+	std::filesystem::path temp_path = path;
+	temp_path += ".tmp";
+	std::error_code ec;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+
+	FILE* f = fopen(temp_path.string().c_str(), "wb");
+	if (!f)
+	{
+		LOG_ERROR("Failed to write shader archive '%s'", temp_path.string().c_str());
+		return false;
+	}
+	const bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+	fclose(f);
+
+	if (success)
+	{
+		std::filesystem::rename(temp_path, path, ec);
+		if (ec)
+		{
+			std::filesystem::remove(path, ec);
+			std::filesystem::rename(temp_path, path, ec);
+		}
+	}
+	if (!success || ec)
+	{
+		LOG_ERROR("Failed to write shader archive '%s'", path);
+		std::filesystem::remove(temp_path, ec);
+		return false;
+	}
+
+	return true;
+}
+
+std::string get_manifest_line(const ShaderSource& source, VkShaderStageFlagBits stage)
+{
+	std::string line = std::string(get_stage_name(stage)) + "\t" + source.filepath + "\t" + source.entry_point;
+	for (const auto& l : source.prepend_lines) line += "\tprepend:" + l;
+	for (const auto& l : source.append_lines) line += "\tappend:" + l;
+	return line;
+}
+
+bool read_manifest(const char* path, std::vector<ShaderManifestEntry>& out_entries)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		LOG_ERROR("Failed to open shader manifest '%s'", path);
+		return false;
+	}
+
+	std::string line;
+	for (uint32_t line_number = 1; std::getline(file, line); ++line_number)
+	{
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+
+		std::vector<std::string> fields;
+		std::stringstream stream(line);
+		for (std::string field; std::getline(stream, field, '\t');) fields.push_back(field);
+
+		ShaderManifestEntry entry;
+		if (fields.size() < 3 || !parse_stage_name(fields[0], entry.stage))
+		{
+			LOG_ERROR("%s:%u: expected <stage> <file> <entry point>", path, line_number);
+			return false;
+		}
+		entry.source.filepath = fields[1];
+		entry.source.entry_point = fields[2];
+
+		for (size_t i = 3; i < fields.size(); ++i)
+		{
+			const std::string& f = fields[i];
+			if (f.rfind("prepend:", 0) == 0) entry.source.prepend_lines.push_back(f.substr(strlen("prepend:")));
+			else if (f.rfind("append:", 0) == 0) entry.source.append_lines.push_back(f.substr(strlen("append:")));
+			else
+			{
+				LOG_ERROR("%s:%u: unknown field '%s'", path, line_number, f.c_str());
+				return false;
+			}
+		}
+
+		out_entries.push_back(std::move(entry));
+	}
+
+	return true;
+}
+
+bool write_manifest(const char* path, const std::set<std::string>& lines)
+{
+	std::ofstream file(path, std::ios::trunc);
+	if (!file)
+	{
+		LOG_WARNING("Failed to write shader manifest '%s'", path);
+		return false;
+	}
+
+	file << "# Shaders the app requested that " SHADER_MANIFEST_PATH " does not list, written by the app.\n";
+	file << "# Packed into " SHADER_ARCHIVE_PATH " along with the manifest, move lines over to check them in.\n";
+	for (const auto& l : lines) file << l << "\n";
+
+	return true;
+}
+
+} // namespace ShaderArchive
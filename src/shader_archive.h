@@ -0,0 +1,72 @@
+#pragma once
+#include "shaders.h"
+#include <string>
+#include <vector>
+#include <set>
+
+#define SHADER_ARCHIVE_MAGIC 0x41565053u // "SPVA"
+#define SHADER_ARCHIVE_VERSION 1
+#define SHADER_ARCHIVE_ALIGNMENT 16
+
+// File layout: header, table_size slots, then the dependency strings and the SPIR-V blobs, each starting
+// at a multiple of SHADER_ARCHIVE_ALIGNMENT. All offsets are relative to the start of the file
+struct ShaderArchiveHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t table_size; // Power of two, open addressing with linear probing
+	uint64_t file_size;
+};
+
+// Key 0 marks an empty slot
+struct ShaderArchiveSlot
+{
+	uint64_t key;
+	uint32_t spirv_offset;
+	uint32_t spirv_size;
+	uint32_t dependencies_offset; // dependency_count null terminated paths, relative to the shader directory
+	uint32_t dependency_count;
+};
+
+struct ShaderArchiveEntry
+{
+	uint64_t key;
+	std::vector<uint32_t> spirv;
+	std::vector<std::string> dependencies;
+};
+
+// Pointers into the mapped archive, valid until close
+struct ShaderArchiveModule
+{
+	const uint32_t* spirv = nullptr;
+	uint32_t size = 0;
+	const char* dependencies = nullptr;
+	uint32_t dependency_count = 0;
+};
+
+// A shader request as listed in the manifest
+struct ShaderManifestEntry
+{
+	ShaderSource source;
+	VkShaderStageFlagBits stage;
+};
+
+// Precompiled SPIR-V of every shader the app requests, built offline by tools/shader_pack from the manifest
+// and memory mapped at startup. Keys are computed by Shaders::get_archive_key.
+namespace ShaderArchive
+{
+	bool open(const char* path);
+	void close();
+	bool is_open();
+	std::filesystem::file_time_type get_timestamp();
+	bool find(uint64_t key, ShaderArchiveModule& out_module);
+
+	bool write(const char* path, const std::vector<ShaderArchiveEntry>& entries);
+
+	// The manifest is a text file with one request per line: stage, file, entry point and any number of
+	// "prepend:" and "append:" source lines, separated by tabs
+	std::string get_manifest_line(const ShaderSource& source, VkShaderStageFlagBits stage);
+	bool read_manifest(const char* path, std::vector<ShaderManifestEntry>& out_entries);
+	bool write_manifest(const char* path, const std::set<std::string>& lines);
+}
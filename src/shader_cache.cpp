@@ -0,0 +1,184 @@
+#include "shader_cache.h"
+#include "misc.h"
+#include <thread>
+
+#define SHADER_CACHE_MAGIC 0x43565053u // "SPVC"
+#define SPIRV_MAGIC 0x07230203u
+
+struct ShaderCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint64_t spirv_hash;
+	uint32_t spirv_size;
+	uint32_t dependency_count;
+};
+
+// Followed by dependency_count records of { uint64_t content_hash; uint32_t path_length; char path[path_length]; }
+// and then spirv_size bytes of SPIR-V
+
+static std::filesystem::path cache_directory;
+static bool initialized = false;
+
+static bool read_file(const std::filesystem::path& path, std::vector<uint8_t>& out_data)
+{
+	FILE* f = fopen(path.string().c_str(), "rb");
+	if (!f) return false;
+
+	fseek(f, 0, SEEK_END);
+	const long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	out_data.resize(size > 0 ? (size_t)size : 0);
+	const bool success = size >= 0 && fread(out_data.data(), 1, out_data.size(), f) == out_data.size();
+	fclose(f);
+
+	return success;
+}
+
+static bool hash_file(const std::filesystem::path& path, uint64_t& out_hash)
+{
+	std::vector<uint8_t> data;
+	if (!read_file(path, data)) return false;
+	out_hash = hash_fnv1a_64(data.data(), data.size());
+	return true;
+}
+
+static std::filesystem::path get_entry_path(uint64_t key)
+{
+	char filename[32];
+	snprintf(filename, sizeof(filename), "%016llx.spvc", (unsigned long long)key);
+	return cache_directory / filename;
+}
+
+namespace ShaderCache
+{
+
+void init(const char* directory)
+{
+	std::error_code ec;
+	cache_directory = std::filesystem::absolute(directory, ec);
+	std::filesystem::create_directories(cache_directory, ec);
+	if (ec)
+	{
+		LOG_ERROR("Failed to create shader cache directory '%s': %s", directory, ec.message().c_str());
+		return;
+	}
+
+	initialized = true;
+}
+
+uint32_t* load(uint64_t key, std::set<std::filesystem::path>& out_dependencies, uint32_t* out_size)
+{
+	if (!initialized) return nullptr;
+
+	std::vector<uint8_t> data;
+	if (!read_file(get_entry_path(key), data)) return nullptr;
+
+	ShaderCacheHeader header;
+	if (data.size() < sizeof(header)) return nullptr;
+	memcpy(&header, data.data(), sizeof(header));
+	if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key) return nullptr;
+
+	std::set<std::filesystem::path> dependencies;
+	size_t offset = sizeof(header);
+	for (uint32_t i = 0; i < header.dependency_count; ++i)
+	{
+		uint64_t content_hash;
+		uint32_t path_length;
+		if (data.size() - offset < sizeof(content_hash) + sizeof(path_length)) return nullptr;
+		memcpy(&content_hash, data.data() + offset, sizeof(content_hash));
+		memcpy(&path_length, data.data() + offset + sizeof(content_hash), sizeof(path_length));
+		offset += sizeof(content_hash) + sizeof(path_length);
+		if (data.size() - offset < path_length) return nullptr;
+
+		std::filesystem::path path(std::string((const char*)data.data() + offset, path_length));
+		offset += path_length;
+
+		// Stale if any include was edited, e.g. by hot reload
+		uint64_t current_hash;
+		if (!hash_file(path, current_hash) || current_hash != content_hash) return nullptr;
+		dependencies.insert(path);
+	}
+
+	if (data.size() - offset != header.spirv_size || header.spirv_size < sizeof(uint32_t) || header.spirv_size % sizeof(uint32_t) != 0) return nullptr;
+
+	const uint8_t* spirv = data.data() + offset;
+	uint32_t spirv_magic;
+	memcpy(&spirv_magic, spirv, sizeof(spirv_magic));
+	if (spirv_magic != SPIRV_MAGIC || hash_fnv1a_64(spirv, header.spirv_size) != header.spirv_hash)
+	{
+		LOG_WARNING("Corrupt shader cache entry %016llx", (unsigned long long)key);
+		return nullptr;
+	}
+
+	uint32_t* out = (uint32_t*)malloc(header.spirv_size);
+	assert(out);
+	memcpy(out, spirv, header.spirv_size);
+	*out_size = header.spirv_size;
+	out_dependencies = std::move(dependencies);
+
+	return out;
+}
+
+void store(uint64_t key, const std::set<std::filesystem::path>& dependencies, const uint32_t* spirv, uint32_t size)
+{
+	if (!initialized) return;
+
+	ShaderCacheHeader header{};
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.key = key;
+	header.spirv_hash = hash_fnv1a_64(spirv, size);
+	header.spirv_size = size;
+	header.dependency_count = (uint32_t)dependencies.size();
+
+	std::vector<uint8_t> data(sizeof(header));
+	memcpy(data.data(), &header, sizeof(header));
+	for (const auto& d : dependencies)
+	{
+		uint64_t content_hash;
+		if (!hash_file(d, content_hash)) return;
+
+		const std::string path = d.string();
+		const uint32_t path_length = (uint32_t)path.size();
+		data.insert(data.end(), (const uint8_t*)&content_hash, (const uint8_t*)&content_hash + sizeof(content_hash));
+		data.insert(data.end(), (const uint8_t*)&path_length, (const uint8_t*)&path_length + sizeof(path_length));
+		data.insert(data.end(), path.begin(), path.end());
+	}
+	data.insert(data.end(), (const uint8_t*)spirv, (const uint8_t*)spirv + size);
+
+	// Write to a temporary file first so a crash never leaves a truncated entry behind. The name is unique
+	// per thread since pipelines sharing a shader may store the same entry concurrently
+	const std::filesystem::path path = get_entry_path(key);
+	std::filesystem::path temp_path = path;
+	temp_path += "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+
+	FILE* f = fopen(temp_path.string().c_str(), "wb");
+	if (!f)
+	{
+		LOG_ERROR("Failed to write shader cache entry '%s'", temp_path.string().c_str());
+		return;
+	}
+	const bool success = fwrite(data.data(), 1, data.size(), f) == data.size();
+	fclose(f);
+
+	std::error_code ec;
+	if (success)
+	{
+		// Rename does not replace existing files on every platform
+		std::filesystem::rename(temp_path, path, ec);
+		if (ec)
+		{
+			std::filesystem::remove(path, ec);
+			std::filesystem::rename(temp_path, path, ec);
+		}
+	}
+	if (!success || ec)
+	{
+		LOG_ERROR("Failed to write shader cache entry '%s'", path.string().c_str());
+		std::filesystem::remove(temp_path, ec);
+	}
+}
+
+} // namespace ShaderCache
@@ -0,0 +1,21 @@
+#pragma once
+#include "defines.h"
+#include <set>
+#include <filesystem>
+
+#define SHADER_CACHE_DIRECTORY "data/shader_cache"
+
+// Bump when the entry layout or the way keys are computed changes
+#define SHADER_CACHE_VERSION 1
+
+// On disk cache of compiled SPIR-V. Entries are keyed by a hash of the compiler inputs and remember the
+// content hash of every file the compilation depended on, so an entry is only used if none of its
+// includes changed since it was written.
+namespace ShaderCache
+{
+	void init(const char* directory = SHADER_CACHE_DIRECTORY);
+
+	// Returns malloc'd SPIR-V on a hit and fills out_dependencies with the recorded dependencies
+	uint32_t* load(uint64_t key, std::set<std::filesystem::path>& out_dependencies, uint32_t* out_size);
+	void store(uint64_t key, const std::set<std::filesystem::path>& dependencies, const uint32_t* spirv, uint32_t size);
+}
@@ -12,16 +12,26 @@
 #include <map>
 #include <sstream>
 #include <set>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
 
 #include "misc.h"
+#include "shader_cache.h"
+#include "shader_archive.h"
+#include "timer.h"
 
 #define OPTIMIZE_SHADERS 1
 
 namespace
 {
-	static CComPtr<IDxcUtils> dxc_utils;
-	static CComPtr<IDxcCompiler3> compiler;
-	//static CComPtr<IDxcIncludeHandler> include_handler;
+	// DXC compiler instances are not thread safe, so every thread that compiles shaders gets its own
+	struct DXCInstance
+	{
+		CComPtr<IDxcUtils> utils;
+		CComPtr<IDxcCompiler3> compiler;
+	};
+	static thread_local DXCInstance dxc;
 
 	struct MyIncludeHandler : IDxcIncludeHandler
 	{
@@ -32,27 +42,27 @@ namespace
 			CComPtr<IDxcBlobEncoding> pEncoding;
 			std::wstring wstr(pFilename);
 			std::string path(wstr.begin(), wstr.end());
-			std::filesystem::path p(std::filesystem::path("shaders") / std::filesystem::path(path));
-			auto cwd = std::filesystem::current_path(); // Current working directory
-			if (included_files.find(path) != included_files.end())
+
+			// Resolve against the shader directory instead of the working directory, which is shared by all threads
+			const std::filesystem::path full_path = (directory / std::filesystem::path(path)).lexically_normal();
+			if (included_files.find(full_path.string()) != included_files.end())
 			{
 				// Return empty string blob if this file has been included before
 				static const char nullStr[] = " ";
-				dxc_utils->CreateBlobFromPinned(nullStr, ARRAYSIZE(nullStr), DXC_CP_ACP, &pEncoding);
+				utils->CreateBlobFromPinned(nullStr, ARRAYSIZE(nullStr), DXC_CP_ACP, &pEncoding);
 				*ppIncludeSource = pEncoding.Detach();
 				return S_OK;
 			}
 
-			//HRESULT hr = dxc_utils->LoadFile(pFilename, nullptr, &pEncoding);
-			HRESULT hr = dxc_utils->LoadFile(pFilename, nullptr, &pEncoding);
+			HRESULT hr = utils->LoadFile(full_path.wstring().c_str(), nullptr, &pEncoding);
 			if (SUCCEEDED(hr))
 			{
-				included_files.insert(path);
+				included_files.insert(full_path.string());
 				*ppIncludeSource = pEncoding.Detach();
 			}
 			else
 			{
-				LOG_ERROR("Failed to load shader include files '%s'", pFilename);
+				LOG_ERROR("Failed to load shader include files '%s'", full_path.string().c_str());
 			}
 			
 			return hr;
@@ -62,10 +72,46 @@ namespace
 		ULONG STDMETHODCALLTYPE AddRef(void) override { return 0; }
 		ULONG STDMETHODCALLTYPE Release(void) override { return 0; }
 
+		IDxcUtils* utils = nullptr;
+		std::filesystem::path directory;
 		std::set<std::string> included_files;
 	};
 
+	// Compiled SPIR-V is kept in memory for the lifetime of the process, so pipelines that share a shader and
+	// only differ in specialization constants or fixed function state compile it once
+	struct CompiledModule
+	{
+		std::mutex mutex; // Held while compiling, concurrent requests for the same module wait for the result
+		bool valid = false;
+		std::vector<uint32_t> spirv;
+		std::set<std::filesystem::path> dependencies;
+		std::vector<std::filesystem::file_time_type> dependency_timestamps; // In the order of dependencies
+	};
+
 	static bool initialized = false;
+	static std::filesystem::path shader_directory;
+	static std::mutex stats_mutex;
+	static ShaderCompileStats stats;
+	static std::mutex modules_mutex;
+	static std::unordered_map<uint64_t, std::unique_ptr<CompiledModule>> modules;
+
+	// Everything listed in the manifest and the requests file at startup, plus requests seen since
+	static std::mutex manifest_mutex;
+	static std::set<std::string> manifest_lines;
+	// Requests the checked in manifest does not list, written back to requests_path
+	static std::string requests_path;
+	static std::set<std::string> request_lines;
+	static bool requests_changed = false;
+}
+
+static DXCInstance& get_dxc_instance()
+{
+	if (!dxc.compiler)
+	{
+		DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&dxc.utils));
+		DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&dxc.compiler));
+	}
+	return dxc;
 }
 
 static LPWSTR get_entry_point(VkShaderStageFlagBits shader_stage)
@@ -100,9 +146,77 @@ static LPWSTR get_shader_type_str(VkShaderStageFlagBits shader_stage)
 	}
 }
 
+// Catches edits of includes, which do not change the key
+static bool is_module_up_to_date(const CompiledModule& module)
+{
+	size_t i = 0;
+	for (const auto& d : module.dependencies)
+	{
+		std::error_code ec;
+		if (std::filesystem::last_write_time(d, ec) != module.dependency_timestamps[i++] || ec) return false;
+	}
+	return true;
+}
+
+static void store_module(CompiledModule& module, const uint32_t* spirv, uint32_t size, const std::set<std::filesystem::path>& dependencies)
+{
+	module.spirv.assign(spirv, spirv + size / sizeof(uint32_t));
+	module.dependencies = dependencies;
+	module.dependency_timestamps.clear();
+	for (const auto& d : dependencies)
+	{
+		std::error_code ec;
+		module.dependency_timestamps.push_back(std::filesystem::last_write_time(d, ec));
+	}
+	module.valid = true;
+}
+
+// An archived module is used as long as none of its sources were edited after the archive was built.
+// Release builds may not ship the sources at all, missing files do not count as edits
+static bool load_from_archive(ShaderSource& shader_source, VkShaderStageFlagBits shader_stage, uint32_t* size, uint32_t** out_spirv)
+{
+	ShaderArchiveModule module;
+	if (!ShaderArchive::find(Shaders::get_archive_key(shader_source, shader_stage), module)) return false;
+
+	std::set<std::filesystem::path> dependencies;
+	const char* path = module.dependencies;
+	for (uint32_t i = 0; i < module.dependency_count; ++i)
+	{
+		const std::filesystem::path full_path = (shader_directory / path).lexically_normal();
+		path += strlen(path) + 1;
+
+		std::error_code ec;
+		const std::filesystem::file_time_type time = std::filesystem::last_write_time(full_path, ec);
+		if (!ec && time > ShaderArchive::get_timestamp()) return false;
+		dependencies.insert(full_path);
+	}
+
+	uint32_t* data = (uint32_t*)malloc(module.size);
+	assert(data);
+	memcpy(data, module.spirv, module.size);
+	*size = module.size;
+	*out_spirv = data;
+	shader_source.dependencies = std::move(dependencies);
+
+	return true;
+}
+
+static void record_request(const ShaderSource& shader_source, VkShaderStageFlagBits shader_stage)
+{
+	std::lock_guard<std::mutex> lock(manifest_mutex);
+	if (requests_path.empty()) return;
+
+	const std::string line = ShaderArchive::get_manifest_line(shader_source, shader_stage);
+	if (manifest_lines.insert(line).second)
+	{
+		request_lines.insert(line);
+		requests_changed = true;
+	}
+}
+
 static std::string load_shader_source(ShaderSource& src)
 {
-	std::string shader_src = read_text_file(src.filepath.c_str());
+	std::string shader_src = read_text_file((shader_directory / src.filepath).string().c_str());
 	if (shader_src.empty()) return "";
 
 	// Make sure file ends in a new line symbol
@@ -125,16 +239,88 @@ static std::string load_shader_source(ShaderSource& src)
 namespace Shaders
 {
 
-void init()
+void init(const char* archive_filepath, const char* manifest_filepath, const char* requests_filepath)
 {
-	DxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&dxc_utils));
-	DxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&compiler));
+	shader_directory = std::filesystem::absolute("shaders");
+
+	// DXC instances are created on the first compile, which never happens if the archive is up to date
+	ShaderCache::init();
 
-	//dxc_utils->CreateDefaultIncludeHandler(&include_handler);
+#ifdef USE_PRECOMPILED_SHADERS
+	if (archive_filepath && !ShaderArchive::open(archive_filepath))
+	{
+		LOG_WARNING("No precompiled shader archive at '%s', compiling shaders at runtime", archive_filepath);
+	}
+#endif
+
+	auto read_lines = [](const char* path, std::set<std::string>& out_lines)
+	{
+		std::vector<ShaderManifestEntry> entries;
+		std::error_code ec;
+		if (path && std::filesystem::exists(path, ec) && ShaderArchive::read_manifest(path, entries))
+		{
+			for (const auto& e : entries) out_lines.insert(ShaderArchive::get_manifest_line(e.source, e.stage));
+		}
+	};
+
+	if (requests_filepath)
+	{
+		requests_path = requests_filepath;
+		read_lines(manifest_filepath, manifest_lines);
+		read_lines(requests_filepath, request_lines);
+
+		// Drop requests that have been checked in since
+		for (auto it = request_lines.begin(); it != request_lines.end();)
+		{
+			if (manifest_lines.count(*it))
+			{
+				it = request_lines.erase(it);
+				requests_changed = true;
+			}
+			else
+			{
+				++it;
+			}
+		}
+		manifest_lines.insert(request_lines.begin(), request_lines.end());
+	}
 
 	initialized = true;
 }
 
+void shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(manifest_mutex);
+		if (requests_changed && !request_lines.empty() && ShaderArchive::write_manifest(requests_path.c_str(), request_lines))
+		{
+			LOG_INFO("Shaders missing from " SHADER_MANIFEST_PATH " were requested, recorded them in '%s'. Rebuild the shader_archive target to precompile them",
+				requests_path.c_str());
+		}
+		else if (requests_changed && request_lines.empty())
+		{
+			std::error_code ec;
+			std::filesystem::remove(requests_path, ec);
+		}
+		requests_path.clear();
+		manifest_lines.clear();
+		request_lines.clear();
+		requests_changed = false;
+	}
+
+	ShaderArchive::close();
+
+	std::lock_guard<std::mutex> lock(modules_mutex);
+	modules.clear();
+	initialized = false;
+}
+
+ShaderCompileStats get_stats()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	return stats;
+}
+
 uint32_t* Shaders::load_shader(const char* filepath, const char* entry_point, VkShaderStageFlagBits shader_stage, uint32_t* size)
 {
 	ShaderSource source(filepath, entry_point);
@@ -146,8 +332,15 @@ uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_
 {
 	assert(initialized);
 
-	auto cwd = std::filesystem::current_path(); // Current working directory
-	std::filesystem::current_path(cwd / std::filesystem::path(std::string("shaders")));
+	record_request(shader_source, shader_stage);
+
+	uint32_t* archived = nullptr;
+	if (ShaderArchive::is_open() && load_from_archive(shader_source, shader_stage, size, &archived))
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.archive_hits++;
+		return archived;
+	}
 
 	std::string shader_src = load_shader_source(shader_source);
 	if (shader_src.empty()) return nullptr;
@@ -173,10 +366,59 @@ uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_
 #endif
 	};
 
+	// Everything that can change the output goes into the key. Includes are validated by the cache itself
+	const uint32_t cache_version = SHADER_CACHE_VERSION;
+	uint64_t cache_key = hash_fnv1a_64(&cache_version, sizeof(cache_version));
+	cache_key = hash_fnv1a_64(shader_source.filepath.data(), shader_source.filepath.size(), cache_key);
+	cache_key = hash_fnv1a_64(shader_src.data(), shader_src.size(), cache_key);
+	for (LPCWSTR arg : args)
+	{
+		cache_key = hash_fnv1a_64(arg, wcslen(arg) * sizeof(wchar_t) + sizeof(wchar_t), cache_key);
+	}
+
+	CompiledModule* module = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(modules_mutex);
+		std::unique_ptr<CompiledModule>& entry = modules[cache_key];
+		if (!entry) entry = std::make_unique<CompiledModule>();
+		module = entry.get();
+	}
+	std::lock_guard<std::mutex> module_lock(module->mutex);
+
+	if (module->valid && is_module_up_to_date(*module))
+	{
+		const uint32_t module_size = (uint32_t)VECTOR_SIZE_BYTES(module->spirv);
+		uint32_t* data = (uint32_t*)malloc(module_size);
+		assert(data);
+		memcpy(data, module->spirv.data(), module_size);
+		*size = module_size;
+		shader_source.dependencies = module->dependencies;
+
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.module_reuses++;
+		return data;
+	}
+	module->valid = false;
+
+	if (uint32_t* cached = ShaderCache::load(cache_key, shader_source.dependencies, size))
+	{
+		store_module(*module, cached, *size, shader_source.dependencies);
+
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.cache_hits++;
+		return cached;
+	}
+
+	Timer timer;
+	timer.tick();
+
+	DXCInstance& instance = get_dxc_instance();
 	MyIncludeHandler include_handler;
+	include_handler.utils = instance.utils;
+	include_handler.directory = shader_directory;
 
 	CComPtr<IDxcResult> results;
-	compiler->Compile(&src, args, _countof(args), &include_handler, IID_PPV_ARGS(&results));
+	instance.compiler->Compile(&src, args, _countof(args), &include_handler, IID_PPV_ARGS(&results));
 
 	CComPtr<IDxcBlobUtf8> errors = nullptr;
 	results->GetOutput(DXC_OUT_ERRORS, IID_PPV_ARGS(&errors), nullptr);
@@ -188,10 +430,15 @@ uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_
 
 	HRESULT hrStatus;
 	results->GetStatus(&hrStatus);
+	timer.tock();
+	{
+		std::lock_guard<std::mutex> lock(stats_mutex);
+		stats.cache_misses++;
+		stats.compile_ms += timer.get_elapsed_milliseconds();
+	}
 	if (FAILED(hrStatus))
 	{
 		LOG_ERROR("Shader Compilation Failed");
-		std::filesystem::current_path(cwd);
 		return nullptr;
 	}
 
@@ -205,14 +452,15 @@ uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_
 
 	*size = shader->GetBufferSize();
 
-	auto dir = std::filesystem::current_path();
-	shader_source.dependencies = { dir / std::filesystem::path(shader_source.filepath) };
+	shader_source.dependencies = { (shader_directory / shader_source.filepath).lexically_normal() };
 	for (const auto& d : include_handler.included_files)
 	{
-		auto p = dir / std::filesystem::relative(d);
-		shader_source.dependencies.insert(p);
+		shader_source.dependencies.insert(std::filesystem::path(d));
 	}
 
+	ShaderCache::store(cache_key, shader_source.dependencies, data, *size);
+	store_module(*module, data, *size, shader_source.dependencies);
+
 #if 0
 	LOG_DEBUG("Shader source (f: '%s', ep: '%s' has dependencies:", shader_source.filepath.c_str(), shader_source.entry_point.c_str());
 	for (const auto& d : shader_source.dependencies)
@@ -221,11 +469,27 @@ uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_
 	}
 #endif
 
-	std::filesystem::current_path(cwd);
-
 	return data;
 }
 
+uint64_t get_archive_key(const ShaderSource& shader_source, VkShaderStageFlagBits shader_stage)
+{
+	const uint32_t version = SHADER_ARCHIVE_VERSION;
+	const uint32_t optimize = OPTIMIZE_SHADERS;
+	uint64_t key = hash_value_fnv1a_64(version, FNV1A_64_OFFSET_BASIS);
+	key = hash_value_fnv1a_64(optimize, key);
+	key = hash_value_fnv1a_64(shader_stage, key);
+	key = hash_string_fnv1a_64(shader_source.filepath, key);
+	key = hash_string_fnv1a_64(shader_source.entry_point, key);
+	key = hash_value_fnv1a_64(shader_source.prepend_lines.size(), key);
+	for (const auto& l : shader_source.prepend_lines) key = hash_string_fnv1a_64(l, key);
+	key = hash_value_fnv1a_64(shader_source.append_lines.size(), key);
+	for (const auto& l : shader_source.append_lines) key = hash_string_fnv1a_64(l, key);
+
+	// Zero marks empty archive slots
+	return key ? key : 1;
+}
+
 } // namespace Shaders
 
 void ShaderSource::add_defines(const std::string& first, const std::string& second)
@@ -271,3 +535,21 @@ void ShaderSource::add_specialization_constant(uint32_t constant_id, float value
 	specialization_constants.push_back(entry);
 }
 
+uint64_t ShaderSource::get_content_hash(uint64_t hash) const
+{
+	hash = hash_string_fnv1a_64(filepath, hash);
+	hash = hash_string_fnv1a_64(entry_point, hash);
+	hash = hash_value_fnv1a_64(prepend_lines.size(), hash);
+	for (const auto& l : prepend_lines) hash = hash_string_fnv1a_64(l, hash);
+	hash = hash_value_fnv1a_64(append_lines.size(), hash);
+	for (const auto& l : append_lines) hash = hash_string_fnv1a_64(l, hash);
+	hash = hash_value_fnv1a_64(specialization_constants.size(), hash);
+	for (const auto& sc : specialization_constants)
+	{
+		hash = hash_value_fnv1a_64(sc.type, hash);
+		hash = hash_value_fnv1a_64(sc.constant_id, hash);
+		hash = hash_value_fnv1a_64(sc.uint_val, hash); // All members are 32 bits wide
+	}
+	return hash;
+}
+
@@ -5,6 +5,10 @@
 #include <filesystem>
 #include <set>
 
+#define SHADER_ARCHIVE_PATH "data/shaders.spva"
+#define SHADER_MANIFEST_PATH "shaders/shader_manifest.txt"
+#define SHADER_REQUESTS_PATH "data/shader_requests.txt" // Requests missing from the checked in manifest
+
 struct ShaderSource
 {
 	struct SpecializationConstantEntry
@@ -47,11 +51,35 @@ struct ShaderSource
 	void add_specialization_constant(uint32_t constant_id, bool value);
 	void add_specialization_constant(uint32_t constant_id, uint32_t value);
 	void add_specialization_constant(uint32_t constant_id, float value);
+
+	// Hash of everything that affects the compiled shader, dependencies excluded
+	uint64_t get_content_hash(uint64_t hash) const;
+};
+
+struct ShaderCompileStats
+{
+	uint32_t archive_hits = 0; // Loaded from the precompiled archive
+	uint32_t module_reuses = 0; // Already compiled in this process
+	uint32_t cache_hits = 0;
+	uint32_t cache_misses = 0;
+	double compile_ms = 0.0; // Time spent in DXC on cache misses
 };
 
 namespace Shaders
 {
-	void init();
+	// Modules are looked up in the precompiled archive first if it exists, DXC is only used for shaders that
+	// are missing from it or were edited after it was built. Requests that the checked in manifest does not
+	// list are recorded in the requests file, which the shader_archive target packs as well. The manifest
+	// itself is never written. Pass nullptr to disable any of them
+	void init(const char* archive_filepath = SHADER_ARCHIVE_PATH, const char* manifest_filepath = SHADER_MANIFEST_PATH,
+		const char* requests_filepath = SHADER_REQUESTS_PATH);
+	void shutdown(); // Writes the requests file if new shaders were requested
+
+	// Safe to call from multiple threads, each thread compiles with its own DXC instance
 	uint32_t* load_shader(const char* filepath, const char* entry_point, VkShaderStageFlagBits shader_stage, uint32_t* size); // Deprecated
 	uint32_t* load_shader(ShaderSource& shader_source, VkShaderStageFlagBits shader_stage, uint32_t* size);
+	ShaderCompileStats get_stats();
+
+	// Identifies a request in the archive by file, entry point, defines and stage, without reading the source
+	uint64_t get_archive_key(const ShaderSource& shader_source, VkShaderStageFlagBits shader_stage);
 }
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "texture_cache.h"
+#include "bc_encoder.h"
+#include "misc.h"
+#include "timer.h"
+#include "stb_image.h"
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <string.h>
+
+static std::mutex stats_mutex;
+static TextureCacheStats stats;
+
+static uint32_t get_block_size(VkFormat format)
+{
+	return format == VK_FORMAT_BC4_UNORM_BLOCK ? 8 : 16;
+}
+
+static uint32_t pack_swizzle(const VkComponentMapping& m)
+{
+	return (uint32_t)m.r | ((uint32_t)m.g << 8) | ((uint32_t)m.b << 16) | ((uint32_t)m.a << 24);
+}
+
+static VkComponentMapping unpack_swizzle(uint32_t packed)
+{
+	VkComponentMapping m;
+	m.r = (VkComponentSwizzle)(packed & 0xFF);
+	m.g = (VkComponentSwizzle)((packed >> 8) & 0xFF);
+	m.b = (VkComponentSwizzle)((packed >> 16) & 0xFF);
+	m.a = (VkComponentSwizzle)((packed >> 24) & 0xFF);
+	return m;
+}
+
+static uint64_t get_uncompressed_size(uint32_t width, uint32_t height, uint32_t mip_count)
+{
+	uint64_t size = 0;
+	for (uint32_t i = 0; i < mip_count; ++i)
+	{
+		size += (uint64_t)std::max(width >> i, 1u) * std::max(height >> i, 1u) * 4;
+	}
+	return size;
+}
+
+static std::filesystem::path get_cache_path(uint64_t key)
+{
+	char filename[32];
+	snprintf(filename, sizeof(filename), "%016llx.bctx", (unsigned long long)key);
+	return std::filesystem::path(TEXTURE_CACHE_DIRECTORY) / filename;
+}
+
+static void record_load(const CompressedTexture& texture, bool hit, double encode_milliseconds)
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	if (hit) stats.hits++;
+	else stats.misses++;
+	stats.encode_milliseconds += encode_milliseconds;
+	stats.compressed_bytes += texture.size;
+	stats.uncompressed_bytes += get_uncompressed_size(texture.width, texture.height, texture.mip_count);
+}
+
+// Checks the whole file once so the upload can trust the level table
+static const char* validate_cache_file(const MappedFile& file, uint64_t key)
+{
+	if (file.size < sizeof(TextureCacheHeader)) return "file too small";
+
+	const TextureCacheHeader* h = (const TextureCacheHeader*)file.data;
+	if (h->magic != TEXTURE_CACHE_MAGIC) return "bad magic";
+	if (h->version != TEXTURE_CACHE_VERSION) return "unsupported version";
+	if (h->key != key) return "key mismatch";
+	if (h->file_size != file.size) return "truncated";
+	if (h->format != VK_FORMAT_BC7_UNORM_BLOCK && h->format != VK_FORMAT_BC4_UNORM_BLOCK && h->format != VK_FORMAT_BC5_UNORM_BLOCK) return "unsupported format";
+	if (h->width == 0 || h->height == 0 || h->mip_count == 0 || h->mip_count > MAX_TEXTURE_MIPS) return "bad dimensions";
+	if (h->mip_count > get_mip_count(h->width, h->height)) return "too many mips";
+
+	const uint64_t table_end = sizeof(TextureCacheHeader) + (uint64_t)h->mip_count * sizeof(TextureCacheLevel);
+	if (table_end > file.size) return "truncated level table";
+
+	const TextureCacheLevel* levels = (const TextureCacheLevel*)(file.data + sizeof(TextureCacheHeader));
+	const uint32_t block_size = get_block_size((VkFormat)h->format);
+	for (uint32_t i = 0; i < h->mip_count; ++i)
+	{
+		const uint64_t blocks_x = (std::max(h->width >> i, 1u) + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+		const uint64_t blocks_y = (std::max(h->height >> i, 1u) + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+		if (levels[i].size != blocks_x * blocks_y * block_size) return "bad level size";
+		if (levels[i].offset % TEXTURE_CACHE_ALIGNMENT != 0 || levels[i].offset < table_end) return "misaligned level";
+		if (levels[i].offset > file.size || levels[i].size > file.size - levels[i].offset) return "level out of bounds";
+	}
+
+	return nullptr;
+}
+
+static bool load_cached(uint64_t key, CompressedTexture& out_texture)
+{
+	const std::filesystem::path path = get_cache_path(key);
+	std::error_code ec;
+	if (!std::filesystem::exists(path, ec)) return false;
+
+	MappedFile file;
+	if (!map_file(path.string().c_str(), file)) return false;
+
+	const char* error = validate_cache_file(file, key);
+	if (error)
+	{
+		LOG_WARNING("Ignoring texture cache file '%s': %s", path.string().c_str(), error);
+		unmap_file(file);
+		return false;
+	}
+
+	const TextureCacheHeader* h = (const TextureCacheHeader*)file.data;
+	const TextureCacheLevel* levels = (const TextureCacheLevel*)(file.data + sizeof(TextureCacheHeader));
+
+	out_texture.format = (VkFormat)h->format;
+	out_texture.swizzle = unpack_swizzle(h->swizzle);
+	out_texture.width = h->width;
+	out_texture.height = h->height;
+	out_texture.mip_count = h->mip_count;
+
+	// Levels are written back to back, so the whole chain is one range of the file
+	const uint64_t first = levels[0].offset;
+	const uint64_t last = levels[h->mip_count - 1].offset + levels[h->mip_count - 1].size;
+	for (uint32_t i = 0; i < h->mip_count; ++i)
+	{
+		if (levels[i].offset < first || levels[i].offset + levels[i].size > last)
+		{
+			LOG_WARNING("Ignoring texture cache file '%s': levels out of order", path.string().c_str());
+			unmap_file(file);
+			return false;
+		}
+		out_texture.levels[i] = { levels[i].offset - first, levels[i].size };
+	}
+	out_texture.data = file.data + first;
+	out_texture.size = last - first;
+	out_texture.file = file;
+
+	return true;
+}
+
+static bool store(uint64_t key, const CompressedTexture& texture)
+{
+	TextureCacheHeader h{};
+	h.magic = TEXTURE_CACHE_MAGIC;
+	h.version = TEXTURE_CACHE_VERSION;
+	h.key = key;
+	h.format = texture.format;
+	h.swizzle = pack_swizzle(texture.swizzle);
+	h.width = texture.width;
+	h.height = texture.height;
+	h.mip_count = texture.mip_count;
+
+	const uint64_t data_offset = align_power_of_2(sizeof(TextureCacheHeader) + texture.mip_count * sizeof(TextureCacheLevel), TEXTURE_CACHE_ALIGNMENT);
+	h.file_size = data_offset + texture.size;
+
+	TextureCacheLevel levels[MAX_TEXTURE_MIPS];
+	for (uint32_t i = 0; i < texture.mip_count; ++i)
+	{
+		levels[i] = { data_offset + texture.levels[i].offset, texture.levels[i].size };
+	}
+
+	const std::filesystem::path path = get_cache_path(key);
+	std::error_code ec;
+	std::filesystem::create_directories(path.parent_path(), ec);
+
+	// Unique per thread, identical embedded images may be encoded by two threads at once
+	std::filesystem::path temp_path = path;
+	temp_path += "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+
+	FILE* f = fopen(temp_path.string().c_str(), "wb");
+	if (!f)
+	{
+		LOG_WARNING("Failed to write texture cache file '%s'", temp_path.string().c_str());
+		return false;
+	}
+
+	const uint8_t padding[TEXTURE_CACHE_ALIGNMENT] = {};
+	const size_t table_size = texture.mip_count * sizeof(TextureCacheLevel);
+	const size_t padding_size = data_offset - sizeof(h) - table_size;
+	bool success = fwrite(&h, sizeof(h), 1, f) == 1;
+	success = success && fwrite(levels, 1, table_size, f) == table_size;
+	success = success && fwrite(padding, 1, padding_size, f) == padding_size;
+	success = success && fwrite(texture.data, 1, texture.size, f) == texture.size;
+	fclose(f);
+
+	if (success)
+	{
+		std::filesystem::rename(temp_path, path, ec);
+		if (ec)
+		{
+			std::filesystem::remove(path, ec);
+			std::filesystem::rename(temp_path, path, ec);
+		}
+	}
+	if (!success || ec)
+	{
+		LOG_WARNING("Failed to write texture cache file '%s'", path.string().c_str());
+		std::filesystem::remove(temp_path, ec);
+		return false;
+	}
+
+	return true;
+}
+
+// Decodes with stb_image, compresses and writes the result to the cache. A failed write only costs the
+// next run another encode
+static bool encode_and_store(uint64_t key, uint8_t* pixels, int width, int height, const char* name, CompressedTexture& out_texture)
+{
+	if (!pixels)
+	{
+		LOG_ERROR("Failed to decode texture '%s': %s", name, stbi_failure_reason());
+		return false;
+	}
+
+	TextureCache::compress(pixels, (uint32_t)width, (uint32_t)height, out_texture);
+	stbi_image_free(pixels);
+
+	store(key, out_texture);
+	return true;
+}
+
+namespace TextureCache
+{
+
+bool load_file(const char* filepath, CompressedTexture& out_texture)
+{
+	std::error_code ec;
+	const std::filesystem::path path = std::filesystem::absolute(filepath, ec);
+	const uintmax_t file_size = std::filesystem::file_size(path, ec);
+	if (ec)
+	{
+		LOG_ERROR("Failed to open texture '%s'", filepath);
+		return false;
+	}
+	const auto timestamp = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+
+	uint64_t key = hash_value_fnv1a_64((uint32_t)TEXTURE_CACHE_VERSION, FNV1A_64_OFFSET_BASIS);
+	key = hash_string_fnv1a_64(path.generic_string(), key);
+	key = hash_value_fnv1a_64((uint64_t)file_size, key);
+	key = hash_value_fnv1a_64((int64_t)timestamp, key);
+
+	if (load_cached(key, out_texture))
+	{
+		record_load(out_texture, true, 0.0);
+		return true;
+	}
+
+	Timer timer;
+	timer.tick();
+
+	int width, height, channels;
+	uint8_t* pixels = stbi_load(filepath, &width, &height, &channels, 4);
+	if (!encode_and_store(key, pixels, width, height, filepath, out_texture)) return false;
+
+	timer.tock();
+	record_load(out_texture, false, timer.get_elapsed_milliseconds());
+	return true;
+}
+
+bool load_memory(const void* encoded, size_t size, CompressedTexture& out_texture)
+{
+	uint64_t key = hash_value_fnv1a_64((uint32_t)TEXTURE_CACHE_VERSION, FNV1A_64_OFFSET_BASIS);
+	key = hash_fnv1a_64(encoded, size, key);
+
+	if (load_cached(key, out_texture))
+	{
+		record_load(out_texture, true, 0.0);
+		return true;
+	}
+
+	Timer timer;
+	timer.tick();
+
+	int width, height, channels;
+	uint8_t* pixels = stbi_load_from_memory((const stbi_uc*)encoded, (int)size, &width, &height, &channels, 4);
+	if (!encode_and_store(key, pixels, width, height, "<embedded>", out_texture)) return false;
+
+	timer.tock();
+	record_load(out_texture, false, timer.get_elapsed_milliseconds());
+	return true;
+}
+
+void release(CompressedTexture& texture)
+{
+	if (texture.file) unmap_file(texture.file);
+	texture.storage.clear();
+	texture.storage.shrink_to_fit();
+	texture.data = nullptr;
+	texture.size = 0;
+}
+
+void compress(const uint8_t* rgba, uint32_t width, uint32_t height, CompressedTexture& out_texture)
+{
+	// Grayscale sources lose nothing to the single and dual channel formats. The tolerance absorbs
+	// chroma noise left behind by lossy source formats
+	bool grayscale = true;
+	bool opaque = true;
+	const size_t texel_count = (size_t)width * height;
+	for (size_t i = 0; i < texel_count && (grayscale || opaque); ++i)
+	{
+		const uint8_t* t = rgba + i * 4;
+		grayscale = grayscale && abs(t[0] - t[1]) <= 2 && abs(t[1] - t[2]) <= 2;
+		opaque = opaque && t[3] == 255;
+	}
+
+	if (grayscale && opaque)
+	{
+		out_texture.format = VK_FORMAT_BC4_UNORM_BLOCK;
+		out_texture.swizzle = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+	}
+	else if (grayscale)
+	{
+		out_texture.format = VK_FORMAT_BC5_UNORM_BLOCK;
+		out_texture.swizzle = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
+	}
+	else
+	{
+		out_texture.format = VK_FORMAT_BC7_UNORM_BLOCK;
+		out_texture.swizzle = {};
+	}
+
+	out_texture.width = width;
+	out_texture.height = height;
+	out_texture.mip_count = std::min(get_mip_count(width, height), (uint32_t)MAX_TEXTURE_MIPS);
+
+	const uint32_t block_size = get_block_size(out_texture.format);
+	uint64_t size = 0;
+	for (uint32_t i = 0; i < out_texture.mip_count; ++i)
+	{
+		const uint64_t blocks_x = (std::max(width >> i, 1u) + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+		const uint64_t blocks_y = (std::max(height >> i, 1u) + BC_BLOCK_DIM - 1) / BC_BLOCK_DIM;
+		size = align_power_of_2(size, TEXTURE_CACHE_ALIGNMENT);
+		out_texture.levels[i] = { size, blocks_x * blocks_y * block_size };
+		size += out_texture.levels[i].size;
+	}
+	out_texture.storage.assign(size, 0);
+
+	std::vector<uint8_t> level(rgba, rgba + texel_count * 4);
+	std::vector<uint8_t> next_level;
+	for (uint32_t i = 0; i < out_texture.mip_count; ++i)
+	{
+		const uint32_t w = std::max(width >> i, 1u);
+		const uint32_t h = std::max(height >> i, 1u);
+		uint8_t* out = out_texture.storage.data() + out_texture.levels[i].offset;
+
+		for (uint32_t y = 0; y < h; y += BC_BLOCK_DIM)
+		{
+			for (uint32_t x = 0; x < w; x += BC_BLOCK_DIM)
+			{
+				uint8_t block[16 * 4];
+				BCEncoder::fetch_block(level.data(), w, h, x, y, block);
+
+				if (out_texture.format == VK_FORMAT_BC7_UNORM_BLOCK)
+				{
+					BCEncoder::encode_bc7_block(block, out);
+				}
+				else
+				{
+					uint8_t luminance[16], alpha[16];
+					for (int t = 0; t < 16; ++t)
+					{
+						luminance[t] = (uint8_t)((block[t * 4] + block[t * 4 + 1] + block[t * 4 + 2] + 1) / 3);
+						alpha[t] = block[t * 4 + 3];
+					}
+
+					if (out_texture.format == VK_FORMAT_BC4_UNORM_BLOCK) BCEncoder::encode_bc4_block(luminance, out);
+					else BCEncoder::encode_bc5_block(luminance, alpha, out);
+				}
+				out += block_size;
+			}
+		}
+
+		if (i + 1 < out_texture.mip_count)
+		{
+			next_level.resize((size_t)std::max(w / 2, 1u) * std::max(h / 2, 1u) * 4);
+			BCEncoder::downsample(level.data(), w, h, next_level.data());
+			level.swap(next_level);
+		}
+	}
+
+	out_texture.data = out_texture.storage.data();
+	out_texture.size = size;
+}
+
+TextureCacheStats get_stats()
+{
+	std::lock_guard<std::mutex> lock(stats_mutex);
+	return stats;
+}
+
+} // namespace TextureCache
@@ -0,0 +1,78 @@
+#pragma once
+#include "defines.h"
+#include "file_mapping.h"
+#include <vector>
+
+#define USE_COMPRESSED_TEXTURES 1
+
+#define TEXTURE_CACHE_DIRECTORY "data/texture_cache"
+#define TEXTURE_CACHE_MAGIC 0x58544342u // "BCTX"
+#define TEXTURE_CACHE_VERSION 1
+#define TEXTURE_CACHE_ALIGNMENT 16
+#define MAX_TEXTURE_MIPS 16
+
+// File layout: header, mip_count level entries, then the blocks of every mip from largest to smallest,
+// each starting at a multiple of TEXTURE_CACHE_ALIGNMENT. Offsets are relative to the start of the file
+struct TextureCacheHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key; // Identifies the source, see TextureCache::load_file and load_memory
+	uint32_t format; // VkFormat
+	uint32_t swizzle; // VkComponentSwizzle r, g, b, a packed into one byte each
+	uint32_t width;
+	uint32_t height;
+	uint32_t mip_count;
+	uint32_t reserved;
+	uint64_t file_size;
+};
+
+struct TextureCacheLevel
+{
+	uint64_t offset;
+	uint64_t size;
+};
+
+// Block compressed texture with its whole mip chain, ready to be copied into an image as is
+struct CompressedTexture
+{
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VkComponentMapping swizzle{}; // Single and dual channel formats are expanded back to RGBA in the view
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t mip_count = 0;
+
+	// All mips back to back, level offsets are relative to data
+	const uint8_t* data = nullptr;
+	uint64_t size = 0;
+	TextureCacheLevel levels[MAX_TEXTURE_MIPS];
+
+	MappedFile file; // Cache hits point into the mapped file
+	std::vector<uint8_t> storage; // Fresh encodes own their blocks
+};
+
+struct TextureCacheStats
+{
+	uint32_t hits = 0;
+	uint32_t misses = 0;
+	double encode_milliseconds = 0.0; // Decoding and compressing the misses, summed over all threads
+	uint64_t compressed_bytes = 0;
+	uint64_t uncompressed_bytes = 0; // What the same textures take as RGBA8 with a full mip chain
+};
+
+// Converts source images into block compressed textures with precomputed mips on first use and keeps them
+// in TEXTURE_CACHE_DIRECTORY. Color is stored as BC7, grayscale as BC4 and grayscale with alpha as BC5.
+// Safe to call from multiple threads.
+namespace TextureCache
+{
+	// Keyed by path, size and modification time, so edited images are encoded again
+	bool load_file(const char* filepath, CompressedTexture& out_texture);
+	// Keyed by the encoded bytes, for images embedded in other files
+	bool load_memory(const void* encoded, size_t size, CompressedTexture& out_texture);
+	void release(CompressedTexture& texture);
+
+	// Encodes without touching the cache
+	void compress(const uint8_t* rgba, uint32_t width, uint32_t height, CompressedTexture& out_texture);
+
+	TextureCacheStats get_stats();
+}
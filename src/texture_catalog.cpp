@@ -1,8 +1,266 @@
 #include "texture_catalog.h"
 #include <filesystem>
 #include <assert.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <algorithm>
 #include "graphics_context.h"
+#include "vk_helpers.h"
+#include "buffer.h"
+#include "misc.h"
+#include "timer.h"
+#include "texture_cache.h"
+#include "cpu_profiler.h"
+#include "stb_image.h"
 #include "imgui/imgui.h"
+#include "imgui/imgui_impl_vulkan.h"
+
+#define TEXTURE_STREAMING 1
+#define TEXTURE_STAGING_RING_SIZE (64ull * 1024 * 1024)
+#define TEXTURE_STAGING_ALIGNMENT 16
+#define MAX_TEXTURE_DECODE_THREADS 4
+
+struct DecodedTexture
+{
+	std::string key;
+	bool loaded = false;
+#if USE_COMPRESSED_TEXTURES
+	CompressedTexture compressed;
+#else
+	uint8_t* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+#endif
+};
+
+struct UploadBatch
+{
+	uint64_t timeline_value;
+	uint64_t ring_head; // Ring space up to here can be reused once the batch completed
+	VkCommandBuffer cmd;
+	std::vector<std::pair<std::string, Texture>> textures;
+	std::vector<Buffer> dedicated_staging_buffers; // Textures that do not fit into the ring
+};
+
+struct TextureStreamer
+{
+	// Shared with the decode threads
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<std::string> decode_queue;
+	std::vector<DecodedTexture> decoded;
+	bool quit = false;
+	std::vector<std::thread> threads;
+
+	// Render thread only. The ring offsets grow monotonically and wrap when indexing into the buffer
+	Buffer ring;
+	uint8_t* ring_mapped = nullptr;
+	uint64_t ring_head = 0;
+	uint64_t ring_tail = 0;
+	VkCommandPool command_pool = VK_NULL_HANDLE;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	uint64_t next_timeline_value = 1;
+	std::deque<UploadBatch> batches;
+	std::deque<DecodedTexture> waiting; // Decoded, but no staging space was left
+
+	uint32_t total = 0;
+	uint32_t resident = 0;
+	uint32_t failed = 0;
+	uint64_t uploaded_bytes = 0;
+	bool first_update = true;
+	Timer timer;
+#if USE_COMPRESSED_TEXTURES
+	TextureCacheStats cache_stats_at_init;
+#endif
+};
+
+static void decode_thread(TextureStreamer* s)
+{
+	CPUProfiler::set_thread_name("Texture decode");
+	while (true)
+	{
+		std::string key;
+		{
+			std::unique_lock<std::mutex> lock(s->mutex);
+			s->wake.wait(lock, [s]() { return s->quit || !s->decode_queue.empty(); });
+			if (s->quit) return;
+			key = std::move(s->decode_queue.front());
+			s->decode_queue.pop_front();
+		}
+
+		DecodedTexture t;
+		t.key = key;
+		{
+			CPU_ZONE("Decode texture");
+#if USE_COMPRESSED_TEXTURES
+			t.loaded = TextureCache::load_file(key.c_str(), t.compressed);
+#else
+			int channels;
+			t.pixels = stbi_load(key.c_str(), &t.width, &t.height, &channels, 4);
+			t.loaded = t.pixels != nullptr;
+#endif
+		}
+
+		std::lock_guard<std::mutex> lock(s->mutex);
+		s->decoded.push_back(std::move(t));
+	}
+}
+
+static const uint8_t* get_upload_data(const DecodedTexture& d, uint64_t& out_size)
+{
+#if USE_COMPRESSED_TEXTURES
+	out_size = d.compressed.size;
+	return d.compressed.data;
+#else
+	out_size = (uint64_t)d.width * d.height * 4;
+	return d.pixels;
+#endif
+}
+
+static void free_decoded(DecodedTexture& d)
+{
+#if USE_COMPRESSED_TEXTURES
+	TextureCache::release(d.compressed);
+#else
+	stbi_image_free(d.pixels);
+	d.pixels = nullptr;
+#endif
+}
+
+// Allocations never straddle the end of the ring, so each one is a single copy region
+static bool allocate_staging(TextureStreamer& s, uint64_t size, uint64_t& out_offset)
+{
+	uint64_t offset = align_power_of_2(s.ring_head, TEXTURE_STAGING_ALIGNMENT);
+	if (offset % TEXTURE_STAGING_RING_SIZE + size > TEXTURE_STAGING_RING_SIZE)
+	{
+		offset = (offset / TEXTURE_STAGING_RING_SIZE + 1) * TEXTURE_STAGING_RING_SIZE;
+	}
+	if (offset + size - s.ring_tail > TEXTURE_STAGING_RING_SIZE) return false;
+
+	s.ring_head = offset + size;
+	out_offset = offset % TEXTURE_STAGING_RING_SIZE;
+	return true;
+}
+
+// Swaps the placeholders of every completed batch for the uploaded textures
+static void retire_batches(TextureCatalog& catalog, TextureStreamer& s)
+{
+	Context* ctx = catalog.context;
+	uint64_t completed = 0;
+	VK_CHECK(vkGetSemaphoreCounterValue(ctx->device, s.timeline, &completed));
+
+	while (!s.batches.empty() && s.batches.front().timeline_value <= completed)
+	{
+		UploadBatch& batch = s.batches.front();
+		for (auto& t : batch.textures)
+		{
+			t.second.descriptor_set = ctx->create_imgui_descriptor_set(t.second);
+			catalog.textures[t.first] = t.second;
+			s.resident++;
+		}
+		for (auto& b : batch.dedicated_staging_buffers) ctx->destroy_buffer(b);
+		vkFreeCommandBuffers(ctx->device, s.command_pool, 1, &batch.cmd);
+		s.ring_tail = batch.ring_head;
+		s.batches.pop_front();
+	}
+}
+
+// Records as many waiting textures as fit into the staging ring into one command buffer and submits it
+static void submit_batch(TextureCatalog& catalog, TextureStreamer& s)
+{
+	if (s.waiting.empty()) return;
+	Context* ctx = catalog.context;
+
+	VkCommandBufferAllocateInfo alloc_info{ VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO };
+	alloc_info.commandPool = s.command_pool;
+	alloc_info.commandBufferCount = 1;
+	alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+
+	UploadBatch batch{};
+	VK_CHECK(vkAllocateCommandBuffers(ctx->device, &alloc_info, &batch.cmd));
+	VkHelpers::begin_command_buffer(batch.cmd, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	while (!s.waiting.empty())
+	{
+		DecodedTexture& d = s.waiting.front();
+		uint64_t size;
+		const uint8_t* data = get_upload_data(d, size);
+
+		VkBuffer staging_buffer = VK_NULL_HANDLE;
+		uint64_t staging_offset = 0;
+		if (size > TEXTURE_STAGING_RING_SIZE)
+		{
+			BufferDesc desc{};
+			desc.size = size;
+			desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+			desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+			desc.data = (void*)data;
+			batch.dedicated_staging_buffers.push_back(ctx->create_buffer(desc));
+			staging_buffer = batch.dedicated_staging_buffers.back().buffer;
+		}
+		else if (allocate_staging(s, size, staging_offset))
+		{
+			memcpy(s.ring_mapped + staging_offset, data, size);
+			vmaFlushAllocation(ctx->allocator, s.ring.allocation, staging_offset, size);
+			staging_buffer = s.ring.buffer;
+		}
+		else
+		{
+			break; // Ring is full, the rest goes into a later batch
+		}
+
+		Texture t{};
+		t.name = catalog.textures[d.key].name;
+#if USE_COMPRESSED_TEXTURES
+		const bool created = ctx->record_compressed_texture_upload(batch.cmd, t, d.compressed, staging_buffer, staging_offset);
+#else
+		t.width = d.width;
+		t.height = d.height;
+		const bool created = ctx->record_texture_upload(batch.cmd, t, staging_buffer, staging_offset);
+#endif
+		if (!created)
+		{
+			LOG_ERROR("Failed to create texture '%s'", d.key.c_str());
+			s.failed++;
+		}
+		else
+		{
+			batch.textures.push_back(std::make_pair(d.key, t));
+			s.uploaded_bytes += size;
+		}
+
+		free_decoded(d);
+		s.waiting.pop_front();
+	}
+
+	VK_CHECK(vkEndCommandBuffer(batch.cmd));
+
+	if (batch.textures.empty())
+	{
+		for (auto& b : batch.dedicated_staging_buffers) ctx->destroy_buffer(b);
+		vkFreeCommandBuffers(ctx->device, s.command_pool, 1, &batch.cmd);
+		return;
+	}
+
+	batch.timeline_value = s.next_timeline_value++;
+	batch.ring_head = s.ring_head;
+
+	VkTimelineSemaphoreSubmitInfo timeline_info{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+	timeline_info.signalSemaphoreValueCount = 1;
+	timeline_info.pSignalSemaphoreValues = &batch.timeline_value;
+
+	VkSubmitInfo info{ VK_STRUCTURE_TYPE_SUBMIT_INFO };
+	info.pNext = &timeline_info;
+	info.commandBufferCount = 1;
+	info.pCommandBuffers = &batch.cmd;
+	info.signalSemaphoreCount = 1;
+	info.pSignalSemaphores = &s.timeline;
+	VK_CHECK(vkQueueSubmit(ctx->transfer_queue, 1, &info, VK_NULL_HANDLE));
+
+	s.batches.push_back(std::move(batch));
+}
 
 void TextureCatalog::init(Context* ctx, const char* texture_directory)
 {
@@ -12,33 +270,189 @@ void TextureCatalog::init(Context* ctx, const char* texture_directory)
 	std::filesystem::path path = directory;
 	assert(std::filesystem::exists(path));
 
+	Timer timer;
+	timer.tick();
+
+	{
+		placeholder.source = (uint8_t*)malloc(4);
+		assert(placeholder.source);
+		memset(placeholder.source, 0xFF, 4);
+		placeholder.width = 1;
+		placeholder.height = 1;
+		placeholder.name = "placeholder";
+		ctx->create_textures(&placeholder, 1);
+		free(placeholder.source);
+		placeholder.source = nullptr;
+	}
+
+	std::vector<std::string> files;
 	for (const auto& f : std::filesystem::directory_iterator(path))
 	{
-		if (f.is_regular_file())
+		if (!f.is_regular_file() || f.path().extension() == ".tif") continue;
+		files.push_back(f.path().string());
+	}
+
+#if TEXTURE_STREAMING
+	for (const auto& f : files)
+	{
+		Texture texture = placeholder;
+		texture.name = strdup(f.c_str());
+		textures.insert(std::make_pair(f, texture));
+	}
+
+	streamer = new TextureStreamer();
+	TextureStreamer& s = *streamer;
+	s.timer.tick();
+#if USE_COMPRESSED_TEXTURES
+	s.cache_stats_at_init = TextureCache::get_stats();
+#endif
+	s.total = (uint32_t)files.size();
+	s.decode_queue.assign(files.begin(), files.end());
+
+	BufferDesc desc{};
+	desc.size = TEXTURE_STAGING_RING_SIZE;
+	desc.usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	desc.allocation_flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+	s.ring = ctx->create_buffer(desc);
+	VK_CHECK(vmaMapMemory(ctx->allocator, s.ring.allocation, (void**)&s.ring_mapped));
+
+	s.command_pool = VkHelpers::create_command_pool(ctx->device, ctx->transfer_queue_family_index);
+
+	VkSemaphoreTypeCreateInfo type_info{ VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO };
+	type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	type_info.initialValue = 0;
+	VkSemaphoreCreateInfo semaphore_info{ VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	semaphore_info.pNext = &type_info;
+	VK_CHECK(vkCreateSemaphore(ctx->device, &semaphore_info, nullptr, &s.timeline));
+
+	const uint32_t thread_count = std::min<uint32_t>({ MAX_TEXTURE_DECODE_THREADS, std::max(std::thread::hardware_concurrency() / 2, 1u), std::max(s.total, 1u) });
+	for (uint32_t i = 0; i < thread_count; ++i) s.threads.emplace_back(decode_thread, streamer);
+
+	timer.tock();
+	LOG_INFO("Streaming %u textures on %u threads, init took %.2f ms", s.total, thread_count, timer.get_elapsed_milliseconds());
+#else
+	for (const auto& f : files)
+	{
+		Texture texture{};
+#if USE_COMPRESSED_TEXTURES
+		CompressedTexture compressed;
+		if (!TextureCache::load_file(f.c_str(), compressed))
+		{
+			LOG_ERROR("Failed to load texture!");
+			exit(EXIT_FAILURE);
+		}
+
+		texture.name = strdup(f.c_str());
+		ctx->create_compressed_textures(&texture, &compressed, 1);
+		TextureCache::release(compressed);
+#else
+		if (!load_texture_from_file(f.c_str(), texture))
+		{
+			LOG_ERROR("Failed to load texture!");
+			exit(EXIT_FAILURE);
+		}
+
+		ctx->create_textures(&texture, 1);
+#endif
+		textures.insert(std::make_pair(f, texture));
+	}
+
+	timer.tock();
+	LOG_INFO("Loaded %zu textures in %.2f ms", files.size(), timer.get_elapsed_milliseconds());
+#endif
+}
+
+void TextureCatalog::update()
+{
+	if (!streamer) return;
+	TextureStreamer& s = *streamer;
+	if (s.first_update)
+	{ // The first frame renders with whatever is resident by now, usually only placeholders
+		s.first_update = false;
+		Timer first_frame = s.timer;
+		first_frame.tock();
+		LOG_INFO("First frame %.2f ms after streaming started, %u of %u textures resident", first_frame.get_elapsed_milliseconds(),
+			s.resident, s.total);
+	}
+	if (s.resident + s.failed == s.total && s.batches.empty()) return;
+
+	retire_batches(*this, s);
+
+	{
+		std::lock_guard<std::mutex> lock(s.mutex);
+		for (auto& d : s.decoded)
 		{
-			std::filesystem::path extension = f.path().extension();
-			if (extension == ".tif") continue;
-			printf("%s\n", f.path().string().c_str());
-			std::string name = f.path().filename().string();
-			Texture texture{};
-			if (!load_texture_from_file(f.path().string().c_str(), texture))
+			if (!d.loaded)
 			{
-				LOG_ERROR("Failed to load texture!");
-				exit(EXIT_FAILURE);
+				LOG_ERROR("Failed to load texture '%s', keeping the placeholder", d.key.c_str());
+				s.failed++;
+				continue;
 			}
-
-			ctx->create_textures(&texture, 1);
-			textures.insert(std::make_pair(f.path().string(), texture));
+			s.waiting.push_back(std::move(d));
 		}
+		s.decoded.clear();
+	}
+
+	submit_batch(*this, s);
+
+	if (s.resident + s.failed == s.total)
+	{
+		s.timer.tock();
+		LOG_INFO("Streamed %u textures (%.1f MB) in %.2f ms, %u failed", s.resident, s.uploaded_bytes / (1024.0 * 1024.0),
+			s.timer.get_elapsed_milliseconds(), s.failed);
+#if USE_COMPRESSED_TEXTURES
+		const TextureCacheStats stats = TextureCache::get_stats();
+		LOG_INFO("Texture cache: %u hits, %u encoded in %.2f ms, %.1f MB RGBA8 equivalent", stats.hits - s.cache_stats_at_init.hits,
+			stats.misses - s.cache_stats_at_init.misses, stats.encode_milliseconds - s.cache_stats_at_init.encode_milliseconds,
+			(stats.uncompressed_bytes - s.cache_stats_at_init.uncompressed_bytes) / (1024.0 * 1024.0));
+#endif
 	}
 }
 
 void TextureCatalog::shutdown()
 {
+	if (streamer)
+	{
+		TextureStreamer& s = *streamer;
+		if (s.resident + s.failed < s.total)
+		{
+			LOG_WARNING("Shutting down with %u of %u textures resident, no total stream time was measured", s.resident, s.total);
+		}
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.quit = true;
+		}
+		s.wake.notify_all();
+		for (auto& t : s.threads) t.join();
+
+		for (auto& d : s.decoded) free_decoded(d);
+		for (auto& d : s.waiting) free_decoded(d);
+
+		if (!s.batches.empty())
+		{
+			VkSemaphoreWaitInfo wait_info{ VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO };
+			wait_info.semaphoreCount = 1;
+			wait_info.pSemaphores = &s.timeline;
+			wait_info.pValues = &s.batches.back().timeline_value;
+			VK_CHECK(vkWaitSemaphores(context->device, &wait_info, UINT64_MAX));
+			retire_batches(*this, s);
+		}
+
+		vmaUnmapMemory(context->allocator, s.ring.allocation);
+		context->destroy_buffer(s.ring);
+		vkDestroyCommandPool(context->device, s.command_pool, nullptr);
+		vkDestroySemaphore(context->device, s.timeline, nullptr);
+
+		delete streamer;
+		streamer = nullptr;
+	}
+
 	for (auto& t : textures)
 	{
-		t.second.destroy(context->device, context->allocator);
+		// Textures that never became resident share the placeholder image
+		if (t.second.image != placeholder.image) t.second.destroy(context->device, context->allocator);
 	}
+	placeholder.destroy(context->device, context->allocator);
 
 	textures.clear();
 }
@@ -48,6 +462,11 @@ void TextureCatalog::draw_ui(bool *open)
 	ImGuiIO& io = ImGui::GetIO();
 	ImGui::Begin("Texture browser", open);
 
+	if (streamer && streamer->resident + streamer->failed < streamer->total)
+	{
+		ImGui::Text("Streaming %u/%u", streamer->resident, streamer->total);
+	}
+
 	static int selected = -1;
 	int index = 0;
 	static const Texture* texture = nullptr;
@@ -1,14 +1,19 @@
 #pragma once
 #include <map>
 #include <string>
+#include "texture.h"
 
 struct Context;
-struct Texture;
+struct TextureStreamer;
 
+// Textures are decoded on background threads and uploaded in batches from update(). Until a texture is
+// resident its entry holds a copy of a white placeholder, so pointers returned by get_texture can be
+// used right away and switch to the real image once it arrives.
 struct TextureCatalog
 {
 	void init(Context* context, const char* texture_directory);
 	void shutdown();
+	void update(); // Call once per frame on the render thread
 	void draw_ui(bool* open);
 	Texture* get_texture(const char* name);
 
@@ -16,4 +21,7 @@ struct TextureCatalog
 
 	std::map<std::string, Texture> textures;
 	Context* context;
-};
\ No newline at end of file
+
+	Texture placeholder{};
+	TextureStreamer* streamer = nullptr;
+};
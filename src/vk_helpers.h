@@ -1,5 +1,6 @@
 #pragma once
 #include "defines.h"
+#include "gpu_profiler.h"
 
 namespace VkHelpers
 {
@@ -122,10 +123,13 @@ namespace VkHelpers
 		label_info.color[2] = 1.0f;
 		label_info.color[3] = 1.0f;
 		vkCmdBeginDebugUtilsLabelEXT(cmd, &label_info);
+		// Labels in the frame command buffer are also the GPU profiler's scopes
+		GPUProfiler::begin_scope(cmd, name);
 	}
 
 	inline void end_label(VkCommandBuffer cmd)
 	{
+		GPUProfiler::end_scope(cmd);
 		vkCmdEndDebugUtilsLabelEXT(cmd);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,351 @@
+// Converts SDFGen text files into the binary .sdfb format loaded by sdf_load_from_file
+#include "../src/sdf_file.h"
+#include "../src/timer.h"
+#include "../src/log.h"
+#include "../src/job_system.h"
+#include "../src/sdf_brick.h"
+#include "../src/sdf_query.h"
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <glm/gtc/packing.hpp>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <filesystem>
+
+// Compares the bricked representation against the dense grid at random points
+static void report_brick_stats(const std::vector<float>& values, glm::uvec3 dims, glm::vec3 origin, float spacing, uint32_t bits)
+{
+	SDFBrickSettings settings;
+	settings.bits = bits;
+	BrickedSDF bricked;
+	if (!bricked.build(values.data(), dims, origin, spacing, settings)) return;
+
+	constexpr uint32_t sample_count = 1 << 22;
+	std::vector<glm::vec3> points(sample_count);
+	const glm::vec3 extent = glm::vec3(dims) * spacing;
+	uint32_t state = 0x9E3779B9u;
+	for (glm::vec3& p : points)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			state = state * 1664525u + 1013904223u;
+			p[i] = origin[i] + (float)(state >> 8) * (1.0f / 16777216.0f) * extent[i];
+		}
+	}
+
+	Timer timer;
+	float checksum = 0.0f;
+
+	timer.tick();
+	for (const glm::vec3& p : points) checksum += sdf_sample_dense(values.data(), dims, origin, spacing, p);
+	timer.tock();
+	const double dense_ms = timer.get_elapsed_milliseconds();
+
+	timer.tick();
+	for (const glm::vec3& p : points) checksum += bricked.sample(p);
+	timer.tock();
+	const double bricked_ms = timer.get_elapsed_milliseconds();
+
+	// Error is only meaningful inside the band, far bricks store a single conservative distance
+	const float band = settings.band_voxels * spacing;
+	float max_error = 0.0f;
+	for (const glm::vec3& p : points)
+	{
+		const float dense = sdf_sample_dense(values.data(), dims, origin, spacing, p);
+		if (fabsf(dense) < band) max_error = fmaxf(max_error, fabsf(dense - bricked.sample(p)));
+	}
+
+	LOG_INFO("%u bit bricks: %.1fx smaller, max error in band %.5f (%.3f voxels)", bits,
+		(double)bricked.dense_memory_bytes() / (double)bricked.memory_bytes(), max_error, max_error / spacing);
+	LOG_INFO("Sampling: dense %.1f Msamples/s, bricked %.1f Msamples/s (checksum %f)",
+		sample_count / (dense_ms * 1000.0), sample_count / (bricked_ms * 1000.0), checksum);
+}
+
+// Measures CPU query throughput at random points within the grid bounds
+static void report_query_stats(const std::vector<float>& values, glm::uvec3 dims, glm::vec3 origin, float spacing)
+{
+	SDFQuery query;
+	query.values = values.data();
+	query.dims = dims;
+	query.grid_origin = origin;
+	query.grid_spacing = spacing;
+
+	constexpr uint32_t sample_count = 1 << 22;
+	std::vector<float> points[3];
+	const glm::vec3 extent = glm::vec3(dims) * spacing;
+	uint32_t state = 0x9E3779B9u;
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		points[axis].resize(sample_count);
+		for (float& p : points[axis])
+		{
+			state = state * 1664525u + 1013904223u;
+			p = origin[axis] + (float)(state >> 8) * (1.0f / 16777216.0f) * extent[axis];
+		}
+	}
+
+	std::vector<float> distance(sample_count), gradient[3];
+	for (int axis = 0; axis < 3; ++axis) gradient[axis].resize(sample_count);
+
+	Timer timer;
+	float checksum = 0.0f;
+	auto report = [&timer](const char* name, uint32_t count)
+	{
+		timer.tock();
+		LOG_INFO("%-24s %8.1f Mqueries/s", name, count / (timer.get_elapsed_milliseconds() * 1000.0));
+	};
+
+	timer.tick();
+	for (uint32_t i = 0; i < sample_count; ++i) checksum += query.sample(glm::vec3(points[0][i], points[1][i], points[2][i]));
+	report("sample", sample_count);
+
+	timer.tick();
+	query.sample_batch(points[0].data(), points[1].data(), points[2].data(), distance.data(), sample_count);
+	report("sample_batch", sample_count);
+
+	timer.tick();
+	for (uint32_t i = 0; i < sample_count; ++i) checksum += query.gradient(glm::vec3(points[0][i], points[1][i], points[2][i])).x;
+	report("gradient", sample_count);
+
+	timer.tick();
+	query.sample_gradient_batch(points[0].data(), points[1].data(), points[2].data(), distance.data(),
+		gradient[0].data(), gradient[1].data(), gradient[2].data(), sample_count);
+	report("sample_gradient_batch", sample_count);
+
+	// Rays from random points towards the grid center
+	constexpr uint32_t ray_count = 1 << 18;
+	const glm::vec3 center = origin + extent * 0.5f;
+	uint32_t hits = 0;
+	timer.tick();
+	for (uint32_t i = 0; i < ray_count; ++i)
+	{
+		const glm::vec3 ray_origin(points[0][i], points[1][i], points[2][i]);
+		const glm::vec3 dir = center - ray_origin;
+		const float length = glm::length(dir);
+		float t;
+		if (length > 0.0f && query.raycast(ray_origin, dir / length, FLT_MAX, t)) ++hits;
+	}
+	report("raycast", ray_count);
+
+	LOG_INFO("%u of %u rays hit (checksum %f)", hits, ray_count, checksum + distance[0] + gradient[0][0]);
+}
+
+// Text parser from before sdf_parse_text, kept as the baseline: one getline, string and atof per value
+static bool parse_text_getline(const char* filepath, glm::uvec3& out_dims, glm::vec3& out_origin, float& out_spacing, std::vector<float>& out_values)
+{
+	std::fstream f(filepath);
+	if (!f.is_open()) return false;
+
+	std::string line;
+	std::vector<uint32_t> dims;
+	std::vector<float> origins;
+
+	if (!std::getline(f, line)) return false;
+	{
+		std::stringstream ss(line);
+		for (std::string token; std::getline(ss, token, ' '); ) dims.push_back(std::atoi(token.c_str()));
+	}
+
+	if (!std::getline(f, line)) return false;
+	{
+		std::stringstream ss(line);
+		for (std::string token; std::getline(ss, token, ' '); ) origins.push_back((float)std::atof(token.c_str()));
+	}
+
+	if (!std::getline(f, line)) return false;
+	out_spacing = (float)std::atof(line.c_str());
+
+	out_values.clear();
+	while (std::getline(f, line)) out_values.push_back((float)std::atof(line.c_str()));
+
+	if (dims.size() != 3 || origins.size() != 3) return false;
+	out_dims = glm::uvec3(dims[0], dims[1], dims[2]);
+	out_origin = glm::vec3(origins[0], origins[1], origins[2]);
+	return out_values.size() == (size_t)dims[0] * dims[1] * dims[2];
+}
+
+// Writes a resolution^3 sphere in the SDFGen text format, values printed with the 6 significant digits SDFGen uses
+static bool write_synthetic_text(const char* filepath, uint32_t resolution)
+{
+	FILE* f = fopen(filepath, "w");
+	if (!f)
+	{
+		LOG_ERROR("Failed to open file '%s' for writing", filepath);
+		return false;
+	}
+
+	const float spacing = 2.0f / resolution;
+	fprintf(f, "%u %u %u\n%g %g %g\n%g\n", resolution, resolution, resolution, -1.0f, -1.0f, -1.0f, spacing);
+	for (uint32_t z = 0; z < resolution; ++z)
+	{
+		for (uint32_t y = 0; y < resolution; ++y)
+		{
+			for (uint32_t x = 0; x < resolution; ++x)
+			{
+				const glm::vec3 p = glm::vec3(-1.0f) + (glm::vec3(x, y, z) + 0.5f) * spacing;
+				fprintf(f, "%g\n", glm::length(p) - 0.5f);
+			}
+		}
+	}
+
+	const bool success = ferror(f) == 0;
+	fclose(f);
+	if (!success) LOG_ERROR("Failed to write file '%s'", filepath);
+	return success;
+}
+
+// Times the getline/atof baseline against sdf_parse_text on the same synthetic file
+static bool run_synthetic_benchmark(uint32_t resolution)
+{
+	const std::string path = "sdf_synthetic_" + std::to_string(resolution) + ".sdf";
+	if (!write_synthetic_text(path.c_str(), resolution)) return false;
+
+	std::error_code ec;
+	const double file_mb = std::filesystem::file_size(path, ec) / (1024.0 * 1024.0);
+
+	Timer timer;
+	glm::uvec3 dims[2];
+	glm::vec3 origin[2];
+	float spacing[2];
+	std::vector<float> values[2];
+
+	timer.tick();
+	const bool baseline_ok = parse_text_getline(path.c_str(), dims[0], origin[0], spacing[0], values[0]);
+	timer.tock();
+	const double baseline_ms = timer.get_elapsed_milliseconds();
+
+	timer.tick();
+	const SDFParseResult result = sdf_parse_text(path.c_str(), dims[1], origin[1], spacing[1], values[1]);
+	timer.tock();
+	const double parallel_ms = timer.get_elapsed_milliseconds();
+
+	std::filesystem::remove(path, ec);
+
+	if (!baseline_ok || result != SDFParseResult::SUCCESS)
+	{
+		LOG_ERROR("Failed to parse the synthetic file: baseline %s, sdf_parse_text %s", baseline_ok ? "ok" : "failed", sdf_parse_result_string(result));
+		return false;
+	}
+
+	// atof rounds through double, from_chars straight to float, so the two may differ by an ulp
+	float max_difference = 0.0f;
+	for (size_t i = 0; i < values[0].size(); ++i) max_difference = fmaxf(max_difference, fabsf(values[0][i] - values[1][i]));
+
+	LOG_INFO("Synthetic %u^3 text file, %.1f MB, %u worker threads", resolution, file_mb, JobSystem::get_worker_count());
+	LOG_INFO("getline/atof %.2f ms, sdf_parse_text %.2f ms (%.1fx faster), max difference %g", baseline_ms, parallel_ms,
+		baseline_ms / parallel_ms, max_difference);
+	return dims[0] == dims[1] && spacing[0] == spacing[1];
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 2 && strcmp(argv[1], "--synthetic-benchmark") == 0)
+	{
+		const uint32_t resolution = argc >= 3 ? (uint32_t)atoi(argv[2]) : 256;
+		if (resolution == 0) return EXIT_FAILURE;
+
+		JobSystem::init();
+		const bool success = run_synthetic_benchmark(resolution);
+		JobSystem::shutdown();
+		return success ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	bool half = false;
+	bool bricks = false;
+	bool queries = false;
+	bool valid_args = argc >= 3;
+	for (int i = 3; i < argc && valid_args; ++i)
+	{
+		if (strcmp(argv[i], "--half") == 0) half = true;
+		else if (strcmp(argv[i], "--bricks") == 0) bricks = true;
+		else if (strcmp(argv[i], "--queries") == 0) queries = true;
+		else valid_args = false;
+	}
+
+	if (!valid_args)
+	{
+		printf("Usage: %s <input.sdf> <output.sdfb> [--half] [--bricks] [--queries]\n", argv[0]);
+		printf("  --half    store the payload as 16 bit floats\n");
+		printf("  --bricks  report compression and sampling throughput of the bricked representation\n");
+		printf("  --queries report CPU query throughput\n");
+		printf("       %s --synthetic-benchmark [resolution]\n", argv[0]);
+		printf("  times the text parser against the getline/atof baseline on a generated resolution^3 file, 256 by default\n");
+		return EXIT_FAILURE;
+	}
+
+	const char* input_path = argv[1];
+	const char* output_path = argv[2];
+	const SDFPayloadFormat format = half ? SDFPayloadFormat::FLOAT16 : SDFPayloadFormat::FLOAT32;
+
+	JobSystem::init();
+
+	Timer timer;
+	timer.tick();
+
+	glm::uvec3 dims;
+	glm::vec3 origin;
+	float spacing;
+	std::vector<float> values;
+	SDFParseResult result = sdf_parse_text(input_path, dims, origin, spacing, values);
+	if (result != SDFParseResult::SUCCESS)
+	{
+		LOG_ERROR("Failed to parse '%s': %s", input_path, sdf_parse_result_string(result));
+		return EXIT_FAILURE;
+	}
+
+	timer.tock();
+	const double text_ms = timer.get_elapsed_milliseconds();
+	LOG_INFO("Parsed %ux%ux%u grid in %.2f ms", dims.x, dims.y, dims.z, text_ms);
+
+	if (!sdf_write_binary(output_path, dims, origin, spacing, values.data(), format))
+	{
+		return EXIT_FAILURE;
+	}
+
+	// Same work as sdf_load_from_file followed by the staging copy in SDF::init_texture, which reads every payload page
+	timer.tick();
+	MappedFile file;
+	SDFBinaryHeader header;
+	const void* payload = nullptr;
+	if (!sdf_map_binary(output_path, file, header, &payload))
+	{
+		return EXIT_FAILURE;
+	}
+	std::vector<uint8_t> staging(header.payload_size);
+	memcpy(staging.data(), payload, header.payload_size);
+	unmap_file(file);
+	timer.tock();
+	const double binary_ms = timer.get_elapsed_milliseconds();
+
+	bool round_trip = true;
+	for (size_t i = 0; i < values.size() && round_trip; ++i)
+	{
+		if (format == SDFPayloadFormat::FLOAT16) round_trip = ((const uint16_t*)staging.data())[i] == glm::packHalf1x16(values[i]);
+		else round_trip = memcmp(staging.data() + i * sizeof(float), &values[i], sizeof(float)) == 0;
+	}
+	if (!round_trip)
+	{
+		LOG_ERROR("Payload read back from '%s' does not match the parsed values", output_path);
+		return EXIT_FAILURE;
+	}
+
+	LOG_INFO("Wrote '%s' (%s, %.1f MB)", output_path, format == SDFPayloadFormat::FLOAT16 ? "half" : "float", header.payload_size / (1024.0 * 1024.0));
+	LOG_INFO("Load time: text parse %.2f ms, binary map and staging copy %.2f ms (%.1fx faster)", text_ms, binary_ms, text_ms / binary_ms);
+
+	if (bricks)
+	{
+		report_brick_stats(values, dims, origin, spacing, 8);
+		report_brick_stats(values, dims, origin, spacing, 16);
+	}
+
+	if (queries)
+	{
+		report_query_stats(values, dims, origin, spacing);
+	}
+
+	JobSystem::shutdown();
+
+	return EXIT_SUCCESS;
+}
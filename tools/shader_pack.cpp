@@ -0,0 +1,120 @@
+// Compiles every shader listed in the manifests and packs the SPIR-V into the archive loaded by Shaders::init
+#include "../src/shaders.h"
+#include "../src/shader_archive.h"
+#include "../src/timer.h"
+#include "../src/log.h"
+#include "../src/job_system.h"
+
+struct CompileJobData
+{
+	std::vector<ShaderManifestEntry>* manifest;
+	std::vector<ShaderArchiveEntry>* entries;
+	std::filesystem::path shader_directory;
+};
+
+static void compile_job(void* data, uint32_t index)
+{
+	CompileJobData& job = *(CompileJobData*)data;
+	ShaderManifestEntry& m = (*job.manifest)[index];
+	ShaderArchiveEntry& e = (*job.entries)[index];
+
+	uint32_t size = 0;
+	uint32_t* spirv = Shaders::load_shader(m.source, m.stage, &size);
+	if (!spirv)
+	{
+		LOG_ERROR("Failed to compile '%s' (%s)", m.source.filepath.c_str(), m.source.entry_point.c_str());
+		return;
+	}
+
+	e.key = Shaders::get_archive_key(m.source, m.stage);
+	e.spirv.assign(spirv, spirv + size / sizeof(uint32_t));
+	free(spirv);
+
+	// Relative, so the archive stays valid when the checkout moves
+	for (const auto& d : m.source.dependencies)
+	{
+		e.dependencies.push_back(d.lexically_relative(job.shader_directory).generic_string());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		printf("Usage: %s <manifest.txt> <archive.spva> [extra manifests...]\n", argv[0]);
+		printf("  Run from the directory containing shaders/\n");
+		printf("  Extra manifests, e.g. the requests recorded by the app, are skipped if they do not exist\n");
+		return EXIT_FAILURE;
+	}
+
+	const char* manifest_path = argv[1];
+	const char* archive_path = argv[2];
+
+	std::vector<ShaderManifestEntry> manifest;
+	if (!ShaderArchive::read_manifest(manifest_path, manifest))
+	{
+		return EXIT_FAILURE;
+	}
+
+	// Same request listed in more than one manifest is only compiled once
+	std::set<std::string> lines;
+	for (const auto& m : manifest) lines.insert(ShaderArchive::get_manifest_line(m.source, m.stage));
+	for (int i = 3; i < argc; ++i)
+	{
+		std::error_code ec;
+		if (!std::filesystem::exists(argv[i], ec)) continue;
+
+		std::vector<ShaderManifestEntry> extra;
+		if (!ShaderArchive::read_manifest(argv[i], extra))
+		{
+			return EXIT_FAILURE;
+		}
+		uint32_t added = 0;
+		for (const auto& m : extra)
+		{
+			if (!lines.insert(ShaderArchive::get_manifest_line(m.source, m.stage)).second) continue;
+			manifest.push_back(m);
+			++added;
+		}
+		LOG_INFO("Added %u shaders from '%s'", added, argv[i]);
+	}
+
+	// Neither read the archive being rebuilt nor record requests
+	Shaders::init(nullptr, nullptr, nullptr);
+	JobSystem::init();
+
+	Timer timer;
+	timer.tick();
+
+	std::vector<ShaderArchiveEntry> entries(manifest.size());
+	CompileJobData job_data{ &manifest, &entries, std::filesystem::absolute("shaders") };
+	JobCounter counter;
+	JobSystem::dispatch(compile_job, &job_data, (uint32_t)manifest.size(), &counter);
+	JobSystem::wait(&counter);
+
+	timer.tock();
+
+	JobSystem::shutdown();
+
+	uint64_t spirv_bytes = 0;
+	for (const auto& e : entries)
+	{
+		// Failures were logged by the job, an archive with holes would silently fall back to runtime compiles
+		if (e.spirv.empty()) return EXIT_FAILURE;
+		spirv_bytes += VECTOR_SIZE_BYTES(e.spirv);
+	}
+
+	const ShaderCompileStats stats = Shaders::get_stats();
+	LOG_INFO("Compiled %zu shaders in %.2f ms (%u from cache, %u reused)", entries.size(), timer.get_elapsed_milliseconds(),
+		stats.cache_hits, stats.module_reuses);
+
+	if (!ShaderArchive::write(archive_path, entries))
+	{
+		return EXIT_FAILURE;
+	}
+	LOG_INFO("Wrote '%s' with %.1f KiB of SPIR-V", archive_path, spirv_bytes / 1024.0);
+
+	Shaders::shutdown();
+
+	return EXIT_SUCCESS;
+}